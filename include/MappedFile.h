@@ -0,0 +1,43 @@
+#ifndef TECTONIC_MAPPEDFILE_H
+#define TECTONIC_MAPPEDFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/**
+ * Read only view of a whole file mapped into memory.
+ * Pages are loaded by the OS on first access, so reading a large file doesn't need a copy in RAM.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    /**
+     * @brief Maps the file. Throws fileException if the file can't be opened or mapped.
+     */
+    explicit MappedFile(const char* filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    [[nodiscard]] const uint8_t* data() const { return m_data; }
+    [[nodiscard]] std::size_t size() const { return m_size; }
+    [[nodiscard]] bool empty() const { return m_size == 0; }
+
+private:
+    void unmap();
+
+    const uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+
+#if defined(_WIN32)
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+#endif //TECTONIC_MAPPEDFILE_H
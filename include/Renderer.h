@@ -13,6 +13,7 @@
 #include "shader/PickingShader.h"
 #include "shader/DebugShader.h"
 #include "shader/TerrainShader.h"
+#include "shader/TerrainCullShader.h"
 #include "shader/SkyboxShader.h"
 #include "meta/Signal.h"
 #include "meta/Slot.h"
@@ -22,6 +23,8 @@
 #include "Window.h"
 #include "SceneTypes.h"
 #include "model/terrain/Terrain.h"
+#include "model/terrain/ChunkedTerrain.h"
+#include "model/terrain/ClipmapTerrain.h"
 #include "Logger.h"
 #include "model/terrain/Skybox.h"
 
@@ -37,9 +40,15 @@ public:
 
     std::shared_ptr<Window> window;
 
+    /**
+     * With HORIZON_CULLING set on the terrain, the object is queued only once it's tested against the terrain horizon.
+     * Skinned objects are always queued, their animated bounds aren't known.
+     */
     void queueModelRender(const ObjectData& object, Model* model);
     void queueSkinnedModelRender(const SkinnedObjectData& object, SkinnedModel* skinnedModel);
     void setTerrainModelRender(const std::shared_ptr<Terrain>& terrain);
+    void setChunkedTerrainRender(const std::shared_ptr<ChunkedTerrain>& terrain);
+    void setClipmapTerrainRender(const std::shared_ptr<ClipmapTerrain>& terrain);
     void setSkyboxModelRender(const std::shared_ptr<Skybox>& skybox);
     void renderQueues();
     void setWindowSize(int32_t width, int32_t height);
@@ -68,6 +77,8 @@ public:
     PickingTexture      m_pickingTexture;
     DebugShader         m_debugShader;
     TerrainShader       m_terrainShader;
+    TerrainShader       m_terrainTessShader{true};
+    TerrainCullShader   m_terrainCullShader;
     SkyboxShader        m_skyboxShader;
 
     Signal<objectIndex_t> sig_objectClicked;
@@ -124,8 +135,23 @@ private:
     vaoQueue_t m_drawQueue;
     skinnedVaoQueue_t m_skinnedDrawQueue;
     std::shared_ptr<Terrain> m_terrain;
+    std::shared_ptr<ChunkedTerrain> m_chunkedTerrain;
+    std::shared_ptr<ClipmapTerrain> m_clipmapTerrain;
     std::shared_ptr<Skybox> m_skybox;
 
+    // Static objects waiting for the horizon test of the current frame
+    std::vector<std::pair<ObjectData, Model*>> m_pendingObjects;
+    std::vector<HorizonCulling::Box> m_objectBoxes;
+    std::vector<uint8_t> m_objectVisible;
+    HorizonCulling m_horizonCulling;
+
+    void enqueueModel(const ObjectData& object, Model* model);
+
+    /**
+     * @brief Queues pending objects whose world bounds aren't hidden behind the terrain patches of this frame.
+     */
+    void cullPendingObjects();
+
     void initGLFW();
     static void initGL();
     void initShaders();
@@ -153,9 +179,32 @@ private:
     void renderModelDebug(const SkinnedDrawable& drawable);
 
     void renderTerrain();
+
+    /**
+     * @brief Draws instances scattered over the terrain, one instanced draw per mesh of every batch.
+     */
+    void renderScatter();
+
+    /**
+     * @brief Selects LOD of terrain patches and culls them in a compute pass. Leaves the terrain shader enabled.
+     */
+    void cullTerrainGPU();
+    void renderChunkedTerrain();
+    void renderClipmapTerrain();
     void renderSkybox();
 
     static inline void renderMesh(const MeshInfo& mesh);
+    static inline void renderTerrainCommands(GLuint commandBuffer, std::size_t commandCount, uint32_t indexSize, GLenum primitive = GL_TRIANGLES);
+
+    /**
+     * @brief Draws commands whose amount was written by the GPU into the count buffer.
+     */
+    static inline void renderTerrainCommands(GLuint commandBuffer, GLuint countBuffer, std::size_t maxCommandCount, uint32_t indexSize, GLenum primitive = GL_TRIANGLES);
+
+    /**
+     * @brief Maps a size of an index in bytes onto its GL type.
+     */
+    static constexpr GLenum indexType(uint32_t indexSize) { return indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
 
     int32_t m_windowWidth{};
     int32_t m_windowHeight{};
@@ -24,6 +24,8 @@
 #include "Renderer.h"
 #include "SceneTypes.h"
 #include "model/terrain/Terrain.h"
+#include "model/terrain/ChunkedTerrain.h"
+#include "model/terrain/ClipmapTerrain.h"
 
 #include "meta/meta.h"
 #include "model/terrain/Skybox.h"
@@ -47,6 +49,8 @@ public:
 
     void insertTerrain(const std::shared_ptr<Terrain>& terrain);
     std::shared_ptr<Terrain> getTerrain();
+    void insertChunkedTerrain(const std::shared_ptr<ChunkedTerrain>& terrain);
+    void insertClipmapTerrain(const std::shared_ptr<ClipmapTerrain>& terrain);
 
     void insertSkybox(const std::shared_ptr<Skybox>& skybox);
     std::shared_ptr<Skybox> getSkybox();
@@ -123,6 +127,8 @@ private:
     std::unordered_map<skinnedModelIndex_t, std::shared_ptr<SkinnedModel>> m_skinnedModelMap;
     std::unordered_map<skinnedObjectIndex_t, std::pair<SkinnedObjectData, skinnedModelIndex_t>> m_skinnedObjectMap;
     std::shared_ptr<Terrain> m_terrain;
+    std::shared_ptr<ChunkedTerrain> m_chunkedTerrain;
+    std::shared_ptr<ClipmapTerrain> m_clipmapTerrain;
 
     std::shared_ptr<GameCamera>         m_gameCamera;
     Transformation                      m_worldTransform;
@@ -0,0 +1,71 @@
+#ifndef TECTONIC_THREADPOOL_H
+#define TECTONIC_THREADPOOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <cstdint>
+
+/**
+ * Fixed set of worker threads shared by the engine.
+ * Used for splitting data parallel passes and for running background jobs.
+ */
+class ThreadPool {
+public:
+    ThreadPool(ThreadPool const&) = delete;
+    void operator=(ThreadPool const&) = delete;
+
+    static ThreadPool& getInstance(){
+        static ThreadPool instance;
+        return instance;
+    }
+
+    /**
+     * @brief Queues a job for a worker thread.
+     * @param job Callable without arguments.
+     * @return Future with the result of the job.
+     */
+    template<typename F>
+    auto submit(F&& job) -> std::future<decltype(job())> {
+        using result_t = decltype(job());
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(job));
+        std::future<result_t> result = task->get_future();
+        enqueue([task](){ (*task)(); });
+        return result;
+    }
+
+    /**
+     * Splits the range into chunks and processes them on the workers and the calling thread.
+     * Returns after every chunk is processed. Safe to call from inside a worker job,
+     * the calling thread keeps taking chunks, so the call can't starve on busy workers.
+     *
+     * @brief Runs a function over a range in parallel.
+     * @param begin First index of the range.
+     * @param end One past the last index of the range.
+     * @param func Function called with a sub range [begin, end).
+     * @param grain Minimal amount of indices in one chunk.
+     */
+    void parallelFor(uint32_t begin, uint32_t end, const std::function<void(uint32_t, uint32_t)>& func, uint32_t grain = 1);
+
+    [[nodiscard]] uint32_t threadCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+private:
+    ThreadPool();
+    ~ThreadPool();
+
+    void enqueue(std::function<void()> job);
+    void workerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop = false;
+};
+
+#endif //TECTONIC_THREADPOOL_H
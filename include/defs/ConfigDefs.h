@@ -34,6 +34,10 @@
 #define DEBUG_FRAG_SHADER_PATH      "shaders/frag/debug.frag"
 #define TERRAIN_VERT_SHADER_PATH    "shaders/vert/terrain.vert"
 #define TERRAIN_FRAG_SHADER_PATH    "shaders/frag/terrain.frag"
+#define TERRAIN_TESS_VERT_SHADER_PATH "shaders/vert/terrainTess.vert"
+#define TERRAIN_TESC_SHADER_PATH    "shaders/tesc/terrain.tesc"
+#define TERRAIN_TESE_SHADER_PATH    "shaders/tese/terrain.tese"
+#define TERRAIN_CULL_COMP_SHADER_PATH "shaders/comp/terrainCull.comp"
 #define SKYBOX_VERT_SHADER_PATH     "shaders/vert/skybox.vert"
 #define SKYBOX_FRAG_SHADER_PATH     "shaders/frag/skybox.frag"
 
@@ -6,6 +6,46 @@
 #define BITANGENT_LOCATION      4
 #define BONE_ID_LOCATION        5
 #define BONE_WEIGHT_LOCATION    6
+#define GRID_POSITION_LOCATION  7
+#define PATCH_ORIGIN_LOCATION   8
+#define TILE_PATCH_LOCATION     9
+#define TILE_LAYER_LOCATION     10
+#define CLIPMAP_INSTANCE_LOCATION 11
+#define INSTANCE_POSITION_LOCATION  12
+#define INSTANCE_ROTATION_LOCATION  13
+
+// Where the terrain vertex shader takes positions from
+#define TERRAIN_SOURCE_VERTEX           0
+#define TERRAIN_SOURCE_HEIGHT_TEXTURE   1
+#define TERRAIN_SOURCE_TILES            2
+#define TERRAIN_SOURCE_CLIPMAP          3
+
+// Storage buffer bindings of the terrain culling pass
+#define TERRAIN_PATCH_BOUNDS_BINDING    0
+#define TERRAIN_PATCH_ERRORS_BINDING    1
+#define TERRAIN_LOD_VARIANTS_BINDING    2
+#define TERRAIN_DRAW_COMMANDS_BINDING   3
+#define TERRAIN_DRAW_COUNT_BINDING      4
+
+// Storage buffer of virtual texture page requests written by the terrain fragment shader
+#define VIRTUAL_FEEDBACK_BINDING        5
+
+// Texels per side of a virtual texture page and of the border around it in the page cache
+#define VIRTUAL_PAGE_SIZE       128
+#define VIRTUAL_PAGE_BORDER     1
+
+// One pixel of every square of this many pixels per side writes virtual texture feedback
+#define VIRTUAL_FEEDBACK_STRIDE 8
+
+// Patches processed by one work group of the terrain culling pass
+#define TERRAIN_CULL_GROUP_SIZE 64
+
+// Control points of a tessellated terrain patch and the highest subdivision of its edges
+#define TERRAIN_PATCH_VERTICES  4
+#define TERRAIN_MAX_TESS_LEVEL  64
+
+// Maximum amount of clipmap terrain levels
+#define MAX_CLIPMAP_LEVELS 12
 
 // Maximum amount of point lights
 #define MAX_POINT_LIGHTS 2
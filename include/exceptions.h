@@ -106,4 +106,11 @@ public:
     explicit modelLoaderException(T... args) : tectonicException(args...){}
     modelLoaderException() : tectonicException(){}
 };
+
+class fileException : public tectonicException {
+public:
+    template<typename ...T>
+    explicit fileException(T... args) : tectonicException(args...){}
+    fileException() : tectonicException(){}
+};
 #endif //TECTONIC_EXCEPTIONS_H
@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <array>
 #include <functional>
+#include <limits>
 #include "extern/glad/glad.h"
 
 #include "exceptions.h"
@@ -42,6 +43,12 @@ public:
     uint32_t getMaterialCount() { return m_materials.size(); }
     NodeData* findNode(const std::string& nodeName);
 
+    /**
+     * @brief Local space box around all vertices. Minimum is above the maximum for a model without vertices.
+     */
+    [[nodiscard]] const glm::vec3& getBoundsMin() const { return m_boundsMin; }
+    [[nodiscard]] const glm::vec3& getBoundsMax() const { return m_boundsMax; }
+
     virtual void bufferMeshes();
     virtual void eraseBuffers();
     virtual void clear();
@@ -62,6 +69,9 @@ protected:
     std::vector<Vertex>         m_vertices;
     std::vector<uint32_t>       m_indices;
 
+    glm::vec3 m_boundsMin{std::numeric_limits<float>::infinity()};
+    glm::vec3 m_boundsMax{-std::numeric_limits<float>::infinity()};
+
     NodeData m_rootNode;
     uint32_t m_nodeCount = 0;
 
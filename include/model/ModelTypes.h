@@ -42,6 +42,17 @@ struct MeshInfo{
     MeshInfo& operator=(MeshInfo const&) = default;
 };
 
+/**
+ * Layout of one command of glMultiDrawElementsIndirect.
+ */
+struct DrawElementsIndirectCommand{
+    uint32_t count = 0;
+    uint32_t instanceCount = 0;
+    uint32_t firstIndex = 0;
+    int32_t baseVertex = 0;
+    uint32_t baseInstance = 0;
+};
+
 struct BoneInfo{
     int id = 0;
     glm::mat4 offset = glm::mat4(1.0f);
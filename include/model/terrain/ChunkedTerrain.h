@@ -0,0 +1,228 @@
+#ifndef TECTONIC_CHUNKEDTERRAIN_H
+#define TECTONIC_CHUNKEDTERRAIN_H
+
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <limits>
+
+#include "Terrain.h"
+#include "PatchIndices.h"
+#include "LODManager.h"
+#include "FractalNoise.h"
+#include "HeightTiles.h"
+#include "SplatMap.h"
+#include "model/texture/TextureArray.h"
+
+/**
+ * Unbounded terrain streamed in square tiles around the camera.
+ * Tiles are generated on worker threads and uploaded as layers of one pooled height texture array.
+ * Tiles out of the view distance stay resident until their layer is needed, then the least recently used one is evicted.
+ * Tile size and pool size depend only on the view distance, not on the size of the world.
+ */
+class ChunkedTerrain {
+    friend class Renderer;
+public:
+    /**
+     * Fills heights of a square block of samples addressed in global sample coordinates,
+     * so neighbouring tiles evaluate identical values on shared borders. Called from worker threads.
+     *
+     * @param originX Global X coordinate of the first sample.
+     * @param originY Global Y coordinate of the first sample.
+     * @param size Amount of samples per side.
+     * @param heights Output of size*size heights, row major.
+     */
+    using TileSource = std::function<void(int32_t originX, int32_t originY, uint32_t size, float* heights)>;
+
+    ChunkedTerrain() = default;
+    ~ChunkedTerrain();
+
+    /**
+     * @brief Sets a maximum amount of LOD levels per patch. Adjusts the patch size accordingly.
+     */
+    void setMaxLOD(uint32_t maxLOD);
+    void setPatchesPerTile(uint32_t patches);
+    void setScale(float scale);
+    [[nodiscard]] float getScale() const { return m_worldScale; }
+
+    /**
+     * @brief Sets the distance around the camera which is kept resident and rendered.
+     */
+    void setViewDistance(float distance);
+    void setTileSource(TileSource source);
+    void setMaxTileUploads(uint32_t uploadsPerFrame);
+
+    /**
+     * @brief Sets the blending textures spread evenly over the height range.
+     */
+    void setTextures(const std::vector<std::string>& textureFiles, float minHeight, float maxHeight);
+
+    /**
+     * @brief Makes one texture layer cover steep slopes. Affects tiles generated afterwards.
+     * @param layer Index of the layer, negative disables it.
+     * @param slopeStart Slope at which the layer starts to fade in, as one minus the up component of the normal.
+     * @param slopeEnd Slope at which the layer fully covers the terrain.
+     */
+    void setSlopeLayer(int32_t layer, float slopeStart, float slopeEnd);
+    void setCamera(Camera& camera);
+
+    /**
+     * @brief Allocates the tile pool and the shared patch grid. Has to be called after the settings are set.
+     */
+    void init();
+
+    /**
+     * Requests missing tiles, uploads finished ones and builds the list of visible patches.
+     * Has to be called from the thread owning the GL context, once per frame.
+     *
+     * @brief Streams tiles around the camera.
+     */
+    void update();
+
+    /**
+     * @brief Bilinearly interpolated height at world coordinates. Zero if the tile isn't resident.
+     */
+    [[nodiscard]] float heightAt(float x, float z) const;
+    [[nodiscard]] std::pair<float, float> getMinMaxHeight() const { return {m_minHeight, m_maxHeight}; }
+    [[nodiscard]] std::size_t residentTiles() const { return m_tiles.size(); }
+
+    /**
+     * @brief Draw commands of patches to render this frame. Base instance selects the patch instance.
+     */
+    [[nodiscard]] const std::vector<DrawElementsIndirectCommand>& drawCommands() const { return m_drawCommands; }
+
+    /**
+     * @brief Default tile source summing octaves of value noise hashed from global coordinates.
+     * @param seed Seed of the noise.
+     * @param amplitude Maximum absolute height.
+     * @param featureSize Size of the largest features in samples.
+     */
+    static TileSource valueNoiseSource(uint64_t seed, float amplitude, float featureSize);
+
+    /**
+     * @brief Tile source of fractal gradient noise.
+     * @param settings Noise mode, seed and octave settings.
+     * @param amplitude Maximum absolute height.
+     */
+    static TileSource fractalNoiseSource(const FractalNoise::Settings& settings, float amplitude);
+
+    /**
+     * Global sample coordinates address the samples of the tiles directly, samples outside of them repeat the nearest border sample.
+     *
+     * @brief Tile source streaming compressed height tiles, only tiles overlapping a requested tile are decoded.
+     * @param tiles Height tiles shared by every tile job.
+     */
+    static TileSource heightTilesSource(std::shared_ptr<const HeightTiles> tiles);
+
+private:
+    struct Tile {
+        int32_t x = 0;
+        int32_t y = 0;
+        uint32_t layer = 0;
+        uint64_t lastUsed = 0;
+
+        // Heights including one sample wide border, kept for height queries
+        std::vector<float> heights;
+        // Layer weights of the same samples, released after the upload
+        std::vector<uint8_t> splat;
+        // Minimum and maximum height of the tile and of every patch
+        glm::vec2 bounds{std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+        std::vector<glm::vec2> patchBounds;
+    };
+
+    struct PatchInstance {
+        glm::ivec4 patch;   // Global sample origin in xy, origin inside of the tile in zw
+        int32_t layer;
+    };
+
+    static uint64_t tileKey(int32_t x, int32_t y);
+    static int32_t floorDiv(int32_t a, int32_t b);
+
+    static Tile buildTile(const TileSource& source, int32_t tileX, int32_t tileY, uint32_t tileSamples, uint32_t patchSize, uint32_t patchesPerTile,
+                          const SplatMap::Settings& splatSettings, float worldScale);
+
+    void requestTiles(const std::vector<std::pair<int32_t, int32_t>>& missing);
+    void receiveTiles();
+    uint32_t acquireLayer();
+    void buildDrawList();
+
+    [[nodiscard]] uint32_t patchLOD(int32_t patchX, int32_t patchY) const;
+
+    /**
+     * @brief Selects LODs of the patches of all needed tiles and coarsens them until neighbours differ by at most one.
+     */
+    void relaxLODs();
+    [[nodiscard]] uint32_t relaxedLOD(int32_t patchX, int32_t patchY) const;
+    /**
+     * @brief Classifies a square of patches against the frustum.
+     */
+    [[nodiscard]] Utils::FrustumCulling::Containment classifyPatches(int32_t patchX, int32_t patchY, uint32_t patchCount, const glm::vec2& bounds, uint32_t& planeMask) const;
+    [[nodiscard]] bool isTileNeeded(int32_t tileX, int32_t tileY) const;
+
+    uint32_t m_maxLOD = 0;
+    uint32_t m_patchSize = 0;
+    uint32_t m_patchesPerTile = 8;
+    uint32_t m_tileSamples = 0;
+    float m_worldScale = 1.0f;
+    float m_viewDistance = 50.0f;
+    int32_t m_tileRadius = 0;
+    uint32_t m_maxTileUploads = 2;
+    uint32_t m_maxPendingTiles = 0;
+
+    TileSource m_tileSource = fractalNoiseSource(FractalNoise::Settings(), 10.0f);
+
+    std::unordered_map<uint64_t, Tile> m_tiles;
+    std::unordered_map<uint64_t, std::future<Tile>> m_pendingTiles;
+    std::vector<uint32_t> m_freeLayers;
+    uint32_t m_layerCount = 0;
+    uint64_t m_frame = 0;
+
+    glm::vec3 m_cameraPos{0.0f};
+    int32_t m_cameraTileX = 0;
+    int32_t m_cameraTileY = 0;
+
+    float m_minHeight = std::numeric_limits<float>::infinity();
+    float m_maxHeight = -std::numeric_limits<float>::infinity();
+
+    // LODs of the needed tiles' patches and a ring around them, rebuilt every frame
+    std::vector<uint32_t> m_patchLODs;
+    int32_t m_lodOriginX = 0;
+    int32_t m_lodOriginY = 0;
+    uint32_t m_lodSide = 0;
+
+    PatchIndices m_patchIndices;
+    LODManager m_lodManager;
+    Utils::FrustumCulling m_frustumCulling = Utils::FrustumCulling(0.1);
+
+    std::vector<DrawElementsIndirectCommand> m_drawCommands;
+    std::vector<PatchInstance> m_instances;
+
+    enum GRID_BUFFER_TYPE {
+        GRID_INDEX_BUFFER = 0,
+        GRID_VB           = 1,
+        GRID_INSTANCE_VB  = 2,
+        GRID_COMMAND_BUFFER = 3,
+        NUM_GRID_BUFFERS  = 4
+    };
+
+    GLuint m_gridVAO = -1;
+    GLuint m_gridBuffers[NUM_GRID_BUFFERS] = {0};
+
+    GLuint m_heightArray = -1;
+    GLuint64 m_heightArrayHandle = 0;
+
+    // Layer weights of every tile, layers match the height array
+    GLuint m_splatArray = -1;
+    GLuint64 m_splatArrayHandle = 0;
+
+    std::shared_ptr<TextureArray> m_layerTextures;
+    SplatMap::Settings m_splatSettings;
+
+    Slot<const glm::vec3&> slt_cameraPosition{[this](const glm::vec3& pos){ m_cameraPos = pos; }};
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_CHUNKEDTERRAIN_H
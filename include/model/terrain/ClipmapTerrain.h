@@ -0,0 +1,183 @@
+#ifndef TECTONIC_CLIPMAPTERRAIN_H
+#define TECTONIC_CLIPMAPTERRAIN_H
+
+#include <functional>
+#include <vector>
+#include <string>
+#include <limits>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "extern/glad/glad.h"
+#include "model/ModelTypes.h"
+#include "camera/Camera.h"
+#include "FractalNoise.h"
+#include "SplatMap.h"
+#include "model/texture/TextureArray.h"
+#include "Logger.h"
+#include "utils.h"
+
+/**
+ * Unbounded terrain rendered as geometry clipmaps.
+ * Every level is a ring of fixed size grid geometry centred on the camera, each level has twice the spacing of the previous one.
+ * Heights of a level live in one layer of a texture array addressed toroidally, so when the camera moves
+ * only the strips of samples entering the level are generated and uploaded.
+ * Per frame CPU and upload cost depends on the camera movement and the level size, not on the size of the world.
+ */
+class ClipmapTerrain {
+    friend class Renderer;
+public:
+    /**
+     * Fills heights of a rectangle of samples addressed in global coordinates of the finest level.
+     *
+     * @param originX Global X coordinate of the first sample.
+     * @param originY Global Y coordinate of the first sample.
+     * @param width Amount of samples in a row.
+     * @param height Amount of rows.
+     * @param step Distance between neighbouring samples in global coordinates.
+     * @param heights Output of width*height heights, row major.
+     */
+    using HeightSource = std::function<void(int32_t originX, int32_t originY, uint32_t width, uint32_t height, int32_t step, float* heights)>;
+
+    ClipmapTerrain() = default;
+    ~ClipmapTerrain();
+
+    /**
+     * @brief Sets the amount of samples per side of a level. Rounded to the nearest size of 4m-1 samples.
+     */
+    void setLevelSize(uint32_t samples);
+    void setLevelCount(uint32_t levels);
+    void setScale(float scale);
+    [[nodiscard]] float getScale() const { return m_worldScale; }
+    void setHeightSource(HeightSource source);
+
+    /**
+     * @brief Sets the blending textures spread evenly over the height range.
+     */
+    void setTextures(const std::vector<std::string>& textureFiles, float minHeight, float maxHeight);
+    void setCamera(Camera& camera);
+
+    /**
+     * @brief Allocates level textures and the ring geometry. Has to be called after the settings are set.
+     */
+    void init();
+
+    /**
+     * Moves the levels with the camera, refreshes strips of samples which entered them and builds the list of visible blocks.
+     * Has to be called from the thread owning the GL context, once per frame.
+     *
+     * @brief Updates the clipmap around the camera.
+     */
+    void update();
+
+    [[nodiscard]] std::pair<float, float> getMinMaxHeight() const { return {m_minHeight, m_maxHeight}; }
+    [[nodiscard]] uint32_t levelCount() const { return m_levelCount; }
+
+    /**
+     * @brief Draw commands of visible blocks of all levels. Base instance selects the block instance.
+     */
+    [[nodiscard]] const std::vector<DrawElementsIndirectCommand>& drawCommands() const { return m_drawCommands; }
+
+    /**
+     * @brief Height source of fractal gradient noise.
+     * @param settings Noise mode, seed and octave settings.
+     * @param amplitude Maximum absolute height.
+     */
+    static HeightSource fractalNoiseSource(const FractalNoise::Settings& settings, float amplitude);
+
+private:
+    // Pieces of ring geometry, every level is put together from instances of them
+    enum MeshType {
+        MESH_BLOCK   = 0,   // m x m samples, twelve of them form the ring
+        MESH_FIXUP_X = 1,   // 3 x m samples filling the gap between blocks on the left and right side
+        MESH_FIXUP_Y = 2,   // m x 3 samples filling the gap between blocks on the bottom and top side
+        MESH_TRIM_X  = 3,   // 2m+1 x 2 samples, horizontal part of the trim around the finer level
+        MESH_TRIM_Y  = 4,   // 2 x 2m samples, vertical part of the trim around the finer level
+        MESH_CENTER  = 5,   // 2m+1 x 2m+1 samples filling the hole of the finest level
+        NUM_MESHES   = 6
+    };
+
+    struct BlockInstance {
+        glm::ivec4 origin;  // First sample of the block in units of its level in xy, level in z
+    };
+
+    struct Range {
+        uint32_t start = 0;
+        uint32_t count = 0;
+    };
+
+    /**
+     * @brief Level origins of a camera position. Every origin is even so a level lines up with vertices of the coarser one.
+     */
+    void levelOrigins(const glm::vec3& position, std::vector<glm::ivec2>& origins) const;
+
+    /**
+     * @brief Refreshes samples of a level which aren't covered by its previous origin.
+     */
+    void moveLevel(uint32_t level, const glm::ivec2& origin);
+
+    /**
+     * @brief Generates a rectangle of samples of a level and uploads it into the toroidal layer.
+     * @param x First sample in units of the level.
+     * @param y First row in units of the level.
+     */
+    void uploadRegion(uint32_t level, int32_t x, int32_t y, uint32_t width, uint32_t height);
+
+    void buildGeometry();
+    void buildDrawList();
+    void addBlock(MeshType mesh, uint32_t level, const glm::ivec2& origin, uint32_t sizeX, uint32_t sizeY);
+
+    static int32_t floorDiv(int32_t a, int32_t b);
+
+    uint32_t m_blockSize = 64;
+    uint32_t m_gridSize = 255;
+    // Samples per side of a level layer, the grid plus a one sample wide border for normals
+    uint32_t m_textureSize = 257;
+    uint32_t m_levelCount = 6;
+    float m_worldScale = 1.0f;
+
+    HeightSource m_heightSource = fractalNoiseSource(FractalNoise::Settings(), 10.0f);
+
+    std::vector<glm::ivec2> m_origins;
+    std::vector<bool> m_levelValid;
+
+    glm::vec3 m_cameraPos{0.0f};
+
+    float m_minHeight = std::numeric_limits<float>::infinity();
+    float m_maxHeight = -std::numeric_limits<float>::infinity();
+
+    Utils::FrustumCulling m_frustumCulling = Utils::FrustumCulling(0.1);
+
+    Range m_meshes[NUM_MESHES];
+    std::vector<DrawElementsIndirectCommand> m_drawCommands;
+    std::vector<BlockInstance> m_instances;
+
+    // Scratch buffers of uploaded regions, kept to avoid allocations every frame
+    std::vector<float> m_regionHeights;
+    std::vector<uint8_t> m_regionSplat;
+
+    enum GRID_BUFFER_TYPE {
+        GRID_INDEX_BUFFER   = 0,
+        GRID_VB             = 1,
+        GRID_INSTANCE_VB    = 2,
+        GRID_COMMAND_BUFFER = 3,
+        NUM_GRID_BUFFERS    = 4
+    };
+
+    GLuint m_gridVAO = -1;
+    GLuint m_gridBuffers[NUM_GRID_BUFFERS] = {0};
+
+    GLuint m_heightArray = -1;
+    GLuint64 m_heightArrayHandle = 0;
+    GLuint m_splatArray = -1;
+    GLuint64 m_splatArrayHandle = 0;
+
+    std::shared_ptr<TextureArray> m_layerTextures;
+    SplatMap::Settings m_splatSettings;
+
+    Slot<const glm::vec3&> slt_cameraPosition{[this](const glm::vec3& pos){ m_cameraPos = pos; }};
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_CLIPMAPTERRAIN_H
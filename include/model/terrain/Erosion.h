@@ -0,0 +1,92 @@
+#ifndef TECTONIC_EROSION_H
+#define TECTONIC_EROSION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "Heightfield.h"
+#include "Logger.h"
+
+/**
+ * Grid based erosion of a heightfield, a virtual pipe model for water flow and a talus model for thermal weathering.
+ * Every pass reads only the state of the previous pass and writes the cells it owns, so rows are split between
+ * the threads of the pool and bands of neighbouring threads exchange their border rows through the shared grids.
+ * Eight samples of a row are processed at once with AVX2.
+ */
+class Erosion {
+public:
+    struct Settings {
+        // Fixed iteration budgets, zero disables the solver
+        uint32_t hydraulicIterations = 0;
+        uint32_t thermalIterations = 0;
+
+        float timeStep = 0.05f;
+        // Water depth added to every sample per time unit
+        float rain = 0.02f;
+        // Fraction of water evaporated per time unit
+        float evaporation = 0.05f;
+        // Cross section area of the virtual pipes times gravity
+        float pipeFlow = 20.0f;
+        // Sediment carried per unit of water discharge on a fully steep slope
+        float capacity = 0.5f;
+        float dissolving = 0.3f;
+        float deposition = 0.3f;
+        // Lower bound of the slope factor, so flat areas still get eroded by fast water
+        float minSlope = 0.05f;
+
+        // Steepest stable slope as height difference per unit of distance
+        float talus = 0.8f;
+        // Fraction of the material above the talus slope moved per iteration
+        float thermalRate = 0.5f;
+
+        [[nodiscard]] bool enabled() const { return hydraulicIterations > 0 || thermalIterations > 0; }
+    };
+
+    /**
+     * Water left after the last iteration is dropped and the sediment it carries settles in place, so no material is lost.
+     *
+     * @brief Erodes heights of the heightfield in place. Normals aren't touched.
+     * @param settings Iteration budgets and solver constants.
+     * @param heightfield Heights in world units.
+     * @param spacing World distance between two neighbouring samples.
+     */
+    static void erode(const Settings& settings, Heightfield& heightfield, float spacing);
+
+private:
+    /**
+     * Solver state padded by a one sample border. Border heights mirror the edge samples and border flows stay zero,
+     * so no water or material leaves the grid and inner loops need no bounds checks.
+     */
+    struct Grid {
+        uint32_t dimX = 0;
+        uint32_t dimY = 0;
+        std::size_t stride = 0;
+
+        std::vector<float> terrain;
+        std::vector<float> water;
+        std::vector<float> sediment;
+        // Sediment per unit of water, what leaves a cell with its outflows
+        std::vector<float> concentration;
+        std::vector<float> slope;
+        // Outflows towards -X, +X, -Y and +Y, reused for moved material by the thermal solver
+        std::vector<float> flowLeft;
+        std::vector<float> flowRight;
+        std::vector<float> flowDown;
+        std::vector<float> flowUp;
+
+        [[nodiscard]] inline std::size_t index(uint32_t x, uint32_t y) const { return static_cast<std::size_t>(y+1)*stride + x+1; }
+    };
+
+    static void copyBorder(const Grid& grid, std::vector<float>& plane);
+
+    static void hydraulicFlow(const Settings& settings, Grid& grid, float spacing, uint32_t rowBegin, uint32_t rowEnd);
+    static void hydraulicErode(const Settings& settings, Grid& grid, float spacing, uint32_t rowBegin, uint32_t rowEnd);
+
+    static void thermalFlow(const Settings& settings, Grid& grid, float spacing, uint32_t rowBegin, uint32_t rowEnd);
+    static void thermalApply(Grid& grid, uint32_t rowBegin, uint32_t rowEnd);
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_EROSION_H
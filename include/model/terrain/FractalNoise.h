@@ -0,0 +1,79 @@
+#ifndef TECTONIC_FRACTALNOISE_H
+#define TECTONIC_FRACTALNOISE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <glm/vec2.hpp>
+
+/**
+ * Fractal sums of 2D gradient noise addressed by global sample coordinates.
+ * Every sample depends only on its coordinates and the settings, so any rectangle of a world
+ * can be generated on its own and neighbouring rectangles agree on shared samples.
+ * Eight samples are evaluated at once with AVX2.
+ */
+class FractalNoise {
+public:
+    enum class Mode : std::uint8_t {
+        FBM,            // Sum of octaves with decreasing amplitude
+        RIDGED,         // Inverted absolute octaves, sharp ridges and rounded valleys
+        DOMAIN_WARP     // fBm sampled at coordinates displaced by two other fBm fields
+    };
+
+    struct Settings {
+        Mode mode = Mode::FBM;
+        uint64_t seed = 0;
+        uint32_t octaves = 6;
+        // Amount of samples per lattice cell of the first octave
+        float featureSize = 256.0f;
+        // Frequency multiplier between octaves
+        float lacunarity = 2.0f;
+        // Amplitude multiplier between octaves
+        float gain = 0.5f;
+        // Maximal displacement of domain warping in samples
+        float warpStrength = 64.0f;
+    };
+
+    FractalNoise() : FractalNoise(Settings()){}
+    explicit FractalNoise(const Settings& settings);
+
+    /**
+     * @brief Fills a rectangle of samples on the calling thread.
+     * @param originX Global X coordinate of the first sample.
+     * @param originY Global Y coordinate of the first sample.
+     * @param width Amount of samples in a row.
+     * @param height Amount of rows.
+     * @param out Output of values roughly in range [-1, 1].
+     * @param stride Distance between two rows of the output in floats.
+     * @param step Distance between two neighbouring output samples in global coordinates.
+     */
+    void fill(int32_t originX, int32_t originY, uint32_t width, uint32_t height, float* out, std::size_t stride, int32_t step = 1) const;
+
+    /**
+     * @brief Fills a rectangle of samples, rows are split between the threads of the pool.
+     */
+    void fillParallel(int32_t originX, int32_t originY, uint32_t width, uint32_t height, float* out, std::size_t stride, int32_t step = 1) const;
+
+    [[nodiscard]] const Settings& settings() const { return m_settings; }
+
+private:
+    static constexpr uint32_t BLOCK = 8;
+    static constexpr uint32_t MAX_OCTAVES = 16;
+
+    /**
+     * @brief Gradient noise of a block of coordinates in lattice units.
+     */
+    void noiseBlock(const float* x, const float* y, float* out) const;
+
+    void fractalBlock(const float* x, const float* y, float* out) const;
+    void fbmBlock(const float* x, const float* y, float* out) const;
+    void ridgedBlock(const float* x, const float* y, float* out) const;
+
+    Settings m_settings;
+
+    // Permutation of 0..255 repeated twice, 32-bit so it can be gathered
+    alignas(32) int32_t m_perm[512]{};
+    // Shift of every octave, so lattice points of octaves don't line up
+    glm::vec2 m_octaveOffsets[MAX_OCTAVES];
+};
+
+#endif //TECTONIC_FRACTALNOISE_H
@@ -0,0 +1,121 @@
+#ifndef TECTONIC_HEIGHTTILES_H
+#define TECTONIC_HEIGHTTILES_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include "Heightfield.h"
+#include "MappedFile.h"
+#include "Logger.h"
+
+/**
+ * Heights stored as independently compressed square tiles, on disk and in RAM.
+ * Samples of a tile are quantized to 16 bits inside of the height range of the tile, predicted from the already
+ * decoded neighbours and the residuals are Rice coded with a parameter picked per row.
+ * Every tile decodes on its own, so bands of tiles decode in parallel and single tiles can be streamed.
+ */
+class HeightTiles {
+public:
+    HeightTiles() = default;
+
+    /**
+     * @brief Maps a tile file. Tiles are decoded straight from the mapping. Throws fileException if it isn't a valid tile file.
+     */
+    explicit HeightTiles(const char* filename);
+
+    HeightTiles(const HeightTiles&) = delete;
+    HeightTiles& operator=(const HeightTiles&) = delete;
+    HeightTiles(HeightTiles&& other) noexcept = default;
+    HeightTiles& operator=(HeightTiles&& other) noexcept = default;
+
+    /**
+     * @brief Compresses heights, tiles are encoded in parallel.
+     * @param heights Heights of dimY rows.
+     * @param dimX Amount of samples in a row.
+     * @param dimY Amount of rows.
+     * @param stride Distance between two rows of the input in floats.
+     * @param tileSize Amount of samples per side of a tile.
+     * @param maxError Allowed error of a decoded height. Zero keeps full 16-bit precision, larger errors compress better.
+     */
+    static HeightTiles encode(const float* heights, uint32_t dimX, uint32_t dimY, std::size_t stride, uint32_t tileSize = 256, float maxError = 0.0f);
+    static HeightTiles encode(const Heightfield& heightfield, uint32_t tileSize = 256, float maxError = 0.0f);
+
+    /**
+     * @brief Writes the tiles next to the target and renames the file. Throws fileException if it can't be written.
+     */
+    void save(const char* filename) const;
+
+    [[nodiscard]] uint32_t dimX() const { return m_dimX; }
+    [[nodiscard]] uint32_t dimY() const { return m_dimY; }
+    [[nodiscard]] uint32_t tileSize() const { return m_tileSize; }
+    [[nodiscard]] uint32_t tilesX() const { return m_tilesX; }
+    [[nodiscard]] uint32_t tilesY() const { return m_tilesY; }
+    [[nodiscard]] bool empty() const { return m_tiles.empty(); }
+
+    /**
+     * @brief Size of the whole encoded file in bytes.
+     */
+    [[nodiscard]] std::size_t compressedSize() const { return m_size; }
+
+    /**
+     * @brief Minimum and maximum height of a tile, known without decoding it.
+     */
+    [[nodiscard]] std::pair<float, float> tileRange(uint32_t tileX, uint32_t tileY) const;
+
+    /**
+     * @brief Decodes one tile on the calling thread. Tiles on the right and bottom border may be smaller than the tile size.
+     * @param out Output of the samples of the tile.
+     * @param stride Distance between two rows of the output in floats.
+     */
+    void decodeTile(uint32_t tileX, uint32_t tileY, float* out, std::size_t stride) const;
+
+    /**
+     * Only tiles overlapping the rectangle are decoded, each of them once. Samples outside of the heights repeat the nearest border sample.
+     *
+     * @brief Decodes a rectangle of samples on the calling thread.
+     * @param originX X coordinate of the first sample.
+     * @param originY Y coordinate of the first sample.
+     * @param width Amount of samples in a row.
+     * @param height Amount of rows.
+     * @param out Output of width*height heights, row major.
+     */
+    void decodeRegion(int32_t originX, int32_t originY, uint32_t width, uint32_t height, float* out) const;
+
+private:
+    struct TileEntry {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        float minHeight = 0.0f;
+        float maxHeight = 0.0f;
+        // Height difference of neighbouring quantized values
+        float step = 0.0f;
+        uint32_t reserved = 0;
+    };
+
+    /**
+     * @brief Reads the header and the tile table of the encoded data. Throws fileException if they aren't valid.
+     */
+    void parse(const char* name);
+    [[nodiscard]] std::pair<uint32_t, uint32_t> tileExtent(uint32_t tileX, uint32_t tileY) const;
+
+    static void encodeTile(const float* heights, std::size_t stride, uint32_t width, uint32_t height, float maxError, TileEntry& entry, std::vector<uint8_t>& out);
+
+    // Encoded data lives either in the mapping of a loaded file or in the buffer of freshly encoded tiles
+    MappedFile m_file;
+    std::vector<uint8_t> m_buffer;
+    const uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+
+    uint32_t m_dimX = 0;
+    uint32_t m_dimY = 0;
+    uint32_t m_tileSize = 0;
+    uint32_t m_tilesX = 0;
+    uint32_t m_tilesY = 0;
+    std::vector<TileEntry> m_tiles;
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_HEIGHTTILES_H
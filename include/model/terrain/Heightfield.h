@@ -0,0 +1,125 @@
+#ifndef TECTONIC_HEIGHTFIELD_H
+#define TECTONIC_HEIGHTFIELD_H
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+/**
+ * Dense grid of terrain samples.
+ * Heights and normals are stored in separate planes, so passes touching only one attribute
+ * walk over tightly packed memory. Position and texture coordinates are implied by the grid coordinates.
+ */
+class Heightfield {
+public:
+    Heightfield() = default;
+
+    /**
+     * @brief Resizes the grid. Heights are reset to zero and normals point up.
+     * @param dimX Amount of samples in X dimension.
+     * @param dimY Amount of samples in Y dimension.
+     */
+    void resize(uint32_t dimX, uint32_t dimY);
+    void clear();
+
+    [[nodiscard]] uint32_t dimX() const { return m_dimX; }
+    [[nodiscard]] uint32_t dimY() const { return m_dimY; }
+    [[nodiscard]] std::size_t size() const { return m_heights.size(); }
+    [[nodiscard]] bool empty() const { return m_heights.empty(); }
+
+    [[nodiscard]] inline uint32_t xy2i(uint32_t x, uint32_t y) const { return (y*m_dimX)+x; }
+
+    float& heightAt(uint32_t x, uint32_t y) { return m_heights[xy2i(x,y)]; }
+    [[nodiscard]] float heightAt(uint32_t x, uint32_t y) const { return m_heights[xy2i(x,y)]; }
+    float& heightAt(uint32_t i) { return m_heights[i]; }
+    [[nodiscard]] float heightAt(uint32_t i) const { return m_heights[i]; }
+
+    glm::vec3& normalAt(uint32_t x, uint32_t y) { return m_normals[xy2i(x,y)]; }
+    [[nodiscard]] const glm::vec3& normalAt(uint32_t x, uint32_t y) const { return m_normals[xy2i(x,y)]; }
+    glm::vec3& normalAt(uint32_t i) { return m_normals[i]; }
+    [[nodiscard]] const glm::vec3& normalAt(uint32_t i) const { return m_normals[i]; }
+
+    /**
+     * @brief Finds the lowest and highest sample with a parallel SIMD reduction.
+     * @return Pair of minimum and maximum height.
+     */
+    [[nodiscard]] std::pair<float, float> calcMinMax() const;
+
+    /**
+     * @brief Finds the lowest and highest sample inside a rectangle on the calling thread.
+     * @param x First column of the rectangle.
+     * @param y First row of the rectangle.
+     * @param width Amount of columns.
+     * @param height Amount of rows.
+     * @return Pair of minimum and maximum height.
+     */
+    [[nodiscard]] std::pair<float, float> calcMinMax(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const;
+
+    /**
+     * Single sweep over the grid. Heights are linearly mapped from the source range into the destination range
+     * and normals are computed from central differences of the mapped heights.
+     *
+     * @brief Normalizes heights and calculates normals.
+     * @param srcMin Current minimum height, usually from calcMinMax.
+     * @param srcMax Current maximum height, usually from calcMinMax.
+     * @param dstMin Minimum height after the mapping.
+     * @param dstMax Maximum height after the mapping.
+     * @param spacing World distance between two neighbouring samples.
+     * @return Pair of minimum and maximum height after the mapping.
+     */
+    std::pair<float, float> normalizeAndCalcNormals(float srcMin, float srcMax, float dstMin, float dstMax, float spacing);
+
+    /**
+     * @brief Linearly maps heights from the source range into the destination range, normals are left untouched.
+     */
+    void normalize(float srcMin, float srcMax, float dstMin, float dstMax);
+
+    /**
+     * @brief Calculates normals from central differences of the heights.
+     * @param spacing World distance between two neighbouring samples.
+     * @return Pair of minimum and maximum height, gathered by the same sweep.
+     */
+    std::pair<float, float> calcNormals(float spacing);
+
+    /**
+     * @brief Calculates normals of a rectangle on the calling thread, with the same differences as the full pass.
+     * @param x First column of the rectangle.
+     * @param y First row of the rectangle.
+     * @param width Amount of columns.
+     * @param height Amount of rows.
+     */
+    void calcNormals(float spacing, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    /**
+     * Follows the triangulation of the rendered mesh, cell diagonals alternate like the LOD 0 fans of terrain patches.
+     * Positions outside of the grid are clamped to its border. Eight positions are sampled at once with AVX2.
+     *
+     * @brief Heights and normals of the triangulated surface at a span of world XZ positions.
+     * @param positions World X and Z coordinates.
+     * @param count Amount of positions.
+     * @param origin World XZ position of the first sample.
+     * @param spacing World distance between two neighbouring samples.
+     * @param heights Output of count heights.
+     * @param normals Optional output of count normals.
+     */
+    void sampleSurface(const glm::vec2* positions, std::size_t count, const glm::vec2& origin, float spacing, float* heights, glm::vec3* normals = nullptr) const;
+
+    float* heights() { return m_heights.data(); }
+    [[nodiscard]] const float* heights() const { return m_heights.data(); }
+    glm::vec3* normals() { return m_normals.data(); }
+    [[nodiscard]] const glm::vec3* normals() const { return m_normals.data(); }
+
+private:
+    std::pair<float, float> remapAndCalcNormals(float scale, float offset, float spacing);
+    void normalsRow(uint32_t y, const float* up, const float* curr, const float* down, float scale, float spacing);
+
+    uint32_t m_dimX = 0;
+    uint32_t m_dimY = 0;
+
+    std::vector<float> m_heights;
+    std::vector<glm::vec3> m_normals;
+};
+
+#endif //TECTONIC_HEIGHTFIELD_H
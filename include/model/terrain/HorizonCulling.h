@@ -0,0 +1,72 @@
+#ifndef TECTONIC_HORIZONCULLING_H
+#define TECTONIC_HORIZONCULLING_H
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "meta/meta.h"
+
+/**
+ * Occlusion culling against terrain with a one dimensional horizon over screen columns.
+ * Every column keeps the highest screen position up to which it is covered by terrain drawn so far.
+ * Occluders are terrain patches, solid from their minimum height down, so a column is covered up to
+ * the upper edge of the projected patch top. Boxes and occluders are walked front to back and a box is
+ * only tested against occluders lying completely in front of it. Assumes the camera is above the terrain surface.
+ */
+class HorizonCulling {
+public:
+    struct Box {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    /**
+     * @param columns Resolution of the horizon, independent of the viewport width.
+     */
+    explicit HorizonCulling(uint32_t columns = 256) : m_horizon(columns) {}
+
+    void setColumns(uint32_t columns);
+    void update(const glm::mat4& VP);
+    void setCameraPosition(const glm::vec3& position) { m_cameraPos = position; }
+
+    /**
+     * @brief Culls boxes against the horizon rasterized from occluders.
+     * @param occluders Boxes solid below their minimum height, usually terrain patches.
+     * @param boxes Tested world space boxes.
+     * @param visible Output of a flag per box, resized to the amount of boxes.
+     */
+    void cull(const std::vector<Box>& occluders, const std::vector<Box>& boxes, std::vector<uint8_t>& visible);
+
+    Slot<const glm::mat4&> slt_updateVP{[this](const glm::mat4& VP) { update(VP); }};
+    Slot<const glm::vec3&> slt_cameraPosition{[this](const glm::vec3& pos) { setCameraPosition(pos); }};
+
+private:
+    /**
+     * @brief Raises the horizon by the top face of an occluder.
+     */
+    void rasterize(const Box& occluder);
+    [[nodiscard]] bool isOccluded(const Box& box) const;
+
+    /**
+     * @brief Projects a point into horizon column units in x and NDC height in y.
+     * @return False if the point is too close to or behind the camera.
+     */
+    [[nodiscard]] bool project(const glm::vec3& point, glm::vec3& projected) const;
+
+    struct Event {
+        float distance;
+        uint32_t index;
+        bool occluder;
+    };
+
+    std::vector<float> m_horizon;
+    std::vector<Event> m_events;
+
+    glm::mat4 m_VP{1.0f};
+    glm::vec3 m_cameraPos{0.0f};
+};
+
+#endif //TECTONIC_HORIZONCULLING_H
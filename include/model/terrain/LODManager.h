@@ -2,6 +2,8 @@
 #define TECTONIC_LODMANAGER_H
 
 #include <vector>
+#include <queue>
+#include <glm/vec2.hpp>
 
 #include "utils.h"
 #include "../../camera/Camera.h"
@@ -10,7 +12,12 @@
 #include "Transformation.h"
 #include "meta/meta.h"
 
-
+/**
+ * Selects LOD of terrain patches from the projected screen-space error.
+ * Every patch keeps its LOD while the camera stays inside of a distance band around it.
+ * Camera movement can change the distance to a patch at most by the travelled length,
+ * so a patch is only re-evaluated once the camera travelled more than the distance to the nearest band boundary.
+ */
 class LODManager {
 public:
 
@@ -24,21 +31,103 @@ public:
         uint32_t bottom = 0;
     };
 
-    const patchLOD& getPatchLOD(uint32_t patchX, uint32_t patchY) const;
+    [[nodiscard]] const patchLOD& getPatchLOD(uint32_t patchX, uint32_t patchY) const { return m_map[patchY * m_patchesX + patchX]; }
     void calcLODRegions();
-    void loadHeightsPerPatch(const std::vector<std::vector<float>>& map);
+
+    /**
+     * @brief Loads height bounds and geometric errors of every patch.
+     * @param bounds Minimum and maximum height of every patch, row major.
+     * @param errors Maximum height deviation of every patch rendered at every LOD, maxLOD+1 values per patch.
+     */
+    void loadPatches(std::vector<glm::vec2> bounds, std::vector<float> errors);
+
+    /**
+     * Changed patches are re-evaluated right away, stitching is refreshed around them.
+     *
+     * @brief Replaces height bounds and geometric errors of a rectangle of patches.
+     * @param lastX Last patch column, inclusive.
+     * @param lastY Last patch row, inclusive.
+     * @param bounds Minimum and maximum height of every patch of the rectangle, row major.
+     * @param errors Geometric errors of every patch of the rectangle, maxLOD+1 values per patch.
+     */
+    void updatePatches(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY, const glm::vec2* bounds, const float* errors);
+
+    /**
+     * @brief Sets vertical field of view in degrees.
+     */
+    void setFOV(float fov);
+    void setViewportHeight(float height);
+
+    /**
+     * @brief Sets the maximum error of a patch in pixels.
+     */
+    void setPixelError(float pixels);
+
+    /**
+     * @brief Sets a relative widening of LOD bands, so patches on a band boundary don't flicker between two levels.
+     */
+    void setHysteresis(float hysteresis);
+
+    /**
+     * @brief Re-evaluates patches whose band the camera could have left since the last update.
+     */
+    void update();
+
+    /**
+     * @brief Geometric errors of loaded patches, maxLOD+1 values per patch.
+     */
+    [[nodiscard]] const std::vector<float>& patchErrors() const { return m_errors; }
+
+    /**
+     * @brief Distance per unit of geometric error at which a LOD reaches the pixel error.
+     */
+    [[nodiscard]] float distancePerError() const;
+
+    /**
+     * @brief Pixels covered by one world unit at unit distance from the camera.
+     */
+    [[nodiscard]] float pixelsPerDistance() const;
+
+    /**
+     * @brief Maps a distance from the camera onto a LOD level.
+     */
+    [[nodiscard]] uint32_t distanceToLOD(float distance) const;
 
     Slot<const glm::vec3&> slt_cameraPosition{[this](const glm::vec3& pos){
-        updateLODMapPass1(pos);
-        updateLODMapPass2(pos);
+        m_cameraPos = pos;
     }};
 
 private:
-
-    void updateLODMapPass1(const glm::vec3& camPos);
-    void updateLODMapPass2(const glm::vec3& camPos);
-
-    uint32_t distanceToLOD(float distance);
+    void rebuild();
+
+    /**
+     * @brief Selects LOD of a patch.
+     * @return Distance the camera can travel before the LOD can change.
+     */
+    float evaluatePatch(uint32_t patch);
+
+    /**
+     * Neighbouring patches may differ by one LOD at most, stitched variants only exist for a one LOD step.
+     * Patches around the rectangle keep their LODs and only raise patches inside of it.
+     *
+     * @brief Resets a rectangle of patches to their selected LODs and coarsens them until neighbours differ by at most one.
+     * @param lastX Last patch column, inclusive.
+     * @param lastY Last patch row, inclusive.
+     */
+    void relaxLODs(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY);
+
+    /**
+     * @brief Relaxes patches a changed patch can reach and refreshes stitching around them.
+     */
+    void relaxAround(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY);
+    void updateStitching(uint32_t patchX, uint32_t patchY);
+
+    [[nodiscard]] float patchDistance(uint32_t patch) const;
+
+    /**
+     * @brief Distance from which a LOD projects below the pixel error.
+     */
+    [[nodiscard]] float switchDistance(uint32_t patch, uint32_t lod) const;
 
     uint32_t m_maxLOD = 0;
     uint32_t m_patchSize = 0;
@@ -47,12 +136,31 @@ private:
     uint32_t m_dimX = 0;
     uint32_t m_dimY = 0;
 
-    std::vector<std::vector<patchLOD>> m_map;
-    std::vector<std::vector<float>> m_heights;
+    std::vector<patchLOD> m_map;
+    // LOD every patch selected from its own error, before neighbours are clamped to one LOD apart
+    std::vector<uint32_t> m_selected;
+    std::vector<glm::vec2> m_bounds;
+    std::vector<float> m_errors;
     std::vector<float> m_regions;
 
     float m_worldScale;
 
+    float m_fov = CAMERA_PPROJ_FOV;
+    float m_viewportHeight = 1080.0f;
+    float m_pixelError = 2.0f;
+    float m_hysteresis = 0.1f;
+    // Pixels per world unit of error at distance one
+    float m_errorScale = 0.0f;
+
+    using wakeup_t = std::pair<double, uint32_t>;
+    // Patches ordered by the travelled length at which they have to be re-evaluated
+    std::priority_queue<wakeup_t, std::vector<wakeup_t>, std::greater<>> m_wakeups;
+    double m_travel = 0.0;
+
+    glm::vec3 m_cameraPos{0.0f};
+    glm::vec3 m_lastCameraPos{0.0f};
+    bool m_dirty = true;
+
     static Logger m_logger;
 
 };
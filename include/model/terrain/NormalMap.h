@@ -0,0 +1,38 @@
+#ifndef TECTONIC_NORMALMAP_H
+#define TECTONIC_NORMALMAP_H
+
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "Heightfield.h"
+
+/**
+ * Normals of a heightfield baked into an RG16 texture, octahedral encoded with the y axis up.
+ * Upward facing normals fill the inner diamond of the octahedron, so linear filtering between
+ * neighbouring texels never crosses the folded seam.
+ */
+class NormalMap {
+public:
+    /**
+     * @brief Octahedral encoding of a unit normal into [0, 1]^2.
+     */
+    static glm::vec2 encode(const glm::vec3& normal);
+
+    /**
+     * @brief Bakes normals of the whole heightfield, rows are split between the threads of the pool.
+     * @param texels Output of 2 values per sample, row major.
+     */
+    static void bake(const Heightfield& heightfield, uint16_t* texels);
+
+    /**
+     * @brief Bakes normals of a rectangle of the heightfield on the calling thread.
+     * @param texels Output of 2 values per sample of the rectangle, row major.
+     */
+    static void bake(const Heightfield& heightfield, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* texels);
+
+private:
+    static void packNormal(const glm::vec3& normal, uint16_t* texel);
+};
+
+#endif //TECTONIC_NORMALMAP_H
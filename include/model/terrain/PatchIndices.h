@@ -0,0 +1,99 @@
+#ifndef TECTONIC_PATCHINDICES_H
+#define TECTONIC_PATCHINDICES_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "Logger.h"
+
+/**
+ * Index lists of one terrain patch for every LOD and every stitching variant.
+ * Patch has 2^(maxLOD+1) + 1 samples per side. A stitched edge connects to a neighbour one LOD coarser.
+ * Indices are relative to the first sample of the patch. With the stride of one patch they stay in 16 bits.
+ */
+class PatchIndices {
+public:
+    struct Range {
+        uint32_t start = 0;
+        uint32_t count = 0;
+    };
+
+    /**
+     * @brief Creates index lists of all variants.
+     * @param maxLOD Highest level of detail.
+     * @param stride Distance between two sample rows in the vertex source.
+     */
+    void build(uint32_t maxLOD, uint32_t stride);
+
+    /**
+     * @brief Restores index lists of another instance, e.g. read back from a terrain cache.
+     * @param maxLOD Highest level of detail the lists were built with.
+     * @param stride Stride the lists were built with.
+     * @param variants Table of variantCount() ranges in the layout of variants().
+     * @param indices Indices of all variants.
+     * @param indexCount Amount of indices.
+     * @param indexSize Size of one index in bytes.
+     */
+    void assign(uint32_t maxLOD, uint32_t stride, const Range* variants, const void* indices, std::size_t indexCount, uint32_t indexSize);
+    void clear();
+
+    /**
+     * @brief Returns a range of indices of one variant.
+     * @param core LOD of the patch.
+     * @param left 1 if the left neighbour has a coarser LOD, 0 otherwise. Same for other edges.
+     */
+    [[nodiscard]] const Range& variant(uint32_t core, uint32_t left, uint32_t right, uint32_t top, uint32_t bottom) const {
+        return m_lodInfo[core].info[left][right][top][bottom];
+    }
+
+    /**
+     * Variants of one LOD follow each other ordered by left, right, top and bottom flags,
+     * range of a variant is at index core*16 + left*8 + right*4 + top*2 + bottom.
+     *
+     * @brief Ranges of all variants in one contiguous table.
+     */
+    [[nodiscard]] const Range* variants() const { return m_lodInfo.empty() ? nullptr : &m_lodInfo.front().info[0][0][0][0]; }
+    [[nodiscard]] std::size_t variantCount() const { return m_lodInfo.size() * variantsPerLOD(); }
+    [[nodiscard]] static constexpr std::size_t variantsPerLOD() { return LEFT * RIGHT * TOP * BOTTOM; }
+
+    /**
+     * @brief Size of one index in bytes. Indices are stored as 16-bit if every index of the patch fits.
+     */
+    [[nodiscard]] uint32_t indexSize() const { return m_compactIndices.empty() ? sizeof(uint32_t) : sizeof(uint16_t); }
+    [[nodiscard]] std::size_t indexCount() const { return m_compactIndices.empty() ? m_indices.size() : m_compactIndices.size(); }
+    [[nodiscard]] std::size_t byteSize() const { return indexCount() * indexSize(); }
+    [[nodiscard]] const void* data() const { return m_compactIndices.empty() ? static_cast<const void*>(m_indices.data()) : m_compactIndices.data(); }
+
+    [[nodiscard]] uint32_t patchSize() const { return m_patchSize; }
+    [[nodiscard]] uint32_t stride() const { return m_stride; }
+    [[nodiscard]] bool empty() const { return indexCount() == 0; }
+
+private:
+    void createPatchIndicesLOD(uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom);
+    void createFan(uint32_t x, uint32_t y, uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom);
+    void createTriangle(uint32_t i0, uint32_t i1, uint32_t i2);
+
+    [[nodiscard]] inline uint32_t xy2i(uint32_t x, uint32_t y) const { return (y*m_stride)+x; }
+
+    constexpr static uint8_t LEFT = 2;
+    constexpr static uint8_t RIGHT = 2;
+    constexpr static uint8_t TOP = 2;
+    constexpr static uint8_t BOTTOM = 2;
+
+    struct LODInfo {
+        Range info[LEFT][RIGHT][TOP][BOTTOM];
+    };
+
+    std::vector<LODInfo> m_lodInfo;
+    std::vector<uint32_t> m_indices;
+    std::vector<uint16_t> m_compactIndices;
+
+    uint32_t m_maxLOD = 0;
+    uint32_t m_patchSize = 0;
+    uint32_t m_stride = 0;
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_PATCHINDICES_H
@@ -0,0 +1,110 @@
+#ifndef TECTONIC_PATCHQUADTREE_H
+#define TECTONIC_PATCHQUADTREE_H
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <glm/vec2.hpp>
+
+#include "Heightfield.h"
+#include "utils.h"
+
+/**
+ * Min/max height pyramid over terrain patches.
+ * Level 0 holds exact height bounds of every patch, every next level merges 2x2 nodes of the previous one.
+ * Culling walks the pyramid from the root, so the cost follows the amount of visible patches.
+ */
+class PatchQuadtree {
+public:
+    /**
+     * @brief Computes bounds of every patch and builds the upper levels.
+     * @param heightfield Samples of the terrain.
+     * @param patchSize Amount of samples per patch side, neighbouring patches share the border samples.
+     * @param patchesX Amount of patches in X dimension.
+     * @param patchesY Amount of patches in Y dimension.
+     * @param origin World position of the first sample in XZ plane.
+     * @param spacing World distance between two neighbouring samples.
+     */
+    void build(const Heightfield& heightfield, uint32_t patchSize, uint32_t patchesX, uint32_t patchesY, glm::vec2 origin, float spacing);
+
+    /**
+     * @brief Builds the upper levels over already known bounds of every patch.
+     * @param patchBounds Minimum and maximum height of every patch, row major.
+     */
+    void build(std::vector<glm::vec2> patchBounds, uint32_t patchSize, uint32_t patchesX, uint32_t patchesY, glm::vec2 origin, float spacing);
+    void clear();
+
+    /**
+     * @brief Recomputes bounds of a rectangle of patches and of the nodes above them.
+     * @param firstX First patch column.
+     * @param firstY First patch row.
+     * @param lastX Last patch column, inclusive.
+     * @param lastY Last patch row, inclusive.
+     */
+    void updatePatches(const Heightfield& heightfield, uint32_t patchSize, uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY);
+
+    /**
+     * @brief Collects indices of patches intersecting the frustum.
+     * @param frustum Frustum to test against.
+     * @param visible Output of patch indices (y * patchesX + x), cleared first.
+     */
+    void cull(const Utils::FrustumCulling& frustum, std::vector<uint32_t>& visible) const;
+
+    /**
+     * Visits patches whose bounds the ray passes through, nearest first, until the visitor reports a hit.
+     * Nodes the ray misses are skipped with all of their patches.
+     *
+     * @brief Walks patches along a ray.
+     * @param origin Origin of the ray.
+     * @param direction Direction of the ray, doesn't have to be normalized.
+     * @param maxDistance Maximal ray parameter.
+     * @param visitor Called with patch coordinates and ray parameters of entering and leaving the patch bounds. Returns true to stop.
+     * @return True if the visitor stopped the walk.
+     */
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                 const std::function<bool(uint32_t patchX, uint32_t patchY, float tEnter, float tExit)>& visitor) const;
+
+    /**
+     * @brief Minimum and maximum height of a patch.
+     */
+    [[nodiscard]] const glm::vec2& patchBounds(uint32_t patchX, uint32_t patchY) const { return m_levels.front().bounds[patchY * m_patchesX + patchX]; }
+    [[nodiscard]] const std::vector<glm::vec2>& leafBounds() const { return m_levels.front().bounds; }
+    [[nodiscard]] bool empty() const { return m_levels.empty(); }
+
+private:
+    struct Level {
+        uint32_t dimX = 0;
+        uint32_t dimY = 0;
+        std::vector<glm::vec2> bounds;
+    };
+
+    void buildLevels();
+    static glm::vec2 mergeChildren(const Level& child, uint32_t x, uint32_t y);
+
+    void cullNode(const Utils::FrustumCulling& frustum, uint32_t level, uint32_t x, uint32_t y, uint32_t planeMask, std::vector<uint32_t>& visible) const;
+    void appendNode(uint32_t level, uint32_t x, uint32_t y, std::vector<uint32_t>& visible) const;
+
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 invDirection;
+        float maxDistance;
+    };
+
+    bool raycastNode(const Ray& ray, uint32_t level, uint32_t x, uint32_t y,
+                     const std::function<bool(uint32_t, uint32_t, float, float)>& visitor) const;
+    bool intersectNode(const Ray& ray, uint32_t level, uint32_t x, uint32_t y, float& tEnter, float& tExit) const;
+
+    /**
+     * @brief World space box of a node. Node covers 2^level patches per side, clamped by the terrain border.
+     */
+    void nodeBox(uint32_t level, uint32_t x, uint32_t y, glm::vec3& min, glm::vec3& max) const;
+
+    std::vector<Level> m_levels;
+
+    uint32_t m_patchesX = 0;
+    uint32_t m_patchesY = 0;
+    float m_patchWorldSize = 0.0f;
+    glm::vec2 m_origin{0.0f};
+};
+
+#endif //TECTONIC_PATCHQUADTREE_H
@@ -0,0 +1,150 @@
+#ifndef TECTONIC_SCATTER_H
+#define TECTONIC_SCATTER_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <limits>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "model/Model.h"
+#include "Heightfield.h"
+#include "SplatMap.h"
+#include "HorizonCulling.h"
+#include "utils.h"
+#include "Logger.h"
+#include "meta/meta.h"
+
+/**
+ * Instances of models scattered over terrain patches by density rules over height, slope and texture layers.
+ * Instances of a patch are generated on demand once the patch comes into range of the camera and dropped once
+ * it leaves, the generation is seeded by the patch, so a patch coming back gets the same instances.
+ * Every frame the instances of visible patches are gathered into one stream, batched by model.
+ */
+class Scatter {
+public:
+    struct Layer {
+        std::shared_ptr<Model> model;
+        // Drawn instead of the model beyond the LOD distance, the model is used everywhere if null
+        std::shared_ptr<Model> lodModel;
+        float lodDistance = 40.0f;
+        // Instances are thinned out from the fade distance and gone at the maximum distance
+        float fadeDistance = 60.0f;
+        float maxDistance = 80.0f;
+
+        // Instances per square world unit where every rule is fully met
+        float density = 0.1f;
+        // World height range, faded out over the blend distance outside of it
+        float minHeight = -std::numeric_limits<float>::infinity();
+        float maxHeight = std::numeric_limits<float>::infinity();
+        float heightBlend = 1.0f;
+        // Steepest slope as one minus the up component of the normal
+        float maxSlope = 0.3f;
+        // Density is scaled by the splat weight of a terrain texture layer, negative ignores the layers
+        int32_t splatLayer = -1;
+
+        float minScale = 0.8f;
+        float maxScale = 1.2f;
+        // Instances lean with the surface normal instead of standing upright
+        bool alignToNormal = false;
+        uint32_t seed = 1;
+    };
+
+    /**
+     * Layout of one instance in the instance stream, rotation is a quaternion.
+     */
+    struct Instance {
+        glm::vec4 positionScale;
+        glm::vec4 rotation;
+    };
+
+    /**
+     * @brief Range of the instance stream drawn with a single model.
+     */
+    struct Batch {
+        const Model* model = nullptr;
+        uint32_t firstInstance = 0;
+        uint32_t instanceCount = 0;
+    };
+
+    /**
+     * @brief Replaces the layers, instances of every patch are generated again.
+     */
+    void setLayers(std::vector<Layer> layers);
+    [[nodiscard]] const std::vector<Layer>& getLayers() const { return m_layers; }
+
+    /**
+     * @brief Drops all instances and lays out patches of a new terrain.
+     * @param origin World XZ position of the first sample.
+     * @param spacing World distance between two neighbouring samples.
+     */
+    void reset(uint32_t patchesX, uint32_t patchesY, uint32_t patchSize, const glm::vec2& origin, float spacing);
+    void clear();
+
+    /**
+     * @brief Drops instances of a rectangle of patches, they are generated again from the current heights.
+     */
+    void invalidate(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY);
+
+    /**
+     * Patches entering the range of the farthest layer are generated in parallel, patches far outside of it are dropped.
+     *
+     * @brief Streams instances of patches around the camera.
+     * @param heightfield Heights the patches were laid out over.
+     * @param splat Texture layers of the terrain, used by layers with a splat layer.
+     */
+    void stream(const Heightfield& heightfield, const SplatMap::Settings& splat);
+
+    /**
+     * @brief Gathers instances of patches in view into the instance stream.
+     * @param horizon Culls patches behind the occluders if not null.
+     * @param occluders Terrain patches of this frame.
+     */
+    void collect(const Utils::FrustumCulling& frustum, HorizonCulling* horizon, const std::vector<HorizonCulling::Box>& occluders);
+
+    void setCameraPosition(const glm::vec3& position) { m_cameraPos = position; }
+
+    [[nodiscard]] const std::vector<Instance>& instances() const { return m_instances; }
+    [[nodiscard]] const std::vector<Batch>& batches() const { return m_batches; }
+    [[nodiscard]] bool empty() const { return m_layers.empty(); }
+
+    Slot<const glm::vec3&> slt_cameraPosition{[this](const glm::vec3& pos) { setCameraPosition(pos); }};
+
+private:
+    struct Patch {
+        // Instances of every layer in random order, any prefix is an even subset of the patch
+        std::vector<std::vector<Instance>> layers;
+        HorizonCulling::Box bounds{};
+        bool resident = false;
+    };
+
+    void generate(const Heightfield& heightfield, const SplatMap::Settings& splat, uint32_t patchIndex);
+    [[nodiscard]] float patchDistance(uint32_t patchIndex) const;
+
+    std::vector<Layer> m_layers;
+    // Distance of the farthest layer
+    float m_range = 0.0f;
+    glm::vec3 m_cameraPos{0.0f};
+
+    uint32_t m_patchesX = 0;
+    uint32_t m_patchesY = 0;
+    uint32_t m_patchSize = 0;
+    glm::vec2 m_origin{0.0f};
+    float m_spacing = 1.0f;
+    std::vector<Patch> m_patches;
+
+    std::vector<uint32_t> m_entering;
+    std::vector<uint32_t> m_inView;
+    std::vector<float> m_inViewDistance;
+    std::vector<HorizonCulling::Box> m_viewBounds;
+    std::vector<uint8_t> m_unoccluded;
+
+    std::vector<Instance> m_instances;
+    std::vector<Batch> m_batches;
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_SCATTER_H
@@ -0,0 +1,70 @@
+#ifndef TECTONIC_SPLATMAP_H
+#define TECTONIC_SPLATMAP_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "defs/ShaderDefines.h"
+#include "Heightfield.h"
+
+static_assert(MAX_TERRAIN_HEIGHT_TEXTURE == 4, "Splat weights of all texture layers are packed into one RGBA8 texel");
+
+/**
+ * Per sample weights of terrain texture layers, baked from height and slope.
+ * Weights of a sample sum up to one, one RGBA8 texel holds weights of all layers.
+ */
+class SplatMap {
+public:
+    struct Settings {
+        // Heights at which the layers are fully weighted, ascending.
+        // Layers blend linearly between neighbouring heights.
+        std::array<float, MAX_TERRAIN_HEIGHT_TEXTURE> heights{};
+        uint32_t layerCount = 0;
+
+        // Layer covering steep slopes regardless of height, negative disables it
+        int32_t slopeLayer = -1;
+        // Slope as one minus the up component of the normal, the slope layer fades in between start and end
+        float slopeStart = 0.4f;
+        float slopeEnd = 0.6f;
+    };
+
+    /**
+     * @brief Layers spread evenly over a height range, the same split the height blending always used.
+     */
+    static Settings evenHeights(uint32_t layerCount, float minHeight, float maxHeight);
+
+    /**
+     * @brief Weights of layers of a single sample.
+     * @param slope One minus the up component of the normal.
+     */
+    static void weights(const Settings& settings, float height, float slope, float* out);
+
+    /**
+     * @brief Bakes weights of the whole heightfield, rows are split between the threads of the pool.
+     * @param texels Output of 4 bytes per sample, row major.
+     */
+    static void bake(const Settings& settings, const Heightfield& heightfield, uint8_t* texels);
+
+    /**
+     * @brief Bakes weights of a rectangle of the heightfield on the calling thread.
+     * @param texels Output of 4 bytes per sample of the rectangle, row major.
+     */
+    static void bake(const Settings& settings, const Heightfield& heightfield, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint8_t* texels);
+
+    /**
+     * Normals are taken from central differences, samples on the border use their nearest neighbours.
+     *
+     * @brief Bakes weights of a rectangle of heights on the calling thread.
+     * @param width Amount of samples in a row.
+     * @param height Amount of rows.
+     * @param spacing Distance between neighbouring samples.
+     * @param texels Output of 4 bytes per sample, row major.
+     */
+    static void bake(const Settings& settings, const float* heights, uint32_t width, uint32_t height, float spacing, uint8_t* texels);
+
+private:
+    static void packWeights(const float* weights, uint8_t* texel);
+};
+
+#endif //TECTONIC_SPLATMAP_H
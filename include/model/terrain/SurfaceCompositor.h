@@ -0,0 +1,57 @@
+#ifndef TECTONIC_SURFACECOMPOSITOR_H
+#define TECTONIC_SURFACECOMPOSITOR_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Heightfield.h"
+#include "SplatMap.h"
+#include "model/texture/VirtualTexture.h"
+#include "exceptions.h"
+#include "Logger.h"
+
+/**
+ * Composites pages of a terrain virtual texture from the texture layers.
+ * Layer weights follow the splat map rules, but are evaluated per virtual texel from interpolated heights and normals,
+ * so layer transitions are unique and finer than the samples. Layers tile once per sample as in the splat shading.
+ * Layer images are kept in RAM with their mip chains.
+ */
+class SurfaceCompositor {
+public:
+    /**
+     * @brief Loads layer images, keeps them if the files didn't change. Throws textureException if an image can't be loaded.
+     */
+    void setLayers(const std::vector<std::string>& fileNames);
+    void clear();
+    [[nodiscard]] bool empty() const { return m_layers.empty(); }
+
+    /**
+     * @brief Composites one page and its border. Only reads, safe to call from several threads at once.
+     * @param span Samples covered by one side of the virtual texture.
+     * @param pages Pages per side of the finest level of the virtual texture.
+     * @param texels Output of VirtualTexture::SLOT_SIZE rows of RGBA8 texels.
+     */
+    void composite(const Heightfield& heightfield, const SplatMap::Settings& settings, float span, uint32_t pages,
+                   const VirtualTexture::Page& page, uint8_t* texels) const;
+
+private:
+    struct Image {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> texels;
+    };
+
+    /**
+     * @brief Halves an RGBA8 image by averaging 2x2 texels, the last row or column is repeated for odd sizes.
+     */
+    static Image downsample(const Image& image);
+
+    // Mip chain of every layer, full resolution first
+    std::vector<std::vector<Image>> m_layers;
+    std::vector<std::string> m_fileNames;
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_SURFACECOMPOSITOR_H
@@ -5,20 +5,34 @@
 #include <random>
 #include <limits>
 #include <utility>
+#include <future>
+#include <memory>
+#include <functional>
 
 #include "model/Model.h"
 #include "Transformation.h"
 #include "Logger.h"
 #include "LODManager.h"
+#include "Heightfield.h"
+#include "PatchIndices.h"
+#include "PatchQuadtree.h"
+#include "FractalNoise.h"
+#include "SplatMap.h"
+#include "NormalMap.h"
+#include "Erosion.h"
+#include "HeightTiles.h"
+#include "HorizonCulling.h"
+#include "Scatter.h"
+#include "SurfaceCompositor.h"
+#include "model/texture/TextureArray.h"
+#include "model/texture/VirtualTexture.h"
 
 class Terrain : public Model {
     friend class Renderer;
 public:
-    Terrain();
+    Terrain() = default;
     ~Terrain() = default;
 
-    void initMeta();
-
     /**
      * @brief Generates a flat terrain with given dimensions.
      * @param dimX Amount of vertices in X dimension.
@@ -29,20 +43,135 @@ public:
     void generateFlat(uint32_t dimX, uint32_t dimZ, const char* textureFile, const char* normalFile = nullptr);
 
     /**
-     * @brief Loads a heightmap from a file.
+     * First channel of 8 or 16-bit images is used, 16-bit images keep their full precision.
+     *
+     * @brief Loads a heightmap from an image file.
      * @param heightmapFile Heightmap file path.
      * @param textureFile Texture file path.
      */
     void loadHeightmap(const char* heightmapFile, const char* textureFile);
 
+    /**
+     * Format of headerless heightmap files, samples are row major.
+     */
+    enum class RawFormat : std::uint8_t {
+        R16,    // Unsigned 16-bit little endian samples
+        R32F    // 32-bit float samples
+    };
+
+    /**
+     * The file is memory-mapped and converted straight into the height store in parallel row bands,
+     * so loading doesn't keep a decoded copy of the file in RAM.
+     *
+     * @brief Loads a heightmap from a raw file.
+     * @param heightmapFile Heightmap file path.
+     * @param format Format of the samples.
+     * @param textureFile Texture file path.
+     * @param dimX Amount of samples in X dimension. Zero with zero dimY infers a square from the file size.
+     * @param dimY Amount of samples in Y dimension.
+     */
+    void loadRawHeightmap(const char* heightmapFile, RawFormat format, const char* textureFile, uint32_t dimX = 0, uint32_t dimY = 0);
+
+    /**
+     * The file is memory-mapped and only the compressed tiles are read, bands of tile rows are decoded
+     * straight into the height store in parallel.
+     *
+     * @brief Loads a heightmap from a file of compressed height tiles.
+     * @param tilesFile File written by saveHeightTiles or HeightTiles::save.
+     * @param textureFile Texture file path.
+     */
+    void loadHeightTiles(const char* tilesFile, const char* textureFile);
+
+    /**
+     * @brief Saves heights of the current terrain as compressed height tiles. Throws fileException if the file can't be written.
+     * @param tilesFile Target file path.
+     * @param tileSize Amount of samples per side of a tile.
+     * @param maxError Allowed error of a decoded height. Zero keeps full 16-bit precision per tile.
+     */
+    void saveHeightTiles(const char* tilesFile, uint32_t tileSize = 256, float maxError = 0.0f) const;
+
     /**
      * @brief Generates a terrain with midpoint algorithm.
      * @param size Terrain size dimension.
      * @param roughness Roughness factor.
      * @param textureFiles Vector of textures.
+     * @param seed Seed of the generator. Same seed and size always give the same terrain.
+     */
+    void generateMidpoint(uint32_t size, float roughness, const std::vector<std::string>& textureFiles, uint64_t seed);
+
+    /**
+     * @brief Generates a terrain with midpoint algorithm from a random seed.
      */
     void generateMidpoint(uint32_t size, float roughness, const std::vector<std::string>& textureFiles);
 
+    /**
+     * Generation runs on a worker thread, the current terrain keeps rendering until the result is uploaded by update.
+     * A new request drops the result of a build still in progress.
+     *
+     * @brief Generates a terrain with midpoint algorithm in the background.
+     * @param size Terrain size dimension.
+     * @param roughness Roughness factor.
+     * @param textureFiles Vector of textures.
+     * @param seed Seed of the generator.
+     */
+    void generateMidpointAsync(uint32_t size, float roughness, const std::vector<std::string>& textureFiles, uint64_t seed);
+    void generateMidpointAsync(uint32_t size, float roughness, const std::vector<std::string>& textureFiles);
+
+    /**
+     * Any size works without padding, rows are generated in parallel blocks.
+     *
+     * @brief Generates a terrain from fractal gradient noise.
+     * @param dimX Amount of vertices in X dimension.
+     * @param dimY Amount of vertices in Y dimension.
+     * @param settings Noise mode, seed and octave settings.
+     * @param textureFiles Vector of textures.
+     */
+    void generateNoise(uint32_t dimX, uint32_t dimY, const FractalNoise::Settings& settings, const std::vector<std::string>& textureFiles);
+
+    /**
+     * @brief Generates a terrain from fractal gradient noise in the background.
+     */
+    void generateNoiseAsync(uint32_t dimX, uint32_t dimY, const FractalNoise::Settings& settings, const std::vector<std::string>& textureFiles);
+
+    /**
+     * The cache holds heights, normals, patch bounds and errors, index lists and the quantized height texture.
+     * It is keyed by the generator parameters, seed and terrain settings, a cache of different ones is regenerated and overwritten.
+     *
+     * @brief Generates a midpoint terrain, or maps it from a cache file written by an earlier call with the same parameters.
+     * @param cacheFile Path of the cache file.
+     */
+    void generateMidpointCached(uint32_t size, float roughness, const std::vector<std::string>& textureFiles, uint64_t seed, const char* cacheFile);
+
+    /**
+     * @brief Generates a noise terrain, or maps it from a cache file written by an earlier call with the same parameters.
+     * @param cacheFile Path of the cache file.
+     */
+    void generateNoiseCached(uint32_t dimX, uint32_t dimY, const FractalNoise::Settings& settings, const std::vector<std::string>& textureFiles, const char* cacheFile);
+
+    /**
+     * Uploads at most the upload budget of a finished background build per call.
+     * Once everything is uploaded, the new terrain replaces the current one.
+     * Afterwards collects draw commands of patches to render, culled against the camera frustum if CULL_PATCHES is set.
+     * With GPU_LOD_CULLING set only uploads patch data, the renderer selects and culls patches in a compute pass.
+     * The flag is cleared if GL_ARB_indirect_parameters isn't supported.
+     * Has to be called from the thread owning the GL context, once per frame.
+     *
+     * @brief Progresses a background regeneration and refreshes visible patches.
+     * @return True if the terrain was swapped during this call.
+     */
+    bool update();
+
+    /**
+     * @brief Sets how many bytes of a background build are uploaded per update.
+     */
+    void setUploadBudget(std::size_t bytesPerFrame);
+    [[nodiscard]] bool isRegenerating() const;
+
+    /**
+     * @brief Seed of the last generated terrain.
+     */
+    [[nodiscard]] uint64_t getSeed() const { return m_seed; }
+
     void setMaxRange(float maxRange);
     void setMinRange(float minRange);
 
@@ -52,115 +181,404 @@ public:
      */
     void setMaxLOD(uint32_t maxLOD);
     void setCamera(Camera& camera);
+
+    /**
+     * @brief Sets the viewport height in pixels used for the screen-space error of patches.
+     */
+    void setViewportHeight(float height);
+
+    /**
+     * Instances are generated per patch around the camera and gathered every update from patches in view.
+     *
+     * @brief Sets models scattered over the terrain and their density rules.
+     */
+    void setScatterLayers(std::vector<Scatter::Layer> layers);
+
+    /**
+     * Pages are composited from the texture layers on the worker threads as fragments request them, the page cache
+     * keeps a fixed amount of GPU memory whatever the size of the terrain. Tiles and clipmaps keep blending the layers.
+     *
+     * @brief Textures whole terrains with a unique sparse virtual texture instead of the tiling layers.
+     * @param texelsPerSample Virtual texels between two neighbouring samples, zero disables virtual texturing.
+     * @param cacheSlots Pages per side of the page cache, at most 256.
+     */
+    void setVirtualTexture(uint32_t texelsPerSample, uint32_t cacheSlots = 16);
+
+    /**
+     * @brief Makes one texture layer cover steep slopes. Takes effect on the next generated or loaded terrain.
+     * @param layer Index of the layer, negative disables it.
+     * @param slopeStart Slope at which the layer starts to fade in, as one minus the up component of the normal.
+     * @param slopeEnd Slope at which the layer fully covers the terrain.
+     */
+    void setSlopeLayer(int32_t layer, float slopeStart, float slopeEnd);
+
+    /**
+     * Heights are eroded after they are mapped into the height range, before normals, patch bounds and LODs are built.
+     *
+     * @brief Sets the erosion stage of the build. Takes effect on the next generated or loaded terrain.
+     * @param settings Iteration budgets and solver constants, zero iterations disable the stage.
+     */
+    void setErosion(const Erosion::Settings& settings);
+    [[nodiscard]] const Erosion::Settings& getErosion() const { return m_erosionSettings; }
+
+    /**
+     * @brief Sets the maximum screen-space error of a patch in pixels. Higher values select coarser LODs.
+     */
+    void setPixelError(float pixels);
+
+    /**
+     * @brief Sets the screen-space length of a triangle edge the TESSELLATION mode aims for, in pixels.
+     */
+    void setTessellationEdge(float pixels);
     void setScale(float scale);
     float getScale();
 
+    /**
+     * Selects how the terrain geometry is fed to the GPU.
+     * VERTEX_BUFFER uploads one vertex per height sample.
+     * HEIGHT_TEXTURE uploads heights into a 16-bit texture and draws a single shared patch grid,
+     * positioned per patch by an instanced origin attribute.
+     * TESSELLATION uploads the same height texture and draws one quad patch per terrain patch, the tessellator
+     * subdivides it by the screen-space length of its edges, so there are no LOD index variants nor CPU LOD selection.
+     */
+    enum class RenderMode : std::uint8_t {
+        VERTEX_BUFFER,
+        HEIGHT_TEXTURE,
+        TESSELLATION
+    };
+
+    /**
+     * @brief Switches the render mode. Already buffered terrain is re-uploaded in the new mode.
+     * @param mode New render mode.
+     */
+    void setRenderMode(RenderMode mode);
+    [[nodiscard]] RenderMode getRenderMode() const { return m_renderMode; }
+
     [[nodiscard]] std::pair<float, float> getMinMaxHeight();
     [[nodiscard]] std::pair<uint32_t, uint32_t> getCenterCoords() const;
     float hMapLCoord(uint32_t x, uint32_t y);
     float hMapLCoord(std::pair<uint32_t, uint32_t> coords);
 
-    const glm::vec3& pMapWCoord(int32_t x, int32_t y);
+    glm::vec3 pMapWCoord(int32_t x, int32_t y);
     float hMapWCoord(int32_t x, int32_t y);
 
     float hMapBaryWCoord(float x, float y);
 
-    void clear() override;
+    /**
+     * Heights follow the rendered triangles. Positions outside of the terrain are clamped to its border.
+     *
+     * @brief Heights and normals at a span of world XZ positions.
+     * @param positions World X and Z coordinates.
+     * @param count Amount of positions.
+     * @param heights Output of count heights.
+     * @param normals Optional output of count normals.
+     */
+    void queryHeights(const glm::vec2* positions, std::size_t count, float* heights, glm::vec3* normals = nullptr) const;
 
-    void bindBlendingTextures();
-
-    using blendingTexturesArray_t = std::array<std::pair<float, std::shared_ptr<Texture>>, MAX_TERRAIN_HEIGHT_TEXTURE>;
-
-    class meshIterator {
-    public:
-        using iterator_category = std::input_iterator_tag;
-        using difference_type   = std::ptrdiff_t;
-        using value_type        = MeshInfo;
-        using pointer           = MeshInfo const*;
-        using reference         = MeshInfo const&;
-
-        std::function<value_type(uint32_t&, uint32_t&)> nextMesh;
-
-        explicit meshIterator(std::function<value_type(uint32_t&, uint32_t&)> func) : m_done(false), nextMesh(std::move(func)){
-            m_mesh = nextMesh(m_patchX, m_patchY);
-            if(m_patchX == 0 && m_patchY == 0)
-                m_done = true;
-        }
-
-        explicit operator bool() const { return !m_done; }
-
-        reference operator*() const { return m_mesh; }
-        pointer operator->() const { return &m_mesh; }
-
-        meshIterator& operator++(){
-            m_mesh = nextMesh(m_patchX, m_patchY);
-            if(m_patchX == 0 && m_patchY == 0)
-                m_done = true;
-            return *this;
-        }
-
-        meshIterator operator++(int){
-            auto tmp = *this;
-            ++(*this);
-            return tmp;
-        }
-
-        friend bool operator==(meshIterator const& lhs, meshIterator const& rhs){
-            return (lhs.m_done && rhs.m_done);
-        }
-
-        friend bool operator!=(meshIterator const& lhs, meshIterator const& rhs){
-            return (!lhs.m_done || !rhs.m_done);
-        }
-
-        meshIterator(meshIterator&&) = default;
-        meshIterator(meshIterator const&) = default;
-        meshIterator& operator=(meshIterator &&) = default;
-        meshIterator& operator=(meshIterator const&) = default;
-        meshIterator() = delete;
-
-    private:
-        bool m_done;
-        value_type m_mesh{};
-        uint32_t m_patchX = 0;
-        uint32_t m_patchY = 0;
+    struct RayHit {
+        glm::vec3 position{0.0f};
+        glm::vec3 normal{0.0f, 1.0f, 0.0f};
+        float distance = 0.0f;
     };
 
-    meshIterator meshIter();
+    /**
+     * Walks the min/max quadtree of patches front to back and tests triangles only inside of patches the ray enters.
+     *
+     * @brief Finds the nearest intersection of a ray with the terrain surface.
+     * @param origin Origin of the ray.
+     * @param direction Direction of the ray.
+     * @param hit Filled with the intersection if there is one.
+     * @param maxDistance Maximal distance along the ray.
+     * @return True if the ray hits the terrain.
+     */
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit, float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+    /**
+     * Normals are recomputed inside of the rectangle and a one sample border, patch bounds and errors only for patches touching it.
+     * GPU data is refreshed with sub-uploads of the changed rows, so the cost follows the size of the edit, not of the terrain.
+     * Edits apply to the current terrain, a background build still in progress replaces them once it's swapped in.
+     *
+     * @brief Edits heights of a rectangle of samples.
+     * @param x First column of the rectangle.
+     * @param y First row of the rectangle.
+     * @param width Amount of columns.
+     * @param height Amount of rows.
+     * @param edit Called with coordinates and the current height of every sample of the rectangle, returns the new height.
+     */
+    void editHeights(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const std::function<float(uint32_t x, uint32_t y, float height)>& edit);
+
+    /**
+     * @brief Raises the terrain around a world XZ position with a smooth falloff. Negative amount digs a crater.
+     */
+    void raise(const glm::vec2& center, float radius, float amount);
+
+    /**
+     * @brief Pulls the terrain around a world XZ position towards a height, fully flat inside of half the radius.
+     */
+    void flatten(const glm::vec2& center, float radius, float targetHeight);
+
+    void bufferMeshes() override;
+    void eraseBuffers() override;
+    void clear() override;
+
+    /**
+     * Vertex buffer mode selects the patch by the base vertex, height texture mode by the base instance.
+     *
+     * @brief Draw commands of patches to render this frame, refreshed by update.
+     */
+    [[nodiscard]] const std::vector<DrawElementsIndirectCommand>& drawCommands() const { return m_drawCommands; }
+
+    /**
+     * With HORIZON_CULLING set, patches hidden behind nearer terrain are dropped from the draw commands.
+     * Filled by update only on the CPU culling path.
+     *
+     * @brief Boxes of patches inside of the frustum this frame, usable as occluders of scene objects.
+     */
+    [[nodiscard]] const std::vector<HorizonCulling::Box>& horizonOccluders() const { return m_occluders; }
 
     enum class Flags : std::uint8_t{
         SET_NEAREST_SIZE,
         CULL_PATCHES,
+        GPU_LOD_CULLING,
+        HORIZON_CULLING,
         SIZE
     };
 
     Utils::Flags<Flags> flags;
 
 private:
-    void generateFlatPlane();
-    [[nodiscard]] inline std::pair<uint32_t,uint32_t> i2xy(uint32_t i) const { return {i % m_dimX, i / m_dimY}; }
+    struct BuildData;
+
+    [[nodiscard]] std::unique_ptr<BuildData> createBuild() const;
+    void commitBuild(std::unique_ptr<BuildData> data);
+    void cancelBuild();
+    uint64_t randomSeed();
+
+    static void preparePlane(BuildData& data);
+
+    /**
+     * Source smaller than the terrain, after SET_NEAREST_SIZE rounding, repeats its last row and column.
+     *
+     * @brief Converts source samples into heights of a prepared plane in parallel row bands.
+     * @param samples Row major source samples.
+     * @param srcDimX Amount of source samples in X dimension.
+     * @param srcDimY Amount of source samples in Y dimension.
+     * @param scale Multiplier of every sample.
+     */
+    template<typename Sample_t>
+    static void importHeights(BuildData& data, const Sample_t* samples, uint32_t srcDimX, uint32_t srcDimY, float scale);
+
+    /**
+     * @brief Finishes a loaded heightmap build and replaces the current terrain with it.
+     */
+    void commitHeightmap(std::unique_ptr<BuildData> data, const char* textureFile);
+    static void buildMidpoint(BuildData& data, float roughness);
+    static void buildNoise(BuildData& data, const FractalNoise::Settings& settings);
+    /**
+     * @brief Calculates per patch data, geometric error of every LOD and the min/max quadtree for culling.
+     */
+    static void calcPatchData(BuildData& data);
+
+    /**
+     * @brief Geometric error of a patch rendered at every LOD.
+     * @param errors Output of maxLOD+1 values.
+     */
+    static void calcPatchErrors(const Heightfield& heightfield, uint32_t patchSize, uint32_t maxLOD, uint32_t patchX, uint32_t patchY, float* errors);
+    static void prepareUploadStreams(BuildData& data);
+    static void quantizeHeights(const Heightfield& heightfield, float minHeight, float maxHeight, uint16_t* texels);
+
+    /**
+     * @brief Quantizes a rectangle of heights on the calling thread.
+     * @param texels Output of a value per sample of the rectangle, row major.
+     */
+    static void quantizeHeights(const Heightfield& heightfield, float minHeight, float maxHeight, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* texels);
+
+    /**
+     * @brief Hash of terrain settings captured by a build, shared part of every cache key.
+     */
+    [[nodiscard]] uint64_t settingsHash() const;
+
+    /**
+     * Heights and normals are copied into the heightfield, the height texture is uploaded straight from the mapped file.
+     * The header has to match the LOD settings of the terrain and every section is validated before it is read.
+     *
+     * @brief Replaces the terrain with the content of a cache file.
+     * @return False if the file doesn't exist, is damaged or was written with a different key.
+     */
+    bool loadCache(const char* cacheFile, uint64_t key, const std::vector<std::string>& textureFiles);
+
+    /**
+     * @brief Writes the current terrain into a cache file.
+     */
+    void saveCache(const char* cacheFile, uint64_t key) const;
+
+    bool progressStagedBuild();
+    void createStagingResources();
+    void eraseStagingResources();
+    void uploadStagedRows();
+    [[nodiscard]] static uint32_t stagedRowCount(const BuildData& data);
+    void swapStaged();
+
+    [[nodiscard]] inline std::pair<uint32_t,uint32_t> i2xy(uint32_t i) const { return {i % m_dimX, i / m_dimX}; }
     [[nodiscard]] inline uint32_t xy2i(uint32_t x, uint32_t y) const { return (y*m_dimX)+x; }
 
     float& hMapAt(uint32_t x, uint32_t y);
     float& hMapAt(uint32_t i);
 
-    glm::vec3& pMapAt(uint32_t x, uint32_t y);
-    glm::vec3& pMapAt(uint32_t i);
+    glm::vec3 pMapAt(uint32_t x, uint32_t y);
+    glm::vec3 pMapAt(uint32_t i);
+
+    void bufferVertices();
+    static void setVertexLayout();
+    /**
+     * @brief Buffers the shared grid of one patch, only its four corners in TESSELLATION mode.
+     */
+    void bufferPatchGrid();
+    /**
+     * @param texels Already quantized heights, quantized from the heightfield if null.
+     */
+    void uploadHeightTexture(const uint16_t* texels = nullptr);
+    static void createHeightTexture(GLuint& texture, GLuint64& handle, uint32_t dimX, uint32_t dimY);
+    void eraseHeightTexture();
+
+    /**
+     * @brief Bakes layer weights of the current heightfield and uploads them. Keeps the texture if the size didn't change.
+     */
+    void bufferSplatMap();
+    void eraseSplatMap();
+
+    /**
+     * @brief Bakes normals of the full resolution heightfield and uploads them. Keeps the texture if the size didn't change.
+     */
+    void bufferNormalMap();
+
+    /**
+     * @brief Lays out the virtual texture over the heightfield, or erases it if it's disabled or there are no layers.
+     */
+    void bufferVirtualTexture();
+    void eraseNormalMap();
+
+    /**
+     * @brief Creates a linearly filtered per sample texture and makes its handle resident.
+     */
+    static void createSampleTexture(GLuint& texture, GLuint64& handle, GLenum format, uint32_t dimX, uint32_t dimY, const char* name);
+
+    /**
+     * @brief Finds the height bounds, normalizes heights into the min and max range and calculates normals.
+     */
+    static void postProcess(BuildData& data);
+
+    /**
+     * @brief Loads texture layers and spreads them evenly over the height range.
+     */
+    void setLayerTextures(const std::vector<std::string>& textureFiles);
+
+    /**
+     * Grid is a square of gridSize^2 samples where gridSize is 2^n + 1.
+     * Every row of a pass is independent, rows are split between the threads of the pool.
+     */
+    static void diamondStep(float* grid, uint32_t gridSize, uint32_t rectSize, float currHeight, uint64_t seed, uint32_t level);
+    static void squareStep(float* grid, uint32_t gridSize, uint32_t rectSize, float currHeight, uint64_t seed, uint32_t level);
+
+    void collectDrawCommands();
+
+    /**
+     * @brief Streams scattered instances around the camera and uploads those of patches in view.
+     */
+    void updateScatter();
+
+    /**
+     * @brief Drops visible patches hidden behind nearer patches, keeps boxes of all of them as occluders.
+     */
+    void cullBehindHorizon();
+
+    /**
+     * @brief Intersects a ray with triangles of one patch, cell by cell along the ray.
+     */
+    bool raycastPatch(const glm::vec3& origin, const glm::vec3& direction, uint32_t patchX, uint32_t patchY, float tEnter, float tExit, RayHit& hit) const;
+
+    /**
+     * @brief World XZ position of the first height sample.
+     */
+    [[nodiscard]] glm::vec2 gridOrigin() const;
+
+    /**
+     * @brief Rectangle of samples covered by a circular brush, clamped to the terrain.
+     * @return False if the brush misses the terrain.
+     */
+    bool brushRect(const glm::vec2& center, float radius, uint32_t& x, uint32_t& y, uint32_t& width, uint32_t& height) const;
+
+    /**
+     * @brief Range of patches holding a rectangle of samples, inclusive.
+     * @return False if no patch holds any of the samples.
+     */
+    bool patchesOfRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& firstX, uint32_t& firstY, uint32_t& lastX, uint32_t& lastY) const;
+
+    /**
+     * @brief Refreshes bounds and errors of patches touching a rectangle of edited samples, on the CPU and in the culling buffers.
+     */
+    void refreshPatches(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    /**
+     * @brief Uploads changed rows of edited samples into the vertex buffer or the height texture.
+     * @param fullHeightTexture Requantizes the whole height texture, the height range changed.
+     */
+    void uploadEditedHeights(uint32_t x, uint32_t y, uint32_t width, uint32_t height, bool fullHeightTexture);
+
+    /**
+     * @brief Rebakes a rectangle of the normal and splat maps.
+     */
+    void uploadEditedMaps(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    /**
+     * @brief Uploads patch bounds, errors and index ranges read by the culling compute pass.
+     */
+    void bufferCullingData();
+    void eraseCullingBuffers();
 
-    void createPatchIndices();
-    void createPatchIndicesLOD(uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom);
-    void createFan(uint32_t x, uint32_t y, uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom);
-    void createTriangle(uint32_t i0, uint32_t i1, uint32_t i2);
-    void normalize();
-    void calcMinMax();
-    void calcNormals();
+    /**
+     * Vertex layout uploaded to the GPU. Filled from the heightfield by fillPatchVertices in bufferVertices and, for staged
+     * uploads, in prepareUploadStreams on a worker thread. Edits refill only changed rows with fillPatchRows in uploadEditedHeights.
+     * Sample coordinates are derived from the position and normals come from the normal map.
+     */
+    struct GPUVertex {
+        glm::vec3 position;
+    };
 
-    void addBlendTexture(float height, const std::shared_ptr<Texture>& texture);
+    /**
+     * @brief Lays out vertices patch after patch, so indices of one patch stay patch local.
+     */
+    static void fillPatchVertices(const Heightfield& heightfield, uint32_t patchSize, uint32_t patchesX, uint32_t patchesY, float worldScale, GPUVertex* vertices);
 
-    void diamondStep(uint32_t rectSize, float currHeight);
-    void squareStep(uint32_t rectSize, float currHeight);
+    /**
+     * @brief Fills a range of rows of one patch.
+     * @param firstRow First row inside of the patch.
+     * @param endRow Row after the last one.
+     * @param vertices Output of (endRow-firstRow)*patchSize vertices.
+     */
+    static void fillPatchRows(const Heightfield& heightfield, uint32_t patchSize, uint32_t patchX, uint32_t patchY, uint32_t firstRow, uint32_t endRow, float worldScale, GPUVertex* vertices);
 
-    bool isPatchInsideFrustum(uint32_t x, uint32_t y);
+    Heightfield m_heightfield;
+
+    RenderMode m_renderMode = RenderMode::VERTEX_BUFFER;
+
+    enum GRID_BUFFER_TYPE {
+        GRID_INDEX_BUFFER = 0,
+        GRID_VB           = 1,
+        GRID_ORIGIN_VB    = 2,
+        NUM_GRID_BUFFERS  = 3
+    };
+
+    GLuint m_gridVAO = -1;
+    GLuint m_gridBuffers[NUM_GRID_BUFFERS] = {0};
+    uint32_t m_gridPatchSize = 0;
+    uint32_t m_gridPatchesX = 0;
+    uint32_t m_gridPatchesY = 0;
+
+    GLuint m_heightTexture = -1;
+    GLuint64 m_heightTextureHandle = 0;
+    uint32_t m_heightTextureDimX = 0;
+    uint32_t m_heightTextureDimY = 0;
 
     float m_worldScale = 1.0f;
 
@@ -175,130 +593,112 @@ private:
 
     float m_minRange = 0.0f;
     float m_maxRange = 50.0f;
-
-    blendingTexturesArray_t m_blendingTextures;
-    decltype(MAX_TERRAIN_HEIGHT_TEXTURE) m_blendingTexturesCount = 0;
+    float m_tessellationEdge = 8.0f;
+
+    Erosion::Settings m_erosionSettings;
+
+    // Blended texture layers and their weights per sample
+    std::shared_ptr<TextureArray> m_layerTextures;
+    SplatMap::Settings m_splatSettings;
+    GLuint m_splatTexture = -1;
+    GLuint64 m_splatTextureHandle = 0;
+    uint32_t m_splatTextureDimX = 0;
+    uint32_t m_splatTextureDimY = 0;
+
+    // Octahedral normals of every sample, shading doesn't depend on the LOD of the geometry
+    GLuint m_normalTexture = -1;
+    GLuint64 m_normalTextureHandle = 0;
+    uint32_t m_normalTextureDimX = 0;
+    uint32_t m_normalTextureDimY = 0;
+
+    // Unique surface texture of whole terrains, composited from the layers
+    VirtualTexture m_virtualTexture;
+    SurfaceCompositor m_surfaceCompositor;
+    std::vector<std::string> m_layerFiles;
+    uint32_t m_virtualTexelsPerSample = 0;
+    uint32_t m_virtualCacheSlots = 16;
+    float m_virtualSpan = 0.0f;
 
     uint32_t m_maxLOD = 0;
     uint32_t m_patchSize = 0;
 
-    constexpr static uint8_t LEFT = 2;
-    constexpr static uint8_t RIGHT = 2;
-    constexpr static uint8_t TOP = 2;
-    constexpr static uint8_t BOTTOM = 2;
-
-    struct singleLODInfo {
-        uint32_t start = 0;
-        uint32_t count = 0;
-    };
-    struct LODInfo {
-        singleLODInfo info[LEFT][RIGHT][TOP][BOTTOM];
-    };
-    std::vector<LODInfo> m_lodInfo;
+    PatchIndices m_patchIndices;
+    PatchQuadtree m_quadtree;
     LODManager m_lodManager;
 
-    std::function<MeshInfo(uint32_t&, uint32_t&)> m_meshFunc = {[this](uint32_t& patchX, uint32_t& patchY){
-
-        if (patchY >= m_patchesY) {
-            patchX = 0;
-            patchY = 0;
-            return MeshInfo();
-        }
-
-        const LODManager::patchLOD& pLOD = m_lodManager.getPatchLOD(patchX, patchY);
-        uint32_t C = pLOD.core;
-        uint32_t L = pLOD.left;
-        uint32_t R = pLOD.right;
-        uint32_t T = pLOD.top;
-        uint32_t B = pLOD.bottom;
-
-        uint32_t baseIndex = m_lodInfo.at(C).info[L][R][T][B].start;
-
-        uint32_t x = patchX * (m_patchSize-1);
-        uint32_t y = patchY * (m_patchSize-1);
-        uint32_t baseVertex = y * m_dimX + x;
-
-        MeshInfo meshInfo;
-        meshInfo.indicesCount = m_lodInfo.at(C).info[L][R][T][B].count;
-        meshInfo.verticesOffset = baseVertex;
-        meshInfo.indicesOffset = baseIndex;
-        meshInfo.matIndex = 0;
+    /**
+     * CPU side of a generated terrain. Built without touching the live terrain,
+     * so it can be produced on a worker thread while the current terrain keeps rendering.
+     */
+    struct BuildData {
+        // Settings captured when the build was requested
+        uint32_t maxLOD = 0;
+        uint32_t patchSize = 0;
+        float worldScale = 1.0f;
+        float minRange = 0.0f;
+        float maxRange = 0.0f;
+        Erosion::Settings erosion;
+        bool setNearestSize = false;
+        RenderMode renderMode = RenderMode::VERTEX_BUFFER;
+        std::vector<std::string> textureFiles;
+
+        uint64_t seed = 0;
+        uint32_t dimX = 0;
+        uint32_t dimY = 0;
+        uint32_t patchesX = 0;
+        uint32_t patchesY = 0;
+        float minHeight = 0.0f;
+        float maxHeight = 0.0f;
+
+        Heightfield heightfield;
+        PatchIndices patchIndices;
+        PatchQuadtree quadtree;
+        // Geometric error of every patch at every LOD, maxLOD+1 values per patch
+        std::vector<float> patchErrors;
+
+        // Streams in GPU format, filled only for staged uploads
+        std::vector<GPUVertex> vertices;
+        std::vector<uint16_t> heightTexels;
+    };
 
-        patchX++;
-        if (patchX == m_patchesX) {
-            patchY++;
-            patchX = 0;
-        }
+    std::future<std::unique_ptr<BuildData>> m_pendingBuild;
+    std::unique_ptr<BuildData> m_stagedBuild;
+    uint32_t m_stagedRows = 0;
+    std::size_t m_uploadBudget = 8 * 1024 * 1024;
 
-        return meshInfo;
-    }};
+    GLuint m_stagedVAO = -1;
+    GLuint m_stagedBuffers[NUM_BUFFERS] = {0};
+    GLuint m_stagedTexture = -1;
+    GLuint64 m_stagedTextureHandle = 0;
 
     Utils::FrustumCulling m_frustumCulling = Utils::FrustumCulling(0.1);
 
-    Slot<Flags, bool> slt_flagChange {[this](Flags flag, bool state){
-        switch(flag){
-            case Flags::CULL_PATCHES:
-                if(state){
-                    m_meshFunc = {[this](uint32_t& patchX, uint32_t& patchY){
-                        if (patchY >= m_patchesY) {
-                            patchX = 0;
-                            patchY = 0;
-                            return MeshInfo();
-                        }
-                        const LODManager::patchLOD& pLOD = m_lodManager.getPatchLOD(patchX, patchY);
-                        uint32_t C = pLOD.core;
-                        uint32_t L = pLOD.left;
-                        uint32_t R = pLOD.right;
-                        uint32_t T = pLOD.top;
-                        uint32_t B = pLOD.bottom;
-                        MeshInfo meshInfo;
-                        meshInfo.indicesCount = m_lodInfo.at(C).info[L][R][T][B].count;
-                        meshInfo.verticesOffset = (patchY * (m_patchSize-1)) * m_dimX + (patchX * (m_patchSize-1));
-                        meshInfo.indicesOffset = m_lodInfo.at(C).info[L][R][T][B].start;
-                        meshInfo.matIndex = 0;
-                        do {
-                            patchX++;
-                            if (patchX == m_patchesX) {
-                                patchY++;
-                                patchX = 0;
-                            }
-                            if (patchY == m_patchesY) break;
-
-                        }while(!isPatchInsideFrustum(patchX, patchY));
-                        return meshInfo;
-                    }};
-                }else{
-                    m_meshFunc = {[this](uint32_t& patchX, uint32_t& patchY){
-                        if (patchY >= m_patchesY) {
-                            patchX = 0;
-                            patchY = 0;
-                            return MeshInfo();
-                        }
-                        const LODManager::patchLOD& pLOD = m_lodManager.getPatchLOD(patchX, patchY);
-                        uint32_t C = pLOD.core;
-                        uint32_t L = pLOD.left;
-                        uint32_t R = pLOD.right;
-                        uint32_t T = pLOD.top;
-                        uint32_t B = pLOD.bottom;
-                        MeshInfo meshInfo;
-                        meshInfo.indicesCount = m_lodInfo.at(C).info[L][R][T][B].count;
-                        meshInfo.verticesOffset = (patchY * (m_patchSize-1)) * m_dimX + (patchX * (m_patchSize-1));
-                        meshInfo.indicesOffset = m_lodInfo.at(C).info[L][R][T][B].start;
-                        meshInfo.matIndex = 0;
-                        patchX++;
-                        if (patchX == m_patchesX) {
-                            patchY++;
-                            patchX = 0;
-                        }
-                        return meshInfo;
-                    }};
-                }
-                break;
-            default: break;
-        }
-    }};
+    // Reused every frame, capacity only grows
+    std::vector<uint32_t> m_visiblePatches;
+
+    HorizonCulling m_horizonCulling;
+    std::vector<HorizonCulling::Box> m_occluders;
+    std::vector<uint8_t> m_unoccludedPatches;
+    std::vector<DrawElementsIndirectCommand> m_drawCommands;
+    GLuint m_drawCommandBuffer = -1;
+
+    Scatter m_scatter;
+    GLuint m_scatterBuffer = -1;
+
+    enum CULL_BUFFER_TYPE {
+        CULL_BOUNDS_BUFFER   = 0,
+        CULL_ERRORS_BUFFER   = 1,
+        CULL_VARIANTS_BUFFER = 2,
+        CULL_COMMAND_BUFFER  = 3,
+        CULL_COUNT_BUFFER    = 4,
+        NUM_CULL_BUFFERS     = 5
+    };
+
+    // Written by the culling compute pass, sized for every patch of the terrain
+    GLuint m_cullBuffers[NUM_CULL_BUFFERS] = {0};
 
     std::random_device m_randDevice;
+    uint64_t m_seed = 0;
     static Logger m_logger;
 };
 
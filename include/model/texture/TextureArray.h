@@ -0,0 +1,48 @@
+#ifndef TECTONIC_TEXTUREARRAY_H
+#define TECTONIC_TEXTUREARRAY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+
+#include "extern/glad/glad.h"
+#include "exceptions.h"
+#include "Logger.h"
+
+/**
+ * Set of images stored as layers of one GL_TEXTURE_2D_ARRAY.
+ * All layers share the size of the first image, other images are resampled to it.
+ */
+class TextureArray {
+public:
+    explicit TextureArray(const std::vector<std::string>& fileNames);
+    ~TextureArray();
+
+    TextureArray(const TextureArray&) = delete;
+    TextureArray& operator=(const TextureArray&) = delete;
+
+    /**
+     * @brief Loads the array, or returns an already loaded array of the same files in the same order.
+     */
+    static std::shared_ptr<TextureArray> createTextureArray(const std::vector<std::string>& fileNames);
+
+    [[nodiscard]] GLuint64 getHandle() const { return m_bindlessHandle; }
+    [[nodiscard]] uint32_t layerCount() const { return static_cast<uint32_t>(m_fileNames.size()); }
+
+private:
+    /**
+     * @brief Bilinearly resamples an RGBA8 image.
+     */
+    static std::vector<u_char> resample(const u_char* data, int32_t width, int32_t height, int32_t targetWidth, int32_t targetHeight);
+
+    static std::unordered_map<std::string, std::shared_ptr<TextureArray>> m_loadedArrays;
+
+    std::vector<std::string> m_fileNames;
+    GLuint m_texObject = -1;
+    GLuint64 m_bindlessHandle = 0;
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_TEXTUREARRAY_H
@@ -0,0 +1,160 @@
+#ifndef TECTONIC_VIRTUALTEXTURE_H
+#define TECTONIC_VIRTUALTEXTURE_H
+
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <glm/vec2.hpp>
+
+#include "extern/glad/glad.h"
+#include "defs/ShaderDefines.h"
+#include "exceptions.h"
+#include "Logger.h"
+
+/**
+ * Sparse virtual texture backed by a fixed page cache.
+ * The virtual texture is a square of pages with a mip chain down to a single page. Fragments write the pages they
+ * want into a feedback buffer, requested pages are produced by a page source on the worker threads and uploaded into
+ * free or least recently used slots of the cache. An indirection texture maps every page onto its slot, or onto the
+ * slot of its nearest resident ancestor, so a missing page is shown blurred until it arrives.
+ */
+class VirtualTexture {
+public:
+    struct Page {
+        uint32_t level = 0;
+        uint32_t x = 0;
+        uint32_t y = 0;
+    };
+
+    // Texels per side of one cache slot, the page and its border
+    static constexpr uint32_t SLOT_SIZE = VIRTUAL_PAGE_SIZE + 2*VIRTUAL_PAGE_BORDER;
+
+    /**
+     * @brief Fills SLOT_SIZE*SLOT_SIZE RGBA8 texels of a page, border included. Called from several threads at once.
+     */
+    using PageSource = std::function<void(const Page& page, uint8_t* texels)>;
+
+    VirtualTexture() = default;
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    /**
+     * @brief Creates the cache, the indirection texture and the feedback buffers. Drops all resident pages.
+     * @param pages Pages per side at the finest level, a power of two.
+     * @param cacheSlots Slots per side of the page cache, at most 256.
+     * @param source Producer of page texels.
+     */
+    void init(uint32_t pages, uint32_t cacheSlots, PageSource source);
+    void erase();
+    [[nodiscard]] bool empty() const { return m_cacheTexture == -1; }
+
+    /**
+     * Waits for the feedback buffer written FEEDBACK_FRAMES frames ago, which is long done, and queues the pages it requested.
+     * Up to the page budget of queued pages are produced in parallel and uploaded, coarser levels first.
+     *
+     * @brief Streams pages for the frame about to be drawn. Called once per frame before the draws writing feedback.
+     */
+    void update();
+
+    /**
+     * @brief Fences the feedback written by this frame's draws.
+     */
+    void endFrame();
+
+    /**
+     * @brief Produces resident pages overlapping a rectangle again, they keep their slots until then.
+     * @param min Lower corner in virtual texture coordinates.
+     * @param max Upper corner in virtual texture coordinates.
+     */
+    void invalidate(const glm::vec2& min, const glm::vec2& max);
+
+    /**
+     * @brief Sets how many pages are produced per frame.
+     */
+    void setPageBudget(uint32_t pages) { m_pageBudget = std::max(pages, 1u); }
+
+    [[nodiscard]] GLuint64 getCacheHandle() const { return m_cacheHandle; }
+    [[nodiscard]] GLuint64 getIndirectionHandle() const { return m_indirectionHandle; }
+    [[nodiscard]] uint32_t pages() const { return m_pages; }
+    [[nodiscard]] uint32_t levels() const { return m_levels; }
+    [[nodiscard]] uint32_t cacheSlots() const { return m_cacheSlots; }
+
+    /**
+     * @brief Storage buffer this frame's fragments write requests into, one word per page of every level.
+     */
+    [[nodiscard]] GLuint getFeedbackBuffer() const { return m_feedback[m_frame % FEEDBACK_FRAMES].buffer; }
+
+    /**
+     * @brief Pixel of every feedback square writing requests this frame, rotated so all pixels are covered over time.
+     */
+    [[nodiscard]] glm::ivec2 feedbackOffset() const;
+
+private:
+    static constexpr uint32_t FEEDBACK_FRAMES = 3;
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    static constexpr uint32_t NO_PAGE = UINT32_MAX;
+
+    struct Slot {
+        uint32_t page = NO_PAGE;
+        uint64_t lastUsed = 0;
+    };
+
+    struct Feedback {
+        GLuint buffer = -1;
+        uint32_t* requests = nullptr;
+        GLsync fence = nullptr;
+    };
+
+    [[nodiscard]] uint32_t pageIndex(uint32_t level, uint32_t x, uint32_t y) const { return m_levelOffsets[level] + y * (m_pages >> level) + x; }
+    [[nodiscard]] Page pageAt(uint32_t index) const;
+
+    void readFeedback(Feedback& feedback);
+
+    /**
+     * @brief Marks the page and its ancestors as used this frame and queues those that aren't resident.
+     */
+    void touch(uint32_t index);
+
+    /**
+     * @brief Finds a free slot or evicts the least recently used page not used this frame.
+     */
+    uint32_t acquireSlot();
+    void produce();
+    void rebuildIndirection();
+
+    PageSource m_source;
+    uint32_t m_pages = 0;
+    uint32_t m_levels = 0;
+    uint32_t m_cacheSlots = 0;
+    uint32_t m_pageBudget = 16;
+    uint64_t m_frame = 0;
+
+    // First page of every level in the page tables and the feedback buffers
+    std::vector<uint32_t> m_levelOffsets;
+    uint32_t m_pageCount = 0;
+    std::vector<uint32_t> m_pageSlots;
+    std::vector<uint8_t> m_queued;
+    std::vector<uint8_t> m_stale;
+    std::vector<uint32_t> m_queue;
+    std::vector<uint32_t> m_refresh;
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    std::vector<uint8_t> m_staging;
+    // RGBA8 entries of every level: cache slot, level of the page in the slot and a resident flag
+    std::vector<uint8_t> m_indirection;
+    bool m_indirectionDirty = false;
+
+    GLuint m_cacheTexture = -1;
+    GLuint64 m_cacheHandle = 0;
+    GLuint m_indirectionTexture = -1;
+    GLuint64 m_indirectionHandle = 0;
+    Feedback m_feedback[FEEDBACK_FRAMES];
+
+    static Logger m_logger;
+};
+
+#endif //TECTONIC_VIRTUALTEXTURE_H
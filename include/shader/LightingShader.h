@@ -138,6 +138,11 @@ public:
     void setSpotLights(GLint num_lights, const std::array<SpotLight, MAX_SPOT_LIGHTS>& light) const;
     void setColorMod(const glm::vec4& clr) const;
 
+    /**
+     * @brief Places vertices by the instance attributes of scattered instances. Basic shader only.
+     */
+    void setInstanced(bool instanced) const;
+
 private:
 
     // Position of gameCamera in world space
@@ -208,6 +213,7 @@ private:
     uint32_t loc_numSpotLights = -1;
 
     uint32_t loc_colorMod = -1;
+    uint32_t loc_instanced = -1;
 
     // Array of bones inside the scene
     uint32_t loc_boneMatrixArray{};
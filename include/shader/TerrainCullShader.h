@@ -0,0 +1,59 @@
+#ifndef TECTONIC_TERRAINCULLSHADER_H
+#define TECTONIC_TERRAINCULLSHADER_H
+
+#include <glm/ext/matrix_float4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "defs/ConfigDefs.h"
+
+/**
+ * Compute pass selecting LOD of terrain patches and culling them against the frustum.
+ * Writes draw commands of visible patches and their amount for an indirect count draw.
+ */
+class TerrainCullShader : public Shader {
+public:
+    TerrainCullShader() : Shader(ShaderType::BASIC_SHADER){}
+    void init() override;
+
+    void setVP(const glm::mat4& vp) const;
+    void setFrustumBias(float bias) const;
+    void setCameraPosition(const glm::vec3& position) const;
+
+    /**
+     * @brief Sets the distance per unit of geometric error at which a LOD reaches the pixel error.
+     */
+    void setErrorScale(float scale) const;
+
+    /**
+     * @brief Sets the layout of the patch grid.
+     * @param gridOrigin World XZ coordinates of the minimal corner of the first patch.
+     * @param patchWorldSize Size of one patch side in world units.
+     */
+    void setPatchGrid(uint32_t patchesX, uint32_t patchesY, uint32_t patchSize, uint32_t maxLOD, const glm::vec2& gridOrigin, float patchWorldSize) const;
+
+    /**
+     * @brief Selects patches by the base instance instead of the base vertex.
+     */
+    void setInstanced(bool instanced) const;
+
+    /**
+     * @brief Emits a single quad patch per visible patch instead of a LOD variant.
+     */
+    void setTessellated(bool tessellated) const;
+
+private:
+    uint32_t loc_VP = -1;
+    uint32_t loc_frustumBias = -1;
+    uint32_t loc_cameraPosition = -1;
+    uint32_t loc_errorScale = -1;
+    uint32_t loc_patchCount = -1;
+    uint32_t loc_patchSize = -1;
+    uint32_t loc_maxLOD = -1;
+    uint32_t loc_gridOrigin = -1;
+    uint32_t loc_patchWorldSize = -1;
+    uint32_t loc_instanced = -1;
+    uint32_t loc_tessellated = -1;
+};
+
+#endif //TECTONIC_TERRAINCULLSHADER_H
@@ -9,29 +9,112 @@
 #include "defs/ConfigDefs.h"
 #include "model/Material.h"
 #include "model/terrain/Terrain.h"
+#include "model/texture/TextureArray.h"
+#include "model/texture/VirtualTexture.h"
 
 class TerrainShader : public Shader {
 public:
-    TerrainShader() : Shader(ShaderType::BASIC_SHADER){}
+    /**
+     * @param tessellated Builds the tessellation pipeline of Terrain::RenderMode::TESSELLATION instead of the vertex shader
+     * of all the other sources. Both share the fragment shader.
+     */
+    explicit TerrainShader(bool tessellated = false) : Shader(ShaderType::BASIC_SHADER), m_tessellated(tessellated){}
     void init() override;
 
     void setWVP(const glm::mat4& wvp) const;
     void setMinHeight(float minHeight) const;
     void setMaxHeight(float maxHeight) const;
-    void setBlendedTextures(const std::array<std::pair<float, std::shared_ptr<Texture>>, MAX_TERRAIN_HEIGHT_TEXTURE>& heights, uint32_t textureCount);
+
+    /**
+     * @brief Sets the texture layers blended by the splat weights. Terrain is shaded by height if there are none.
+     */
+    void setLayerTextures(const std::shared_ptr<TextureArray>& textures, uint32_t layerCount) const;
+
+    /**
+     * @brief Sets the layer weights of a whole terrain, one texel per sample.
+     */
+    void setSplatMap(GLuint64 handle, uint32_t dimX, uint32_t dimY) const;
+
+    /**
+     * @brief Sets the octahedral normals of a whole terrain, one texel per sample.
+     */
+    void setNormalMap(GLuint64 handle, uint32_t dimX, uint32_t dimY) const;
     void setDirectionalLight(const DirectionalLight &light) const;
 
+    /**
+     * @brief Selects where the vertex shader takes positions from.
+     * @param source One of TERRAIN_SOURCE_* values.
+     */
+    void setVertexSource(int32_t source) const;
+    void setHeightMap(GLuint64 handle, uint32_t dimX, uint32_t dimY) const;
+    void setWorldScale(float scale) const;
+
+    /**
+     * @brief Sets the texture array with heights of streamed tiles.
+     * @param tileSize Amount of texels per side of one layer, including the border.
+     */
+    void setTileHeights(GLuint64 handle, uint32_t tileSize) const;
+
+    /**
+     * @brief Sets the texture array with layer weights of streamed tiles or clipmap levels, laid out as their heights.
+     */
+    void setSplatArray(GLuint64 handle) const;
+
+    /**
+     * @brief Sets the clipmap level heights and placement.
+     * @param textureSize Amount of texels per side of one level layer.
+     * @param gridSize Amount of samples per side of the level grid.
+     * @param origins First grid sample of every level in units of the level.
+     */
+    void setClipmap(GLuint64 handle, uint32_t textureSize, uint32_t gridSize, const std::vector<glm::ivec2>& origins) const;
+
+    /**
+     * @brief Sets how finely the patch edges of the tessellation pipeline are subdivided.
+     * @param scale Pixels covered by one world unit at unit depth divided by the target edge length in pixels.
+     * @param maxLevel Highest subdivision of an edge.
+     */
+    void setTessellation(float scale, uint32_t maxLevel) const;
+
+    /**
+     * @brief Samples the virtual texture in place of the layers. Null or an empty texture goes back to the layers.
+     * @param span Samples covered by one side of the virtual texture.
+     */
+    void setVirtualTexture(const VirtualTexture* texture, float span) const;
+
 private:
+    bool m_tessellated;
+
     uint32_t loc_WVP = -1;
     uint32_t loc_minHeight = -1;
     uint32_t loc_maxHeight = -1;
-
-    struct {
-        uint32_t height[MAX_TERRAIN_HEIGHT_TEXTURE]{};
-    } loc_sampler;
-
-    uint32_t loc_textureHeight[MAX_TERRAIN_HEIGHT_TEXTURE]{};
-    uint32_t loc_numTextureHeights = -1;
+    uint32_t loc_vertexSource = -1;
+    uint32_t loc_heightMap = -1;
+    uint32_t loc_heightMapSize = -1;
+    uint32_t loc_worldScale = -1;
+    uint32_t loc_tileHeights = -1;
+    uint32_t loc_tileSize = -1;
+    uint32_t loc_splatArray = -1;
+    uint32_t loc_clipmapHeights = -1;
+    uint32_t loc_clipmapTextureSize = -1;
+    uint32_t loc_clipmapGridSize = -1;
+    uint32_t loc_clipmapLevels = -1;
+    uint32_t loc_clipmapOrigins = -1;
+    uint32_t loc_layers = -1;
+    uint32_t loc_layerCount = -1;
+    uint32_t loc_splatMap = -1;
+    uint32_t loc_splatMapSize = -1;
+    uint32_t loc_normalMap = -1;
+    uint32_t loc_normalMapSize = -1;
+    uint32_t loc_tessScale = -1;
+    uint32_t loc_maxTessLevel = -1;
+    uint32_t loc_virtualTexture = -1;
+    uint32_t loc_virtualIndirection = -1;
+    uint32_t loc_virtualCache = -1;
+    uint32_t loc_virtualPages = -1;
+    uint32_t loc_virtualLevels = -1;
+    uint32_t loc_virtualCacheSlots = -1;
+    uint32_t loc_virtualSpan = -1;
+    uint32_t loc_feedbackOffset = -1;
 
     // Definition of a directional light
     struct {
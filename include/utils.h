@@ -56,11 +56,36 @@ namespace Utils{
         void update(const glm::mat4& VP);
         [[nodiscard]] bool isPointInside(const glm::vec3& point) const;
 
+        enum class Containment : std::uint8_t {
+            OUTSIDE,
+            INTERSECT,
+            INSIDE
+        };
+
+        static constexpr uint32_t ALL_PLANES = 0x3F;
+
+        /**
+         * Tests the box against four planes at once. Only planes in the mask are considered,
+         * on return the mask holds the planes the box straddles. Children of a box only need the planes of their parent.
+         *
+         * @brief Classifies an axis aligned box against the frustum.
+         * @param min Minimal corner of the box.
+         * @param max Maximal corner of the box.
+         * @param planeMask Bit mask of planes to test, updated to planes intersecting the box.
+         */
+        [[nodiscard]] Containment classifyBox(const glm::vec3& min, const glm::vec3& max, uint32_t& planeMask) const;
+
         Slot<const glm::mat4&> slt_updateVP{[this](const glm::mat4& VP) { update(VP); }};
     private:
 
         float m_bias = 0.0;
 
+        // Planes split into components, padded to eight with planes every box is inside of
+        alignas(16) float m_planeX[8] = {0};
+        alignas(16) float m_planeY[8] = {0};
+        alignas(16) float m_planeZ[8] = {0};
+        alignas(16) float m_planeW[8] = {0};
+
         glm::vec4 m_leftClipPlane{};
         glm::vec4 m_rightClipPlane{};
         glm::vec4 m_bottomClipPlane{};
@@ -103,6 +128,38 @@ namespace Utils{
     int64_t binPow(int32_t exp);
 
     void barycentric(glm::vec2 p, glm::vec2 a, glm::vec2 b, glm::vec2 c, float &u, float &v, float &w);
+
+    /**
+     * @brief SplitMix64 finalizer. Scrambles all input bits into the output.
+     */
+    inline uint64_t mix64(uint64_t x){
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    /**
+     * @brief Folds a value into a running hash.
+     */
+    inline uint64_t hashCombine(uint64_t hash, uint64_t value){
+        return mix64(hash ^ (value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2)));
+    }
+
+    /**
+     * Counter based random number. The value depends only on the key, not on the order of calls,
+     * so the result is the same no matter how the work is split between threads.
+     *
+     * @brief Random number keyed by seed, grid coordinates and level.
+     * @return Value in range [-1, 1).
+     */
+    inline float counterRandom(uint64_t seed, uint32_t x, uint32_t y, uint32_t level){
+        uint64_t key = mix64(seed + 0x9E3779B97F4A7C15ull * (static_cast<uint64_t>(level) + 1));
+        key = mix64(key ^ ((static_cast<uint64_t>(y) << 32) | x));
+        return static_cast<float>(key >> 40) * (2.0f / 16777216.0f) - 1.0f;
+    }
 }
 
 #endif //TECTONIC_UTILS_H
@@ -1,10 +1,14 @@
 
+// Hidden fragments don't request virtual texture pages
+layout(early_fragment_tests) in;
+
 out vec4 FragColor;
 
 in vec4 Color0;
 in vec2 TexCoord0;
 in vec3 Pos0;
 in vec3 Normal0;
+in vec3 SplatCoord0;
 
 struct BaseLight{
     vec3 color;
@@ -17,15 +21,31 @@ struct DirectionalLight {
     vec3 direction;
 };
 
-struct Sampler {
-    sampler2D height[MAX_TERRAIN_HEIGHT_TEXTURE];
+// Texture layers and their per sample weights, weights of all layers fit into one RGBA texel
+uniform sampler2DArray u_layers;
+uniform uint u_layerCount;
+uniform sampler2D u_splatMap;
+uniform sampler2DArray u_splatArray;     // Weights of streamed tiles or clipmap levels, one layer each
+uniform int u_vertexSource;
+
+// Octahedral normals of a whole terrain, one texel per sample
+uniform sampler2D u_normalMap;
+uniform ivec2 u_normalMapSize;
+
+// Sparse virtual texture of whole terrains, sampled in place of the layers
+uniform bool u_virtualTexture;
+uniform usampler2D u_virtualIndirection;    // Per page and level: cache slot, level of the resident page, resident flag
+uniform sampler2D u_virtualCache;
+uniform int u_virtualPages;                 // Pages per side of the finest level
+uniform int u_virtualLevels;
+uniform int u_virtualCacheSlots;            // Slots per side of the cache
+uniform float u_virtualSpan;                // Samples covered by one side of the virtual texture
+uniform ivec2 u_feedbackOffset;
+
+layout (std430, binding = VIRTUAL_FEEDBACK_BINDING) writeonly buffer VirtualFeedback {
+    uint requests[];
 };
 
-uniform Sampler u_samplers;
-
-uniform float u_textureHeight[MAX_TERRAIN_HEIGHT_TEXTURE];
-uniform uint u_textureHeightCount;
-
 uniform DirectionalLight u_directionalLight;
 
 vec4 calcLightInternalColor(BaseLight baseLight, vec3 direction, vec3 normal){
@@ -55,71 +75,74 @@ vec4 calcDirectionalLight(vec3 normal){
     return calcLightInternalColor(u_directionalLight.base, u_directionalLight.direction, normal);
 }
 
-vec4 blendHeightTextures(uint lowerIndex){
-    float height = Pos0.y;
+vec3 decodeNormal(vec2 encoded){
+    vec2 p = encoded * 2.0f - 1.0f;
+    vec3 normal = vec3(p.x, 1.0f - abs(p.x) - abs(p.y), p.y);
+    if(normal.y < 0.0f){
+        normal.xz = (1.0f - abs(p.yx)) * vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(normal);
+}
+
+// One weight fetch and a fixed amount of layer samples, no branching on height
+vec4 blendLayers(){
+    vec4 weights = u_vertexSource >= TERRAIN_SOURCE_TILES ? texture(u_splatArray, SplatCoord0) : texture(u_splatMap, SplatCoord0.xy);
+    // Quantized weights may not sum up to exactly one
+    weights /= max(dot(weights, vec4(1.0f)), 0.0001f);
 
-    vec4 color0 = texture(u_samplers.height[lowerIndex], TexCoord0);
-    vec4 color1 = texture(u_samplers.height[lowerIndex+1], TexCoord0);
-    float delta = u_textureHeight[lowerIndex+1] - u_textureHeight[lowerIndex];
-    float factor = (height - u_textureHeight[lowerIndex]) / delta;
-    return mix(color0, color1, factor);
+    vec4 color = vec4(0.0f);
+    for(int i = 0; i < MAX_TERRAIN_HEIGHT_TEXTURE; i++){
+        color += weights[i] * texture(u_layers, vec3(TexCoord0, float(i)));
+    }
+    return color;
 }
 
-void main(){
-    float height = Pos0.y;
-    vec3 normal = normalize(Normal0);
-    vec4 texColor;
-
-    switch(u_textureHeightCount){
-        case 0:
-            texColor = Color0;
-        break;
-
-        case 1:
-            texColor = texture(u_samplers.height[0], TexCoord0);
-        break;
-
-        case 2:
-            if(height < u_textureHeight[0]){
-                texColor = texture(u_samplers.height[0], TexCoord0);
-            }else if(height < u_textureHeight[1]){
-                texColor = blendHeightTextures(0);
-            }else{
-                texColor = texture(u_samplers.height[1], TexCoord0);
-            }
-        break;
-
-        case 3:
-            if(height < u_textureHeight[0]){
-                texColor = texture(u_samplers.height[0], TexCoord0);
-            }else if(height < u_textureHeight[1]){
-                texColor = blendHeightTextures(0);
-            }else if(height < u_textureHeight[2]){
-                texColor = blendHeightTextures(1);
-            }else{
-                texColor = texture(u_samplers.height[2], TexCoord0);
-            }
-        break;
-
-        case 4:
-            if(height < u_textureHeight[0]){
-                texColor = texture(u_samplers.height[0], TexCoord0);
-            }else if(height < u_textureHeight[1]){
-                texColor = blendHeightTextures(0);
-            }else if(height < u_textureHeight[2]){
-                texColor = blendHeightTextures(1);
-            }else if(height < u_textureHeight[3]){
-                texColor = blendHeightTextures(2);
-            }else{
-                texColor = texture(u_samplers.height[3], TexCoord0);
-            }
-        break;
-
-        default:
-            texColor = Color0;
-        break;
+vec4 sampleVirtual(){
+    vec2 uv = clamp(TexCoord0 / u_virtualSpan, 0.0f, 1.0f);
+
+    // Level with about one virtual texel per pixel, finer rather than coarser
+    vec2 texel = uv * float(u_virtualPages * VIRTUAL_PAGE_SIZE);
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5f * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8f));
+    int level = clamp(int(floor(lod)), 0, u_virtualLevels - 1);
+
+    int pages = u_virtualPages >> level;
+    ivec2 page = min(ivec2(uv * float(pages)), ivec2(pages - 1));
+
+    // Low resolution feedback, one fragment of every square requests the page it wants
+    if(all(equal(ivec2(gl_FragCoord.xy) % VIRTUAL_FEEDBACK_STRIDE, u_feedbackOffset))){
+        uint offset = 0u;
+        for(int i = 0; i < level; i++){
+            uint side = uint(u_virtualPages >> i);
+            offset += side * side;
+        }
+        requests[offset + uint(page.y * pages + page.x)] = 1u;
     }
 
+    // The entry points at the page itself or at its nearest resident ancestor
+    uvec4 entry = texelFetch(u_virtualIndirection, page, level);
+    // Only before the coarsest page arrives, the entry is empty and its level meaningless
+    if(entry.a == 0u)
+        return Color0;
+
+    int residentLevel = int(entry.b);
+    vec2 inPage = clamp(uv * float(u_virtualPages >> residentLevel) - vec2(page >> (residentLevel - level)), 0.0f, 1.0f);
+
+    float slotSize = float(VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER);
+    vec2 cacheTexel = vec2(entry.rg) * slotSize + float(VIRTUAL_PAGE_BORDER) + inPage * float(VIRTUAL_PAGE_SIZE);
+    return textureLod(u_virtualCache, cacheTexel / (slotSize * float(u_virtualCacheSlots)), 0.0f);
+}
+
+void main(){
+    // Whole terrains sample full resolution normals, streamed tiles and clipmap levels keep the vertex normals
+    vec3 normal = u_vertexSource <= TERRAIN_SOURCE_HEIGHT_TEXTURE ?
+                  decodeNormal(texture(u_normalMap, (TexCoord0 + 0.5f) / vec2(u_normalMapSize)).rg) :
+                  normalize(Normal0);
+
+    // Uniform condition, all fragments of a draw take the same path
+    vec4 texColor = u_virtualTexture ? sampleVirtual() : (u_layerCount > 0u ? blendLayers() : Color0);
+
     vec4 totalLight = calcDirectionalLight(normal);
 
     FragColor = texColor * totalLight;
@@ -2,9 +2,14 @@
 #include shaders/inc/buffersLayout.glsl
 #include shaders/inc/boneTransformation.glsl
 
+// Scattered instances, position and uniform scale in the first, rotation quaternion in the second
+layout (location = INSTANCE_POSITION_LOCATION) in vec4 InstancePositionScale;
+layout (location = INSTANCE_ROTATION_LOCATION) in vec4 InstanceRotation;
+
 uniform mat4 u_WVP;
 uniform mat4 u_LightWVP;
 uniform mat4 u_world;
+uniform bool u_instanced;
 
 out vec2 TexCoord0;
 out vec3 Normal0;
@@ -14,12 +19,26 @@ flat out ivec4 BoneIDs0;
 out vec4 Weights0;
 out mat3 TBN;
 
+mat4 instanceTransform(){
+    vec4 q = InstanceRotation;
+    mat3 rotation = mat3(1.0f - 2.0f*(q.y*q.y + q.z*q.z), 2.0f*(q.x*q.y + q.w*q.z), 2.0f*(q.x*q.z - q.w*q.y),
+                         2.0f*(q.x*q.y - q.w*q.z), 1.0f - 2.0f*(q.x*q.x + q.z*q.z), 2.0f*(q.y*q.z + q.w*q.x),
+                         2.0f*(q.x*q.z + q.w*q.y), 2.0f*(q.y*q.z - q.w*q.x), 1.0f - 2.0f*(q.x*q.x + q.y*q.y));
+
+    mat4 transform = mat4(rotation * InstancePositionScale.w);
+    transform[3] = vec4(InstancePositionScale.xyz, 1.0f);
+    return transform;
+}
+
 void main(){
+    // Instances are placed in the world directly, world and WVP matrices are set without the model transform
+    mat4 instance = u_instanced ? instanceTransform() : mat4(1.0f);
+
     vec4 localPos = vec4(Position, 1.0f);
     vec4 localNormal = vec4(Normal, 0.0f);
 
-    localPos = #BONE_SWITCH[localPos | boneTransform()*localPos]
-    localNormal = #BONE_SWITCH[localNormal | boneTransform()*localNormal]
+    localPos = #BONE_SWITCH[instance * localPos | instance * boneTransform()*localPos]
+    localNormal = #BONE_SWITCH[instance * localNormal | instance * boneTransform()*localNormal]
 
     gl_Position = u_WVP * localPos;
     TexCoord0 = TexCoord;
@@ -27,9 +46,9 @@ void main(){
     WorldPos0 = (u_world * localPos).xyz;
     LightSpacePos = u_LightWVP * localPos;
 
-    #BONE_SWITCH[vec3 T = normalize(vec3(u_world * vec4(Tangent, 0.0f))) | vec3 T = normalize(vec3(u_world * boneTransform() * vec4(Tangent, 0.0f)))]
-    #BONE_SWITCH[vec3 B = normalize(vec3(u_world * vec4(BiTangent, 0.0f))) | vec3 B = normalize(vec3(u_world * boneTransform() * vec4(BiTangent, 0.0f)))]
-    #BONE_SWITCH[vec3 N = normalize(vec3(u_world * vec4(Normal, 0.0f))) | vec3 N = normalize(vec3(u_world * boneTransform() * vec4(Normal, 0.0f)))]
+    #BONE_SWITCH[vec3 T = normalize(vec3(u_world * instance * vec4(Tangent, 0.0f))) | vec3 T = normalize(vec3(u_world * instance * boneTransform() * vec4(Tangent, 0.0f)))]
+    #BONE_SWITCH[vec3 B = normalize(vec3(u_world * instance * vec4(BiTangent, 0.0f))) | vec3 B = normalize(vec3(u_world * instance * boneTransform() * vec4(BiTangent, 0.0f)))]
+    #BONE_SWITCH[vec3 N = normalize(vec3(u_world * instance * vec4(Normal, 0.0f))) | vec3 N = normalize(vec3(u_world * instance * boneTransform() * vec4(Normal, 0.0f)))]
 
     //vec3 T = normalize(Tangent);
     //vec3 B = normalize(BiTangent);
@@ -1,26 +1,133 @@
-
-#include shaders/inc/buffersLayout.glsl
+layout (location = POSITION_LOCATION) in vec3 Position;
+layout (location = GRID_POSITION_LOCATION) in uvec2 GridPosition;
+layout (location = PATCH_ORIGIN_LOCATION) in uvec2 PatchOrigin;
+layout (location = TILE_PATCH_LOCATION) in ivec4 TilePatch;     // Global sample origin in xy, origin inside of the tile in zw
+layout (location = TILE_LAYER_LOCATION) in int TileLayer;
+layout (location = CLIPMAP_INSTANCE_LOCATION) in ivec4 ClipmapBlock;   // First sample of the block in level units in xy, level in z
 
 uniform mat4 u_WVP;
 uniform float u_minHeight;
 uniform float u_maxHeight;
 
+uniform int u_vertexSource;
+uniform sampler2D u_heightMap;
+uniform ivec2 u_heightMapSize;
+uniform float u_worldScale;
+
+uniform sampler2DArray u_tileHeights;
+uniform int u_tileSize;
+
+uniform ivec2 u_splatMapSize;
+uniform ivec2 u_normalMapSize;
+
+uniform sampler2DArray u_clipmapHeights;
+uniform int u_clipmapTextureSize;
+uniform int u_clipmapGridSize;
+uniform int u_clipmapLevels;
+uniform ivec2 u_clipmapOrigins[MAX_CLIPMAP_LEVELS];
+
 out vec4 Color0;
 out vec2 TexCoord0;
 out vec3 Pos0;
 out vec3 Normal0;
+out vec3 SplatCoord0;   // Splat map coordinates in xy, tile or clipmap layer in z
+
+float fetchHeight(ivec2 coord){
+    coord = clamp(coord, ivec2(0), u_heightMapSize - 1);
+    return mix(u_minHeight, u_maxHeight, texelFetch(u_heightMap, coord, 0).r);
+}
+
+float fetchTileHeight(ivec2 coord){
+    // Layers carry a one texel border, so neighbours of edge samples are always present
+    return texelFetch(u_tileHeights, ivec3(coord + 1, TileLayer), 0).r;
+}
+
+float fetchClipmapHeight(ivec2 coord, int level){
+    // Layers are addressed toroidally, a sample keeps its texel while it stays inside the level
+    ivec2 texel = ((coord % u_clipmapTextureSize) + u_clipmapTextureSize) % u_clipmapTextureSize;
+    return texelFetch(u_clipmapHeights, ivec3(texel, level), 0).r;
+}
 
 void main(){
-    vec4 localPos = vec4(Position, 1.0f);
-    vec4 localNormal = vec4(Normal, 0.0f);
+    vec4 localPos;
+    vec4 localNormal;
+
+    if(u_vertexSource == TERRAIN_SOURCE_TILES){
+        ivec2 coord = TilePatch.xy + ivec2(GridPosition);
+        ivec2 tileCoord = TilePatch.zw + ivec2(GridPosition);
+
+        localPos = vec4(float(coord.x) * u_worldScale,
+                        fetchTileHeight(tileCoord),
+                        float(coord.y) * u_worldScale,
+                        1.0f);
+
+        float hL = fetchTileHeight(tileCoord - ivec2(1, 0));
+        float hR = fetchTileHeight(tileCoord + ivec2(1, 0));
+        float hD = fetchTileHeight(tileCoord - ivec2(0, 1));
+        float hU = fetchTileHeight(tileCoord + ivec2(0, 1));
+        localNormal = vec4(normalize(vec3(hL - hR, 2.0f * u_worldScale, hD - hU)), 0.0f);
+
+        TexCoord0 = vec2(coord);
+        SplatCoord0 = vec3((vec2(tileCoord + 1) + 0.5f) / float(u_tileSize), float(TileLayer));
+    }else if(u_vertexSource == TERRAIN_SOURCE_CLIPMAP){
+        int level = ClipmapBlock.z;
+        ivec2 coord = ClipmapBlock.xy + ivec2(GridPosition);
+        float spacing = u_worldScale * float(1 << level);
+        float height = fetchClipmapHeight(coord, level);
+
+        // Outer band of a level morphs into the coarser level, samples on the border match its edges exactly
+        float halfGrid = float(u_clipmapGridSize-1) / 2.0f;
+        vec2 fromCenter = abs(vec2(coord - u_clipmapOrigins[level]) - halfGrid);
+        float morphWidth = halfGrid / 5.0f;
+        float morph = clamp((max(fromCenter.x, fromCenter.y) - (halfGrid - morphWidth - 1.0f)) / morphWidth, 0.0f, 1.0f);
+        if(level+1 < u_clipmapLevels && morph > 0.0f){
+            // Odd samples lie on coarse edges or diagonals, both ends of them are averaged
+            ivec2 coarse = coord >> 1;
+            float coarseHeight = 0.5f * (fetchClipmapHeight(coarse, level+1) + fetchClipmapHeight(coarse + (coord & 1), level+1));
+            height = mix(height, coarseHeight, morph);
+        }
+
+        localPos = vec4(float(coord.x) * spacing,
+                        height,
+                        float(coord.y) * spacing,
+                        1.0f);
+
+        float hL = fetchClipmapHeight(coord - ivec2(1, 0), level);
+        float hR = fetchClipmapHeight(coord + ivec2(1, 0), level);
+        float hD = fetchClipmapHeight(coord - ivec2(0, 1), level);
+        float hU = fetchClipmapHeight(coord + ivec2(0, 1), level);
+        localNormal = vec4(normalize(vec3(hL - hR, 2.0f * spacing, hD - hU)), 0.0f);
+
+        TexCoord0 = vec2(coord * (1 << level));
+        // Continuous over the toroidal seam, the splat array wraps
+        SplatCoord0 = vec3((vec2(coord) + 0.5f) / float(u_clipmapTextureSize), float(level));
+    }else if(u_vertexSource == TERRAIN_SOURCE_HEIGHT_TEXTURE){
+        ivec2 coord = ivec2(PatchOrigin + GridPosition);
+        vec2 halfSize = vec2(u_heightMapSize) / 2.0f;
+
+        localPos = vec4((float(coord.x) - halfSize.x) * u_worldScale,
+                        fetchHeight(coord),
+                        (float(coord.y) - halfSize.y) * u_worldScale,
+                        1.0f);
+        // Shaded by the normal map
+        localNormal = vec4(0.0f, 1.0f, 0.0f, 0.0f);
+
+        TexCoord0 = vec2(coord);
+        SplatCoord0 = vec3((TexCoord0 + 0.5f) / vec2(u_splatMapSize), 0.0f);
+    }else{
+        localPos = vec4(Position, 1.0f);
+        localNormal = vec4(0.0f, 1.0f, 0.0f, 0.0f);
+        // Vertices carry only their position, the sample coordinate is recovered from it
+        TexCoord0 = Position.xz / u_worldScale + vec2(u_normalMapSize) / 2.0f;
+        SplatCoord0 = vec3((TexCoord0 + 0.5f) / vec2(u_splatMapSize), 0.0f);
+    }
 
     gl_Position = u_WVP * localPos;
-    TexCoord0 = TexCoord;
     Normal0 = localNormal.xyz;
     Pos0 = localPos.xyz;
 
     float deltaHeight = u_maxHeight - u_minHeight;
-    float heightRation = (Position.y - u_minHeight) / deltaHeight;
+    float heightRation = (localPos.y - u_minHeight) / deltaHeight;
     float c = heightRation * 0.8 + 0.2;
     Color0 = vec4(c,c,c,1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,8 @@
+layout (location = GRID_POSITION_LOCATION) in uvec2 GridPosition;
+layout (location = PATCH_ORIGIN_LOCATION) in uvec2 PatchOrigin;
+
+out vec2 Coord_CS;  // Height map sample of the patch corner
+
+void main(){
+    Coord_CS = vec2(PatchOrigin + GridPosition);
+}
@@ -326,6 +326,8 @@ void AssimpLoader::loadMesh(const aiMesh *mesh, const std::shared_ptr<Model>& mo
         vertex.m_position.x = mesh->mVertices[i].x;
         vertex.m_position.y = mesh->mVertices[i].y;
         vertex.m_position.z = mesh->mVertices[i].z;
+        model->m_boundsMin = glm::min(model->m_boundsMin, vertex.m_position);
+        model->m_boundsMax = glm::max(model->m_boundsMax, vertex.m_position);
         if(mesh->HasNormals()){
             vertex.m_normal.x = mesh->mNormals[i].x;
             vertex.m_normal.y = mesh->mNormals[i].y;
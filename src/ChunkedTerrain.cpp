@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <chrono>
+#include <glm/gtc/type_precision.hpp>
+
+#include "model/terrain/ChunkedTerrain.h"
+#include "ThreadPool.h"
+
+Logger ChunkedTerrain::m_logger = Logger("Chunked Terrain");
+
+ChunkedTerrain::~ChunkedTerrain() {
+    // Jobs still running only hold copies of the tile source, their results are dropped
+    m_pendingTiles.clear();
+
+    if(m_gridVAO != -1){
+        glDeleteVertexArrays(1, &m_gridVAO);
+        glDeleteBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
+    }
+
+    if(m_heightArray != -1){
+        glMakeTextureHandleNonResidentARB(m_heightArrayHandle);
+        glDeleteTextures(1, &m_heightArray);
+    }
+
+    if(m_splatArray != -1){
+        glMakeTextureHandleNonResidentARB(m_splatArrayHandle);
+        glDeleteTextures(1, &m_splatArray);
+    }
+}
+
+void ChunkedTerrain::setMaxLOD(uint32_t maxLOD) {
+    m_maxLOD = maxLOD;
+    m_patchSize = Utils::binPow(static_cast<int32_t>(maxLOD+1)) + 1;
+}
+
+void ChunkedTerrain::setPatchesPerTile(uint32_t patches) {
+    m_patchesPerTile = std::max(1u, patches);
+}
+
+void ChunkedTerrain::setScale(float scale) {
+    m_worldScale = scale;
+}
+
+void ChunkedTerrain::setViewDistance(float distance) {
+    m_viewDistance = distance;
+}
+
+void ChunkedTerrain::setTileSource(TileSource source) {
+    m_tileSource = std::move(source);
+}
+
+void ChunkedTerrain::setMaxTileUploads(uint32_t uploadsPerFrame) {
+    m_maxTileUploads = std::max(1u, uploadsPerFrame);
+}
+
+void ChunkedTerrain::setTextures(const std::vector<std::string> &textureFiles, float minHeight, float maxHeight) {
+    assert(textureFiles.size() <= MAX_TERRAIN_HEIGHT_TEXTURE);
+
+    SplatMap::Settings settings = SplatMap::evenHeights(static_cast<uint32_t>(textureFiles.size()), minHeight, maxHeight);
+    m_splatSettings.heights = settings.heights;
+    m_splatSettings.layerCount = settings.layerCount;
+
+    m_layerTextures = textureFiles.empty() ? nullptr : TextureArray::createTextureArray(textureFiles);
+}
+
+void ChunkedTerrain::setSlopeLayer(int32_t layer, float slopeStart, float slopeEnd) {
+    m_splatSettings.slopeLayer = layer;
+    m_splatSettings.slopeStart = slopeStart;
+    m_splatSettings.slopeEnd = slopeEnd;
+}
+
+void ChunkedTerrain::setCamera(Camera &camera) {
+    camera.sig_position.connect(slt_cameraPosition);
+    camera.sig_VPMatrix.connect(m_frustumCulling.slt_updateVP);
+}
+
+void ChunkedTerrain::init() {
+    m_tileSamples = m_patchesPerTile * (m_patchSize-1) + 1;
+
+    float tileWorldSize = static_cast<float>(m_tileSamples-1) * m_worldScale;
+    m_tileRadius = static_cast<int32_t>(std::ceil(m_viewDistance / tileWorldSize));
+
+    // Needed square of tiles plus one ring, so tiles crossing the border aren't thrown away immediately
+    auto side = static_cast<uint32_t>(2*m_tileRadius + 2);
+    m_layerCount = side * side;
+
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if(m_layerCount > static_cast<uint32_t>(maxLayers)){
+        // Radius of the largest square of tiles plus its ring fitting into the limit, otherwise needed tiles evict each other
+        auto maxSide = static_cast<int32_t>(std::sqrt(static_cast<double>(maxLayers)));
+        m_tileRadius = std::max((maxSide - 2) / 2, 0);
+        side = static_cast<uint32_t>(2*m_tileRadius + 2);
+
+        m_logger(Logger::WARNING) << "Tile pool of " << m_layerCount << " layers exceeds the limit of " << static_cast<uint32_t>(maxLayers)
+                                  << ", view distance is clamped to " << static_cast<float>(m_tileRadius) * tileWorldSize << '\n';
+        m_layerCount = side * side;
+    }
+
+    m_maxPendingTiles = std::max(2u, ThreadPool::getInstance().threadCount() * 2);
+
+    m_freeLayers.resize(m_layerCount);
+    for(uint32_t i = 0; i < m_layerCount; i++){
+        m_freeLayers[i] = m_layerCount - 1 - i;
+    }
+
+    m_lodManager.init(m_maxLOD, 0, 0, m_worldScale);
+    m_patchIndices.build(m_maxLOD, m_patchSize);
+
+    uint32_t layerSize = m_tileSamples + 2;
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_heightArray);
+    glTextureStorage3D(m_heightArray, 1, GL_R32F, static_cast<GLsizei>(layerSize), static_cast<GLsizei>(layerSize), static_cast<GLsizei>(m_layerCount));
+
+    glTextureParameteri(m_heightArray, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(m_heightArray, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(m_heightArray, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(m_heightArray, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    m_heightArrayHandle = glGetTextureHandleARB(m_heightArray);
+    if(m_heightArrayHandle == 0){
+        m_logger(Logger::ERROR) << "Unable to retrieve texture handle for tile height array" << '\n';
+        throw textureException();
+    }
+    glMakeTextureHandleResidentARB(m_heightArrayHandle);
+
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_splatArray);
+    glTextureStorage3D(m_splatArray, 1, GL_RGBA8, static_cast<GLsizei>(layerSize), static_cast<GLsizei>(layerSize), static_cast<GLsizei>(m_layerCount));
+
+    glTextureParameteri(m_splatArray, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(m_splatArray, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(m_splatArray, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(m_splatArray, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    m_splatArrayHandle = glGetTextureHandleARB(m_splatArray);
+    if(m_splatArrayHandle == 0){
+        m_logger(Logger::ERROR) << "Unable to retrieve texture handle for tile splat array" << '\n';
+        throw textureException();
+    }
+    glMakeTextureHandleResidentARB(m_splatArrayHandle);
+
+    std::vector<glm::u16vec2> gridVertices(m_patchSize * m_patchSize);
+    for(uint32_t y = 0; y < m_patchSize; y++){
+        for(uint32_t x = 0; x < m_patchSize; x++){
+            gridVertices[y * m_patchSize + x] = {x, y};
+        }
+    }
+
+    glGenVertexArrays(1, &m_gridVAO);
+    glBindVertexArray(m_gridVAO);
+
+    glGenBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_gridBuffers[GRID_VB]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(gridVertices.size() * sizeof(glm::u16vec2)), gridVertices.data(), GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(GRID_POSITION_LOCATION);
+    glVertexAttribIPointer(GRID_POSITION_LOCATION, 2, GL_UNSIGNED_SHORT, sizeof(glm::u16vec2), (void*)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_gridBuffers[GRID_INSTANCE_VB]);
+
+    glEnableVertexAttribArray(TILE_PATCH_LOCATION);
+    glVertexAttribIPointer(TILE_PATCH_LOCATION, 4, GL_INT, sizeof(PatchInstance), (void*) offsetof(PatchInstance, patch));
+    glVertexAttribDivisor(TILE_PATCH_LOCATION, 1);
+
+    glEnableVertexAttribArray(TILE_LAYER_LOCATION);
+    glVertexAttribIPointer(TILE_LAYER_LOCATION, 1, GL_INT, sizeof(PatchInstance), (void*) offsetof(PatchInstance, layer));
+    glVertexAttribDivisor(TILE_LAYER_LOCATION, 1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridBuffers[GRID_INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(m_patchIndices.byteSize()), m_patchIndices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+
+    m_logger(Logger::INFO) << "Initialized tile pool of " << m_layerCount << " tiles with " << m_tileSamples << "x" << m_tileSamples << " samples" << '\n';
+}
+
+void ChunkedTerrain::update() {
+    if(m_gridVAO == -1)
+        return;
+
+    m_frame++;
+
+    int32_t tileStep = static_cast<int32_t>(m_tileSamples-1);
+    m_cameraTileX = floorDiv(static_cast<int32_t>(std::floor(m_cameraPos.x / m_worldScale)), tileStep);
+    m_cameraTileY = floorDiv(static_cast<int32_t>(std::floor(m_cameraPos.z / m_worldScale)), tileStep);
+
+    std::vector<std::pair<int32_t, int32_t>> missing;
+    for(int32_t y = m_cameraTileY - m_tileRadius; y <= m_cameraTileY + m_tileRadius; y++){
+        for(int32_t x = m_cameraTileX - m_tileRadius; x <= m_cameraTileX + m_tileRadius; x++){
+            uint64_t key = tileKey(x, y);
+            auto tile = m_tiles.find(key);
+            if(tile != m_tiles.end()){
+                tile->second.lastUsed = m_frame;
+            }else if(!m_pendingTiles.contains(key)){
+                missing.emplace_back(x, y);
+            }
+        }
+    }
+
+    requestTiles(missing);
+    receiveTiles();
+    buildDrawList();
+}
+
+void ChunkedTerrain::requestTiles(const std::vector<std::pair<int32_t, int32_t>>& missing) {
+    if(missing.empty())
+        return;
+
+    // Closest tiles first
+    std::vector<std::pair<int32_t, int32_t>> ordered = missing;
+    std::sort(ordered.begin(), ordered.end(), [this](const auto& a, const auto& b){
+        int32_t distA = std::max(std::abs(a.first - m_cameraTileX), std::abs(a.second - m_cameraTileY));
+        int32_t distB = std::max(std::abs(b.first - m_cameraTileX), std::abs(b.second - m_cameraTileY));
+        return distA < distB;
+    });
+
+    for(const auto& [x, y] : ordered){
+        if(m_pendingTiles.size() >= m_maxPendingTiles)
+            break;
+
+        m_pendingTiles.emplace(tileKey(x, y), ThreadPool::getInstance().submit(
+                [source = m_tileSource, x, y, tileSamples = m_tileSamples, patchSize = m_patchSize, patchesPerTile = m_patchesPerTile,
+                 splatSettings = m_splatSettings, worldScale = m_worldScale](){
+                    return buildTile(source, x, y, tileSamples, patchSize, patchesPerTile, splatSettings, worldScale);
+                }));
+    }
+}
+
+void ChunkedTerrain::receiveTiles() {
+    uint32_t uploads = 0;
+    uint32_t layerSize = m_tileSamples + 2;
+
+    for(auto it = m_pendingTiles.begin(); it != m_pendingTiles.end() && uploads < m_maxTileUploads;){
+        if(it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready){
+            ++it;
+            continue;
+        }
+
+        Tile tile = it->second.get();
+        uint64_t key = it->first;
+        it = m_pendingTiles.erase(it);
+
+        // Camera moved away while the tile was generated
+        if(!isTileNeeded(tile.x, tile.y))
+            continue;
+
+        tile.layer = acquireLayer();
+        tile.lastUsed = m_frame;
+
+        glTextureSubImage3D(m_heightArray, 0, 0, 0, static_cast<GLint>(tile.layer),
+                            static_cast<GLsizei>(layerSize), static_cast<GLsizei>(layerSize), 1,
+                            GL_RED, GL_FLOAT, tile.heights.data());
+
+        if(!tile.splat.empty()){
+            glTextureSubImage3D(m_splatArray, 0, 0, 0, static_cast<GLint>(tile.layer),
+                                static_cast<GLsizei>(layerSize), static_cast<GLsizei>(layerSize), 1,
+                                GL_RGBA, GL_UNSIGNED_BYTE, tile.splat.data());
+            tile.splat = {};
+        }
+
+        for(const glm::vec2& bounds : tile.patchBounds){
+            m_minHeight = std::min(m_minHeight, bounds.x);
+            m_maxHeight = std::max(m_maxHeight, bounds.y);
+        }
+
+        m_tiles.insert_or_assign(key, std::move(tile));
+        uploads++;
+    }
+}
+
+uint32_t ChunkedTerrain::acquireLayer() {
+    if(!m_freeLayers.empty()){
+        uint32_t layer = m_freeLayers.back();
+        m_freeLayers.pop_back();
+        return layer;
+    }
+
+    // Pool holds more tiles than are needed at once, so the least recently used tile is never a needed one
+    auto lru = std::min_element(m_tiles.begin(), m_tiles.end(), [](const auto& a, const auto& b){
+        return a.second.lastUsed < b.second.lastUsed;
+    });
+
+    uint32_t layer = lru->second.layer;
+    m_tiles.erase(lru);
+    return layer;
+}
+
+bool ChunkedTerrain::isTileNeeded(int32_t tileX, int32_t tileY) const {
+    return std::abs(tileX - m_cameraTileX) <= m_tileRadius && std::abs(tileY - m_cameraTileY) <= m_tileRadius;
+}
+
+ChunkedTerrain::Tile ChunkedTerrain::buildTile(const TileSource &source, int32_t tileX, int32_t tileY, uint32_t tileSamples, uint32_t patchSize, uint32_t patchesPerTile,
+                                               const SplatMap::Settings& splatSettings, float worldScale) {
+    Tile tile;
+    tile.x = tileX;
+    tile.y = tileY;
+
+    int32_t tileStep = static_cast<int32_t>(tileSamples-1);
+    uint32_t layerSize = tileSamples + 2;
+
+    tile.heights.resize(static_cast<std::size_t>(layerSize) * layerSize);
+    source(tileX * tileStep - 1, tileY * tileStep - 1, layerSize, tile.heights.data());
+
+    if(splatSettings.layerCount > 0){
+        tile.splat.resize(tile.heights.size() * 4);
+        SplatMap::bake(splatSettings, tile.heights.data(), layerSize, layerSize, worldScale, tile.splat.data());
+    }
+
+    tile.patchBounds.resize(patchesPerTile * patchesPerTile);
+    for(uint32_t patchY = 0; patchY < patchesPerTile; patchY++){
+        for(uint32_t patchX = 0; patchX < patchesPerTile; patchX++){
+            glm::vec2 bounds(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+            for(uint32_t y = 0; y < patchSize; y++){
+                const float* row = &tile.heights[static_cast<std::size_t>(patchY*(patchSize-1) + y + 1) * layerSize + patchX*(patchSize-1) + 1];
+                for(uint32_t x = 0; x < patchSize; x++){
+                    bounds.x = std::min(bounds.x, row[x]);
+                    bounds.y = std::max(bounds.y, row[x]);
+                }
+            }
+            tile.patchBounds[patchY * patchesPerTile + patchX] = bounds;
+            tile.bounds.x = std::min(tile.bounds.x, bounds.x);
+            tile.bounds.y = std::max(tile.bounds.y, bounds.y);
+        }
+    }
+
+    return tile;
+}
+
+uint32_t ChunkedTerrain::patchLOD(int32_t patchX, int32_t patchY) const {
+    // Horizontal distance only, so the LOD of any patch is known without its tile being resident.
+    // Neighbouring tiles then agree on the LOD of border patches and stitch without exchanging data.
+    float halfPatch = static_cast<float>(m_patchSize-1) / 2.0f;
+    glm::vec2 center((static_cast<float>(patchX) * static_cast<float>(m_patchSize-1) + halfPatch) * m_worldScale,
+                     (static_cast<float>(patchY) * static_cast<float>(m_patchSize-1) + halfPatch) * m_worldScale);
+
+    return std::min(m_maxLOD, m_lodManager.distanceToLOD(glm::distance(center, glm::vec2(m_cameraPos.x, m_cameraPos.z))));
+}
+
+void ChunkedTerrain::relaxLODs() {
+    // Patches of the needed tiles plus a ring of their neighbours, the ring only serves the stitching of border patches
+    auto patchesPerTile = static_cast<int32_t>(m_patchesPerTile);
+    m_lodOriginX = (m_cameraTileX - m_tileRadius) * patchesPerTile - 1;
+    m_lodOriginY = (m_cameraTileY - m_tileRadius) * patchesPerTile - 1;
+    m_lodSide = static_cast<uint32_t>((2*m_tileRadius + 1) * patchesPerTile + 2);
+
+    auto side = static_cast<int32_t>(m_lodSide);
+    m_patchLODs.resize(static_cast<std::size_t>(m_lodSide) * m_lodSide);
+    for(int32_t y = 0; y < side; y++){
+        for(int32_t x = 0; x < side; x++){
+            m_patchLODs[y * side + x] = patchLOD(m_lodOriginX + x, m_lodOriginY + y);
+        }
+    }
+
+    // Neighbouring patches may differ by one LOD at most, stitched variants only exist for a one LOD step.
+    // Raising every patch to the LOD of any other patch minus their distance in patches settles in two sweeps.
+    for(int32_t y = 0; y < side; y++){
+        for(int32_t x = 0; x < side; x++){
+            uint32_t& lod = m_patchLODs[y * side + x];
+            if(x > 0) lod = std::max(lod, m_patchLODs[y * side + x-1] > 0 ? m_patchLODs[y * side + x-1] - 1 : 0);
+            if(y > 0) lod = std::max(lod, m_patchLODs[(y-1) * side + x] > 0 ? m_patchLODs[(y-1) * side + x] - 1 : 0);
+        }
+    }
+    for(int32_t y = side-1; y >= 0; y--){
+        for(int32_t x = side-1; x >= 0; x--){
+            uint32_t& lod = m_patchLODs[y * side + x];
+            if(x < side-1) lod = std::max(lod, m_patchLODs[y * side + x+1] > 0 ? m_patchLODs[y * side + x+1] - 1 : 0);
+            if(y < side-1) lod = std::max(lod, m_patchLODs[(y+1) * side + x] > 0 ? m_patchLODs[(y+1) * side + x] - 1 : 0);
+        }
+    }
+}
+
+uint32_t ChunkedTerrain::relaxedLOD(int32_t patchX, int32_t patchY) const {
+    return m_patchLODs[static_cast<std::size_t>(patchY - m_lodOriginY) * m_lodSide + static_cast<std::size_t>(patchX - m_lodOriginX)];
+}
+
+Utils::FrustumCulling::Containment ChunkedTerrain::classifyPatches(int32_t patchX, int32_t patchY, uint32_t patchCount, const glm::vec2 &bounds, uint32_t &planeMask) const {
+    float patchWorldSize = static_cast<float>(m_patchSize-1) * m_worldScale;
+    glm::vec3 min(static_cast<float>(patchX) * patchWorldSize, bounds.x, static_cast<float>(patchY) * patchWorldSize);
+    glm::vec3 max(min.x + static_cast<float>(patchCount) * patchWorldSize, bounds.y, min.z + static_cast<float>(patchCount) * patchWorldSize);
+
+    return m_frustumCulling.classifyBox(min, max, planeMask);
+}
+
+void ChunkedTerrain::buildDrawList() {
+    m_drawCommands.clear();
+    m_instances.clear();
+
+    int32_t patchesPerTile = static_cast<int32_t>(m_patchesPerTile);
+    int32_t patchStep = static_cast<int32_t>(m_patchSize-1);
+
+    relaxLODs();
+
+    for(const auto& [key, tile] : m_tiles){
+        if(tile.lastUsed != m_frame)
+            continue;
+
+        // Whole tile is tested first, patches only when the tile straddles the frustum
+        uint32_t tileMask = Utils::FrustumCulling::ALL_PLANES;
+        auto tileContainment = classifyPatches(tile.x * patchesPerTile, tile.y * patchesPerTile, m_patchesPerTile, tile.bounds, tileMask);
+        if(tileContainment == Utils::FrustumCulling::Containment::OUTSIDE)
+            continue;
+
+        for(int32_t localY = 0; localY < patchesPerTile; localY++){
+            for(int32_t localX = 0; localX < patchesPerTile; localX++){
+                int32_t patchX = tile.x * patchesPerTile + localX;
+                int32_t patchY = tile.y * patchesPerTile + localY;
+
+                uint32_t patchMask = tileMask;
+                if(tileContainment == Utils::FrustumCulling::Containment::INTERSECT &&
+                   classifyPatches(patchX, patchY, 1, tile.patchBounds[localY * patchesPerTile + localX], patchMask) == Utils::FrustumCulling::Containment::OUTSIDE)
+                    continue;
+
+                uint32_t core = relaxedLOD(patchX, patchY);
+                uint32_t left   = relaxedLOD(patchX - 1, patchY) > core ? 1 : 0;
+                uint32_t right  = relaxedLOD(patchX + 1, patchY) > core ? 1 : 0;
+                uint32_t bottom = relaxedLOD(patchX, patchY - 1) > core ? 1 : 0;
+                uint32_t top    = relaxedLOD(patchX, patchY + 1) > core ? 1 : 0;
+
+                const PatchIndices::Range& range = m_patchIndices.variant(core, left, right, top, bottom);
+
+                DrawElementsIndirectCommand& command = m_drawCommands.emplace_back();
+                command.count = range.count;
+                command.instanceCount = 1;
+                command.firstIndex = range.start;
+                command.baseVertex = 0;
+                command.baseInstance = static_cast<uint32_t>(m_instances.size());
+
+                m_instances.push_back({{patchX * patchStep, patchY * patchStep, localX * patchStep, localY * patchStep},
+                                       static_cast<int32_t>(tile.layer)});
+            }
+        }
+    }
+
+    // Orphan the instance and command buffers every frame, the lists are rebuilt from scratch anyway
+    glNamedBufferData(m_gridBuffers[GRID_INSTANCE_VB], static_cast<GLsizeiptr>(m_instances.size() * sizeof(PatchInstance)), m_instances.data(), GL_STREAM_DRAW);
+    glNamedBufferData(m_gridBuffers[GRID_COMMAND_BUFFER], static_cast<GLsizeiptr>(m_drawCommands.size() * sizeof(DrawElementsIndirectCommand)), m_drawCommands.data(), GL_STREAM_DRAW);
+}
+
+float ChunkedTerrain::heightAt(float x, float z) const {
+    float sampleX = x / m_worldScale;
+    float sampleY = z / m_worldScale;
+    auto baseX = static_cast<int32_t>(std::floor(sampleX));
+    auto baseY = static_cast<int32_t>(std::floor(sampleY));
+
+    int32_t tileStep = static_cast<int32_t>(m_tileSamples-1);
+    int32_t tileX = floorDiv(baseX, tileStep);
+    int32_t tileY = floorDiv(baseY, tileStep);
+
+    auto tile = m_tiles.find(tileKey(tileX, tileY));
+    if(tile == m_tiles.end())
+        return 0.0f;
+
+    uint32_t layerSize = m_tileSamples + 2;
+    auto localX = static_cast<uint32_t>(baseX - tileX * tileStep + 1);
+    auto localY = static_cast<uint32_t>(baseY - tileY * tileStep + 1);
+    const float* row = &tile->second.heights[static_cast<std::size_t>(localY) * layerSize + localX];
+
+    float tx = sampleX - static_cast<float>(baseX);
+    float ty = sampleY - static_cast<float>(baseY);
+
+    float bottom = row[0] + (row[1] - row[0]) * tx;
+    float top = row[layerSize] + (row[layerSize+1] - row[layerSize]) * tx;
+    return bottom + (top - bottom) * ty;
+}
+
+uint64_t ChunkedTerrain::tileKey(int32_t x, int32_t y) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) | static_cast<uint32_t>(x);
+}
+
+int32_t ChunkedTerrain::floorDiv(int32_t a, int32_t b) {
+    int32_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+ChunkedTerrain::TileSource ChunkedTerrain::valueNoiseSource(uint64_t seed, float amplitude, float featureSize) {
+    return [seed, amplitude, featureSize](int32_t originX, int32_t originY, uint32_t size, float* heights){
+        constexpr uint32_t octaves = 6;
+
+        auto lattice = [seed](int32_t x, int32_t y, uint32_t octave){
+            return Utils::counterRandom(seed, static_cast<uint32_t>(x), static_cast<uint32_t>(y), octave);
+        };
+
+        for(uint32_t y = 0; y < size; y++){
+            for(uint32_t x = 0; x < size; x++){
+                float sum = 0.0f;
+                float weight = 0.0f;
+                float octaveAmplitude = 1.0f;
+                float frequency = 1.0f / featureSize;
+
+                for(uint32_t octave = 0; octave < octaves; octave++){
+                    float fx = static_cast<float>(originX + static_cast<int32_t>(x)) * frequency;
+                    float fy = static_cast<float>(originY + static_cast<int32_t>(y)) * frequency;
+                    auto ix = static_cast<int32_t>(std::floor(fx));
+                    auto iy = static_cast<int32_t>(std::floor(fy));
+                    float tx = fx - static_cast<float>(ix);
+                    float ty = fy - static_cast<float>(iy);
+                    tx = tx * tx * (3.0f - 2.0f * tx);
+                    ty = ty * ty * (3.0f - 2.0f * ty);
+
+                    float bottom = glm::mix(lattice(ix, iy, octave), lattice(ix+1, iy, octave), tx);
+                    float top = glm::mix(lattice(ix, iy+1, octave), lattice(ix+1, iy+1, octave), tx);
+
+                    sum += glm::mix(bottom, top, ty) * octaveAmplitude;
+                    weight += octaveAmplitude;
+                    octaveAmplitude *= 0.5f;
+                    frequency *= 2.0f;
+                }
+
+                heights[y * size + x] = sum / weight * amplitude;
+            }
+        }
+    };
+}
+
+ChunkedTerrain::TileSource ChunkedTerrain::fractalNoiseSource(const FractalNoise::Settings &settings, float amplitude) {
+    // Shared by every tile job, the noise is read only after construction
+    auto noise = std::make_shared<FractalNoise>(settings);
+    return [noise, amplitude](int32_t originX, int32_t originY, uint32_t size, float* heights){
+        noise->fill(originX, originY, size, size, heights, size);
+        for(std::size_t i = 0; i < static_cast<std::size_t>(size) * size; i++){
+            heights[i] *= amplitude;
+        }
+    };
+}
+
+ChunkedTerrain::TileSource ChunkedTerrain::heightTilesSource(std::shared_ptr<const HeightTiles> tiles) {
+    return [tiles = std::move(tiles)](int32_t originX, int32_t originY, uint32_t size, float* heights){
+        tiles->decodeRegion(originX, originY, size, size, heights);
+    };
+}
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/type_precision.hpp>
+
+#include "model/terrain/ClipmapTerrain.h"
+#include "defs/ShaderDefines.h"
+
+Logger ClipmapTerrain::m_logger = Logger("Clipmap Terrain");
+
+ClipmapTerrain::~ClipmapTerrain() {
+    if(m_gridVAO != -1){
+        glDeleteVertexArrays(1, &m_gridVAO);
+        glDeleteBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
+    }
+
+    if(m_heightArray != -1){
+        glMakeTextureHandleNonResidentARB(m_heightArrayHandle);
+        glDeleteTextures(1, &m_heightArray);
+    }
+
+    if(m_splatArray != -1){
+        glMakeTextureHandleNonResidentARB(m_splatArrayHandle);
+        glDeleteTextures(1, &m_splatArray);
+    }
+}
+
+void ClipmapTerrain::setLevelSize(uint32_t samples) {
+    m_blockSize = std::max(2u, (samples + 1) / 4);
+    m_gridSize = 4 * m_blockSize - 1;
+    m_textureSize = m_gridSize + 2;
+}
+
+void ClipmapTerrain::setLevelCount(uint32_t levels) {
+    m_levelCount = std::clamp(levels, 1u, static_cast<uint32_t>(MAX_CLIPMAP_LEVELS));
+}
+
+void ClipmapTerrain::setScale(float scale) {
+    m_worldScale = scale;
+}
+
+void ClipmapTerrain::setHeightSource(HeightSource source) {
+    m_heightSource = std::move(source);
+    std::fill(m_levelValid.begin(), m_levelValid.end(), false);
+}
+
+void ClipmapTerrain::setTextures(const std::vector<std::string> &textureFiles, float minHeight, float maxHeight) {
+    assert(textureFiles.size() <= MAX_TERRAIN_HEIGHT_TEXTURE);
+
+    m_splatSettings = SplatMap::evenHeights(static_cast<uint32_t>(textureFiles.size()), minHeight, maxHeight);
+    m_layerTextures = textureFiles.empty() ? nullptr : TextureArray::createTextureArray(textureFiles);
+
+    // Weights of resident samples were baked for the previous layers
+    std::fill(m_levelValid.begin(), m_levelValid.end(), false);
+}
+
+void ClipmapTerrain::setCamera(Camera &camera) {
+    camera.sig_position.connect(slt_cameraPosition);
+    camera.sig_VPMatrix.connect(m_frustumCulling.slt_updateVP);
+}
+
+void ClipmapTerrain::init() {
+    auto createArray = [this](GLuint& texture, GLuint64& handle, GLenum format, GLint filter, GLint wrap, const char* name){
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &texture);
+        glTextureStorage3D(texture, 1, format, static_cast<GLsizei>(m_textureSize), static_cast<GLsizei>(m_textureSize), static_cast<GLsizei>(m_levelCount));
+
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, filter);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, filter);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_S, wrap);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_T, wrap);
+
+        handle = glGetTextureHandleARB(texture);
+        if(handle == 0){
+            m_logger(Logger::ERROR) << "Unable to retrieve texture handle for clipmap " << name << " array" << '\n';
+            throw textureException();
+        }
+        glMakeTextureHandleResidentARB(handle);
+    };
+
+    createArray(m_heightArray, m_heightArrayHandle, GL_R32F, GL_NEAREST, GL_CLAMP_TO_EDGE, "height");
+    // Splat coordinates run continuously over the toroidal seam, wrapping turns them back into texels
+    createArray(m_splatArray, m_splatArrayHandle, GL_RGBA8, GL_LINEAR, GL_REPEAT, "splat");
+
+    m_origins.assign(m_levelCount, glm::ivec2(0));
+    m_levelValid.assign(m_levelCount, false);
+
+    buildGeometry();
+
+    m_logger(Logger::INFO) << "Initialized clipmap of " << m_levelCount << " levels with " << m_gridSize << "x" << m_gridSize << " samples" << '\n';
+}
+
+void ClipmapTerrain::update() {
+    if(m_gridVAO == -1)
+        return;
+
+    std::vector<glm::ivec2> origins;
+    levelOrigins(m_cameraPos, origins);
+
+    for(uint32_t level = 0; level < m_levelCount; level++){
+        if(!m_levelValid[level] || origins[level] != m_origins[level])
+            moveLevel(level, origins[level]);
+    }
+
+    buildDrawList();
+}
+
+void ClipmapTerrain::levelOrigins(const glm::vec3 &position, std::vector<glm::ivec2> &origins) const {
+    origins.resize(m_levelCount);
+
+    auto halfGrid = static_cast<int32_t>(m_gridSize-1) / 2;
+    auto cameraX = static_cast<int32_t>(std::floor(position.x / m_worldScale));
+    auto cameraY = static_cast<int32_t>(std::floor(position.z / m_worldScale));
+    origins[0] = {2 * floorDiv(cameraX - halfGrid, 2), 2 * floorDiv(cameraY - halfGrid, 2)};
+
+    // Finer level starts one ring block plus at most one sample into the coarser one, the trim covers the other side
+    auto ringOffset = static_cast<int32_t>(m_blockSize-1);
+    for(uint32_t level = 1; level < m_levelCount; level++){
+        origins[level] = {2 * floorDiv(origins[level-1].x / 2 - ringOffset, 2),
+                          2 * floorDiv(origins[level-1].y / 2 - ringOffset, 2)};
+    }
+}
+
+void ClipmapTerrain::moveLevel(uint32_t level, const glm::ivec2 &origin) {
+    auto size = static_cast<int32_t>(m_textureSize);
+    glm::ivec2 delta = origin - m_origins[level];
+    // Layer holds the grid and one sample around it
+    glm::ivec2 region = origin - glm::ivec2(1);
+
+    if(!m_levelValid[level] || std::abs(delta.x) >= size || std::abs(delta.y) >= size){
+        uploadRegion(level, region.x, region.y, m_textureSize, m_textureSize);
+        m_levelValid[level] = true;
+    }else{
+        // Only strips which entered the level, samples still inside stay where they are in the layer
+        if(delta.x > 0)
+            uploadRegion(level, region.x + size - delta.x, region.y, delta.x, m_textureSize);
+        else if(delta.x < 0)
+            uploadRegion(level, region.x, region.y, -delta.x, m_textureSize);
+
+        if(delta.y > 0)
+            uploadRegion(level, region.x, region.y + size - delta.y, m_textureSize, delta.y);
+        else if(delta.y < 0)
+            uploadRegion(level, region.x, region.y, m_textureSize, -delta.y);
+    }
+
+    m_origins[level] = origin;
+}
+
+void ClipmapTerrain::uploadRegion(uint32_t level, int32_t x, int32_t y, uint32_t width, uint32_t height) {
+    int32_t step = 1 << level;
+
+    // One extra sample around the region, so slopes of the splat weights don't need the neighbouring strips
+    uint32_t paddedWidth = width + 2;
+    uint32_t paddedHeight = height + 2;
+    m_regionHeights.resize(static_cast<std::size_t>(paddedWidth) * paddedHeight);
+    m_heightSource((x-1) * step, (y-1) * step, paddedWidth, paddedHeight, step, m_regionHeights.data());
+
+    for(uint32_t row = 1; row <= height; row++){
+        const float* heights = &m_regionHeights[static_cast<std::size_t>(row) * paddedWidth + 1];
+        auto [rowMin, rowMax] = std::minmax_element(heights, heights + width);
+        m_minHeight = std::min(m_minHeight, *rowMin);
+        m_maxHeight = std::max(m_maxHeight, *rowMax);
+    }
+
+    bool splat = m_splatSettings.layerCount > 0;
+    if(splat){
+        m_regionSplat.resize(m_regionHeights.size() * 4);
+        SplatMap::bake(m_splatSettings, m_regionHeights.data(), paddedWidth, paddedHeight, m_worldScale * static_cast<float>(step), m_regionSplat.data());
+    }
+
+    // Region wraps around the layer in up to four pieces
+    auto size = static_cast<int32_t>(m_textureSize);
+    int32_t texelX = ((x % size) + size) % size;
+    int32_t texelY = ((y % size) + size) % size;
+    uint32_t firstWidth = std::min(width, static_cast<uint32_t>(size - texelX));
+    uint32_t firstHeight = std::min(height, static_cast<uint32_t>(size - texelY));
+
+    const std::pair<uint32_t, uint32_t> piecesX[2] = {{0, firstWidth}, {firstWidth, width - firstWidth}};
+    const std::pair<uint32_t, uint32_t> piecesY[2] = {{0, firstHeight}, {firstHeight, height - firstHeight}};
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<GLint>(paddedWidth));
+    for(const auto& [offsetY, pieceHeight] : piecesY){
+        for(const auto& [offsetX, pieceWidth] : piecesX){
+            if(pieceWidth == 0 || pieceHeight == 0)
+                continue;
+
+            auto targetX = static_cast<GLint>((texelX + offsetX) % size);
+            auto targetY = static_cast<GLint>((texelY + offsetY) % size);
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, static_cast<GLint>(offsetX + 1));
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, static_cast<GLint>(offsetY + 1));
+
+            glTextureSubImage3D(m_heightArray, 0, targetX, targetY, static_cast<GLint>(level),
+                                static_cast<GLsizei>(pieceWidth), static_cast<GLsizei>(pieceHeight), 1,
+                                GL_RED, GL_FLOAT, m_regionHeights.data());
+            if(splat){
+                glTextureSubImage3D(m_splatArray, 0, targetX, targetY, static_cast<GLint>(level),
+                                    static_cast<GLsizei>(pieceWidth), static_cast<GLsizei>(pieceHeight), 1,
+                                    GL_RGBA, GL_UNSIGNED_BYTE, m_regionSplat.data());
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
+void ClipmapTerrain::buildGeometry() {
+    std::vector<glm::u16vec2> vertices;
+    std::vector<uint32_t> indices;
+
+    auto addMesh = [&](MeshType type, uint32_t sizeX, uint32_t sizeY){
+        auto base = static_cast<uint32_t>(vertices.size());
+        for(uint32_t y = 0; y < sizeY; y++){
+            for(uint32_t x = 0; x < sizeX; x++){
+                vertices.emplace_back(x, y);
+            }
+        }
+
+        // Every cell is split along the same diagonal, so a vertex morphing into the coarser level lies on its triangle
+        m_meshes[type].start = static_cast<uint32_t>(indices.size());
+        for(uint32_t y = 0; y+1 < sizeY; y++){
+            for(uint32_t x = 0; x+1 < sizeX; x++){
+                uint32_t i00 = base + y * sizeX + x;
+                uint32_t i10 = i00 + 1;
+                uint32_t i01 = i00 + sizeX;
+                uint32_t i11 = i01 + 1;
+                indices.insert(indices.end(), {i00, i01, i11, i00, i11, i10});
+            }
+        }
+        m_meshes[type].count = static_cast<uint32_t>(indices.size()) - m_meshes[type].start;
+    };
+
+    uint32_t m = m_blockSize;
+    addMesh(MESH_BLOCK, m, m);
+    addMesh(MESH_FIXUP_X, 3, m);
+    addMesh(MESH_FIXUP_Y, m, 3);
+    addMesh(MESH_TRIM_X, 2*m + 1, 2);
+    addMesh(MESH_TRIM_Y, 2, 2*m);
+    addMesh(MESH_CENTER, 2*m + 1, 2*m + 1);
+
+    glGenVertexArrays(1, &m_gridVAO);
+    glBindVertexArray(m_gridVAO);
+
+    glGenBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_gridBuffers[GRID_VB]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(vertices.size() * sizeof(glm::u16vec2)), vertices.data(), GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(GRID_POSITION_LOCATION);
+    glVertexAttribIPointer(GRID_POSITION_LOCATION, 2, GL_UNSIGNED_SHORT, sizeof(glm::u16vec2), (void*)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_gridBuffers[GRID_INSTANCE_VB]);
+
+    glEnableVertexAttribArray(CLIPMAP_INSTANCE_LOCATION);
+    glVertexAttribIPointer(CLIPMAP_INSTANCE_LOCATION, 4, GL_INT, sizeof(BlockInstance), (void*) offsetof(BlockInstance, origin));
+    glVertexAttribDivisor(CLIPMAP_INSTANCE_LOCATION, 1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridBuffers[GRID_INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(indices.size() * sizeof(uint32_t)), indices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+}
+
+void ClipmapTerrain::buildDrawList() {
+    m_drawCommands.clear();
+    m_instances.clear();
+
+    uint32_t m = m_blockSize;
+    // Block offsets along one side: two blocks, two samples wide gap, two blocks
+    const uint32_t blockOffsets[4] = {0, m-1, 2*m, 3*m-1};
+
+    for(uint32_t level = 0; level < m_levelCount; level++){
+        const glm::ivec2& origin = m_origins[level];
+
+        for(uint32_t blockY = 0; blockY < 4; blockY++){
+            for(uint32_t blockX = 0; blockX < 4; blockX++){
+                bool ring = blockX == 0 || blockX == 3 || blockY == 0 || blockY == 3;
+                if(ring)
+                    addBlock(MESH_BLOCK, level, origin + glm::ivec2(blockOffsets[blockX], blockOffsets[blockY]), m, m);
+            }
+        }
+
+        addBlock(MESH_FIXUP_X, level, origin + glm::ivec2(2*m-2, 0), 3, m);
+        addBlock(MESH_FIXUP_X, level, origin + glm::ivec2(2*m-2, 3*m-1), 3, m);
+        addBlock(MESH_FIXUP_Y, level, origin + glm::ivec2(0, 2*m-2), m, 3);
+        addBlock(MESH_FIXUP_Y, level, origin + glm::ivec2(3*m-1, 2*m-2), m, 3);
+
+        if(level == 0){
+            addBlock(MESH_CENTER, level, origin + glm::ivec2(m-1, m-1), 2*m+1, 2*m+1);
+            continue;
+        }
+
+        // Finer level sits at the low or the high end of the hole, the trim fills the remaining sample wide strip
+        glm::ivec2 finerStart = m_origins[level-1] / 2 - origin;
+        bool trimLowX = finerStart.x != static_cast<int32_t>(m-1);
+        bool trimLowY = finerStart.y != static_cast<int32_t>(m-1);
+
+        int32_t trimX = trimLowX ? static_cast<int32_t>(m-1) : static_cast<int32_t>(3*m-2);
+        int32_t trimY = trimLowY ? static_cast<int32_t>(m-1) : static_cast<int32_t>(3*m-2);
+        addBlock(MESH_TRIM_X, level, origin + glm::ivec2(m-1, trimY), 2*m+1, 2);
+        addBlock(MESH_TRIM_Y, level, origin + glm::ivec2(trimX, trimLowY ? m : m-1), 2, 2*m);
+    }
+
+    // Orphan the instance and command buffers every frame, the lists are rebuilt from scratch anyway
+    glNamedBufferData(m_gridBuffers[GRID_INSTANCE_VB], static_cast<GLsizeiptr>(m_instances.size() * sizeof(BlockInstance)), m_instances.data(), GL_STREAM_DRAW);
+    glNamedBufferData(m_gridBuffers[GRID_COMMAND_BUFFER], static_cast<GLsizeiptr>(m_drawCommands.size() * sizeof(DrawElementsIndirectCommand)), m_drawCommands.data(), GL_STREAM_DRAW);
+}
+
+void ClipmapTerrain::addBlock(MeshType mesh, uint32_t level, const glm::ivec2 &origin, uint32_t sizeX, uint32_t sizeY) {
+    float spacing = m_worldScale * static_cast<float>(1 << level);
+    glm::vec3 min(static_cast<float>(origin.x) * spacing, m_minHeight, static_cast<float>(origin.y) * spacing);
+    glm::vec3 max(static_cast<float>(origin.x + static_cast<int32_t>(sizeX-1)) * spacing, m_maxHeight, static_cast<float>(origin.y + static_cast<int32_t>(sizeY-1)) * spacing);
+
+    uint32_t planeMask = Utils::FrustumCulling::ALL_PLANES;
+    if(m_frustumCulling.classifyBox(min, max, planeMask) == Utils::FrustumCulling::Containment::OUTSIDE)
+        return;
+
+    DrawElementsIndirectCommand& command = m_drawCommands.emplace_back();
+    command.count = m_meshes[mesh].count;
+    command.instanceCount = 1;
+    command.firstIndex = m_meshes[mesh].start;
+    command.baseVertex = 0;
+    command.baseInstance = static_cast<uint32_t>(m_instances.size());
+
+    m_instances.push_back({{origin.x, origin.y, static_cast<int32_t>(level), 0}});
+}
+
+int32_t ClipmapTerrain::floorDiv(int32_t a, int32_t b) {
+    int32_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+ClipmapTerrain::HeightSource ClipmapTerrain::fractalNoiseSource(const FractalNoise::Settings &settings, float amplitude) {
+    auto noise = std::make_shared<FractalNoise>(settings);
+    return [noise, amplitude](int32_t originX, int32_t originY, uint32_t width, uint32_t height, int32_t step, float* heights){
+        noise->fillParallel(originX, originY, width, height, heights, width, step);
+        for(std::size_t i = 0; i < static_cast<std::size_t>(width) * height; i++){
+            heights[i] *= amplitude;
+        }
+    };
+}
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "model/terrain/Erosion.h"
+#include "ThreadPool.h"
+
+Logger Erosion::m_logger = Logger("Erosion");
+
+void Erosion::erode(const Settings &settings, Heightfield &heightfield, float spacing) {
+    if(!settings.enabled() || heightfield.empty())
+        return;
+
+    Grid grid;
+    grid.dimX = heightfield.dimX();
+    grid.dimY = heightfield.dimY();
+    grid.stride = grid.dimX + 2;
+    std::size_t size = grid.stride * (grid.dimY + 2);
+
+    grid.terrain.assign(size, 0.0f);
+    grid.flowLeft.assign(size, 0.0f);
+    grid.flowRight.assign(size, 0.0f);
+    grid.flowDown.assign(size, 0.0f);
+    grid.flowUp.assign(size, 0.0f);
+    if(settings.hydraulicIterations > 0){
+        grid.water.assign(size, 0.0f);
+        grid.sediment.assign(size, 0.0f);
+        grid.concentration.assign(size, 0.0f);
+        grid.slope.assign(size, 0.0f);
+    }
+
+    m_logger(Logger::DEBUG) << "Eroding " << grid.dimX << "x" << grid.dimY << " samples with " << settings.hydraulicIterations << " hydraulic and "
+                            << settings.thermalIterations << " thermal iterations" << '\n';
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t y = rowBegin; y < rowEnd; y++){
+            std::memcpy(&grid.terrain[grid.index(0, y)], &heightfield.heightAt(0, y), grid.dimX * sizeof(float));
+            if(!grid.water.empty()){
+                std::fill_n(&grid.water[grid.index(0, y)], grid.dimX, settings.rain * settings.timeStep);
+            }
+        }
+    }, 16);
+    copyBorder(grid, grid.terrain);
+
+    if(settings.hydraulicIterations > 0){
+        copyBorder(grid, grid.water);
+
+        for(uint32_t i = 0; i < settings.hydraulicIterations; i++){
+            pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){ hydraulicFlow(settings, grid, spacing, rowBegin, rowEnd); }, 16);
+            pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){ hydraulicErode(settings, grid, spacing, rowBegin, rowEnd); }, 16);
+            copyBorder(grid, grid.terrain);
+            copyBorder(grid, grid.water);
+        }
+
+        // Whatever the water still carries settles in place
+        pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){
+            for(uint32_t y = rowBegin; y < rowEnd; y++){
+                float* terrain = &grid.terrain[grid.index(0, y)];
+                const float* sediment = &grid.sediment[grid.index(0, y)];
+                for(uint32_t x = 0; x < grid.dimX; x++){
+                    terrain[x] += sediment[x];
+                }
+            }
+        }, 16);
+        copyBorder(grid, grid.terrain);
+
+        // Thermal passes reuse the flow planes, outflows left from the pipe model must not leak into them
+        std::fill(grid.flowLeft.begin(), grid.flowLeft.end(), 0.0f);
+        std::fill(grid.flowRight.begin(), grid.flowRight.end(), 0.0f);
+        std::fill(grid.flowDown.begin(), grid.flowDown.end(), 0.0f);
+        std::fill(grid.flowUp.begin(), grid.flowUp.end(), 0.0f);
+    }
+
+    for(uint32_t i = 0; i < settings.thermalIterations; i++){
+        pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){ thermalFlow(settings, grid, spacing, rowBegin, rowEnd); }, 16);
+        pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){ thermalApply(grid, rowBegin, rowEnd); }, 16);
+        copyBorder(grid, grid.terrain);
+    }
+
+    pool.parallelFor(0, grid.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t y = rowBegin; y < rowEnd; y++){
+            std::memcpy(&heightfield.heightAt(0, y), &grid.terrain[grid.index(0, y)], grid.dimX * sizeof(float));
+        }
+    }, 16);
+}
+
+void Erosion::copyBorder(const Grid &grid, std::vector<float> &plane) {
+    std::size_t lastRow = grid.index(0, grid.dimY) - 1;
+    std::memcpy(&plane[0], &plane[grid.stride], grid.stride * sizeof(float));
+    std::memcpy(&plane[lastRow], &plane[lastRow - grid.stride], grid.stride * sizeof(float));
+
+    for(std::size_t row = 0; row < grid.dimY + 2; row++){
+        float* samples = &plane[row * grid.stride];
+        samples[0] = samples[1];
+        samples[grid.dimX + 1] = samples[grid.dimX];
+    }
+}
+
+void Erosion::hydraulicFlow(const Settings &settings, Grid &grid, float spacing, uint32_t rowBegin, uint32_t rowEnd) {
+    const float flowFactor = settings.timeStep * settings.pipeFlow / spacing;
+    const float cellArea = spacing * spacing;
+    const float inverseSpacing = 0.5f / spacing;
+    const auto stride = static_cast<std::ptrdiff_t>(grid.stride);
+    const auto dimX = static_cast<std::ptrdiff_t>(grid.dimX);
+
+    for(uint32_t y = rowBegin; y < rowEnd; y++){
+        std::size_t row = grid.index(0, y);
+        const float* terrain = &grid.terrain[row];
+        const float* water = &grid.water[row];
+        const float* sediment = &grid.sediment[row];
+        float* concentration = &grid.concentration[row];
+        float* slope = &grid.slope[row];
+        float* left = &grid.flowLeft[row];
+        float* right = &grid.flowRight[row];
+        float* down = &grid.flowDown[row];
+        float* up = &grid.flowUp[row];
+
+        std::ptrdiff_t x = 0;
+#if defined(__AVX2__)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        auto surfaceAt = [&](std::ptrdiff_t i){ return _mm256_add_ps(_mm256_loadu_ps(terrain + i), _mm256_loadu_ps(water + i)); };
+
+        for(; x + 8 <= dimX; x += 8){
+            __m256 depth = _mm256_loadu_ps(water + x);
+            __m256 surface = _mm256_add_ps(_mm256_loadu_ps(terrain + x), depth);
+            auto pipe = [&](const float* flow, std::ptrdiff_t offset){
+                __m256 head = _mm256_sub_ps(surface, surfaceAt(x + offset));
+                return _mm256_max_ps(zero, _mm256_add_ps(_mm256_loadu_ps(flow + x), _mm256_mul_ps(_mm256_set1_ps(flowFactor), head)));
+            };
+            __m256 fl = pipe(left, -1);
+            __m256 fr = pipe(right, 1);
+            __m256 fd = pipe(down, -stride);
+            __m256 fu = pipe(up, stride);
+
+            __m256 outflow = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(fl, fr), _mm256_add_ps(fd, fu)), _mm256_set1_ps(settings.timeStep));
+            __m256 scale = _mm256_min_ps(one, _mm256_div_ps(_mm256_mul_ps(depth, _mm256_set1_ps(cellArea)), _mm256_max_ps(outflow, _mm256_set1_ps(1e-12f))));
+            _mm256_storeu_ps(left + x, _mm256_mul_ps(fl, scale));
+            _mm256_storeu_ps(right + x, _mm256_mul_ps(fr, scale));
+            _mm256_storeu_ps(down + x, _mm256_mul_ps(fd, scale));
+            _mm256_storeu_ps(up + x, _mm256_mul_ps(fu, scale));
+
+            _mm256_storeu_ps(concentration + x, _mm256_div_ps(_mm256_loadu_ps(sediment + x), _mm256_max_ps(depth, _mm256_set1_ps(1e-6f))));
+
+            __m256 dx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(terrain + x + 1), _mm256_loadu_ps(terrain + x - 1)), _mm256_set1_ps(inverseSpacing));
+            __m256 dy = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(terrain + x + stride), _mm256_loadu_ps(terrain + x - stride)), _mm256_set1_ps(inverseSpacing));
+            __m256 gradient = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 sine = _mm256_sqrt_ps(_mm256_div_ps(gradient, _mm256_add_ps(one, gradient)));
+            _mm256_storeu_ps(slope + x, _mm256_max_ps(_mm256_set1_ps(settings.minSlope), sine));
+        }
+#endif
+        for(; x < dimX; x++){
+            float surface = terrain[x] + water[x];
+            float fl = std::max(0.0f, left[x]  + flowFactor * (surface - terrain[x-1] - water[x-1]));
+            float fr = std::max(0.0f, right[x] + flowFactor * (surface - terrain[x+1] - water[x+1]));
+            float fd = std::max(0.0f, down[x]  + flowFactor * (surface - terrain[x-stride] - water[x-stride]));
+            float fu = std::max(0.0f, up[x]    + flowFactor * (surface - terrain[x+stride] - water[x+stride]));
+
+            // Outflow can't drain more water than the cell holds
+            float outflow = (fl + fr + fd + fu) * settings.timeStep;
+            float scale = std::min(1.0f, water[x] * cellArea / std::max(outflow, 1e-12f));
+            left[x] = fl * scale;
+            right[x] = fr * scale;
+            down[x] = fd * scale;
+            up[x] = fu * scale;
+
+            concentration[x] = sediment[x] / std::max(water[x], 1e-6f);
+
+            float dx = (terrain[x+1] - terrain[x-1]) * inverseSpacing;
+            float dy = (terrain[x+stride] - terrain[x-stride]) * inverseSpacing;
+            float gradient = dx*dx + dy*dy;
+            slope[x] = std::max(settings.minSlope, std::sqrt(gradient / (1.0f + gradient)));
+        }
+    }
+}
+
+void Erosion::hydraulicErode(const Settings &settings, Grid &grid, float spacing, uint32_t rowBegin, uint32_t rowEnd) {
+    const float volumeToDepth = settings.timeStep / (spacing * spacing);
+    const float inverseSpacing = 1.0f / spacing;
+    const float evaporation = std::max(0.0f, 1.0f - settings.evaporation * settings.timeStep);
+    const float rain = settings.rain * settings.timeStep;
+    const auto stride = static_cast<std::ptrdiff_t>(grid.stride);
+    const auto dimX = static_cast<std::ptrdiff_t>(grid.dimX);
+
+    for(uint32_t y = rowBegin; y < rowEnd; y++){
+        std::size_t row = grid.index(0, y);
+        float* terrain = &grid.terrain[row];
+        float* water = &grid.water[row];
+        float* sediment = &grid.sediment[row];
+        const float* concentration = &grid.concentration[row];
+        const float* slope = &grid.slope[row];
+        const float* left = &grid.flowLeft[row];
+        const float* right = &grid.flowRight[row];
+        const float* down = &grid.flowDown[row];
+        const float* up = &grid.flowUp[row];
+
+        std::ptrdiff_t x = 0;
+#if defined(__AVX2__)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 toDepth = _mm256_set1_ps(volumeToDepth);
+        auto at = [](const float* plane, std::ptrdiff_t i){ return _mm256_loadu_ps(plane + i); };
+
+        for(; x + 8 <= dimX; x += 8){
+            __m256 fl = at(left, x);
+            __m256 fr = at(right, x);
+            __m256 fd = at(down, x);
+            __m256 fu = at(up, x);
+            __m256 inLeft = at(right, x - 1);
+            __m256 inRight = at(left, x + 1);
+            __m256 inDown = at(up, x - stride);
+            __m256 inUp = at(down, x + stride);
+
+            __m256 inflow = _mm256_add_ps(_mm256_add_ps(inLeft, inRight), _mm256_add_ps(inDown, inUp));
+            __m256 outflow = _mm256_add_ps(_mm256_add_ps(fl, fr), _mm256_add_ps(fd, fu));
+            __m256 depth = _mm256_max_ps(zero, _mm256_add_ps(at(water, x), _mm256_mul_ps(_mm256_sub_ps(inflow, outflow), toDepth)));
+
+            __m256 sedimentIn = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(inLeft, at(concentration, x - 1)), _mm256_mul_ps(inRight, at(concentration, x + 1))),
+                                              _mm256_add_ps(_mm256_mul_ps(inDown, at(concentration, x - stride)), _mm256_mul_ps(inUp, at(concentration, x + stride))));
+            __m256 sedimentOut = _mm256_mul_ps(outflow, at(concentration, x));
+            __m256 carried = _mm256_max_ps(zero, _mm256_add_ps(at(sediment, x), _mm256_mul_ps(_mm256_sub_ps(sedimentIn, sedimentOut), toDepth)));
+
+            __m256 passX = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(inLeft, fl), _mm256_sub_ps(fr, inRight)), half);
+            __m256 passY = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(inDown, fd), _mm256_sub_ps(fu, inUp)), half);
+            __m256 discharge = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(passX, passX), _mm256_mul_ps(passY, passY))), _mm256_set1_ps(inverseSpacing));
+
+            __m256 difference = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(settings.capacity), at(slope, x)), discharge), carried);
+            __m256 rate = _mm256_blendv_ps(_mm256_set1_ps(settings.deposition), _mm256_set1_ps(settings.dissolving), _mm256_cmp_ps(difference, zero, _CMP_GT_OQ));
+            __m256 exchanged = _mm256_mul_ps(rate, difference);
+
+            _mm256_storeu_ps(terrain + x, _mm256_sub_ps(at(terrain, x), exchanged));
+            _mm256_storeu_ps(sediment + x, _mm256_add_ps(carried, exchanged));
+            _mm256_storeu_ps(water + x, _mm256_add_ps(_mm256_mul_ps(depth, _mm256_set1_ps(evaporation)), _mm256_set1_ps(rain)));
+        }
+#endif
+        for(; x < dimX; x++){
+            float inflow = right[x-1] + left[x+1] + up[x-stride] + down[x+stride];
+            float outflow = left[x] + right[x] + down[x] + up[x];
+            float depth = std::max(0.0f, water[x] + (inflow - outflow) * volumeToDepth);
+
+            // Sediment moves with the water between the same pipes, so none of it gets lost on the way
+            float sedimentIn = right[x-1] * concentration[x-1] + left[x+1] * concentration[x+1]
+                             + up[x-stride] * concentration[x-stride] + down[x+stride] * concentration[x+stride];
+            float carried = std::max(0.0f, sediment[x] + (sedimentIn - outflow * concentration[x]) * volumeToDepth);
+
+            // Water passing through the cell per unit of width, independent of how shallow it is
+            float passX = (right[x-1] - left[x] + right[x] - left[x+1]) * 0.5f;
+            float passY = (up[x-stride] - down[x] + up[x] - down[x+stride]) * 0.5f;
+            float discharge = std::sqrt(passX*passX + passY*passY) * inverseSpacing;
+
+            float difference = settings.capacity * slope[x] * discharge - carried;
+            float exchanged = (difference > 0.0f ? settings.dissolving : settings.deposition) * difference;
+
+            terrain[x] -= exchanged;
+            sediment[x] = carried + exchanged;
+            water[x] = depth * evaporation + rain;
+        }
+    }
+}
+
+void Erosion::thermalFlow(const Settings &settings, Grid &grid, float spacing, uint32_t rowBegin, uint32_t rowEnd) {
+    const float talus = settings.talus * spacing;
+    const float rate = settings.thermalRate * 0.5f;
+    const auto stride = static_cast<std::ptrdiff_t>(grid.stride);
+    const auto dimX = static_cast<std::ptrdiff_t>(grid.dimX);
+
+    for(uint32_t y = rowBegin; y < rowEnd; y++){
+        std::size_t row = grid.index(0, y);
+        const float* terrain = &grid.terrain[row];
+        float* left = &grid.flowLeft[row];
+        float* right = &grid.flowRight[row];
+        float* down = &grid.flowDown[row];
+        float* up = &grid.flowUp[row];
+
+        std::ptrdiff_t x = 0;
+#if defined(__AVX2__)
+        const __m256 zero = _mm256_setzero_ps();
+        for(; x + 8 <= dimX; x += 8){
+            __m256 height = _mm256_loadu_ps(terrain + x);
+            auto excess = [&](std::ptrdiff_t offset){
+                return _mm256_max_ps(zero, _mm256_sub_ps(_mm256_sub_ps(height, _mm256_loadu_ps(terrain + x + offset)), _mm256_set1_ps(talus)));
+            };
+            __m256 excessLeft = excess(-1);
+            __m256 excessRight = excess(1);
+            __m256 excessDown = excess(-stride);
+            __m256 excessUp = excess(stride);
+
+            __m256 total = _mm256_add_ps(_mm256_add_ps(excessLeft, excessRight), _mm256_add_ps(excessDown, excessUp));
+            __m256 largest = _mm256_max_ps(_mm256_max_ps(excessLeft, excessRight), _mm256_max_ps(excessDown, excessUp));
+            __m256 share = _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(rate), largest), _mm256_max_ps(total, _mm256_set1_ps(1e-12f)));
+
+            _mm256_storeu_ps(left + x, _mm256_mul_ps(excessLeft, share));
+            _mm256_storeu_ps(right + x, _mm256_mul_ps(excessRight, share));
+            _mm256_storeu_ps(down + x, _mm256_mul_ps(excessDown, share));
+            _mm256_storeu_ps(up + x, _mm256_mul_ps(excessUp, share));
+        }
+#endif
+        for(; x < dimX; x++){
+            float excessLeft = std::max(0.0f, terrain[x] - terrain[x-1] - talus);
+            float excessRight = std::max(0.0f, terrain[x] - terrain[x+1] - talus);
+            float excessDown = std::max(0.0f, terrain[x] - terrain[x-stride] - talus);
+            float excessUp = std::max(0.0f, terrain[x] - terrain[x+stride] - talus);
+
+            // Moving half of the largest excess at most never turns a slope the other way around
+            float total = excessLeft + excessRight + excessDown + excessUp;
+            float largest = std::max(std::max(excessLeft, excessRight), std::max(excessDown, excessUp));
+            float share = rate * largest / std::max(total, 1e-12f);
+
+            left[x] = excessLeft * share;
+            right[x] = excessRight * share;
+            down[x] = excessDown * share;
+            up[x] = excessUp * share;
+        }
+    }
+}
+
+void Erosion::thermalApply(Grid &grid, uint32_t rowBegin, uint32_t rowEnd) {
+    const auto stride = static_cast<std::ptrdiff_t>(grid.stride);
+    const auto dimX = static_cast<std::ptrdiff_t>(grid.dimX);
+
+    for(uint32_t y = rowBegin; y < rowEnd; y++){
+        std::size_t row = grid.index(0, y);
+        float* terrain = &grid.terrain[row];
+        const float* left = &grid.flowLeft[row];
+        const float* right = &grid.flowRight[row];
+        const float* down = &grid.flowDown[row];
+        const float* up = &grid.flowUp[row];
+
+        std::ptrdiff_t x = 0;
+#if defined(__AVX2__)
+        for(; x + 8 <= dimX; x += 8){
+            __m256 inflow = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(right + x - 1), _mm256_loadu_ps(left + x + 1)),
+                                          _mm256_add_ps(_mm256_loadu_ps(up + x - stride), _mm256_loadu_ps(down + x + stride)));
+            __m256 outflow = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(left + x), _mm256_loadu_ps(right + x)),
+                                           _mm256_add_ps(_mm256_loadu_ps(down + x), _mm256_loadu_ps(up + x)));
+            _mm256_storeu_ps(terrain + x, _mm256_add_ps(_mm256_loadu_ps(terrain + x), _mm256_sub_ps(inflow, outflow)));
+        }
+#endif
+        for(; x < dimX; x++){
+            float inflow = right[x-1] + left[x+1] + up[x-stride] + down[x+stride];
+            float outflow = left[x] + right[x] + down[x] + up[x];
+            terrain[x] += inflow - outflow;
+        }
+    }
+}
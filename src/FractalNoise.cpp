@@ -0,0 +1,247 @@
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "model/terrain/FractalNoise.h"
+#include "ThreadPool.h"
+#include "utils.h"
+
+namespace {
+    // Eight gradient directions, chosen by the lowest three bits of the lattice hash
+    alignas(32) constexpr float GRAD_X[8] = {1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f};
+    alignas(32) constexpr float GRAD_Y[8] = {1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f};
+
+    inline float fade(float t){
+        return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+    }
+}
+
+FractalNoise::FractalNoise(const Settings &settings) : m_settings(settings) {
+    m_settings.octaves = std::clamp(m_settings.octaves, 1u, MAX_OCTAVES);
+
+    for(int32_t i = 0; i < 256; i++){
+        m_perm[i] = i;
+    }
+    for(uint32_t i = 255; i > 0; i--){
+        float r = Utils::counterRandom(m_settings.seed, i, 0, 0) * 0.5f + 0.5f;
+        auto j = std::min(static_cast<uint32_t>(r * static_cast<float>(i + 1)), i);
+        std::swap(m_perm[i], m_perm[j]);
+    }
+    std::copy(m_perm, m_perm + 256, m_perm + 256);
+
+    for(uint32_t octave = 0; octave < MAX_OCTAVES; octave++){
+        m_octaveOffsets[octave] = {Utils::counterRandom(m_settings.seed, octave, 0, 1) * 128.0f,
+                                   Utils::counterRandom(m_settings.seed, octave, 1, 1) * 128.0f};
+    }
+}
+
+void FractalNoise::fill(int32_t originX, int32_t originY, uint32_t width, uint32_t height, float *out, std::size_t stride, int32_t step) const {
+    alignas(32) float x[BLOCK];
+    alignas(32) float y[BLOCK];
+    alignas(32) float values[BLOCK];
+
+    for(uint32_t row = 0; row < height; row++){
+        std::fill(y, y + BLOCK, static_cast<float>(originY + static_cast<int32_t>(row) * step));
+        float* outRow = out + row * stride;
+
+        // Partial blocks are evaluated whole, so every sample takes the same code path wherever it lies in a tile
+        for(uint32_t column = 0; column < width; column += BLOCK){
+            for(uint32_t l = 0; l < BLOCK; l++){
+                x[l] = static_cast<float>(originX + static_cast<int32_t>(column + l) * step);
+            }
+            fractalBlock(x, y, values);
+            std::copy(values, values + std::min(BLOCK, width - column), outRow + column);
+        }
+    }
+}
+
+void FractalNoise::fillParallel(int32_t originX, int32_t originY, uint32_t width, uint32_t height, float *out, std::size_t stride, int32_t step) const {
+    ThreadPool::getInstance().parallelFor(0, height, [&](uint32_t rowBegin, uint32_t rowEnd){
+        fill(originX, originY + static_cast<int32_t>(rowBegin) * step, width, rowEnd - rowBegin, out + rowBegin * stride, stride, step);
+    }, 8);
+}
+
+void FractalNoise::fractalBlock(const float *x, const float *y, float *out) const {
+    switch(m_settings.mode){
+        case Mode::FBM:
+            fbmBlock(x, y, out);
+            break;
+
+        case Mode::RIDGED:
+            ridgedBlock(x, y, out);
+            break;
+
+        case Mode::DOMAIN_WARP: {
+            alignas(32) float warpX[BLOCK];
+            alignas(32) float warpY[BLOCK];
+            alignas(32) float shifted[BLOCK];
+
+            // Displacement fields are the same fBm sampled far away from the base one
+            fbmBlock(x, y, warpX);
+            for(uint32_t l = 0; l < BLOCK; l++){
+                shifted[l] = x[l] + 5.2f * m_settings.featureSize;
+            }
+            fbmBlock(shifted, y, warpY);
+
+            alignas(32) float wx[BLOCK];
+            alignas(32) float wy[BLOCK];
+            for(uint32_t l = 0; l < BLOCK; l++){
+                wx[l] = x[l] + warpX[l] * m_settings.warpStrength;
+                wy[l] = y[l] + warpY[l] * m_settings.warpStrength;
+            }
+            fbmBlock(wx, wy, out);
+            break;
+        }
+    }
+}
+
+void FractalNoise::fbmBlock(const float *x, const float *y, float *out) const {
+    alignas(32) float px[BLOCK];
+    alignas(32) float py[BLOCK];
+    alignas(32) float octave[BLOCK];
+
+    std::fill(out, out + BLOCK, 0.0f);
+    float frequency = 1.0f / m_settings.featureSize;
+    float amplitude = 1.0f;
+    float weight = 0.0f;
+
+    for(uint32_t o = 0; o < m_settings.octaves; o++){
+        for(uint32_t l = 0; l < BLOCK; l++){
+            px[l] = x[l] * frequency + m_octaveOffsets[o].x;
+            py[l] = y[l] * frequency + m_octaveOffsets[o].y;
+        }
+        noiseBlock(px, py, octave);
+        for(uint32_t l = 0; l < BLOCK; l++){
+            out[l] += octave[l] * amplitude;
+        }
+
+        weight += amplitude;
+        amplitude *= m_settings.gain;
+        frequency *= m_settings.lacunarity;
+    }
+
+    for(uint32_t l = 0; l < BLOCK; l++){
+        out[l] /= weight;
+    }
+}
+
+void FractalNoise::ridgedBlock(const float *x, const float *y, float *out) const {
+    alignas(32) float px[BLOCK];
+    alignas(32) float py[BLOCK];
+    alignas(32) float octave[BLOCK];
+    alignas(32) float prev[BLOCK];
+
+    std::fill(out, out + BLOCK, 0.0f);
+    std::fill(prev, prev + BLOCK, 1.0f);
+    float frequency = 1.0f / m_settings.featureSize;
+    float amplitude = 1.0f;
+    float weight = 0.0f;
+
+    for(uint32_t o = 0; o < m_settings.octaves; o++){
+        for(uint32_t l = 0; l < BLOCK; l++){
+            px[l] = x[l] * frequency + m_octaveOffsets[o].x;
+            py[l] = y[l] * frequency + m_octaveOffsets[o].y;
+        }
+        noiseBlock(px, py, octave);
+
+        // Finer octaves are damped in valleys of the coarser ones
+        for(uint32_t l = 0; l < BLOCK; l++){
+            float ridge = 1.0f - std::abs(octave[l]);
+            ridge *= ridge;
+            out[l] += ridge * amplitude * prev[l];
+            prev[l] = ridge;
+        }
+
+        weight += amplitude;
+        amplitude *= m_settings.gain;
+        frequency *= m_settings.lacunarity;
+    }
+
+    for(uint32_t l = 0; l < BLOCK; l++){
+        out[l] = out[l] / weight * 2.0f - 1.0f;
+    }
+}
+
+void FractalNoise::noiseBlock(const float *x, const float *y, float *out) const {
+#if defined(__AVX2__)
+    const __m256 vx = _mm256_load_ps(x);
+    const __m256 vy = _mm256_load_ps(y);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i oneI = _mm256_set1_epi32(1);
+    const __m256i gradMask = _mm256_set1_epi32(7);
+    const __m256 gradX = _mm256_load_ps(GRAD_X);
+    const __m256 gradY = _mm256_load_ps(GRAD_Y);
+
+    __m256 floorX = _mm256_floor_ps(vx);
+    __m256 floorY = _mm256_floor_ps(vy);
+    __m256 fx = _mm256_sub_ps(vx, floorX);
+    __m256 fy = _mm256_sub_ps(vy, floorY);
+
+    __m256i cellX = _mm256_and_si256(_mm256_cvttps_epi32(floorX), mask);
+    __m256i cellY = _mm256_and_si256(_mm256_cvttps_epi32(floorY), mask);
+
+    __m256i permX0 = _mm256_i32gather_epi32(m_perm, cellX, 4);
+    __m256i permX1 = _mm256_i32gather_epi32(m_perm, _mm256_add_epi32(cellX, oneI), 4);
+    __m256i cellY1 = _mm256_add_epi32(cellY, oneI);
+
+    __m256i h00 = _mm256_i32gather_epi32(m_perm, _mm256_add_epi32(permX0, cellY), 4);
+    __m256i h10 = _mm256_i32gather_epi32(m_perm, _mm256_add_epi32(permX1, cellY), 4);
+    __m256i h01 = _mm256_i32gather_epi32(m_perm, _mm256_add_epi32(permX0, cellY1), 4);
+    __m256i h11 = _mm256_i32gather_epi32(m_perm, _mm256_add_epi32(permX1, cellY1), 4);
+
+    auto gradient = [&](__m256i hash, __m256 dx, __m256 dy){
+        __m256i index = _mm256_and_si256(hash, gradMask);
+        return _mm256_add_ps(_mm256_mul_ps(_mm256_permutevar8x32_ps(gradX, index), dx),
+                             _mm256_mul_ps(_mm256_permutevar8x32_ps(gradY, index), dy));
+    };
+
+    __m256 fx1 = _mm256_sub_ps(fx, one);
+    __m256 fy1 = _mm256_sub_ps(fy, one);
+    __m256 n00 = gradient(h00, fx, fy);
+    __m256 n10 = gradient(h10, fx1, fy);
+    __m256 n01 = gradient(h01, fx, fy1);
+    __m256 n11 = gradient(h11, fx1, fy1);
+
+    auto fadeV = [&](__m256 t){
+        __m256 inner = _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f));
+        return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+    };
+    auto lerp = [](__m256 a, __m256 b, __m256 t){
+        return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+    };
+
+    __m256 u = fadeV(fx);
+    __m256 v = fadeV(fy);
+    _mm256_store_ps(out, lerp(lerp(n00, n10, u), lerp(n01, n11, u), v));
+#else
+    for(uint32_t l = 0; l < BLOCK; l++){
+        float floorX = std::floor(x[l]);
+        float floorY = std::floor(y[l]);
+        float fx = x[l] - floorX;
+        float fy = y[l] - floorY;
+
+        int32_t cellX = static_cast<int32_t>(floorX) & 255;
+        int32_t cellY = static_cast<int32_t>(floorY) & 255;
+
+        auto gradient = [](int32_t hash, float dx, float dy){
+            return GRAD_X[hash & 7] * dx + GRAD_Y[hash & 7] * dy;
+        };
+
+        float n00 = gradient(m_perm[m_perm[cellX] + cellY], fx, fy);
+        float n10 = gradient(m_perm[m_perm[cellX+1] + cellY], fx - 1.0f, fy);
+        float n01 = gradient(m_perm[m_perm[cellX] + cellY+1], fx, fy - 1.0f);
+        float n11 = gradient(m_perm[m_perm[cellX+1] + cellY+1], fx - 1.0f, fy - 1.0f);
+
+        float u = fade(fx);
+        float v = fade(fy);
+        float bottom = n00 + (n10 - n00) * u;
+        float top = n01 + (n11 - n01) * u;
+        out[l] = bottom + (top - bottom) * v;
+    }
+#endif
+}
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <filesystem>
+#include <string>
+
+#include "model/terrain/HeightTiles.h"
+#include "ThreadPool.h"
+#include "exceptions.h"
+
+Logger HeightTiles::m_logger = Logger("Height Tiles");
+
+namespace {
+    constexpr char TILES_MAGIC[4] = {'T', 'T', 'H', 'T'};
+    constexpr uint32_t TILES_VERSION = 1;
+
+    // Quotients from this length on are cut short and followed by the raw residual
+    constexpr uint32_t RICE_ESCAPE = 24;
+    constexpr uint32_t RESIDUAL_BITS = 17;
+    constexpr uint32_t MAX_RICE_PARAMETER = 16;
+
+    struct TilesHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t dimX;
+        uint32_t dimY;
+        uint32_t tileSize;
+        uint32_t tileCount;
+    };
+
+    /**
+     * @brief Appends bits to a byte vector, least significant bit first.
+     */
+    class BitWriter {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+        void write(uint64_t bits, uint32_t count) {
+            m_buffer |= bits << m_count;
+            m_count += count;
+            while(m_count >= 8){
+                m_out.push_back(static_cast<uint8_t>(m_buffer));
+                m_buffer >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        void flush() {
+            if(m_count > 0)
+                m_out.push_back(static_cast<uint8_t>(m_buffer));
+            m_buffer = 0;
+            m_count = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& m_out;
+        uint64_t m_buffer = 0;
+        uint32_t m_count = 0;
+    };
+
+    /**
+     * @brief Reads bits written by BitWriter. Reading past the end returns zero bits.
+     */
+    class BitReader {
+    public:
+        BitReader(const uint8_t* data, const uint8_t* end) : m_data(data), m_end(end) {}
+
+        uint32_t read(uint32_t count) {
+            refill();
+            auto bits = static_cast<uint32_t>(m_buffer & ((uint64_t(1) << count) - 1));
+            m_buffer >>= count;
+            m_count -= count;
+            return bits;
+        }
+
+        /**
+         * @brief Reads a unary quotient, zero bits terminated by a one bit.
+         */
+        uint32_t readUnary() {
+            refill();
+            auto zeros = std::min<uint32_t>(std::countr_zero(m_buffer), RICE_ESCAPE);
+            m_buffer >>= zeros + 1;
+            m_count -= zeros + 1;
+            return zeros;
+        }
+
+    private:
+        void refill() {
+            while(m_count <= 56){
+                uint64_t byte = m_data < m_end ? *m_data++ : 0;
+                m_buffer |= byte << m_count;
+                m_count += 8;
+            }
+        }
+
+        const uint8_t* m_data;
+        const uint8_t* m_end;
+        uint64_t m_buffer = 0;
+        uint32_t m_count = 0;
+    };
+
+    /**
+     * Second order predictor, the plane through the left, upper and upper left neighbours corrected by the change
+     * of slope over the previous samples. Terrain is smooth, so mostly the quantization noise is left over.
+     *
+     * @brief Predicts a sample from the already decoded part of the tile.
+     */
+    inline int32_t predict(const uint16_t* curr, const uint16_t* prev, const uint16_t* prev2, uint32_t x, uint32_t y) {
+        int32_t prediction;
+        if(y == 0){
+            prediction = x == 0 ? 0 : x == 1 ? curr[0] : 2 * curr[x-1] - curr[x-2];
+        }else if(x == 0){
+            prediction = y == 1 ? prev[0] : 2 * prev[0] - prev2[0];
+        }else{
+            int32_t left = curr[x-1];
+            int32_t up = prev[x];
+            int32_t upLeft = prev[x-1];
+            prediction = left + up - upLeft;
+            if(x > 1 && y > 1){
+                prediction += ((left - curr[x-2]) - (upLeft - prev[x-2]) + (up - prev2[x]) - (upLeft - prev2[x-1])) / 2;
+            }
+        }
+        return std::clamp<int32_t>(prediction, 0, std::numeric_limits<uint16_t>::max());
+    }
+
+    inline uint32_t zigzag(int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    inline int32_t unzigzag(uint32_t value) {
+        return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+    }
+
+    inline uint32_t riceLength(uint32_t value, uint32_t parameter) {
+        uint32_t quotient = value >> parameter;
+        return quotient < RICE_ESCAPE ? quotient + 1 + parameter : RICE_ESCAPE + 1 + RESIDUAL_BITS;
+    }
+}
+
+HeightTiles::HeightTiles(const char *filename) : m_file(filename) {
+    m_data = m_file.data();
+    m_size = m_file.size();
+    parse(filename);
+
+    m_logger(Logger::DEBUG) << "Mapped " << m_dimX << "x" << m_dimY << " samples in " << std::to_string(m_tiles.size()) << " tiles from " << filename << '\n';
+}
+
+HeightTiles HeightTiles::encode(const float *heights, uint32_t dimX, uint32_t dimY, std::size_t stride, uint32_t tileSize, float maxError) {
+    HeightTiles tiles;
+    if(dimX == 0 || dimY == 0 || tileSize == 0)
+        return tiles;
+
+    tiles.m_dimX = dimX;
+    tiles.m_dimY = dimY;
+    tiles.m_tileSize = tileSize;
+    tiles.m_tilesX = (dimX + tileSize - 1) / tileSize;
+    tiles.m_tilesY = (dimY + tileSize - 1) / tileSize;
+
+    uint32_t tileCount = tiles.m_tilesX * tiles.m_tilesY;
+    std::vector<TileEntry> entries(tileCount);
+    std::vector<std::vector<uint8_t>> blobs(tileCount);
+
+    ThreadPool::getInstance().parallelFor(0, tileCount, [&](uint32_t begin, uint32_t end){
+        for(uint32_t i = begin; i < end; i++){
+            uint32_t tileX = i % tiles.m_tilesX;
+            uint32_t tileY = i / tiles.m_tilesX;
+            auto [width, height] = tiles.tileExtent(tileX, tileY);
+            const float* origin = heights + static_cast<std::size_t>(tileY) * tileSize * stride + static_cast<std::size_t>(tileX) * tileSize;
+            encodeTile(origin, stride, width, height, maxError, entries[i], blobs[i]);
+        }
+    });
+
+    uint64_t offset = sizeof(TilesHeader) + tileCount * sizeof(TileEntry);
+    for(uint32_t i = 0; i < tileCount; i++){
+        entries[i].offset = offset;
+        entries[i].size = blobs[i].size();
+        offset += blobs[i].size();
+    }
+
+    TilesHeader header{};
+    std::memcpy(header.magic, TILES_MAGIC, sizeof(TILES_MAGIC));
+    header.version = TILES_VERSION;
+    header.dimX = dimX;
+    header.dimY = dimY;
+    header.tileSize = tileSize;
+    header.tileCount = tileCount;
+
+    tiles.m_buffer.resize(offset);
+    std::memcpy(tiles.m_buffer.data(), &header, sizeof(TilesHeader));
+    std::memcpy(tiles.m_buffer.data() + sizeof(TilesHeader), entries.data(), tileCount * sizeof(TileEntry));
+    for(uint32_t i = 0; i < tileCount; i++){
+        std::memcpy(tiles.m_buffer.data() + entries[i].offset, blobs[i].data(), blobs[i].size());
+    }
+
+    tiles.m_data = tiles.m_buffer.data();
+    tiles.m_size = tiles.m_buffer.size();
+    tiles.m_tiles = std::move(entries);
+
+    m_logger(Logger::DEBUG) << "Encoded " << dimX << "x" << dimY << " samples into " << std::to_string(tiles.m_size) << " bytes, "
+                            << static_cast<float>(static_cast<double>(static_cast<std::size_t>(dimX) * dimY * sizeof(float)) / static_cast<double>(tiles.m_size))
+                            << " times smaller than floats" << '\n';
+    return tiles;
+}
+
+HeightTiles HeightTiles::encode(const Heightfield &heightfield, uint32_t tileSize, float maxError) {
+    return encode(heightfield.heights(), heightfield.dimX(), heightfield.dimY(), heightfield.dimX(), tileSize, maxError);
+}
+
+void HeightTiles::save(const char *filename) const {
+    // Written next to the target and renamed, a crash never leaves a half written file behind
+    std::string tmpFile = std::string(filename) + ".tmp";
+    std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+    if(!out)
+        throw fileException("Unable to write height tiles ", filename);
+
+    out.write(reinterpret_cast<const char*>(m_data), static_cast<std::streamsize>(m_size));
+    out.close();
+
+    std::error_code error;
+    std::filesystem::rename(tmpFile, filename, error);
+    if(!out || error){
+        std::filesystem::remove(tmpFile, error);
+        throw fileException("Unable to write height tiles ", filename);
+    }
+
+    m_logger(Logger::INFO) << "Saved " << m_dimX << "x" << m_dimY << " samples in " << std::to_string(m_tiles.size()) << " tiles to " << filename << '\n';
+}
+
+std::pair<float, float> HeightTiles::tileRange(uint32_t tileX, uint32_t tileY) const {
+    const TileEntry& entry = m_tiles[static_cast<std::size_t>(tileY) * m_tilesX + tileX];
+    return {entry.minHeight, entry.maxHeight};
+}
+
+void HeightTiles::decodeTile(uint32_t tileX, uint32_t tileY, float *out, std::size_t stride) const {
+    const TileEntry& entry = m_tiles[static_cast<std::size_t>(tileY) * m_tilesX + tileX];
+    auto [width, height] = tileExtent(tileX, tileY);
+
+    const uint8_t* blob = m_data + entry.offset;
+    const uint8_t* parameters = blob;
+    BitReader reader(blob + height, blob + entry.size);
+
+    std::vector<uint16_t> rows(static_cast<std::size_t>(width) * 3);
+    uint16_t* prev2 = rows.data();
+    uint16_t* prev = rows.data() + width;
+    uint16_t* curr = rows.data() + 2 * width;
+
+    for(uint32_t y = 0; y < height; y++){
+        uint32_t parameter = parameters[y];
+        float* outRow = out + static_cast<std::size_t>(y) * stride;
+
+        for(uint32_t x = 0; x < width; x++){
+            uint32_t quotient = reader.readUnary();
+            uint32_t value = quotient < RICE_ESCAPE ? (quotient << parameter) | reader.read(parameter) : reader.read(RESIDUAL_BITS);
+
+            auto sample = static_cast<uint16_t>(predict(curr, prev, prev2, x, y) + unzigzag(value));
+            curr[x] = sample;
+            outRow[x] = entry.minHeight + static_cast<float>(sample) * entry.step;
+        }
+        std::swap(prev2, prev);
+        std::swap(prev, curr);
+    }
+}
+
+void HeightTiles::decodeRegion(int32_t originX, int32_t originY, uint32_t width, uint32_t height, float *out) const {
+    if(m_tiles.empty() || width == 0 || height == 0)
+        return;
+
+    auto clampX = [&](int64_t x){ return static_cast<uint32_t>(std::clamp<int64_t>(x, 0, m_dimX-1)); };
+    auto clampY = [&](int64_t y){ return static_cast<uint32_t>(std::clamp<int64_t>(y, 0, m_dimY-1)); };
+    uint32_t firstTileX = clampX(originX) / m_tileSize;
+    uint32_t lastTileX = clampX(static_cast<int64_t>(originX) + width - 1) / m_tileSize;
+    uint32_t firstTileY = clampY(originY) / m_tileSize;
+    uint32_t lastTileY = clampY(static_cast<int64_t>(originY) + height - 1) / m_tileSize;
+
+    std::vector<float> tile(static_cast<std::size_t>(m_tileSize) * m_tileSize);
+    for(uint32_t tileY = firstTileY; tileY <= lastTileY; tileY++){
+        for(uint32_t tileX = firstTileX; tileX <= lastTileX; tileX++){
+            decodeTile(tileX, tileY, tile.data(), m_tileSize);
+
+            for(uint32_t row = 0; row < height; row++){
+                uint32_t y = clampY(static_cast<int64_t>(originY) + row);
+                if(y / m_tileSize != tileY)
+                    continue;
+
+                const float* tileRow = &tile[static_cast<std::size_t>(y - tileY * m_tileSize) * m_tileSize];
+                float* outRow = out + static_cast<std::size_t>(row) * width;
+                for(uint32_t column = 0; column < width; column++){
+                    uint32_t x = clampX(static_cast<int64_t>(originX) + column);
+                    if(x / m_tileSize == tileX){
+                        outRow[column] = tileRow[x - tileX * m_tileSize];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void HeightTiles::parse(const char *name) {
+    TilesHeader header{};
+    if(m_size < sizeof(TilesHeader))
+        throw fileException("File ", name, " is too small for height tiles");
+
+    std::memcpy(&header, m_data, sizeof(TilesHeader));
+    if(std::memcmp(header.magic, TILES_MAGIC, sizeof(TILES_MAGIC)) != 0 || header.version != TILES_VERSION)
+        throw fileException("File ", name, " doesn't contain height tiles of version ", std::to_string(TILES_VERSION));
+
+    if(header.tileSize == 0 || header.dimX == 0 || header.dimY == 0)
+        throw fileException("Height tiles ", name, " are empty");
+
+    m_dimX = header.dimX;
+    m_dimY = header.dimY;
+    m_tileSize = header.tileSize;
+    m_tilesX = (m_dimX + m_tileSize - 1) / m_tileSize;
+    m_tilesY = (m_dimY + m_tileSize - 1) / m_tileSize;
+
+    std::size_t tableEnd = sizeof(TilesHeader) + static_cast<std::size_t>(header.tileCount) * sizeof(TileEntry);
+    if(static_cast<std::size_t>(m_tilesX) * m_tilesY != header.tileCount || tableEnd > m_size)
+        throw fileException("Height tiles ", name, " are damaged");
+
+    m_tiles.resize(header.tileCount);
+    std::memcpy(m_tiles.data(), m_data + sizeof(TilesHeader), header.tileCount * sizeof(TileEntry));
+    for(uint32_t i = 0; i < header.tileCount; i++){
+        const TileEntry& entry = m_tiles[i];
+        if(entry.offset < tableEnd || entry.offset + entry.size > m_size || entry.size < tileExtent(i % m_tilesX, i / m_tilesX).second)
+            throw fileException("Height tiles ", name, " are damaged");
+    }
+}
+
+std::pair<uint32_t, uint32_t> HeightTiles::tileExtent(uint32_t tileX, uint32_t tileY) const {
+    return {std::min(m_tileSize, m_dimX - tileX * m_tileSize), std::min(m_tileSize, m_dimY - tileY * m_tileSize)};
+}
+
+void HeightTiles::encodeTile(const float *heights, std::size_t stride, uint32_t width, uint32_t height, float maxError, TileEntry &entry, std::vector<uint8_t> &out) {
+    float minHeight = std::numeric_limits<float>::infinity();
+    float maxHeight = -std::numeric_limits<float>::infinity();
+    for(uint32_t y = 0; y < height; y++){
+        auto [rowMin, rowMax] = std::minmax_element(heights + y * stride, heights + y * stride + width);
+        minHeight = std::min(minHeight, *rowMin);
+        maxHeight = std::max(maxHeight, *rowMax);
+    }
+    // Never finer than 16 bits over the range of the tile, coarser if the allowed error permits it
+    entry.minHeight = minHeight;
+    entry.maxHeight = maxHeight;
+    entry.step = std::max((maxHeight - minHeight) / static_cast<float>(std::numeric_limits<uint16_t>::max()), 2.0f * maxError);
+    float scale = entry.step > 0.0f ? 1.0f / entry.step : 0.0f;
+
+    std::vector<uint16_t> rows(static_cast<std::size_t>(width) * 3);
+    std::vector<uint32_t> residuals(width);
+    uint16_t* prev2 = rows.data();
+    uint16_t* prev = rows.data() + width;
+    uint16_t* curr = rows.data() + 2 * width;
+
+    // Rice parameters of all rows come first, the bit stream follows
+    out.assign(height, 0);
+    BitWriter writer(out);
+
+    for(uint32_t y = 0; y < height; y++){
+        const float* row = heights + y * stride;
+        for(uint32_t x = 0; x < width; x++){
+            curr[x] = static_cast<uint16_t>(std::lround(std::clamp((row[x] - minHeight) * scale, 0.0f, 65535.0f)));
+            residuals[x] = zigzag(static_cast<int32_t>(curr[x]) - predict(curr, prev, prev2, x, y));
+        }
+
+        uint32_t bestParameter = 0;
+        uint64_t bestLength = std::numeric_limits<uint64_t>::max();
+        for(uint32_t parameter = 0; parameter <= MAX_RICE_PARAMETER; parameter++){
+            uint64_t length = 0;
+            for(uint32_t x = 0; x < width; x++){
+                length += riceLength(residuals[x], parameter);
+            }
+            if(length < bestLength){
+                bestLength = length;
+                bestParameter = parameter;
+            }
+        }
+        out[y] = static_cast<uint8_t>(bestParameter);
+
+        for(uint32_t x = 0; x < width; x++){
+            uint32_t quotient = residuals[x] >> bestParameter;
+            if(quotient < RICE_ESCAPE){
+                writer.write(uint64_t(1) << quotient, quotient + 1);
+                writer.write(residuals[x] & ((1u << bestParameter) - 1), bestParameter);
+            }else{
+                writer.write(uint64_t(1) << RICE_ESCAPE, RICE_ESCAPE + 1);
+                writer.write(residuals[x], RESIDUAL_BITS);
+            }
+        }
+        std::swap(prev2, prev);
+        std::swap(prev, curr);
+    }
+    writer.flush();
+}
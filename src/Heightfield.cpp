@@ -0,0 +1,418 @@
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <glm/geometric.hpp>
+
+#include "model/terrain/Heightfield.h"
+#include "ThreadPool.h"
+
+namespace {
+    /**
+     * @brief Extends min and max by the values in the span.
+     */
+    void minMaxSpan(const float* data, std::size_t count, float& min, float& max){
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        __m256 vMin = _mm256_set1_ps(min);
+        __m256 vMax = _mm256_set1_ps(max);
+        for(; i + 8 <= count; i += 8){
+            __m256 v = _mm256_loadu_ps(data + i);
+            vMin = _mm256_min_ps(vMin, v);
+            vMax = _mm256_max_ps(vMax, v);
+        }
+        alignas(32) float lanes[16];
+        _mm256_store_ps(lanes, vMin);
+        _mm256_store_ps(lanes + 8, vMax);
+        for(uint32_t l = 0; l < 8; l++){
+            min = std::min(min, lanes[l]);
+            max = std::max(max, lanes[8 + l]);
+        }
+#elif defined(__SSE2__)
+        __m128 vMin = _mm_set1_ps(min);
+        __m128 vMax = _mm_set1_ps(max);
+        for(; i + 4 <= count; i += 4){
+            __m128 v = _mm_loadu_ps(data + i);
+            vMin = _mm_min_ps(vMin, v);
+            vMax = _mm_max_ps(vMax, v);
+        }
+        alignas(16) float lanes[8];
+        _mm_store_ps(lanes, vMin);
+        _mm_store_ps(lanes + 4, vMax);
+        for(uint32_t l = 0; l < 4; l++){
+            min = std::min(min, lanes[l]);
+            max = std::max(max, lanes[4 + l]);
+        }
+#endif
+        for(; i < count; i++){
+            min = std::min(min, data[i]);
+            max = std::max(max, data[i]);
+        }
+    }
+
+    /**
+     * @brief Maps values in the span by value * scale + offset and extends min and max by the results.
+     */
+    void remapSpan(float* data, std::size_t count, float scale, float offset, float& min, float& max){
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        __m256 vScale = _mm256_set1_ps(scale);
+        __m256 vOffset = _mm256_set1_ps(offset);
+        __m256 vMin = _mm256_set1_ps(min);
+        __m256 vMax = _mm256_set1_ps(max);
+        for(; i + 8 <= count; i += 8){
+            __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(data + i), vScale), vOffset);
+            _mm256_storeu_ps(data + i, v);
+            vMin = _mm256_min_ps(vMin, v);
+            vMax = _mm256_max_ps(vMax, v);
+        }
+        alignas(32) float lanes[16];
+        _mm256_store_ps(lanes, vMin);
+        _mm256_store_ps(lanes + 8, vMax);
+        for(uint32_t l = 0; l < 8; l++){
+            min = std::min(min, lanes[l]);
+            max = std::max(max, lanes[8 + l]);
+        }
+#elif defined(__SSE2__)
+        __m128 vScale = _mm_set1_ps(scale);
+        __m128 vOffset = _mm_set1_ps(offset);
+        __m128 vMin = _mm_set1_ps(min);
+        __m128 vMax = _mm_set1_ps(max);
+        for(; i + 4 <= count; i += 4){
+            __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(data + i), vScale), vOffset);
+            _mm_storeu_ps(data + i, v);
+            vMin = _mm_min_ps(vMin, v);
+            vMax = _mm_max_ps(vMax, v);
+        }
+        alignas(16) float lanes[8];
+        _mm_store_ps(lanes, vMin);
+        _mm_store_ps(lanes + 4, vMax);
+        for(uint32_t l = 0; l < 4; l++){
+            min = std::min(min, lanes[l]);
+            max = std::max(max, lanes[4 + l]);
+        }
+#endif
+        for(; i < count; i++){
+            data[i] = data[i] * scale + offset;
+            min = std::min(min, data[i]);
+            max = std::max(max, data[i]);
+        }
+    }
+}
+
+void Heightfield::resize(uint32_t dimX, uint32_t dimY) {
+    m_dimX = dimX;
+    m_dimY = dimY;
+
+    m_heights.assign(static_cast<std::size_t>(m_dimX) * m_dimY, 0.0f);
+    m_normals.assign(static_cast<std::size_t>(m_dimX) * m_dimY, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+void Heightfield::clear() {
+    m_dimX = 0;
+    m_dimY = 0;
+
+    m_heights.clear();
+    m_heights.shrink_to_fit();
+    m_normals.clear();
+    m_normals.shrink_to_fit();
+}
+
+std::pair<float, float> Heightfield::calcMinMax() const {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    std::mutex mergeMutex;
+
+    ThreadPool::getInstance().parallelFor(0, m_dimY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        float localMin = std::numeric_limits<float>::infinity();
+        float localMax = -std::numeric_limits<float>::infinity();
+        minMaxSpan(&m_heights[xy2i(0, rowBegin)], static_cast<std::size_t>(rowEnd - rowBegin) * m_dimX, localMin, localMax);
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        min = std::min(min, localMin);
+        max = std::max(max, localMax);
+    }, 16);
+
+    return {min, max};
+}
+
+std::pair<float, float> Heightfield::calcMinMax(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+
+    for(uint32_t row = y; row < y + height; row++){
+        minMaxSpan(&m_heights[xy2i(x, row)], width, min, max);
+    }
+
+    return {min, max};
+}
+
+std::pair<float, float> Heightfield::normalizeAndCalcNormals(float srcMin, float srcMax, float dstMin, float dstMax, float spacing) {
+    if(srcMax <= srcMin){
+        calcNormals(spacing);
+        return {srcMin, srcMax};
+    }
+
+    float scale = (dstMax - dstMin) / (srcMax - srcMin);
+    float offset = dstMin - srcMin * scale;
+    return remapAndCalcNormals(scale, offset, spacing);
+}
+
+void Heightfield::normalize(float srcMin, float srcMax, float dstMin, float dstMax) {
+    if(srcMax <= srcMin || empty())
+        return;
+
+    float scale = (dstMax - dstMin) / (srcMax - srcMin);
+    float offset = dstMin - srcMin * scale;
+    ThreadPool::getInstance().parallelFor(0, m_dimY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        float min = 0.0f, max = 0.0f;
+        remapSpan(&m_heights[xy2i(0, rowBegin)], static_cast<std::size_t>(rowEnd - rowBegin) * m_dimX, scale, offset, min, max);
+    }, 16);
+}
+
+std::pair<float, float> Heightfield::calcNormals(float spacing) {
+    return remapAndCalcNormals(1.0f, 0.0f, spacing);
+}
+
+void Heightfield::calcNormals(float spacing, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    for(uint32_t row = y; row < y + height; row++){
+        const float* prev = &m_heights[xy2i(0, row > 0 ? row-1 : row)];
+        const float* next = &m_heights[xy2i(0, row+1 < m_dimY ? row+1 : row)];
+        const float* curr = &m_heights[xy2i(0, row)];
+
+        for(uint32_t column = x; column < x + width; column++){
+            float nx = curr[column > 0 ? column-1 : column] - curr[column+1 < m_dimX ? column+1 : column];
+            float nz = prev[column] - next[column];
+            m_normals[xy2i(column, row)] = glm::normalize(glm::vec3(nx, 2.0f * spacing, nz));
+        }
+    }
+}
+
+std::pair<float, float> Heightfield::remapAndCalcNormals(float scale, float offset, float spacing) {
+    if(empty()){
+        return {0.0f, 0.0f};
+    }
+
+    ThreadPool& pool = ThreadPool::getInstance();
+    uint32_t bandCount = std::min(m_dimY, pool.threadCount() * 4);
+
+    // Bands remap their own rows in place, rows bordering a neighbouring band are copied before the sweep
+    std::vector<float> borders(static_cast<std::size_t>(bandCount) * 2 * m_dimX);
+    for(uint32_t band = 0; band < bandCount; band++){
+        uint32_t rowBegin = static_cast<uint32_t>(static_cast<uint64_t>(m_dimY) * band / bandCount);
+        uint32_t rowEnd = static_cast<uint32_t>(static_cast<uint64_t>(m_dimY) * (band+1) / bandCount);
+        uint32_t above = rowBegin > 0 ? rowBegin - 1 : 0;
+        uint32_t below = std::min(rowEnd, m_dimY - 1);
+        std::memcpy(&borders[static_cast<std::size_t>(band*2) * m_dimX], &m_heights[xy2i(0, above)], m_dimX * sizeof(float));
+        std::memcpy(&borders[static_cast<std::size_t>(band*2+1) * m_dimX], &m_heights[xy2i(0, below)], m_dimX * sizeof(float));
+    }
+
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    std::mutex mergeMutex;
+
+    pool.parallelFor(0, bandCount, [&](uint32_t bandBegin, uint32_t bandEnd){
+        float localMin = std::numeric_limits<float>::infinity();
+        float localMax = -std::numeric_limits<float>::infinity();
+
+        for(uint32_t band = bandBegin; band < bandEnd; band++){
+            uint32_t rowBegin = static_cast<uint32_t>(static_cast<uint64_t>(m_dimY) * band / bandCount);
+            uint32_t rowEnd = static_cast<uint32_t>(static_cast<uint64_t>(m_dimY) * (band+1) / bandCount);
+            const float* above = &borders[static_cast<std::size_t>(band*2) * m_dimX];
+            const float* below = &borders[static_cast<std::size_t>(band*2+1) * m_dimX];
+
+            // Row is remapped one step behind, once the row after it no longer needs its original heights
+            for(uint32_t y = rowBegin; y < rowEnd; y++){
+                const float* prev = y == rowBegin ? above : &m_heights[xy2i(0, y-1)];
+                const float* next = y+1 == rowEnd ? below : &m_heights[xy2i(0, y+1)];
+                normalsRow(y, prev, &m_heights[xy2i(0, y)], next, scale, spacing);
+
+                if(y > rowBegin){
+                    remapSpan(&m_heights[xy2i(0, y-1)], m_dimX, scale, offset, localMin, localMax);
+                }
+            }
+            remapSpan(&m_heights[xy2i(0, rowEnd-1)], m_dimX, scale, offset, localMin, localMax);
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        min = std::min(min, localMin);
+        max = std::max(max, localMax);
+    });
+
+    return {min, max};
+}
+
+void Heightfield::normalsRow(uint32_t y, const float* prev, const float* curr, const float* next, float scale, float spacing) {
+    float* out = reinterpret_cast<float*>(&m_normals[xy2i(0, y)]);
+    float ny = 2.0f * spacing;
+
+    auto normalAt = [&](uint32_t x){
+        float left = curr[x > 0 ? x-1 : x];
+        float right = curr[x+1 < m_dimX ? x+1 : x];
+        float nx = (left - right) * scale;
+        float nz = (prev[x] - next[x]) * scale;
+        float invLength = 1.0f / std::sqrt(nx*nx + ny*ny + nz*nz);
+        out[x*3]     = nx * invLength;
+        out[x*3 + 1] = ny * invLength;
+        out[x*3 + 2] = nz * invLength;
+    };
+
+    if(m_dimX < 3){
+        for(uint32_t x = 0; x < m_dimX; x++){
+            normalAt(x);
+        }
+        return;
+    }
+
+    normalAt(0);
+
+    uint32_t x = 1;
+#if defined(__AVX2__)
+    __m256 vScale = _mm256_set1_ps(scale);
+    __m256 vNy2 = _mm256_set1_ps(ny * ny);
+    __m256 vNy = _mm256_set1_ps(ny);
+    __m256 vOne = _mm256_set1_ps(1.0f);
+    alignas(32) float lanes[24];
+    for(; x + 8 < m_dimX; x += 8){
+        __m256 nx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(curr + x - 1), _mm256_loadu_ps(curr + x + 1)), vScale);
+        __m256 nz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(prev + x), _mm256_loadu_ps(next + x)), vScale);
+        __m256 lengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(nz, nz)), vNy2);
+        __m256 invLength = _mm256_div_ps(vOne, _mm256_sqrt_ps(lengthSq));
+        _mm256_store_ps(lanes, _mm256_mul_ps(nx, invLength));
+        _mm256_store_ps(lanes + 8, _mm256_mul_ps(vNy, invLength));
+        _mm256_store_ps(lanes + 16, _mm256_mul_ps(nz, invLength));
+        for(uint32_t l = 0; l < 8; l++){
+            out[(x+l)*3]     = lanes[l];
+            out[(x+l)*3 + 1] = lanes[8 + l];
+            out[(x+l)*3 + 2] = lanes[16 + l];
+        }
+    }
+#elif defined(__SSE2__)
+    __m128 vScale = _mm_set1_ps(scale);
+    __m128 vNy2 = _mm_set1_ps(ny * ny);
+    __m128 vNy = _mm_set1_ps(ny);
+    __m128 vOne = _mm_set1_ps(1.0f);
+    alignas(16) float lanes[12];
+    for(; x + 4 < m_dimX; x += 4){
+        __m128 nx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(curr + x - 1), _mm_loadu_ps(curr + x + 1)), vScale);
+        __m128 nz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(prev + x), _mm_loadu_ps(next + x)), vScale);
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(nz, nz)), vNy2);
+        __m128 invLength = _mm_div_ps(vOne, _mm_sqrt_ps(lengthSq));
+        _mm_store_ps(lanes, _mm_mul_ps(nx, invLength));
+        _mm_store_ps(lanes + 4, _mm_mul_ps(vNy, invLength));
+        _mm_store_ps(lanes + 8, _mm_mul_ps(nz, invLength));
+        for(uint32_t l = 0; l < 4; l++){
+            out[(x+l)*3]     = lanes[l];
+            out[(x+l)*3 + 1] = lanes[4 + l];
+            out[(x+l)*3 + 2] = lanes[8 + l];
+        }
+    }
+#endif
+    for(; x < m_dimX; x++){
+        normalAt(x);
+    }
+}
+
+void Heightfield::sampleSurface(const glm::vec2 *positions, std::size_t count, const glm::vec2 &origin, float spacing, float *heights, glm::vec3 *normals) const {
+    if(m_dimX < 2 || m_dimY < 2)
+        return;
+
+    float invSpacing = 1.0f / spacing;
+    const float* samples = m_heights.data();
+
+    // Every triangle is a plane h = base + fx * dx + fy * dy over the local coordinates of its cell.
+    // Cells with even x + y are split from (0,0) to (1,1), odd ones from (1,0) to (0,1).
+    auto sample = [&](std::size_t i){
+        float gx = std::clamp((positions[i].x - origin.x) * invSpacing, 0.0f, static_cast<float>(m_dimX-1));
+        float gy = std::clamp((positions[i].y - origin.y) * invSpacing, 0.0f, static_cast<float>(m_dimY-1));
+        uint32_t ix = std::min(static_cast<uint32_t>(gx), m_dimX-2);
+        uint32_t iy = std::min(static_cast<uint32_t>(gy), m_dimY-2);
+        float fx = gx - static_cast<float>(ix);
+        float fy = gy - static_cast<float>(iy);
+
+        const float* cell = samples + xy2i(ix, iy);
+        float h00 = cell[0], h10 = cell[1], h01 = cell[m_dimX], h11 = cell[m_dimX+1];
+
+        bool anti = (ix + iy) & 1;
+        bool upper = anti ? fx + fy >= 1.0f : fx <= fy;
+        float dx = upper ? h11 - h01 : h10 - h00;
+        float dy = upper != anti ? h01 - h00 : h11 - h10;
+        float base = anti && upper ? h11 - dx - dy : h00;
+
+        heights[i] = base + fx * dx + fy * dy;
+        if(normals){
+            normals[i] = glm::normalize(glm::vec3(-dx * invSpacing, 1.0f, -dy * invSpacing));
+        }
+    };
+
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 vOriginX = _mm256_set1_ps(origin.x);
+    const __m256 vOriginY = _mm256_set1_ps(origin.y);
+    const __m256 vInvSpacing = _mm256_set1_ps(invSpacing);
+    const __m256 vZero = _mm256_setzero_ps();
+    const __m256 vOne = _mm256_set1_ps(1.0f);
+    const __m256 vMaxX = _mm256_set1_ps(static_cast<float>(m_dimX-1));
+    const __m256 vMaxY = _mm256_set1_ps(static_cast<float>(m_dimY-1));
+    const __m256 vCellMaxX = _mm256_set1_ps(static_cast<float>(m_dimX-2));
+    const __m256 vCellMaxY = _mm256_set1_ps(static_cast<float>(m_dimY-2));
+    const __m256i vDimX = _mm256_set1_epi32(static_cast<int32_t>(m_dimX));
+    const __m256i vOddBit = _mm256_set1_epi32(1);
+    alignas(32) float lanes[24];
+
+    for(; i + 8 <= count; i += 8){
+        // Split interleaved XZ pairs into two registers
+        __m256 a = _mm256_loadu_ps(&positions[i].x);
+        __m256 b = _mm256_loadu_ps(&positions[i+4].x);
+        __m256 px = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0))), _MM_SHUFFLE(3,1,2,0)));
+        __m256 py = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1))), _MM_SHUFFLE(3,1,2,0)));
+
+        __m256 gx = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(px, vOriginX), vInvSpacing), vZero), vMaxX);
+        __m256 gy = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(py, vOriginY), vInvSpacing), vZero), vMaxY);
+        __m256 cellX = _mm256_min_ps(_mm256_floor_ps(gx), vCellMaxX);
+        __m256 cellY = _mm256_min_ps(_mm256_floor_ps(gy), vCellMaxY);
+        __m256 fx = _mm256_sub_ps(gx, cellX);
+        __m256 fy = _mm256_sub_ps(gy, cellY);
+
+        __m256i ix = _mm256_cvttps_epi32(cellX);
+        __m256i iy = _mm256_cvttps_epi32(cellY);
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(iy, vDimX), ix);
+
+        __m256 h00 = _mm256_i32gather_ps(samples, index, 4);
+        __m256 h10 = _mm256_i32gather_ps(samples + 1, index, 4);
+        __m256 h01 = _mm256_i32gather_ps(samples + m_dimX, index, 4);
+        __m256 h11 = _mm256_i32gather_ps(samples + m_dimX + 1, index, 4);
+
+        __m256 anti = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_add_epi32(ix, iy), vOddBit), vOddBit));
+        __m256 upper = _mm256_blendv_ps(_mm256_cmp_ps(fx, fy, _CMP_LE_OQ),
+                                        _mm256_cmp_ps(_mm256_add_ps(fx, fy), vOne, _CMP_GE_OQ),
+                                        anti);
+        __m256 dx = _mm256_blendv_ps(_mm256_sub_ps(h10, h00), _mm256_sub_ps(h11, h01), upper);
+        __m256 dy = _mm256_blendv_ps(_mm256_sub_ps(h11, h10), _mm256_sub_ps(h01, h00), _mm256_xor_ps(upper, anti));
+        __m256 base = _mm256_blendv_ps(h00, _mm256_sub_ps(_mm256_sub_ps(h11, dx), dy), _mm256_and_ps(anti, upper));
+
+        _mm256_storeu_ps(heights + i, _mm256_add_ps(base, _mm256_add_ps(_mm256_mul_ps(fx, dx), _mm256_mul_ps(fy, dy))));
+
+        if(normals){
+            __m256 nx = _mm256_mul_ps(dx, vInvSpacing);
+            __m256 nz = _mm256_mul_ps(dy, vInvSpacing);
+            __m256 invLength = _mm256_div_ps(vOne, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(nz, nz)), vOne)));
+            _mm256_store_ps(lanes, _mm256_mul_ps(nx, invLength));
+            _mm256_store_ps(lanes + 8, invLength);
+            _mm256_store_ps(lanes + 16, _mm256_mul_ps(nz, invLength));
+            for(uint32_t l = 0; l < 8; l++){
+                normals[i+l] = {-lanes[l], lanes[8 + l], -lanes[16 + l]};
+            }
+        }
+    }
+#endif
+    for(; i < count; i++){
+        sample(i);
+    }
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+
+#include "model/terrain/HorizonCulling.h"
+
+namespace {
+    // Points closer to the camera plane than this aren't projected, boxes touching them stay visible
+    constexpr float MIN_CLIP_W = 1e-3f;
+
+    float nearestDistance(const glm::vec3& point, const HorizonCulling::Box& box) {
+        return glm::distance(point, glm::clamp(point, box.min, box.max));
+    }
+
+    float farthestDistance(const glm::vec3& point, const HorizonCulling::Box& box) {
+        glm::vec3 farthest(std::abs(point.x - box.min.x) > std::abs(point.x - box.max.x) ? box.min.x : box.max.x,
+                           std::abs(point.y - box.min.y) > std::abs(point.y - box.max.y) ? box.min.y : box.max.y,
+                           std::abs(point.z - box.min.z) > std::abs(point.z - box.max.z) ? box.min.z : box.max.z);
+        return glm::distance(point, farthest);
+    }
+}
+
+void HorizonCulling::setColumns(uint32_t columns) {
+    m_horizon.resize(std::max(columns, 1u));
+}
+
+void HorizonCulling::update(const glm::mat4 &VP) {
+    m_VP = VP;
+}
+
+void HorizonCulling::cull(const std::vector<Box> &occluders, const std::vector<Box> &boxes, std::vector<uint8_t> &visible) {
+    std::fill(m_horizon.begin(), m_horizon.end(), -std::numeric_limits<float>::infinity());
+    visible.assign(boxes.size(), 1);
+
+    // Boxes are tested once the camera reaches their nearest point, occluders are drawn once it passes their farthest one
+    m_events.clear();
+    m_events.reserve(occluders.size() + boxes.size());
+    for(uint32_t i = 0; i < boxes.size(); i++){
+        m_events.push_back({nearestDistance(m_cameraPos, boxes[i]), i, false});
+    }
+    for(uint32_t i = 0; i < occluders.size(); i++){
+        m_events.push_back({farthestDistance(m_cameraPos, occluders[i]), i, true});
+    }
+    std::sort(m_events.begin(), m_events.end(), [](const Event& a, const Event& b){
+        return a.distance < b.distance || (a.distance == b.distance && !a.occluder && b.occluder);
+    });
+
+    for(const Event& event : m_events){
+        if(event.occluder){
+            rasterize(occluders[event.index]);
+        }else{
+            visible[event.index] = isOccluded(boxes[event.index]) ? 0 : 1;
+        }
+    }
+}
+
+bool HorizonCulling::project(const glm::vec3 &point, glm::vec3 &projected) const {
+    glm::vec4 clip = m_VP * glm::vec4(point, 1.0f);
+    if(clip.w < MIN_CLIP_W)
+        return false;
+
+    projected.x = (clip.x / clip.w * 0.5f + 0.5f) * static_cast<float>(m_horizon.size());
+    projected.y = clip.y / clip.w;
+    projected.z = 0.0f;
+    return true;
+}
+
+void HorizonCulling::rasterize(const Box &occluder) {
+    // Top face at the minimum height, everything below it is solid
+    const glm::vec3 corners[4] = {{occluder.min.x, occluder.min.y, occluder.min.z},
+                                  {occluder.max.x, occluder.min.y, occluder.min.z},
+                                  {occluder.max.x, occluder.min.y, occluder.max.z},
+                                  {occluder.min.x, occluder.min.y, occluder.max.z}};
+    glm::vec3 projected[4];
+    float left = std::numeric_limits<float>::infinity();
+    float right = -std::numeric_limits<float>::infinity();
+    for(uint32_t i = 0; i < 4; i++){
+        if(!project(corners[i], projected[i]))
+            return;
+        left = std::min(left, projected[i].x);
+        right = std::max(right, projected[i].x);
+    }
+
+    // Upper edge of the projected quad, the highest of the edges spanning the position
+    auto upperEdge = [&](float x){
+        float top = -std::numeric_limits<float>::infinity();
+        for(uint32_t i = 0; i < 4; i++){
+            const glm::vec3& a = projected[i];
+            const glm::vec3& b = projected[(i+1) % 4];
+            if(x < std::min(a.x, b.x) || x > std::max(a.x, b.x))
+                continue;
+            float t = b.x != a.x ? (x - a.x) / (b.x - a.x) : 1.0f;
+            top = std::max(top, b.x != a.x ? a.y + (b.y - a.y) * t : std::max(a.y, b.y));
+        }
+        return top;
+    };
+
+    // Only columns fully covered count, the edge is concave so its lowest point over a column lies on a column border
+    auto first = static_cast<int64_t>(std::ceil(std::max(left, 0.0f)));
+    auto last = static_cast<int64_t>(std::floor(std::min(right, static_cast<float>(m_horizon.size())))) - 1;
+    for(int64_t column = first; column <= last; column++){
+        float covered = std::min(upperEdge(static_cast<float>(column)), upperEdge(static_cast<float>(column + 1)));
+        m_horizon[column] = std::max(m_horizon[column], covered);
+    }
+}
+
+bool HorizonCulling::isOccluded(const Box &box) const {
+    float left = std::numeric_limits<float>::infinity();
+    float right = -std::numeric_limits<float>::infinity();
+    float top = -std::numeric_limits<float>::infinity();
+
+    for(uint32_t i = 0; i < 8; i++){
+        glm::vec3 corner(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+        glm::vec3 projected;
+        if(!project(corner, projected))
+            return false;
+        left = std::min(left, projected.x);
+        right = std::max(right, projected.x);
+        top = std::max(top, projected.y);
+    }
+
+    // Boxes beside the screen are left to frustum culling
+    auto columns = static_cast<float>(m_horizon.size());
+    if(right < 0.0f || left > columns)
+        return false;
+
+    auto first = static_cast<std::size_t>(std::max(left, 0.0f));
+    auto last = std::min(static_cast<std::size_t>(std::max(right, 0.0f)), m_horizon.size() - 1);
+    for(std::size_t column = first; column <= last; column++){
+        if(top >= m_horizon[column])
+            return false;
+    }
+    return true;
+}
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <glm/common.hpp>
+
 #include "model/terrain/LODManager.h"
 
 Logger LODManager::m_logger = Logger("LOD Manager");
@@ -12,10 +17,11 @@ void LODManager::init(uint32_t maxLOD, uint32_t patchesX, uint32_t patchesY, flo
     m_dimX = m_patchesX * (m_patchSize-1) + 1;
     m_dimY = m_patchesY * (m_patchSize-1) + 1;
 
-    m_map.resize(m_patchesY);
-    for(uint32_t y = 0; y < patchesY; y++){
-        m_map.at(y).resize(m_patchesX);
-    }
+    m_map.assign(static_cast<std::size_t>(m_patchesX) * m_patchesY, patchLOD());
+    m_selected.assign(m_map.size(), 0);
+    m_bounds.clear();
+    m_errors.clear();
+    m_dirty = true;
 
     m_regions.resize(m_maxLOD+1);
     calcLODRegions();
@@ -40,86 +46,249 @@ void LODManager::calcLODRegions() {
     }
 }
 
-const LODManager::patchLOD &LODManager::getPatchLOD(uint32_t patchX, uint32_t patchY) const {
-    return m_map.at(patchY).at(patchX);
+void LODManager::loadPatches(std::vector<glm::vec2> bounds, std::vector<float> errors) {
+    assert(bounds.size() == m_map.size());
+    assert(errors.size() == m_map.size() * (m_maxLOD+1));
+
+    m_bounds = std::move(bounds);
+    m_errors = std::move(errors);
+    m_dirty = true;
+}
+
+void LODManager::updatePatches(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY, const glm::vec2 *bounds, const float *errors) {
+    uint32_t levels = m_maxLOD+1;
+    for(uint32_t y = firstY; y <= lastY; y++){
+        for(uint32_t x = firstX; x <= lastX; x++){
+            uint32_t patch = y * m_patchesX + x;
+            m_bounds[patch] = *bounds++;
+            std::copy(errors, errors + levels, &m_errors[static_cast<std::size_t>(patch) * levels]);
+            errors += levels;
+        }
+    }
+
+    // A pending rebuild evaluates every patch anyway
+    if(m_dirty)
+        return;
+
+    for(uint32_t y = firstY; y <= lastY; y++){
+        for(uint32_t x = firstX; x <= lastX; x++){
+            uint32_t patch = y * m_patchesX + x;
+            // Previous wake up of the patch stays queued, an early re-evaluation is harmless
+            float slack = evaluatePatch(patch);
+            if(std::isfinite(slack))
+                m_wakeups.emplace(m_travel + slack, patch);
+        }
+    }
+
+    relaxAround(firstX, firstY, lastX, lastY);
 }
 
-void LODManager::updateLODMapPass1(const glm::vec3 &camPos) {
-    int32_t centerStep = m_patchSize / 2;
-    for(uint32_t lodMapY = 0; lodMapY < m_patchesY; lodMapY++){
-        for(uint32_t lodMapX = 0; lodMapX < m_patchesX; lodMapX++) {
-            uint32_t x = lodMapX * (m_patchSize - 1) + centerStep;
-            uint32_t y = lodMapY * (m_patchSize - 1) + centerStep;
+void LODManager::setFOV(float fov) {
+    m_fov = fov;
+    m_dirty = true;
+}
 
-            glm::vec3 patchCenter = glm::vec3((static_cast<float>(x) - static_cast<float>(m_dimX)/2) * m_worldScale,
-                                              m_heights.at(lodMapY).at(lodMapX),
-                                              (static_cast<float>(y) - static_cast<float>(m_dimY)/2) * m_worldScale);
+void LODManager::setViewportHeight(float height) {
+    // Window may not be created yet
+    if(height <= 0.0f)
+        return;
 
-            float distanceToCamera = glm::distance(patchCenter, camPos);
+    m_viewportHeight = height;
+    m_dirty = true;
+}
 
-            uint32_t coreLOD = distanceToLOD(distanceToCamera);
+void LODManager::setPixelError(float pixels) {
+    m_pixelError = pixels;
+    m_dirty = true;
+}
 
-            patchLOD* pPatchLOD = &m_map.at(lodMapY).at(lodMapX);
-            pPatchLOD->core = coreLOD;
-        }
+void LODManager::setHysteresis(float hysteresis) {
+    m_hysteresis = hysteresis;
+    m_dirty = true;
+}
+
+void LODManager::update() {
+    if(m_map.empty() || m_errors.empty())
+        return;
+
+    if(m_dirty){
+        rebuild();
+        return;
+    }
+
+    m_travel += glm::distance(m_cameraPos, m_lastCameraPos);
+    m_lastCameraPos = m_cameraPos;
+
+    std::vector<uint32_t> changed;
+    while(!m_wakeups.empty() && m_wakeups.top().first <= m_travel){
+        uint32_t patch = m_wakeups.top().second;
+        m_wakeups.pop();
+
+        uint32_t oldLOD = m_selected[patch];
+        float slack = evaluatePatch(patch);
+        if(m_selected[patch] != oldLOD)
+            changed.push_back(patch);
+
+        if(std::isfinite(slack))
+            m_wakeups.emplace(m_travel + slack, patch);
+    }
+
+    for(uint32_t patch : changed){
+        uint32_t x = patch % m_patchesX;
+        uint32_t y = patch / m_patchesX;
+        relaxAround(x, y, x, y);
     }
 }
 
-void LODManager::updateLODMapPass2(const glm::vec3 &camPos) {
+float LODManager::distancePerError() const {
+    return pixelsPerDistance() / m_pixelError;
+}
 
-    for(uint32_t lodMapY = 0; lodMapY < m_patchesY; lodMapY++) {
-        for (uint32_t lodMapX = 0; lodMapX < m_patchesX; lodMapX++) {
-            uint32_t coreLOD = m_map.at(lodMapY).at(lodMapX).core;
+float LODManager::pixelsPerDistance() const {
+    return m_viewportHeight / (2.0f * std::tan(glm::radians(m_fov) / 2.0f));
+}
 
-            uint32_t indexLeft = lodMapX;
-            uint32_t indexRight = lodMapX;
-            uint32_t indexTop = lodMapY;
-            uint32_t indexBottom = lodMapY;
+void LODManager::rebuild() {
+    m_errorScale = m_viewportHeight / (2.0f * std::tan(glm::radians(m_fov) / 2.0f));
+    m_travel = 0.0;
+    m_lastCameraPos = m_cameraPos;
 
-            if(lodMapX > 0){
-                indexLeft--;
+    std::vector<wakeup_t> wakeups;
+    wakeups.reserve(m_map.size());
 
-                if(m_map.at(lodMapY).at(indexLeft).core > coreLOD){
-                    m_map.at(lodMapY).at(lodMapX).left = 1;
-                }else{
-                    m_map.at(lodMapY).at(lodMapX).left = 0;
-                }
-            }
+    for(uint32_t patch = 0; patch < m_map.size(); patch++){
+        // Invalid LOD forces a fresh selection without the bias towards the previous one
+        m_selected[patch] = std::numeric_limits<uint32_t>::max();
+        float slack = evaluatePatch(patch);
+        if(std::isfinite(slack))
+            wakeups.emplace_back(slack, patch);
+    }
+    m_wakeups = decltype(m_wakeups)(std::greater<>(), std::move(wakeups));
 
-            if(lodMapX < m_patchesX - 1){
-                indexRight++;
+    relaxLODs(0, 0, m_patchesX-1, m_patchesY-1);
+    for(uint32_t y = 0; y < m_patchesY; y++){
+        for(uint32_t x = 0; x < m_patchesX; x++){
+            updateStitching(x, y);
+        }
+    }
 
-                if(m_map.at(lodMapY).at(indexRight).core > coreLOD){
-                    m_map.at(lodMapY).at(lodMapX).right = 1;
-                }else{
-                    m_map.at(lodMapY).at(lodMapX).right = 0;
-                }
-            }
+    m_dirty = false;
+    m_logger(Logger::DEBUG) << "Rebuilt LOD map of " << m_patchesX << "x" << m_patchesY << " patches" << '\n';
+}
 
-            if(lodMapY > 0){
-                indexBottom--;
+float LODManager::evaluatePatch(uint32_t patch) {
+    float distance = patchDistance(patch);
+    uint32_t lod = m_selected[patch];
 
-                if(m_map.at(indexBottom).at(lodMapX).core > coreLOD){
-                    m_map.at(lodMapY).at(lodMapX).bottom = 1;
-                }else{
-                    m_map.at(lodMapY).at(lodMapX).bottom = 0;
-                }
+    auto bandMin = [&](uint32_t l){ return l == 0 ? -std::numeric_limits<float>::infinity() : switchDistance(patch, l) * (1.0f - m_hysteresis); };
+    auto bandMax = [&](uint32_t l){ return l == m_maxLOD ? std::numeric_limits<float>::infinity() : switchDistance(patch, l+1) * (1.0f + m_hysteresis); };
+
+    if(lod > m_maxLOD || distance < bandMin(lod) || distance >= bandMax(lod)){
+        // Coarsest LOD whose error is below the limit at this distance
+        lod = 0;
+        for(uint32_t l = m_maxLOD; l > 0; l--){
+            if(switchDistance(patch, l) <= distance){
+                lod = l;
+                break;
             }
+        }
+    }
+
+    m_selected[patch] = lod;
+    return std::min(distance - bandMin(lod), bandMax(lod) - distance);
+}
+
+void LODManager::relaxLODs(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY) {
+    auto inside = [&](uint32_t x, uint32_t y){ return x >= firstX && x <= lastX && y >= firstY && y <= lastY; };
 
-            if(lodMapY < m_patchesY - 1){
-                indexTop++;
+    std::vector<uint32_t> stack;
+    for(uint32_t y = firstY; y <= lastY; y++){
+        for(uint32_t x = firstX; x <= lastX; x++){
+            uint32_t patch = y * m_patchesX + x;
+            m_map[patch].core = m_selected[patch];
+            stack.push_back(patch);
+        }
+    }
+
+    // Patches bordering the rectangle push into it with the LODs they already have
+    for(uint32_t y = firstY > 0 ? firstY-1 : 0; y <= std::min(lastY+1, m_patchesY-1); y++){
+        for(uint32_t x = firstX > 0 ? firstX-1 : 0; x <= std::min(lastX+1, m_patchesX-1); x++){
+            if(!inside(x, y))
+                stack.push_back(y * m_patchesX + x);
+        }
+    }
+
+    // LODs only grow and are bounded by the coarsest one, so the propagation settles
+    while(!stack.empty()){
+        uint32_t patch = stack.back();
+        stack.pop_back();
 
-                if(m_map.at(indexTop).at(lodMapX).core > coreLOD){
-                    m_map.at(lodMapY).at(lodMapX).top = 1;
-                }else{
-                    m_map.at(lodMapY).at(lodMapX).top = 0;
-                }
+        uint32_t core = m_map[patch].core;
+        if(core == 0)
+            continue;
+
+        uint32_t x = patch % m_patchesX;
+        uint32_t y = patch / m_patchesX;
+        auto raise = [&](uint32_t nx, uint32_t ny){
+            uint32_t neighbour = ny * m_patchesX + nx;
+            if(inside(nx, ny) && m_map[neighbour].core < core - 1){
+                m_map[neighbour].core = core - 1;
+                stack.push_back(neighbour);
             }
+        };
+
+        if(x > 0)               raise(x-1, y);
+        if(x < m_patchesX-1)    raise(x+1, y);
+        if(y > 0)               raise(x, y-1);
+        if(y < m_patchesY-1)    raise(x, y+1);
+    }
+}
+
+void LODManager::relaxAround(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY) {
+    // Influence of a patch drops by one LOD per patch, it can't reach further than the coarsest LOD
+    uint32_t reach = m_maxLOD;
+    uint32_t x0 = firstX > reach ? firstX - reach : 0;
+    uint32_t y0 = firstY > reach ? firstY - reach : 0;
+    uint32_t x1 = std::min(lastX + reach, m_patchesX-1);
+    uint32_t y1 = std::min(lastY + reach, m_patchesY-1);
+    relaxLODs(x0, y0, x1, y1);
+
+    // Stitching of a patch depends only on its direct neighbours
+    for(uint32_t y = y0 > 0 ? y0-1 : 0; y <= std::min(y1+1, m_patchesY-1); y++){
+        for(uint32_t x = x0 > 0 ? x0-1 : 0; x <= std::min(x1+1, m_patchesX-1); x++){
+            updateStitching(x, y);
         }
     }
 }
 
-uint32_t LODManager::distanceToLOD(float distance) {
+void LODManager::updateStitching(uint32_t patchX, uint32_t patchY) {
+    patchLOD& patch = m_map[patchY * m_patchesX + patchX];
+
+    patch.left   = patchX > 0            && getPatchLOD(patchX-1, patchY).core > patch.core ? 1 : 0;
+    patch.right  = patchX < m_patchesX-1 && getPatchLOD(patchX+1, patchY).core > patch.core ? 1 : 0;
+    patch.bottom = patchY > 0            && getPatchLOD(patchX, patchY-1).core > patch.core ? 1 : 0;
+    patch.top    = patchY < m_patchesY-1 && getPatchLOD(patchX, patchY+1).core > patch.core ? 1 : 0;
+}
+
+float LODManager::patchDistance(uint32_t patch) const {
+    uint32_t patchX = patch % m_patchesX;
+    uint32_t patchY = patch / m_patchesX;
+
+    float patchWorldSize = static_cast<float>(m_patchSize-1) * m_worldScale;
+    glm::vec3 min((static_cast<float>(patchX * (m_patchSize-1)) - static_cast<float>(m_dimX)/2) * m_worldScale,
+                  m_bounds[patch].x,
+                  (static_cast<float>(patchY * (m_patchSize-1)) - static_cast<float>(m_dimY)/2) * m_worldScale);
+    glm::vec3 max(min.x + patchWorldSize, m_bounds[patch].y, min.z + patchWorldSize);
+
+    // Distance to the closest point of the patch box
+    return glm::distance(m_cameraPos, glm::clamp(m_cameraPos, min, max));
+}
+
+float LODManager::switchDistance(uint32_t patch, uint32_t lod) const {
+    return m_errors[patch * (m_maxLOD+1) + lod] * m_errorScale / m_pixelError;
+}
+
+uint32_t LODManager::distanceToLOD(float distance) const {
     uint32_t LOD = m_maxLOD;
     for(uint32_t i = 0; i <= m_maxLOD; i++){
         if(distance < m_regions.at(i)){
@@ -129,7 +298,3 @@ uint32_t LODManager::distanceToLOD(float distance) {
     }
     return LOD;
 }
-
-void LODManager::loadHeightsPerPatch(const std::vector<std::vector<float>>& map) {
-    m_heights = map;
-}
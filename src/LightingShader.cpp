@@ -119,6 +119,7 @@ void LightingShader::init() {
     }
 
     loc_colorMod = cacheUniform("u_colorMod");
+    loc_instanced = cacheUniform("u_instanced", ShaderType::BASIC_SHADER);
     loc_boneMatrixArray = cacheUniform("u_bonesMatrices", ShaderType::BONE_SHADER);
 }
 
@@ -208,6 +209,10 @@ void LightingShader::setColorMod(const glm::vec4 &clr) const {
     glUniform4f(getUniformLocation(loc_colorMod), clr.r, clr.g, clr.b, clr.a);
 }
 
+void LightingShader::setInstanced(bool instanced) const {
+    glUniform1i(getUniformLocation(loc_instanced), instanced ? 1 : 0);
+}
+
 void LightingShader::setBoneTransforms(const boneTransfoms_t &transforms) const {
     glUniformMatrix4fv(getUniformLocation(loc_boneMatrixArray), MAX_BONES, GL_FALSE, glm::value_ptr(transforms[0]));
 }
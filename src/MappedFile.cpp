@@ -0,0 +1,113 @@
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+#include "exceptions.h"
+
+MappedFile::MappedFile(const char *filename) {
+#if defined(_WIN32)
+    m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(m_file == INVALID_HANDLE_VALUE){
+        m_file = nullptr;
+        throw fileException("Unable to open file ", filename);
+    }
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(m_file, &fileSize)){
+        unmap();
+        throw fileException("Unable to read size of file ", filename);
+    }
+    m_size = static_cast<std::size_t>(fileSize.QuadPart);
+    if(m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!m_mapping){
+        unmap();
+        throw fileException("Unable to map file ", filename);
+    }
+
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if(!m_data){
+        unmap();
+        throw fileException("Unable to map file ", filename);
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        throw fileException("Unable to open file ", filename);
+
+    struct stat fileStat{};
+    if(fstat(fd, &fileStat) != 0){
+        close(fd);
+        throw fileException("Unable to read size of file ", filename);
+    }
+    m_size = static_cast<std::size_t>(fileStat.st_size);
+    if(m_size == 0){
+        close(fd);
+        return;
+    }
+
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // Mapping keeps its own reference to the file
+    close(fd);
+    if(mapping == MAP_FAILED){
+        m_size = 0;
+        throw fileException("Unable to map file ", filename);
+    }
+
+    // Files are mostly consumed front to back, read ahead aggressively
+    madvise(mapping, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const uint8_t*>(mapping);
+#endif
+}
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if(this == &other)
+        return *this;
+
+    unmap();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+#if defined(_WIN32)
+    m_file = std::exchange(other.m_file, nullptr);
+    m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+    return *this;
+}
+
+void MappedFile::unmap() {
+#if defined(_WIN32)
+    if(m_data)
+        UnmapViewOfFile(m_data);
+    if(m_mapping)
+        CloseHandle(m_mapping);
+    if(m_file)
+        CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if(m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
@@ -68,5 +68,7 @@ void Model::clear() {
     m_materials.clear();
     m_meshes.clear();
     m_indices.clear();
+    m_boundsMin = glm::vec3(std::numeric_limits<float>::infinity());
+    m_boundsMax = glm::vec3(-std::numeric_limits<float>::infinity());
 }
 
@@ -0,0 +1,41 @@
+#include <algorithm>
+#include <cmath>
+
+#include "model/terrain/NormalMap.h"
+#include "ThreadPool.h"
+
+glm::vec2 NormalMap::encode(const glm::vec3 &normal) {
+    float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    glm::vec2 p = glm::vec2(normal.x, normal.z) / std::max(sum, 1e-6f);
+
+    // Lower hemisphere folds over the diagonals into the outer triangles
+    if(normal.y < 0.0f){
+        p = {(1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+             (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f)};
+    }
+    return {p.x * 0.5f + 0.5f, p.y * 0.5f + 0.5f};
+}
+
+void NormalMap::bake(const Heightfield &heightfield, uint16_t *texels) {
+    const glm::vec3* normals = heightfield.normals();
+
+    ThreadPool::getInstance().parallelFor(0, heightfield.dimY(), [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(std::size_t i = heightfield.xy2i(0, rowBegin); i < heightfield.xy2i(0, rowEnd); i++){
+            packNormal(normals[i], &texels[i * 2]);
+        }
+    });
+}
+
+void NormalMap::bake(const Heightfield &heightfield, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t *texels) {
+    for(uint32_t row = 0; row < height; row++){
+        for(uint32_t column = 0; column < width; column++){
+            packNormal(heightfield.normalAt(x + column, y + row), &texels[(static_cast<std::size_t>(row) * width + column) * 2]);
+        }
+    }
+}
+
+void NormalMap::packNormal(const glm::vec3 &normal, uint16_t *texel) {
+    glm::vec2 encoded = encode(normal);
+    texel[0] = static_cast<uint16_t>(std::lround(std::clamp(encoded.x, 0.0f, 1.0f) * 65535.0f));
+    texel[1] = static_cast<uint16_t>(std::lround(std::clamp(encoded.y, 0.0f, 1.0f) * 65535.0f));
+}
@@ -0,0 +1,155 @@
+#include <cassert>
+#include <algorithm>
+#include <limits>
+#include <string>
+
+#include "model/terrain/PatchIndices.h"
+#include "utils.h"
+
+Logger PatchIndices::m_logger = Logger("Patch Indices");
+
+void PatchIndices::build(uint32_t maxLOD, uint32_t stride) {
+    clear();
+
+    m_maxLOD = maxLOD;
+    m_patchSize = Utils::binPow(static_cast<int32_t>(maxLOD+1)) + 1;
+    m_stride = stride;
+
+    m_lodInfo.resize(m_maxLOD+1);
+
+    for(uint32_t lod = 0; lod <= m_maxLOD; lod++){
+        for(uint8_t l = 0; l < LEFT; l++){
+            for(uint8_t r = 0; r < RIGHT; r++){
+                for(uint8_t t = 0; t < TOP; t++){
+                    for(uint8_t b = 0; b < BOTTOM; b++){
+                        m_lodInfo.at(lod).info[l][r][t][b].start = m_indices.size();
+                        createPatchIndicesLOD(lod, lod + l, lod + r, lod + t, lod + b);
+                        m_lodInfo.at(lod).info[l][r][t][b].count = m_indices.size() - m_lodInfo.at(lod).info[l][r][t][b].start;
+
+                        m_logger(Logger::DEBUG) << "Created " << m_lodInfo.at(lod).info[l][r][t][b].count << " indices for LOD " << lod << " patch variant " << l << r << t << b << '\n';
+                    }
+                }
+            }
+        }
+    }
+
+    // Patch local indices of a patch sized vertex block fit into 16 bits up to a patch of 129x129 samples, maxLOD <= 6
+    if(xy2i(m_patchSize-1, m_patchSize-1) <= std::numeric_limits<uint16_t>::max()){
+        m_compactIndices.assign(m_indices.begin(), m_indices.end());
+        m_indices.clear();
+        m_indices.shrink_to_fit();
+    }
+
+    m_logger(Logger::DEBUG) << "Stored " << std::to_string(indexCount()) << " indices with " << indexSize() << " bytes per index" << '\n';
+}
+
+void PatchIndices::assign(uint32_t maxLOD, uint32_t stride, const Range *variants, const void *indices, std::size_t indexCount, uint32_t indexSize) {
+    clear();
+
+    m_maxLOD = maxLOD;
+    m_patchSize = Utils::binPow(static_cast<int32_t>(maxLOD+1)) + 1;
+    m_stride = stride;
+
+    m_lodInfo.resize(m_maxLOD+1);
+    std::copy(variants, variants + variantCount(), &m_lodInfo.front().info[0][0][0][0]);
+
+    if(indexSize == sizeof(uint16_t)){
+        const auto* first = static_cast<const uint16_t*>(indices);
+        m_compactIndices.assign(first, first + indexCount);
+    }else{
+        const auto* first = static_cast<const uint32_t*>(indices);
+        m_indices.assign(first, first + indexCount);
+    }
+}
+
+void PatchIndices::createPatchIndicesLOD(uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom) {
+    uint32_t fanStep = Utils::binPow(lodCore+1);
+    int32_t endPos = m_patchSize - 1 - fanStep;
+
+    for(uint32_t y = 0; y <= endPos; y += fanStep){
+        for(uint32_t x = 0; x <= endPos; x += fanStep){
+            uint32_t lLeft      = x == 0        ? lodLeft : lodCore;
+            uint32_t lRight     = x == endPos   ? lodRight : lodCore;
+            uint32_t lBottom    = y == 0        ? lodBottom : lodCore;
+            uint32_t lTop       = y == endPos   ? lodTop : lodCore;
+
+            createFan(x,y, lodCore, lLeft, lRight, lTop, lBottom);
+        }
+    }
+}
+
+void PatchIndices::createFan(uint32_t x, uint32_t y, uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom) {
+    uint32_t stepLeft   = Utils::binPow(lodLeft);
+    uint32_t stepRight  = Utils::binPow(lodRight);
+    uint32_t stepTop    = Utils::binPow(lodTop);
+    uint32_t stepBottom = Utils::binPow(lodBottom);
+    uint32_t stepCenter = Utils::binPow(lodCore);
+
+    uint32_t iCnt = xy2i(x+stepCenter, y+stepCenter);
+
+    uint32_t indexTemp1 = xy2i(x, y);
+    uint32_t indexTemp2 = xy2i(x, y+stepLeft);
+
+    createTriangle(iCnt, indexTemp1, indexTemp2);
+
+    if(lodLeft == lodCore){
+        indexTemp1 = indexTemp2;
+        indexTemp2 += stepLeft * m_stride;
+
+        createTriangle(iCnt, indexTemp1, indexTemp2);
+    }
+
+    indexTemp1 = indexTemp2;
+    indexTemp2 += stepTop;
+
+    createTriangle(iCnt, indexTemp1, indexTemp2);
+
+    if(lodTop == lodCore){
+        indexTemp1 = indexTemp2;
+        indexTemp2 += stepTop;
+
+        createTriangle(iCnt, indexTemp1, indexTemp2);
+    }
+
+    indexTemp1 = indexTemp2;
+    indexTemp2 -= stepRight * m_stride;
+
+    createTriangle(iCnt, indexTemp1, indexTemp2);
+
+    if(lodRight == lodCore){
+        indexTemp1 = indexTemp2;
+        indexTemp2 -= stepRight * m_stride;
+
+        createTriangle(iCnt, indexTemp1, indexTemp2);
+    }
+
+    indexTemp1 = indexTemp2;
+    indexTemp2 -= stepBottom;
+
+    createTriangle(iCnt, indexTemp1, indexTemp2);
+
+    if(lodBottom == lodCore){
+        indexTemp1 = indexTemp2;
+        indexTemp2 -= stepBottom;
+
+        createTriangle(iCnt, indexTemp1, indexTemp2);
+    }
+}
+
+void PatchIndices::createTriangle(uint32_t i0, uint32_t i1, uint32_t i2) {
+    assert(i0 < xy2i(m_patchSize, m_patchSize-1));
+    assert(i1 < xy2i(m_patchSize, m_patchSize-1));
+    assert(i2 < xy2i(m_patchSize, m_patchSize-1));
+    m_indices.push_back(i0);
+    m_indices.push_back(i1);
+    m_indices.push_back(i2);
+}
+
+void PatchIndices::clear() {
+    m_lodInfo.clear();
+    m_indices.clear();
+    m_compactIndices.clear();
+    m_maxLOD = 0;
+    m_patchSize = 0;
+    m_stride = 0;
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#include <limits>
+
+#include "model/terrain/PatchQuadtree.h"
+#include "ThreadPool.h"
+
+void PatchQuadtree::build(const Heightfield &heightfield, uint32_t patchSize, uint32_t patchesX, uint32_t patchesY, glm::vec2 origin, float spacing) {
+    clear();
+
+    if(patchesX == 0 || patchesY == 0)
+        return;
+
+    m_patchesX = patchesX;
+    m_patchesY = patchesY;
+    m_patchWorldSize = static_cast<float>(patchSize-1) * spacing;
+    m_origin = origin;
+
+    Level& patches = m_levels.emplace_back();
+    patches.dimX = patchesX;
+    patches.dimY = patchesY;
+    patches.bounds.resize(static_cast<std::size_t>(patchesX) * patchesY);
+
+    // Every sample of the patch counts, peaks inside of the patch must not be culled
+    ThreadPool::getInstance().parallelFor(0, patchesY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t patchY = rowBegin; patchY < rowEnd; patchY++){
+            for(uint32_t patchX = 0; patchX < patchesX; patchX++){
+                auto [min, max] = heightfield.calcMinMax(patchX * (patchSize-1), patchY * (patchSize-1), patchSize, patchSize);
+                patches.bounds[patchY * patchesX + patchX] = {min, max};
+            }
+        }
+    });
+
+    buildLevels();
+}
+
+void PatchQuadtree::build(std::vector<glm::vec2> patchBounds, uint32_t patchSize, uint32_t patchesX, uint32_t patchesY, glm::vec2 origin, float spacing) {
+    clear();
+
+    if(patchesX == 0 || patchesY == 0)
+        return;
+
+    assert(patchBounds.size() == static_cast<std::size_t>(patchesX) * patchesY);
+
+    m_patchesX = patchesX;
+    m_patchesY = patchesY;
+    m_patchWorldSize = static_cast<float>(patchSize-1) * spacing;
+    m_origin = origin;
+
+    Level& patches = m_levels.emplace_back();
+    patches.dimX = patchesX;
+    patches.dimY = patchesY;
+    patches.bounds = std::move(patchBounds);
+
+    buildLevels();
+}
+
+void PatchQuadtree::buildLevels() {
+    while(m_levels.back().dimX > 1 || m_levels.back().dimY > 1){
+        const Level& child = m_levels.back();
+        Level parent;
+        parent.dimX = (child.dimX + 1) / 2;
+        parent.dimY = (child.dimY + 1) / 2;
+        parent.bounds.resize(static_cast<std::size_t>(parent.dimX) * parent.dimY);
+
+        for(uint32_t y = 0; y < parent.dimY; y++){
+            for(uint32_t x = 0; x < parent.dimX; x++){
+                parent.bounds[y * parent.dimX + x] = mergeChildren(child, x, y);
+            }
+        }
+
+        m_levels.push_back(std::move(parent));
+    }
+}
+
+glm::vec2 PatchQuadtree::mergeChildren(const Level &child, uint32_t x, uint32_t y) {
+    glm::vec2 bounds(std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity());
+    for(uint32_t childY = 2*y; childY < std::min(2*y + 2, child.dimY); childY++){
+        for(uint32_t childX = 2*x; childX < std::min(2*x + 2, child.dimX); childX++){
+            const glm::vec2& childBounds = child.bounds[childY * child.dimX + childX];
+            bounds.x = std::min(bounds.x, childBounds.x);
+            bounds.y = std::max(bounds.y, childBounds.y);
+        }
+    }
+    return bounds;
+}
+
+void PatchQuadtree::updatePatches(const Heightfield &heightfield, uint32_t patchSize, uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY) {
+    if(m_levels.empty())
+        return;
+
+    Level& patches = m_levels.front();
+    for(uint32_t patchY = firstY; patchY <= lastY; patchY++){
+        for(uint32_t patchX = firstX; patchX <= lastX; patchX++){
+            auto [min, max] = heightfield.calcMinMax(patchX * (patchSize-1), patchY * (patchSize-1), patchSize, patchSize);
+            patches.bounds[patchY * m_patchesX + patchX] = {min, max};
+        }
+    }
+
+    // Only ancestors of the changed patches are merged again
+    for(uint32_t level = 1; level < m_levels.size(); level++){
+        firstX /= 2; firstY /= 2;
+        lastX /= 2; lastY /= 2;
+
+        Level& parent = m_levels[level];
+        for(uint32_t y = firstY; y <= lastY; y++){
+            for(uint32_t x = firstX; x <= lastX; x++){
+                parent.bounds[y * parent.dimX + x] = mergeChildren(m_levels[level-1], x, y);
+            }
+        }
+    }
+}
+
+void PatchQuadtree::clear() {
+    m_levels.clear();
+    m_patchesX = 0;
+    m_patchesY = 0;
+}
+
+void PatchQuadtree::cull(const Utils::FrustumCulling &frustum, std::vector<uint32_t> &visible) const {
+    visible.clear();
+
+    if(m_levels.empty())
+        return;
+
+    cullNode(frustum, static_cast<uint32_t>(m_levels.size()-1), 0, 0, Utils::FrustumCulling::ALL_PLANES, visible);
+}
+
+void PatchQuadtree::cullNode(const Utils::FrustumCulling &frustum, uint32_t level, uint32_t x, uint32_t y, uint32_t planeMask, std::vector<uint32_t> &visible) const {
+    glm::vec3 min, max;
+    nodeBox(level, x, y, min, max);
+
+    switch(frustum.classifyBox(min, max, planeMask)){
+        case Utils::FrustumCulling::Containment::OUTSIDE:
+            return;
+        case Utils::FrustumCulling::Containment::INSIDE:
+            appendNode(level, x, y, visible);
+            return;
+        case Utils::FrustumCulling::Containment::INTERSECT:
+            break;
+    }
+
+    if(level == 0){
+        visible.push_back(y * m_patchesX + x);
+        return;
+    }
+
+    const Level& child = m_levels[level-1];
+    for(uint32_t childY = 2*y; childY < std::min(2*y + 2, child.dimY); childY++){
+        for(uint32_t childX = 2*x; childX < std::min(2*x + 2, child.dimX); childX++){
+            cullNode(frustum, level-1, childX, childY, planeMask, visible);
+        }
+    }
+}
+
+void PatchQuadtree::appendNode(uint32_t level, uint32_t x, uint32_t y, std::vector<uint32_t> &visible) const {
+    uint32_t patchX1 = std::min((x+1) << level, m_patchesX);
+    uint32_t patchY1 = std::min((y+1) << level, m_patchesY);
+
+    for(uint32_t patchY = y << level; patchY < patchY1; patchY++){
+        for(uint32_t patchX = x << level; patchX < patchX1; patchX++){
+            visible.push_back(patchY * m_patchesX + patchX);
+        }
+    }
+}
+
+void PatchQuadtree::nodeBox(uint32_t level, uint32_t x, uint32_t y, glm::vec3 &min, glm::vec3 &max) const {
+    const glm::vec2& bounds = m_levels[level].bounds[y * m_levels[level].dimX + x];
+
+    uint32_t patchX0 = x << level;
+    uint32_t patchY0 = y << level;
+    uint32_t patchX1 = std::min((x+1) << level, m_patchesX);
+    uint32_t patchY1 = std::min((y+1) << level, m_patchesY);
+
+    min = {m_origin.x + static_cast<float>(patchX0) * m_patchWorldSize, bounds.x, m_origin.y + static_cast<float>(patchY0) * m_patchWorldSize};
+    max = {m_origin.x + static_cast<float>(patchX1) * m_patchWorldSize, bounds.y, m_origin.y + static_cast<float>(patchY1) * m_patchWorldSize};
+}
+
+bool PatchQuadtree::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance,
+                            const std::function<bool(uint32_t, uint32_t, float, float)> &visitor) const {
+    if(m_levels.empty())
+        return false;
+
+    // Huge instead of infinite inverse keeps axis parallel rays free of 0 * inf
+    auto safeInverse = [](float d){ return std::abs(d) > 1e-30f ? 1.0f / d : std::copysign(1e30f, d); };
+    Ray ray{origin, {safeInverse(direction.x), safeInverse(direction.y), safeInverse(direction.z)}, maxDistance};
+
+    return raycastNode(ray, static_cast<uint32_t>(m_levels.size()-1), 0, 0, visitor);
+}
+
+bool PatchQuadtree::raycastNode(const Ray &ray, uint32_t level, uint32_t x, uint32_t y,
+                                const std::function<bool(uint32_t, uint32_t, float, float)> &visitor) const {
+    float tEnter, tExit;
+    if(!intersectNode(ray, level, x, y, tEnter, tExit))
+        return false;
+
+    if(level == 0)
+        return visitor(x, y, tEnter, tExit);
+
+    // Children don't overlap in XZ, so visiting them by entry distance finds the nearest hit first
+    struct ChildHit {
+        float tEnter;
+        uint32_t x;
+        uint32_t y;
+    };
+    ChildHit children[4];
+    uint32_t childCount = 0;
+
+    const Level& child = m_levels[level-1];
+    for(uint32_t childY = 2*y; childY < std::min(2*y + 2, child.dimY); childY++){
+        for(uint32_t childX = 2*x; childX < std::min(2*x + 2, child.dimX); childX++){
+            float childEnter, childExit;
+            if(intersectNode(ray, level-1, childX, childY, childEnter, childExit)){
+                children[childCount++] = {childEnter, childX, childY};
+            }
+        }
+    }
+    std::sort(children, children + childCount, [](const ChildHit& a, const ChildHit& b){ return a.tEnter < b.tEnter; });
+
+    for(uint32_t i = 0; i < childCount; i++){
+        if(raycastNode(ray, level-1, children[i].x, children[i].y, visitor))
+            return true;
+    }
+    return false;
+}
+
+bool PatchQuadtree::intersectNode(const Ray &ray, uint32_t level, uint32_t x, uint32_t y, float &tEnter, float &tExit) const {
+    glm::vec3 min, max;
+    nodeBox(level, x, y, min, max);
+
+    // Slab test of the node box
+    glm::vec3 t0 = (min - ray.origin) * ray.invDirection;
+    glm::vec3 t1 = (max - ray.origin) * ray.invDirection;
+    tEnter = std::max({std::min(t0.x, t1.x), std::min(t0.y, t1.y), std::min(t0.z, t1.z), 0.0f});
+    tExit = std::min({std::max(t0.x, t1.x), std::max(t0.y, t1.y), std::max(t0.z, t1.z), ray.maxDistance});
+    return tEnter <= tExit;
+}
@@ -1,6 +1,16 @@
 #include "Renderer.h"
 
 void Renderer::queueModelRender(const ObjectData &object, Model* model) {
+    // Objects wait for the horizon of this frame's terrain patches, models without vertices have no bounds to test
+    bool hasBounds = model->getBoundsMin().x <= model->getBoundsMax().x;
+    if(hasBounds && m_terrain && m_terrain->flags[Terrain::Flags::HORIZON_CULLING]){
+        m_pendingObjects.emplace_back(object, model);
+        return;
+    }
+    enqueueModel(object, model);
+}
+
+void Renderer::enqueueModel(const ObjectData &object, Model *model) {
     GLuint vao = model->getVAO();
     if(!m_drawQueue.contains(vao)) {
         m_drawQueue.insert({vao, meshQueue_t()});
@@ -25,15 +35,62 @@ void Renderer::queueSkinnedModelRender(const SkinnedObjectData &object, SkinnedM
     }
 }
 
+void Renderer::cullPendingObjects() {
+    if(m_pendingObjects.empty())
+        return;
+
+    if(!m_terrain || m_terrain->horizonOccluders().empty()){
+        for(const auto& [object, model] : m_pendingObjects){
+            enqueueModel(object, model);
+        }
+        m_pendingObjects.clear();
+        return;
+    }
+
+    m_objectBoxes.clear();
+    for(const auto& [object, model] : m_pendingObjects){
+        const glm::mat4& world = object.transformation.getMatrix();
+        const glm::vec3& localMin = model->getBoundsMin();
+        const glm::vec3& localMax = model->getBoundsMax();
+
+        HorizonCulling::Box& box = m_objectBoxes.emplace_back();
+        box.min = glm::vec3(std::numeric_limits<float>::infinity());
+        box.max = glm::vec3(-std::numeric_limits<float>::infinity());
+        for(uint32_t i = 0; i < 8; i++){
+            glm::vec3 corner(i & 1 ? localMax.x : localMin.x, i & 2 ? localMax.y : localMin.y, i & 4 ? localMax.z : localMin.z);
+            glm::vec3 worldCorner = glm::vec3(world * glm::vec4(corner, 1.0f));
+            box.min = glm::min(box.min, worldCorner);
+            box.max = glm::max(box.max, worldCorner);
+        }
+    }
+
+    m_horizonCulling.update(m_gameCamera->getVP());
+    m_horizonCulling.setCameraPosition(m_gameCamera->getPosition());
+    m_horizonCulling.cull(m_terrain->horizonOccluders(), m_objectBoxes, m_objectVisible);
+
+    for(std::size_t i = 0; i < m_pendingObjects.size(); i++){
+        if(m_objectVisible[i])
+            enqueueModel(m_pendingObjects[i].first, m_pendingObjects[i].second);
+    }
+    m_pendingObjects.clear();
+}
+
 void Renderer::setTerrainModelRender(const std::shared_ptr<Terrain>& terrain) {
     m_terrain =  terrain;
+    m_terrain->setViewportHeight(static_cast<float>(m_windowHeight));
     m_terrainShader.enable();
     float min,max;
     std::tie(min,max) = m_terrain->getMinMaxHeight();
     m_terrainShader.setMinHeight(min);
     m_terrainShader.setMaxHeight(max);
+}
+
+void Renderer::setChunkedTerrainRender(const std::shared_ptr<ChunkedTerrain> &terrain) {
+    m_chunkedTerrain = terrain;
+}
 
-    m_terrainShader.setBlendedTextures(m_terrain->m_blendingTextures, m_terrain->m_blendingTexturesCount);
+void Renderer::setClipmapTerrainRender(const std::shared_ptr<ClipmapTerrain> &terrain) {
+    m_clipmapTerrain = terrain;
 }
 
 void Renderer::setSkyboxModelRender(const std::shared_ptr<Skybox> &skybox) {
@@ -44,16 +101,23 @@ void Renderer::renderQueues() {
     clearRender();
 
     /// Terrain shader
-    if(m_terrain) {
+    if(m_terrain || m_chunkedTerrain || m_clipmapTerrain) {
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         m_terrainShader.enable();
         glViewport(0,0, m_windowWidth, m_windowHeight);
 
         glCullFace(GL_BACK);
-        glBindVertexArray(m_terrain->getVAO());
-        renderTerrain();
+        if(m_terrain)
+            renderTerrain();
+        if(m_chunkedTerrain)
+            renderChunkedTerrain();
+        if(m_clipmapTerrain)
+            renderClipmapTerrain();
     }
 
+    // Terrain patches of this frame are known now, objects hidden behind them are never queued
+    cullPendingObjects();
+
     /// Picking phase
     if(m_cursorPressed) {
         m_pickingShader.enable(Shader::ShaderType::BONE_SHADER);
@@ -122,6 +186,10 @@ void Renderer::renderQueues() {
         lightingPass(queue);
     }
 
+    if(m_terrain) {
+        renderScatter();
+    }
+
     // Skybox phase
     if(m_skybox) {
         glCullFace(GL_FRONT);
@@ -323,6 +391,62 @@ void Renderer::renderModelLight(const SkinnedDrawable& drawable) {
     renderMesh(*drawable.mesh);
 }
 
+void Renderer::renderScatter() {
+    const std::vector<Scatter::Batch>& batches = m_terrain->m_scatter.batches();
+    if(batches.empty())
+        return;
+
+    // Instances carry their world transform, the model transform is identity
+    glm::mat4 identity(1.0f);
+    m_lightingShader.setInstanced(true);
+    m_lightingShader.setWVP(m_gameCamera->getWVP(identity));
+    m_lightingShader.setWorld(identity);
+    m_lightingShader.setLightWVP(m_spotLights->at(0).getWVP(identity));
+    m_lightingShader.setDirectionalLight(*m_dirLight);
+    m_lightingShader.setWorldCameraPos(m_gameCamera->getPosition());
+    m_lightingShader.setSpotLights(m_spotLightsCount, *m_spotLights);
+    m_lightingShader.setPointLights(m_pointLightsCount, *m_pointLights);
+    m_lightingShader.setColorMod(glm::vec4(1.0f));
+
+    for(const Scatter::Batch& batch : batches){
+        glBindVertexArray(batch.model->getVAO());
+
+        // Instance attributes are attached to the model VAO only for the draw
+        glBindBuffer(GL_ARRAY_BUFFER, m_terrain->m_scatterBuffer);
+        glEnableVertexAttribArray(INSTANCE_POSITION_LOCATION);
+        glVertexAttribPointer(INSTANCE_POSITION_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Scatter::Instance), (void*) offsetof(Scatter::Instance, positionScale));
+        glVertexAttribDivisor(INSTANCE_POSITION_LOCATION, 1);
+        glEnableVertexAttribArray(INSTANCE_ROTATION_LOCATION);
+        glVertexAttribPointer(INSTANCE_ROTATION_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Scatter::Instance), (void*) offsetof(Scatter::Instance, rotation));
+        glVertexAttribDivisor(INSTANCE_ROTATION_LOCATION, 1);
+
+        for(const MeshInfo& mesh : batch.model->m_meshes){
+            const Material* material = batch.model->getMaterial(mesh.matIndex);
+            if(material){
+                m_lightingShader.setMaterial(*material);
+                material->bindTextures();
+            }
+
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES,
+                                                          static_cast<GLsizei>(mesh.indicesCount),
+                                                          GL_UNSIGNED_INT,
+                                                          (void *)(mesh.indicesOffset * sizeof(uint32_t)),
+                                                          static_cast<GLsizei>(batch.instanceCount),
+                                                          static_cast<GLint>(mesh.verticesOffset),
+                                                          batch.firstInstance);
+
+            if(material){
+                material->unbindTextures();
+            }
+        }
+
+        glDisableVertexAttribArray(INSTANCE_POSITION_LOCATION);
+        glDisableVertexAttribArray(INSTANCE_ROTATION_LOCATION);
+    }
+
+    m_lightingShader.setInstanced(false);
+}
+
 inline void Renderer::renderMesh(const MeshInfo &mesh) {
     glDrawElementsBaseVertex(GL_TRIANGLES,
                              static_cast<GLsizei>(mesh.indicesCount),
@@ -418,22 +542,203 @@ void Renderer::renderModelDebug(const SkinnedDrawable &drawable) {
 }
 
 void Renderer::renderTerrain() {
+    // Background regeneration uploads a slice per frame
+    m_terrain->update();
+
+    bool gpuCulling = m_terrain->flags[Terrain::Flags::GPU_LOD_CULLING];
+    if(gpuCulling){
+        cullTerrainGPU();
+    }
+
+    // Tessellated terrain has its own pipeline, the fragment stage and its uniforms are the same
+    bool tessellated = m_terrain->getRenderMode() == Terrain::RenderMode::TESSELLATION;
+    const TerrainShader& shader = tessellated ? m_terrainTessShader : m_terrainShader;
+    if(tessellated){
+        m_terrainTessShader.enable();
+    }
+
+    glm::mat4 vp = m_gameCamera->getVP();
+    shader.setWVP(vp);
+
+    // Layers are set every frame, both terrains share the shader and a regenerated terrain brings its own splat map
+    shader.setLayerTextures(m_terrain->m_layerTextures, m_terrain->m_splatSettings.layerCount);
+    shader.setSplatMap(m_terrain->m_splatTextureHandle, m_terrain->m_splatTextureDimX, m_terrain->m_splatTextureDimY);
+    shader.setNormalMap(m_terrain->m_normalTextureHandle, m_terrain->m_normalTextureDimX, m_terrain->m_normalTextureDimY);
+    shader.setWorldScale(m_terrain->getScale());
+
+    // Fragments write page requests of this frame into the feedback buffer handed out by the last update
+    shader.setVirtualTexture(&m_terrain->m_virtualTexture, m_terrain->m_virtualSpan);
+    if(!m_terrain->m_virtualTexture.empty()){
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VIRTUAL_FEEDBACK_BINDING, m_terrain->m_virtualTexture.getFeedbackBuffer());
+    }
+
+    // Setup dir light
+    shader.setDirectionalLight(*m_dirLight);
+
+    float min,max;
+    std::tie(min,max) = m_terrain->getMinMaxHeight();
+    shader.setMinHeight(min);
+    shader.setMaxHeight(max);
+
+    uint32_t indexSize = m_terrain->m_patchIndices.indexSize();
+    GLenum primitive = GL_TRIANGLES;
+
+    switch(m_terrain->getRenderMode()){
+        case Terrain::RenderMode::VERTEX_BUFFER:
+            shader.setVertexSource(TERRAIN_SOURCE_VERTEX);
+            glBindVertexArray(m_terrain->getVAO());
+            break;
+
+        case Terrain::RenderMode::HEIGHT_TEXTURE:
+            shader.setVertexSource(TERRAIN_SOURCE_HEIGHT_TEXTURE);
+            shader.setHeightMap(m_terrain->m_heightTextureHandle, m_terrain->m_heightTextureDimX, m_terrain->m_heightTextureDimY);
+            glBindVertexArray(m_terrain->m_gridVAO);
+            break;
+
+        case Terrain::RenderMode::TESSELLATION:
+            // Fragments are shaded as the height texture source
+            shader.setVertexSource(TERRAIN_SOURCE_HEIGHT_TEXTURE);
+            shader.setHeightMap(m_terrain->m_heightTextureHandle, m_terrain->m_heightTextureDimX, m_terrain->m_heightTextureDimY);
+            // Edges aren't subdivided beyond the samples they span
+            shader.setTessellation(m_terrain->m_lodManager.pixelsPerDistance() / m_terrain->m_tessellationEdge,
+                                   std::min<uint32_t>(TERRAIN_MAX_TESS_LEVEL, m_terrain->m_patchSize - 1));
+            glBindVertexArray(m_terrain->m_gridVAO);
+            glPatchParameteri(GL_PATCH_VERTICES, TERRAIN_PATCH_VERTICES);
+            indexSize = sizeof(uint16_t);
+            primitive = GL_PATCHES;
+            break;
+    }
+
+    if(gpuCulling){
+        renderTerrainCommands(m_terrain->m_cullBuffers[Terrain::CULL_COMMAND_BUFFER],
+                              m_terrain->m_cullBuffers[Terrain::CULL_COUNT_BUFFER],
+                              static_cast<std::size_t>(m_terrain->m_patchesX) * m_terrain->m_patchesY,
+                              indexSize, primitive);
+    }else{
+        renderTerrainCommands(m_terrain->m_drawCommandBuffer, m_terrain->drawCommands().size(), indexSize, primitive);
+    }
+    m_terrain->m_virtualTexture.endFrame();
+
+    if(tessellated){
+        m_terrainShader.enable();
+    }
+ }
+
+void Renderer::cullTerrainGPU() {
+    const GLuint* buffers = m_terrain->m_cullBuffers;
+    if(buffers[Terrain::CULL_BOUNDS_BUFFER] == 0)
+        return;
+
+    uint32_t patchCount = m_terrain->m_patchesX * m_terrain->m_patchesY;
+    float patchWorldSize = static_cast<float>(m_terrain->m_patchSize - 1) * m_terrain->getScale();
+
+    m_terrainCullShader.enable();
+    m_terrainCullShader.setVP(m_gameCamera->getVP());
+    m_terrainCullShader.setFrustumBias(-0.1f);
+    m_terrainCullShader.setCameraPosition(m_gameCamera->getPosition());
+    m_terrainCullShader.setErrorScale(m_terrain->m_lodManager.distancePerError());
+    m_terrainCullShader.setPatchGrid(m_terrain->m_patchesX, m_terrain->m_patchesY, m_terrain->m_patchSize, m_terrain->m_maxLOD, m_terrain->gridOrigin(), patchWorldSize);
+    m_terrainCullShader.setInstanced(m_terrain->getRenderMode() != Terrain::RenderMode::VERTEX_BUFFER);
+    m_terrainCullShader.setTessellated(m_terrain->getRenderMode() == Terrain::RenderMode::TESSELLATION);
+
+    glClearNamedBufferData(buffers[Terrain::CULL_COUNT_BUFFER], GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_PATCH_BOUNDS_BINDING, buffers[Terrain::CULL_BOUNDS_BUFFER]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_PATCH_ERRORS_BINDING, buffers[Terrain::CULL_ERRORS_BUFFER]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_LOD_VARIANTS_BINDING, buffers[Terrain::CULL_VARIANTS_BUFFER]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_DRAW_COMMANDS_BINDING, buffers[Terrain::CULL_COMMAND_BUFFER]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TERRAIN_DRAW_COUNT_BINDING, buffers[Terrain::CULL_COUNT_BUFFER]);
+
+    glDispatchCompute((patchCount + TERRAIN_CULL_GROUP_SIZE - 1) / TERRAIN_CULL_GROUP_SIZE, 1, 1);
+
+    // Commands and their count are consumed as indirect draw parameters
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+    m_terrainShader.enable();
+}
+
+void Renderer::renderChunkedTerrain() {
+    m_chunkedTerrain->update();
+
+    glm::mat4 vp = m_gameCamera->getVP();
+    m_terrainShader.setWVP(vp);
+
+    m_terrainShader.setLayerTextures(m_chunkedTerrain->m_layerTextures, m_chunkedTerrain->m_splatSettings.layerCount);
+    m_terrainShader.setVirtualTexture(nullptr, 0.0f);
+    m_terrainShader.setSplatArray(m_chunkedTerrain->m_splatArrayHandle);
+
+    // Setup dir light
+    m_terrainShader.setDirectionalLight(*m_dirLight);
+
+    // Range grows as new tiles stream in
+    float min,max;
+    std::tie(min,max) = m_chunkedTerrain->getMinMaxHeight();
+    m_terrainShader.setMinHeight(min);
+    m_terrainShader.setMaxHeight(max);
+
+    m_terrainShader.setVertexSource(TERRAIN_SOURCE_TILES);
+    m_terrainShader.setTileHeights(m_chunkedTerrain->m_heightArrayHandle, m_chunkedTerrain->m_tileSamples + 2);
+    m_terrainShader.setWorldScale(m_chunkedTerrain->getScale());
+    glBindVertexArray(m_chunkedTerrain->m_gridVAO);
+
+    renderTerrainCommands(m_chunkedTerrain->m_gridBuffers[ChunkedTerrain::GRID_COMMAND_BUFFER], m_chunkedTerrain->drawCommands().size(), m_chunkedTerrain->m_patchIndices.indexSize());
+}
+
+void Renderer::renderClipmapTerrain() {
+    m_clipmapTerrain->update();
+
     glm::mat4 vp = m_gameCamera->getVP();
     m_terrainShader.setWVP(vp);
 
-    m_terrain->bindBlendingTextures();
+    m_terrainShader.setLayerTextures(m_clipmapTerrain->m_layerTextures, m_clipmapTerrain->m_splatSettings.layerCount);
+    m_terrainShader.setVirtualTexture(nullptr, 0.0f);
+    m_terrainShader.setSplatArray(m_clipmapTerrain->m_splatArrayHandle);
 
     // Setup dir light
     m_terrainShader.setDirectionalLight(*m_dirLight);
 
-    auto meshIter = m_terrain->meshIter();
+    float min,max;
+    std::tie(min,max) = m_clipmapTerrain->getMinMaxHeight();
+    m_terrainShader.setMinHeight(min);
+    m_terrainShader.setMaxHeight(max);
+
+    m_terrainShader.setVertexSource(TERRAIN_SOURCE_CLIPMAP);
+    m_terrainShader.setClipmap(m_clipmapTerrain->m_heightArrayHandle, m_clipmapTerrain->m_textureSize, m_clipmapTerrain->m_gridSize, m_clipmapTerrain->m_origins);
+    m_terrainShader.setWorldScale(m_clipmapTerrain->getScale());
+    glBindVertexArray(m_clipmapTerrain->m_gridVAO);
 
-    while(meshIter) {
-        auto mesh = *meshIter;
-        renderMesh(mesh);
-        meshIter++;
-    }
- }
+    renderTerrainCommands(m_clipmapTerrain->m_gridBuffers[ClipmapTerrain::GRID_COMMAND_BUFFER], m_clipmapTerrain->drawCommands().size(), sizeof(uint32_t));
+}
+
+inline void Renderer::renderTerrainCommands(GLuint commandBuffer, std::size_t commandCount, uint32_t indexSize, GLenum primitive) {
+    if(commandCount == 0)
+        return;
+
+    // Every visible patch in one call, patches differ only in the index range, base vertex and base instance
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glMultiDrawElementsIndirect(primitive,
+                                indexType(indexSize),
+                                nullptr,
+                                static_cast<GLsizei>(commandCount),
+                                0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+inline void Renderer::renderTerrainCommands(GLuint commandBuffer, GLuint countBuffer, std::size_t maxCommandCount, uint32_t indexSize, GLenum primitive) {
+    if(maxCommandCount == 0)
+        return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+    glMultiDrawElementsIndirectCountARB(primitive,
+                                        indexType(indexSize),
+                                        nullptr,
+                                        0,
+                                        static_cast<GLsizei>(maxCommandCount),
+                                        0);
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
 
 void Renderer::renderSkybox() {
     glm::mat4 vp = m_gameCamera->getVPNoTranslate();
@@ -447,6 +752,10 @@ void Renderer::setWindowSize(int32_t width, int32_t height) {
     m_windowWidth = width;
     m_windowHeight = height;
 
+    // Screen-space error of terrain patches depends on the resolution
+    if(m_terrain)
+        m_terrain->setViewportHeight(static_cast<float>(m_windowHeight));
+
     // Need to change picking texture dimensions
     m_pickingTexture.init(m_windowWidth, m_windowHeight);
 }
@@ -471,6 +780,7 @@ Renderer::~Renderer() {
     m_debugShader.clean();
     m_shadowMapShader.clean();
     m_terrainShader.clean();
+    m_terrainTessShader.clean();
 
     // Cleanup textures
     m_pickingTexture.clean();
@@ -538,6 +848,8 @@ void Renderer::initShaders() {
     m_debugShader.init();
 
     m_terrainShader.init();
+    m_terrainTessShader.init();
+    m_terrainCullShader.init();
     //m_terrainShader.enable();
     //m_terrainShader.setBlendedTextureSamples(COLOR_TEXTURE_UNIT_INDEX);
 
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "model/terrain/Scatter.h"
+#include "ThreadPool.h"
+
+Logger Scatter::m_logger = Logger("Scatter");
+
+namespace {
+    // Patches are dropped only well outside of the range, so patches on its border don't flicker in and out
+    constexpr float DROP_RANGE_FACTOR = 1.25f;
+
+    glm::vec4 multiplyQuat(const glm::vec4& a, const glm::vec4& b) {
+        glm::vec3 av(a), bv(b);
+        glm::vec3 xyz = a.w * bv + b.w * av + glm::cross(av, bv);
+        return {xyz, a.w * b.w - glm::dot(av, bv)};
+    }
+
+    // Shortest rotation of the up axis onto the normal
+    glm::vec4 alignUp(const glm::vec3& normal) {
+        glm::vec4 q(normal.z, 0.0f, -normal.x, 1.0f + normal.y);
+        return q / glm::length(q);
+    }
+
+    // Radius of the model around its origin, bounds of models without vertices are empty
+    float modelRadius(const Model* model) {
+        if(!model || model->getBoundsMin().x > model->getBoundsMax().x)
+            return 0.0f;
+        return glm::length(glm::max(glm::abs(model->getBoundsMin()), glm::abs(model->getBoundsMax())));
+    }
+
+    float ruleWeight(const Scatter::Layer& layer, const SplatMap::Settings& splat, float height, float slope) {
+        if(slope > layer.maxSlope)
+            return 0.0f;
+
+        float outside = std::max({layer.minHeight - height, height - layer.maxHeight, 0.0f});
+        float weight = std::clamp(1.0f - outside / std::max(layer.heightBlend, 1e-6f), 0.0f, 1.0f);
+
+        if(layer.splatLayer >= 0 && static_cast<uint32_t>(layer.splatLayer) < splat.layerCount){
+            float layerWeights[MAX_TERRAIN_HEIGHT_TEXTURE];
+            SplatMap::weights(splat, height, slope, layerWeights);
+            weight *= layerWeights[layer.splatLayer];
+        }
+        return weight;
+    }
+}
+
+void Scatter::setLayers(std::vector<Layer> layers) {
+    m_layers = std::move(layers);
+
+    m_range = 0.0f;
+    for(const Layer& layer : m_layers){
+        m_range = std::max(m_range, layer.maxDistance);
+    }
+
+    for(Patch& patch : m_patches){
+        patch = Patch();
+    }
+}
+
+void Scatter::reset(uint32_t patchesX, uint32_t patchesY, uint32_t patchSize, const glm::vec2 &origin, float spacing) {
+    m_patchesX = patchesX;
+    m_patchesY = patchesY;
+    m_patchSize = patchSize;
+    m_origin = origin;
+    m_spacing = spacing;
+
+    m_patches.clear();
+    m_patches.resize(static_cast<std::size_t>(patchesX) * patchesY);
+    m_instances.clear();
+    m_batches.clear();
+}
+
+void Scatter::clear() {
+    reset(0, 0, 0, glm::vec2(0.0f), 1.0f);
+}
+
+void Scatter::invalidate(uint32_t firstX, uint32_t firstY, uint32_t lastX, uint32_t lastY) {
+    for(uint32_t patchY = firstY; patchY <= lastY && patchY < m_patchesY; patchY++){
+        for(uint32_t patchX = firstX; patchX <= lastX && patchX < m_patchesX; patchX++){
+            m_patches[patchY * m_patchesX + patchX] = Patch();
+        }
+    }
+}
+
+float Scatter::patchDistance(uint32_t patchIndex) const {
+    float patchWorldSize = static_cast<float>(m_patchSize-1) * m_spacing;
+    glm::vec2 min = m_origin + glm::vec2(static_cast<float>(patchIndex % m_patchesX), static_cast<float>(patchIndex / m_patchesX)) * patchWorldSize;
+    glm::vec2 camera(m_cameraPos.x, m_cameraPos.z);
+
+    return glm::distance(camera, glm::clamp(camera, min, min + glm::vec2(patchWorldSize)));
+}
+
+void Scatter::stream(const Heightfield &heightfield, const SplatMap::Settings &splat) {
+    if(m_layers.empty() || m_patches.empty() || heightfield.empty())
+        return;
+
+    m_entering.clear();
+    uint32_t dropped = 0;
+    for(uint32_t i = 0; i < m_patches.size(); i++){
+        Patch& patch = m_patches[i];
+        float distance = patchDistance(i);
+
+        if(!patch.resident && distance <= m_range){
+            m_entering.push_back(i);
+        }else if(patch.resident && distance > m_range * DROP_RANGE_FACTOR){
+            patch = Patch();
+            dropped++;
+        }
+    }
+
+    if(m_entering.empty())
+        return;
+
+    // Patches own their instances, every patch is generated by a single thread
+    ThreadPool::getInstance().parallelFor(0, static_cast<uint32_t>(m_entering.size()), [&](uint32_t begin, uint32_t end){
+        for(uint32_t i = begin; i < end; i++){
+            generate(heightfield, splat, m_entering[i]);
+        }
+    });
+
+    m_logger(Logger::DEBUG) << "Scattered " << std::to_string(m_entering.size()) << " patches, dropped " << dropped << '\n';
+}
+
+void Scatter::generate(const Heightfield &heightfield, const SplatMap::Settings &splat, uint32_t patchIndex) {
+    uint32_t patchX = patchIndex % m_patchesX;
+    uint32_t patchY = patchIndex / m_patchesX;
+    float patchWorldSize = static_cast<float>(m_patchSize-1) * m_spacing;
+    glm::vec2 patchMin = m_origin + glm::vec2(static_cast<float>(patchX), static_cast<float>(patchY)) * patchWorldSize;
+
+    Patch& patch = m_patches[patchIndex];
+    patch.layers.assign(m_layers.size(), {});
+    patch.bounds.min = glm::vec3(std::numeric_limits<float>::infinity());
+    patch.bounds.max = glm::vec3(-std::numeric_limits<float>::infinity());
+    patch.resident = true;
+
+    std::vector<glm::vec2> positions;
+    std::vector<float> heights;
+    std::vector<glm::vec3> normals;
+
+    for(std::size_t l = 0; l < m_layers.size(); l++){
+        const Layer& layer = m_layers[l];
+        if(!layer.model || layer.density <= 0.0f)
+            continue;
+
+        // Seeded by the layer and the patch, a patch streamed in again gets the same instances
+        std::seed_seq seed{layer.seed, patchX, patchY};
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        float expected = layer.density * patchWorldSize * patchWorldSize;
+        auto candidates = static_cast<std::size_t>(expected);
+        if(unit(rng) < expected - static_cast<float>(candidates))
+            candidates++;
+
+        positions.resize(candidates);
+        for(glm::vec2& position : positions){
+            position = patchMin + glm::vec2(unit(rng), unit(rng)) * patchWorldSize;
+        }
+
+        // Instances stand on the rendered surface
+        heights.resize(candidates);
+        normals.resize(candidates);
+        heightfield.sampleSurface(positions.data(), candidates, m_origin, m_spacing, heights.data(), normals.data());
+
+        float radius = std::max(modelRadius(layer.model.get()), modelRadius(layer.lodModel.get()));
+        std::vector<Instance>& instances = patch.layers[l];
+
+        for(std::size_t i = 0; i < candidates; i++){
+            // Every candidate takes the same amount of numbers, so rules don't shift the instances of other candidates
+            float keep = unit(rng);
+            float yaw = unit(rng) * 2.0f * glm::pi<float>();
+            float scale = glm::mix(layer.minScale, layer.maxScale, unit(rng));
+
+            if(keep >= ruleWeight(layer, splat, heights[i], 1.0f - normals[i].y))
+                continue;
+
+            glm::vec4 rotation(0.0f, std::sin(yaw / 2.0f), 0.0f, std::cos(yaw / 2.0f));
+            if(layer.alignToNormal){
+                rotation = multiplyQuat(alignUp(normals[i]), rotation);
+            }
+
+            glm::vec3 position(positions[i].x, heights[i], positions[i].y);
+            instances.push_back({glm::vec4(position, scale), rotation});
+
+            glm::vec3 extent(radius * scale);
+            patch.bounds.min = glm::min(patch.bounds.min, position - extent);
+            patch.bounds.max = glm::max(patch.bounds.max, position + extent);
+        }
+    }
+}
+
+void Scatter::collect(const Utils::FrustumCulling &frustum, HorizonCulling *horizon, const std::vector<HorizonCulling::Box> &occluders) {
+    m_instances.clear();
+    m_batches.clear();
+
+    if(m_layers.empty())
+        return;
+
+    m_inView.clear();
+    m_viewBounds.clear();
+    for(uint32_t i = 0; i < m_patches.size(); i++){
+        const Patch& patch = m_patches[i];
+        // Patches without instances keep inverted bounds
+        if(!patch.resident || patch.bounds.min.x > patch.bounds.max.x)
+            continue;
+
+        uint32_t planeMask = Utils::FrustumCulling::ALL_PLANES;
+        if(frustum.classifyBox(patch.bounds.min, patch.bounds.max, planeMask) == Utils::FrustumCulling::Containment::OUTSIDE)
+            continue;
+
+        m_inView.push_back(i);
+        m_viewBounds.push_back(patch.bounds);
+    }
+
+    if(horizon && !occluders.empty() && !m_inView.empty()){
+        horizon->cull(occluders, m_viewBounds, m_unoccluded);
+
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < m_inView.size(); i++){
+            if(m_unoccluded[i])
+                m_inView[kept++] = m_inView[i];
+        }
+        m_inView.resize(kept);
+    }
+
+    m_inViewDistance.resize(m_inView.size());
+    for(std::size_t i = 0; i < m_inView.size(); i++){
+        m_inViewDistance[i] = patchDistance(m_inView[i]);
+    }
+
+    // Instances of a model are contiguous, every layer and LOD is a single instanced draw
+    for(std::size_t l = 0; l < m_layers.size(); l++){
+        const Layer& layer = m_layers[l];
+
+        for(uint32_t lod = 0; lod < 2; lod++){
+            const Model* model = lod == 0 ? layer.model.get() : layer.lodModel.get();
+            if(!model)
+                continue;
+
+            Batch batch{model, static_cast<uint32_t>(m_instances.size()), 0};
+            for(std::size_t i = 0; i < m_inView.size(); i++){
+                float distance = m_inViewDistance[i];
+                bool far = layer.lodModel && distance >= layer.lodDistance;
+                if(far != (lod == 1) || distance >= layer.maxDistance)
+                    continue;
+
+                const std::vector<Instance>& instances = m_patches[m_inView[i]].layers[l];
+                std::size_t count = instances.size();
+                if(distance > layer.fadeDistance){
+                    float fade = (layer.maxDistance - distance) / std::max(layer.maxDistance - layer.fadeDistance, 1e-6f);
+                    count = static_cast<std::size_t>(std::lround(static_cast<float>(count) * fade));
+                }
+
+                m_instances.insert(m_instances.end(), instances.begin(), instances.begin() + static_cast<std::ptrdiff_t>(count));
+            }
+
+            batch.instanceCount = static_cast<uint32_t>(m_instances.size()) - batch.firstInstance;
+            if(batch.instanceCount > 0){
+                m_batches.push_back(batch);
+            }
+        }
+    }
+}
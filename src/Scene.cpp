@@ -184,6 +184,16 @@ std::shared_ptr<Terrain> Scene::getTerrain() {
     return m_terrain;
 }
 
+void Scene::insertChunkedTerrain(const std::shared_ptr<ChunkedTerrain> &terrain) {
+    m_chunkedTerrain = terrain;
+    m_renderer.setChunkedTerrainRender(terrain);
+}
+
+void Scene::insertClipmapTerrain(const std::shared_ptr<ClipmapTerrain> &terrain) {
+    m_clipmapTerrain = terrain;
+    m_renderer.setClipmapTerrainRender(terrain);
+}
+
 void Scene::insertSkybox(const std::shared_ptr<Skybox> &skybox) {
     m_skybox = skybox;
     m_renderer.setSkyboxModelRender(skybox);
@@ -6,6 +6,8 @@ SkinnedModel::SkinnedModel(const Model &model) {
     m_vertices = model.m_vertices;
     m_indices = model.m_indices;
     m_rootNode = model.m_rootNode;
+    m_boundsMin = model.m_boundsMin;
+    m_boundsMax = model.m_boundsMax;
 }
 
 SkinnedModel::SkinnedModel(const std::shared_ptr<Model>& model){
@@ -14,6 +16,8 @@ SkinnedModel::SkinnedModel(const std::shared_ptr<Model>& model){
     m_vertices = model->m_vertices;
     m_indices = model->m_indices;
     m_rootNode = model->m_rootNode;
+    m_boundsMin = model->m_boundsMin;
+    m_boundsMax = model->m_boundsMax;
 }
 
 const BoneInfo *SkinnedModel::getBoneInfo(const std::string &boneName) const {
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cmath>
+
+#include "model/terrain/SplatMap.h"
+#include "ThreadPool.h"
+
+SplatMap::Settings SplatMap::evenHeights(uint32_t layerCount, float minHeight, float maxHeight) {
+    Settings settings;
+    settings.layerCount = std::min<uint32_t>(layerCount, MAX_TERRAIN_HEIGHT_TEXTURE);
+    for(uint32_t i = 0; i < settings.layerCount; i++){
+        settings.heights[i] = minHeight + (maxHeight-minHeight)/static_cast<float>(settings.layerCount+1) * static_cast<float>(i+1);
+    }
+    return settings;
+}
+
+void SplatMap::weights(const Settings &settings, float height, float slope, float *out) {
+    std::fill(out, out + MAX_TERRAIN_HEIGHT_TEXTURE, 0.0f);
+    if(settings.layerCount == 0)
+        return;
+
+    uint32_t last = settings.layerCount-1;
+    if(height <= settings.heights[0]){
+        out[0] = 1.0f;
+    }else if(height >= settings.heights[last]){
+        out[last] = 1.0f;
+    }else{
+        uint32_t lower = 0;
+        while(height >= settings.heights[lower+1]){
+            lower++;
+        }
+        float factor = (height - settings.heights[lower]) / (settings.heights[lower+1] - settings.heights[lower]);
+        out[lower] = 1.0f - factor;
+        out[lower+1] = factor;
+    }
+
+    if(settings.slopeLayer >= 0 && static_cast<uint32_t>(settings.slopeLayer) < settings.layerCount){
+        float t = std::clamp((slope - settings.slopeStart) / std::max(settings.slopeEnd - settings.slopeStart, 1e-6f), 0.0f, 1.0f);
+        t = t * t * (3.0f - 2.0f * t);
+        for(uint32_t i = 0; i < settings.layerCount; i++){
+            out[i] *= 1.0f - t;
+        }
+        out[settings.slopeLayer] += t;
+    }
+}
+
+void SplatMap::bake(const Settings &settings, const Heightfield &heightfield, uint8_t *texels) {
+    const float* heights = heightfield.heights();
+    const glm::vec3* normals = heightfield.normals();
+
+    ThreadPool::getInstance().parallelFor(0, heightfield.dimY(), [&](uint32_t rowBegin, uint32_t rowEnd){
+        float layerWeights[MAX_TERRAIN_HEIGHT_TEXTURE];
+        for(std::size_t i = heightfield.xy2i(0, rowBegin); i < heightfield.xy2i(0, rowEnd); i++){
+            weights(settings, heights[i], 1.0f - normals[i].y, layerWeights);
+            packWeights(layerWeights, &texels[i * 4]);
+        }
+    });
+}
+
+void SplatMap::bake(const Settings &settings, const Heightfield &heightfield, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint8_t *texels) {
+    float layerWeights[MAX_TERRAIN_HEIGHT_TEXTURE];
+    for(uint32_t row = 0; row < height; row++){
+        for(uint32_t column = 0; column < width; column++){
+            uint32_t i = heightfield.xy2i(x + column, y + row);
+            weights(settings, heightfield.heightAt(i), 1.0f - heightfield.normalAt(i).y, layerWeights);
+            packWeights(layerWeights, &texels[(static_cast<std::size_t>(row) * width + column) * 4]);
+        }
+    }
+}
+
+void SplatMap::bake(const Settings &settings, const float *heights, uint32_t width, uint32_t height, float spacing, uint8_t *texels) {
+    float layerWeights[MAX_TERRAIN_HEIGHT_TEXTURE];
+    auto at = [&](uint32_t x, uint32_t y){ return heights[static_cast<std::size_t>(y) * width + x]; };
+
+    for(uint32_t y = 0; y < height; y++){
+        uint32_t down = y > 0 ? y-1 : y;
+        uint32_t up = std::min(y+1, height-1);
+
+        for(uint32_t x = 0; x < width; x++){
+            uint32_t left = x > 0 ? x-1 : x;
+            uint32_t right = std::min(x+1, width-1);
+
+            // Same differences as the vertex shader, so the slope matches the shaded normal
+            float dx = right > left ? (at(left, y) - at(right, y)) / static_cast<float>(right - left) : 0.0f;
+            float dy = up > down ? (at(x, down) - at(x, up)) / static_cast<float>(up - down) : 0.0f;
+            float normalY = spacing / std::sqrt(dx*dx + spacing*spacing + dy*dy);
+
+            weights(settings, at(x, y), 1.0f - normalY, layerWeights);
+            packWeights(layerWeights, &texels[(static_cast<std::size_t>(y) * width + x) * 4]);
+        }
+    }
+}
+
+void SplatMap::packWeights(const float *weights, uint8_t *texel) {
+    for(uint32_t i = 0; i < MAX_TERRAIN_HEIGHT_TEXTURE; i++){
+        texel[i] = static_cast<uint8_t>(std::lround(std::clamp(weights[i], 0.0f, 1.0f) * 255.0f));
+    }
+}
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <glm/geometric.hpp>
+
+#include "model/terrain/SurfaceCompositor.h"
+#include "extern/stb_image.h"
+
+Logger SurfaceCompositor::m_logger = Logger("Surface Compositor");
+
+namespace {
+    // Bilinear height and normal at a position in samples, clamped to the heightfield
+    void interpolate(const Heightfield& heightfield, const glm::vec2& position, float& height, glm::vec3& normal) {
+        glm::vec2 clamped = glm::clamp(position, glm::vec2(0.0f), glm::vec2(static_cast<float>(heightfield.dimX()-1), static_cast<float>(heightfield.dimY()-1)));
+        auto x0 = static_cast<uint32_t>(clamped.x);
+        auto y0 = static_cast<uint32_t>(clamped.y);
+        uint32_t x1 = std::min(x0 + 1, heightfield.dimX()-1);
+        uint32_t y1 = std::min(y0 + 1, heightfield.dimY()-1);
+        float fx = clamped.x - static_cast<float>(x0);
+        float fy = clamped.y - static_cast<float>(y0);
+
+        float bottom = heightfield.heightAt(x0, y0) + (heightfield.heightAt(x1, y0) - heightfield.heightAt(x0, y0)) * fx;
+        float top = heightfield.heightAt(x0, y1) + (heightfield.heightAt(x1, y1) - heightfield.heightAt(x0, y1)) * fx;
+        height = bottom + (top - bottom) * fy;
+
+        glm::vec3 normalBottom = glm::mix(heightfield.normalAt(x0, y0), heightfield.normalAt(x1, y0), fx);
+        glm::vec3 normalTop = glm::mix(heightfield.normalAt(x0, y1), heightfield.normalAt(x1, y1), fx);
+        normal = glm::normalize(glm::mix(normalBottom, normalTop, fy));
+    }
+
+    // Bilinear texel of a repeating image, coordinates in image repeats
+    glm::vec4 sampleRepeat(const std::vector<uint8_t>& texels, uint32_t width, uint32_t height, const glm::vec2& coord) {
+        float u = coord.x * static_cast<float>(width) - 0.5f;
+        float v = coord.y * static_cast<float>(height) - 0.5f;
+        float floorU = std::floor(u);
+        float floorV = std::floor(v);
+        float fx = u - floorU;
+        float fy = v - floorV;
+
+        auto wrap = [](float value, uint32_t size){
+            auto wrapped = static_cast<int64_t>(value) % static_cast<int64_t>(size);
+            return static_cast<uint32_t>(wrapped < 0 ? wrapped + size : wrapped);
+        };
+        uint32_t x0 = wrap(floorU, width);
+        uint32_t y0 = wrap(floorV, height);
+        uint32_t x1 = x0 + 1 < width ? x0 + 1 : 0;
+        uint32_t y1 = y0 + 1 < height ? y0 + 1 : 0;
+
+        auto texel = [&](uint32_t x, uint32_t y){
+            const uint8_t* t = &texels[(static_cast<std::size_t>(y) * width + x) * 4];
+            return glm::vec4(t[0], t[1], t[2], t[3]);
+        };
+        glm::vec4 bottom = glm::mix(texel(x0, y0), texel(x1, y0), fx);
+        glm::vec4 top = glm::mix(texel(x0, y1), texel(x1, y1), fx);
+        return glm::mix(bottom, top, fy);
+    }
+}
+
+void SurfaceCompositor::setLayers(const std::vector<std::string> &fileNames) {
+    if(fileNames == m_fileNames && !m_layers.empty())
+        return;
+
+    clear();
+    for(const std::string& fileName : fileNames){
+        int x = 0, y = 0, bpp = 0;
+        u_char* imageData = stbi_load(fileName.c_str(), &x, &y, &bpp, 4);
+        if(!imageData){
+            m_logger(Logger::ERROR) << "Unable to load texture [" << fileName << "]" << '\n';
+            clear();
+            throw textureException();
+        }
+
+        Image image;
+        image.width = static_cast<uint32_t>(x);
+        image.height = static_cast<uint32_t>(y);
+        image.texels.assign(imageData, imageData + static_cast<std::size_t>(x) * y * 4);
+        stbi_image_free(imageData);
+
+        std::vector<Image>& chain = m_layers.emplace_back();
+        chain.push_back(std::move(image));
+        while(chain.back().width > 1 || chain.back().height > 1){
+            chain.push_back(downsample(chain.back()));
+        }
+    }
+    m_fileNames = fileNames;
+
+    m_logger(Logger::DEBUG) << "Loaded " << std::to_string(m_layers.size()) << " layers for compositing" << '\n';
+}
+
+void SurfaceCompositor::clear() {
+    m_layers.clear();
+    m_fileNames.clear();
+}
+
+SurfaceCompositor::Image SurfaceCompositor::downsample(const Image &image) {
+    Image half;
+    half.width = std::max(image.width / 2, 1u);
+    half.height = std::max(image.height / 2, 1u);
+    half.texels.resize(static_cast<std::size_t>(half.width) * half.height * 4);
+
+    for(uint32_t y = 0; y < half.height; y++){
+        uint32_t y0 = std::min(y * 2, image.height - 1);
+        uint32_t y1 = std::min(y * 2 + 1, image.height - 1);
+
+        for(uint32_t x = 0; x < half.width; x++){
+            uint32_t x0 = std::min(x * 2, image.width - 1);
+            uint32_t x1 = std::min(x * 2 + 1, image.width - 1);
+
+            for(uint32_t c = 0; c < 4; c++){
+                auto texel = [&](uint32_t tx, uint32_t ty){ return static_cast<uint32_t>(image.texels[(static_cast<std::size_t>(ty) * image.width + tx) * 4 + c]); };
+                uint32_t sum = texel(x0, y0) + texel(x1, y0) + texel(x0, y1) + texel(x1, y1);
+                half.texels[(static_cast<std::size_t>(y) * half.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+    return half;
+}
+
+void SurfaceCompositor::composite(const Heightfield &heightfield, const SplatMap::Settings &settings, float span, uint32_t pages,
+                                  const VirtualTexture::Page &page, uint8_t *texels) const {
+    float pageSamples = span / static_cast<float>(pages >> page.level);
+    float texelSamples = pageSamples / static_cast<float>(VIRTUAL_PAGE_SIZE);
+    glm::vec2 pageOrigin = glm::vec2(static_cast<float>(page.x), static_cast<float>(page.y)) * pageSamples;
+
+    // Layer mips matching the footprint of one virtual texel, so coarse pages don't alias
+    uint32_t layerCount = std::min(settings.layerCount, static_cast<uint32_t>(m_layers.size()));
+    std::array<const Image*, MAX_TERRAIN_HEIGHT_TEXTURE> images{};
+    for(uint32_t layer = 0; layer < layerCount; layer++){
+        const std::vector<Image>& chain = m_layers[layer];
+        float footprint = texelSamples * static_cast<float>(std::max(chain.front().width, chain.front().height));
+        auto mip = footprint > 1.0f ? static_cast<std::size_t>(std::log2(footprint)) : 0;
+        images[layer] = &chain[std::min(mip, chain.size() - 1)];
+    }
+
+    for(uint32_t y = 0; y < VirtualTexture::SLOT_SIZE; y++){
+        for(uint32_t x = 0; x < VirtualTexture::SLOT_SIZE; x++){
+            glm::vec2 texel(static_cast<float>(x) - VIRTUAL_PAGE_BORDER + 0.5f, static_cast<float>(y) - VIRTUAL_PAGE_BORDER + 0.5f);
+            glm::vec2 position = pageOrigin + texel * texelSamples;
+
+            float height;
+            glm::vec3 normal;
+            interpolate(heightfield, position, height, normal);
+
+            float weights[MAX_TERRAIN_HEIGHT_TEXTURE];
+            SplatMap::weights(settings, height, 1.0f - normal.y, weights);
+
+            glm::vec4 color(0.0f);
+            for(uint32_t layer = 0; layer < layerCount; layer++){
+                if(weights[layer] > 0.0f){
+                    color += weights[layer] * sampleRepeat(images[layer]->texels, images[layer]->width, images[layer]->height, position);
+                }
+            }
+
+            uint8_t* out = &texels[(static_cast<std::size_t>(y) * VirtualTexture::SLOT_SIZE + x) * 4];
+            for(uint32_t c = 0; c < 4; c++){
+                out[c] = static_cast<uint8_t>(std::lround(std::clamp(color[c], 0.0f, 255.0f)));
+            }
+        }
+    }
+}
@@ -1,59 +1,122 @@
+#include <bit>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
 #include <glm/gtx/string_cast.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include "model/terrain/Terrain.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
 
 Logger Terrain::m_logger = Logger("Terrain");
 
-Terrain::Terrain() {
-    initMeta();
+namespace {
+    constexpr char CACHE_MAGIC[4] = {'T', 'T', 'R', 'C'};
+    // Bumped with every change of the layout or of the generators
+    constexpr uint32_t CACHE_VERSION = 1;
+
+    /**
+     * @brief Smooth brush weight, one in the centre and zero from the radius on.
+     */
+    float brushFalloff(float distance, float radius) {
+        float t = std::clamp(1.0f - distance / radius, 0.0f, 1.0f);
+        return t * t * (3.0f - 2.0f * t);
+    }
+    constexpr uint64_t CACHE_ALIGNMENT = 64;
+
+    enum class CacheGenerator : uint32_t {
+        MIDPOINT,
+        NOISE
+    };
+
+    enum CacheSectionType {
+        CACHE_HEIGHTS  = 0,
+        CACHE_NORMALS  = 1,
+        CACHE_BOUNDS   = 2,
+        CACHE_ERRORS   = 3,
+        CACHE_INDICES  = 4,
+        CACHE_VARIANTS = 5,
+        CACHE_TEXELS   = 6,
+        NUM_CACHE_SECTIONS = 7
+    };
+
+    struct CacheSection {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    struct CacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint64_t seed;
+        uint32_t dimX;
+        uint32_t dimY;
+        uint32_t patchesX;
+        uint32_t patchesY;
+        uint32_t maxLOD;
+        uint32_t indexSize;
+        float minHeight;
+        float maxHeight;
+        uint64_t indexCount;
+        uint64_t variantCount;
+        CacheSection sections[NUM_CACHE_SECTIONS];
+    };
 }
 
-void Terrain::initMeta() {
-    flags.sig_flagChanged.connect(slt_flagChange);
+std::unique_ptr<Terrain::BuildData> Terrain::createBuild() const {
+    auto data = std::make_unique<BuildData>();
+    data->maxLOD = m_maxLOD;
+    data->patchSize = m_patchSize;
+    data->worldScale = m_worldScale;
+    data->minRange = m_minRange;
+    data->maxRange = m_maxRange;
+    data->erosion = m_erosionSettings;
+    data->setNearestSize = flags[Flags::SET_NEAREST_SIZE];
+    data->renderMode = m_renderMode;
+    return data;
 }
 
-void Terrain::normalize() {
-    if(m_maxHeight <= m_minHeight){
-        return;
-    }
-
-    float minMaxDelta = m_maxHeight - m_minHeight;
-    float minMaxRange = m_maxRange - m_minRange;
+void Terrain::postProcess(BuildData& data) {
+    auto [minHeight, maxHeight] = data.heightfield.calcMinMax();
+    m_logger(Logger::DEBUG) << "Calculated min max height values: " << minHeight << " " << maxHeight << '\n';
 
-    for(auto& vert : m_vertices){
-        vert.m_position.y = ((vert.m_position.y - m_minHeight)/minMaxDelta) * minMaxRange + m_minRange;
+    if(data.erosion.enabled()){
+        // Erosion moves every height, normals and the range are only gathered from its output
+        data.heightfield.normalize(minHeight, maxHeight, data.minRange, data.maxRange);
+        Erosion::erode(data.erosion, data.heightfield, data.worldScale);
+        std::tie(data.minHeight, data.maxHeight) = data.heightfield.calcNormals(data.worldScale);
+        m_logger(Logger::DEBUG) << "Eroded height values into range between " << data.minHeight << " and " << data.maxHeight << '\n';
+        return;
     }
 
-    m_logger(Logger::DEBUG) << "Normalized height values into range between " << m_minRange << " and " << m_maxRange << '\n';
-    calcMinMax();
+    std::tie(data.minHeight, data.maxHeight) = data.heightfield.normalizeAndCalcNormals(minHeight, maxHeight, data.minRange, data.maxRange, data.worldScale);
+    m_logger(Logger::DEBUG) << "Normalized height values into range between " << data.minHeight << " and " << data.maxHeight << '\n';
 }
 
-void Terrain::calcMinMax() {
-    m_minHeight = std::numeric_limits<float>::infinity();
-    m_maxHeight = -std::numeric_limits<float>::infinity();
-
-    for(const auto& vert : m_vertices){
-        m_minHeight = fminf(m_minHeight,vert.m_position.y);
-        m_maxHeight = fmaxf(m_maxHeight,vert.m_position.y);
-    }
+void Terrain::generateFlat(uint32_t dimX, uint32_t dimZ, const char* textureFile, const char* normalFile) {
+    cancelBuild();
 
-    m_logger(Logger::DEBUG) << "Calculated min max height values: " << m_minHeight << " " << m_maxHeight << '\n';
-}
+    auto data = createBuild();
+    data->dimX = dimX;
+    data->dimY = dimZ;
 
-void Terrain::generateFlat(uint32_t dimX, uint32_t dimZ, const char* textureFile, const char* normalFile) {
-    m_dimX = dimX;
-    m_dimY = dimZ;
+    m_logger(Logger::INFO) << "Generating flat terrain of size " << data->dimX << "x" << data->dimY << '\n';
 
-    m_logger(Logger::INFO) << "Generating flat terrain of size " << m_dimX << "x" << m_dimY << '\n';
+    preparePlane(*data);
 
-    generateFlatPlane();
+    postProcess(*data);
+    calcPatchData(*data);
 
-    calcMinMax();
-    normalize();
-    calcNormals();
+    clear();
+    commitBuild(std::move(data));
 
     m_materials.resize(1);
 
-    addBlendTexture(0.0f,Texture::createTexture(GL_TEXTURE_2D, textureFile));
+    setLayerTextures({textureFile});
 
     m_materials.at(0).m_diffuseColor = glm::vec3(1.0f, 1.0f, 1.0f);
     m_materials.at(0).m_ambientColor = glm::vec3(1.0f, 1.0f, 1.0f);
@@ -62,170 +125,907 @@ void Terrain::generateFlat(uint32_t dimX, uint32_t dimZ, const char* textureFile
 }
 
 void Terrain::loadHeightmap(const char *heightmapFile, const char *textureFile) {
+    cancelBuild();
+
+    MappedFile file(heightmapFile);
+    auto fileSize = static_cast<int32_t>(std::min<std::size_t>(file.size(), std::numeric_limits<int32_t>::max()));
+
     int32_t width, height, channels;
-    u_char *hMapData = stbi_load(heightmapFile, &width, &height, &channels, 0);
+    bool is16Bit = stbi_is_16_bit_from_memory(file.data(), fileSize);
+
+    // Only the first channel is decoded, compressed images can't be read without decoding them first
+    void* pixels = is16Bit ?
+            static_cast<void*>(stbi_load_16_from_memory(file.data(), fileSize, &width, &height, &channels, 1)) :
+            static_cast<void*>(stbi_load_from_memory(file.data(), fileSize, &width, &height, &channels, 1));
+    if(!pixels){
+        throw textureException("Unable to load heightmap ", heightmapFile, ": ", stbi_failure_reason());
+    }
+
+    auto data = createBuild();
+    data->dimX = width;
+    data->dimY = height;
+
+    m_logger(Logger::INFO) << "Loading " << (is16Bit ? 16 : 8) << "-bit heightmap terrain of size " << data->dimX << "x" << data->dimY << '\n';
+
+    preparePlane(*data);
+
+    // Heights are normalized into the terrain range afterwards, only the relative scale matters
+    if(is16Bit){
+        importHeights(*data, static_cast<const uint16_t*>(pixels), width, height, 1.0f / std::numeric_limits<uint16_t>::max());
+    }else{
+        importHeights(*data, static_cast<const uint8_t*>(pixels), width, height, 1.0f / std::numeric_limits<uint8_t>::max());
+    }
+    stbi_image_free(pixels);
+
+    commitHeightmap(std::move(data), textureFile);
+}
+
+void Terrain::loadRawHeightmap(const char *heightmapFile, RawFormat format, const char *textureFile, uint32_t dimX, uint32_t dimY) {
+    cancelBuild();
 
-    m_dimX = width;
-    m_dimY = height;
+    MappedFile file(heightmapFile);
+    std::size_t sampleSize = format == RawFormat::R16 ? sizeof(uint16_t) : sizeof(float);
+    std::size_t sampleCount = file.size() / sampleSize;
 
-    m_logger(Logger::INFO) << "Loading heightmap terrain of size " << m_dimX << "x" << m_dimY << '\n';
+    if(dimX == 0 && dimY == 0){
+        dimX = static_cast<uint32_t>(std::llround(std::sqrt(static_cast<double>(sampleCount))));
+        dimY = dimX;
+    }
 
-    generateFlatPlane();
+    if(dimX == 0 || dimY == 0 || static_cast<std::size_t>(dimX) * dimY > sampleCount){
+        throw textureException("Raw heightmap ", heightmapFile, " is too small for ",
+                               std::to_string(dimX), "x", std::to_string(dimY), " samples");
+    }
 
-    float yScale = 64.0f/256.0f;
+    auto data = createBuild();
+    data->dimX = dimX;
+    data->dimY = dimY;
 
-    for(uint32_t i = 0; i < m_vertices.size(); i++){
-        u_char *texel = hMapData + (i) * channels;
+    m_logger(Logger::INFO) << "Loading raw heightmap terrain of size " << data->dimX << "x" << data->dimY << '\n';
 
-        float y = *texel;
+    preparePlane(*data);
 
-        hMapAt(i) = y * yScale;
-        m_minHeight = fminf(m_minHeight,hMapAt(i));
-        m_maxHeight = fmaxf(m_maxHeight,hMapAt(i));
+    // Samples are read in place from the mapping, pages are faulted in by the row bands of the workers
+    switch(format){
+        case RawFormat::R16:
+            importHeights(*data, reinterpret_cast<const uint16_t*>(file.data()), dimX, dimY, 1.0f / std::numeric_limits<uint16_t>::max());
+            break;
+        case RawFormat::R32F:
+            importHeights(*data, reinterpret_cast<const float*>(file.data()), dimX, dimY, 1.0f);
+            break;
     }
 
-    calcMinMax();
-    normalize();
-    calcNormals();
+    commitHeightmap(std::move(data), textureFile);
+}
+
+void Terrain::loadHeightTiles(const char *tilesFile, const char *textureFile) {
+    cancelBuild();
+
+    HeightTiles tiles(tilesFile);
+
+    auto data = createBuild();
+    data->dimX = tiles.dimX();
+    data->dimY = tiles.dimY();
+
+    m_logger(Logger::INFO) << "Loading compressed terrain of size " << data->dimX << "x" << data->dimY << '\n';
+
+    preparePlane(*data);
+
+    // Bands are aligned to tile rows, so every tile is decoded once even if the plane got resized
+    uint32_t tileSize = tiles.tileSize();
+    uint32_t bands = (data->dimY + tileSize - 1) / tileSize;
+    ThreadPool::getInstance().parallelFor(0, bands, [&](uint32_t begin, uint32_t end){
+        for(uint32_t band = begin; band < end; band++){
+            uint32_t y = band * tileSize;
+            uint32_t rows = std::min(tileSize, data->dimY - y);
+            tiles.decodeRegion(0, static_cast<int32_t>(y), data->dimX, rows, &data->heightfield.heightAt(0, y));
+        }
+    });
+
+    commitHeightmap(std::move(data), textureFile);
+}
+
+void Terrain::saveHeightTiles(const char *tilesFile, uint32_t tileSize, float maxError) const {
+    if(m_heightfield.empty())
+        return;
+
+    HeightTiles::encode(m_heightfield, tileSize, maxError).save(tilesFile);
+}
+
+template<typename Sample_t>
+void Terrain::importHeights(BuildData &data, const Sample_t *samples, uint32_t srcDimX, uint32_t srcDimY, float scale) {
+    Heightfield& heightfield = data.heightfield;
+    uint32_t copyX = std::min(srcDimX, heightfield.dimX());
+
+    ThreadPool::getInstance().parallelFor(0, heightfield.dimY(), [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t y = rowBegin; y < rowEnd; y++){
+            const Sample_t* srcRow = samples + static_cast<std::size_t>(std::min(y, srcDimY-1)) * srcDimX;
+            float* dstRow = heightfield.heights() + heightfield.xy2i(0, y);
+
+            for(uint32_t x = 0; x < copyX; x++){
+                dstRow[x] = static_cast<float>(srcRow[x]) * scale;
+            }
+            std::fill(dstRow + copyX, dstRow + heightfield.dimX(), static_cast<float>(srcRow[srcDimX-1]) * scale);
+        }
+    }, 16);
+}
+
+void Terrain::commitHeightmap(std::unique_ptr<BuildData> data, const char *textureFile) {
+    postProcess(*data);
+    calcPatchData(*data);
+
+    clear();
+    commitBuild(std::move(data));
 
     m_materials.resize(1);
 
+    setLayerTextures({textureFile});
+
     m_materials.at(0).m_diffuseColor = glm::vec3(1.0f, 1.0f, 1.0f);
     m_materials.at(0).m_ambientColor = glm::vec3(1.0f, 1.0f, 1.0f);
-    m_materials.at(0).m_diffuseTexture = std::make_shared<Texture>(GL_TEXTURE_2D, textureFile);
 
     bufferMeshes();
 }
 
 void Terrain::generateMidpoint(uint32_t size, float roughness, const std::vector<std::string>& textureFiles) {
+    generateMidpoint(size, roughness, textureFiles, randomSeed());
+}
+
+void Terrain::generateMidpoint(uint32_t size, float roughness, const std::vector<std::string>& textureFiles, uint64_t seed) {
+    cancelBuild();
+
+    auto data = createBuild();
+    data->dimX = size;
+    data->dimY = size;
+    data->seed = seed;
+    data->textureFiles = textureFiles;
+
+    buildMidpoint(*data, roughness);
+
+    clear();
+    commitBuild(std::move(data));
+
+    bufferMeshes();
+}
+
+void Terrain::generateMidpointAsync(uint32_t size, float roughness, const std::vector<std::string>& textureFiles) {
+    generateMidpointAsync(size, roughness, textureFiles, randomSeed());
+}
+
+void Terrain::generateMidpointAsync(uint32_t size, float roughness, const std::vector<std::string>& textureFiles, uint64_t seed) {
+    // Newer request wins, result of a build still running on a worker is dropped
+    cancelBuild();
+
+    auto data = createBuild();
+    data->dimX = size;
+    data->dimY = size;
+    data->seed = seed;
+    data->textureFiles = textureFiles;
+
+    m_logger(Logger::INFO) << "Queued background generation of midpoint terrain of size " << size << '\n';
+
+    m_pendingBuild = ThreadPool::getInstance().submit([data = std::move(data), roughness]() mutable {
+        buildMidpoint(*data, roughness);
+        prepareUploadStreams(*data);
+        return std::move(data);
+    });
+}
+
+void Terrain::generateNoise(uint32_t dimX, uint32_t dimY, const FractalNoise::Settings &settings, const std::vector<std::string> &textureFiles) {
+    cancelBuild();
+
+    auto data = createBuild();
+    data->dimX = dimX;
+    data->dimY = dimY;
+    data->seed = settings.seed;
+    data->textureFiles = textureFiles;
+
+    buildNoise(*data, settings);
+
+    clear();
+    commitBuild(std::move(data));
+
+    bufferMeshes();
+}
+
+void Terrain::generateNoiseAsync(uint32_t dimX, uint32_t dimY, const FractalNoise::Settings &settings, const std::vector<std::string> &textureFiles) {
+    cancelBuild();
+
+    auto data = createBuild();
+    data->dimX = dimX;
+    data->dimY = dimY;
+    data->seed = settings.seed;
+    data->textureFiles = textureFiles;
+
+    m_logger(Logger::INFO) << "Queued background generation of noise terrain of size " << dimX << "x" << dimY << '\n';
+
+    m_pendingBuild = ThreadPool::getInstance().submit([data = std::move(data), settings]() mutable {
+        buildNoise(*data, settings);
+        prepareUploadStreams(*data);
+        return std::move(data);
+    });
+}
+
+void Terrain::generateMidpointCached(uint32_t size, float roughness, const std::vector<std::string> &textureFiles, uint64_t seed, const char *cacheFile) {
+    uint64_t key = settingsHash();
+    key = Utils::hashCombine(key, static_cast<uint64_t>(CacheGenerator::MIDPOINT));
+    key = Utils::hashCombine(key, size);
+    key = Utils::hashCombine(key, std::bit_cast<uint32_t>(roughness));
+    key = Utils::hashCombine(key, seed);
+
+    if(loadCache(cacheFile, key, textureFiles))
+        return;
+
+    generateMidpoint(size, roughness, textureFiles, seed);
+    saveCache(cacheFile, key);
+}
+
+void Terrain::generateNoiseCached(uint32_t dimX, uint32_t dimY, const FractalNoise::Settings &settings, const std::vector<std::string> &textureFiles, const char *cacheFile) {
+    uint64_t key = settingsHash();
+    key = Utils::hashCombine(key, static_cast<uint64_t>(CacheGenerator::NOISE));
+    key = Utils::hashCombine(key, (static_cast<uint64_t>(dimY) << 32) | dimX);
+    key = Utils::hashCombine(key, static_cast<uint64_t>(settings.mode));
+    key = Utils::hashCombine(key, settings.seed);
+    key = Utils::hashCombine(key, settings.octaves);
+    key = Utils::hashCombine(key, std::bit_cast<uint32_t>(settings.featureSize));
+    key = Utils::hashCombine(key, std::bit_cast<uint32_t>(settings.lacunarity));
+    key = Utils::hashCombine(key, std::bit_cast<uint32_t>(settings.gain));
+    key = Utils::hashCombine(key, std::bit_cast<uint32_t>(settings.warpStrength));
+
+    if(loadCache(cacheFile, key, textureFiles))
+        return;
+
+    generateNoise(dimX, dimY, settings, textureFiles);
+    saveCache(cacheFile, key);
+}
+
+uint64_t Terrain::settingsHash() const {
+    uint64_t hash = Utils::hashCombine(0, CACHE_VERSION);
+    hash = Utils::hashCombine(hash, m_maxLOD);
+    hash = Utils::hashCombine(hash, m_patchSize);
+    hash = Utils::hashCombine(hash, std::bit_cast<uint32_t>(m_worldScale));
+    hash = Utils::hashCombine(hash, std::bit_cast<uint32_t>(m_minRange));
+    hash = Utils::hashCombine(hash, std::bit_cast<uint32_t>(m_maxRange));
+    hash = Utils::hashCombine(hash, flags[Flags::SET_NEAREST_SIZE]);
+
+    // Disabled erosion keeps keys of caches written before it existed
+    const Erosion::Settings& erosion = m_erosionSettings;
+    if(erosion.enabled()){
+        hash = Utils::hashCombine(hash, (static_cast<uint64_t>(erosion.thermalIterations) << 32) | erosion.hydraulicIterations);
+        for(float value : {erosion.timeStep, erosion.rain, erosion.evaporation, erosion.pipeFlow, erosion.capacity, erosion.dissolving,
+                           erosion.deposition, erosion.minSlope, erosion.talus, erosion.thermalRate}){
+            hash = Utils::hashCombine(hash, std::bit_cast<uint32_t>(value));
+        }
+    }
+    return hash;
+}
+
+bool Terrain::loadCache(const char *cacheFile, uint64_t key, const std::vector<std::string> &textureFiles) {
+    MappedFile file;
+    try{
+        file = MappedFile(cacheFile);
+    }catch(fileException&){
+        m_logger(Logger::INFO) << "No terrain cache at " << cacheFile << '\n';
+        return false;
+    }
+
+    if(file.size() < sizeof(CacheHeader))
+        return false;
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(CacheHeader));
+    if(std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION || header.key != key){
+        m_logger(Logger::INFO) << "Terrain cache " << cacheFile << " is stale" << '\n';
+        return false;
+    }
+
+    auto data = createBuild();
+
+    // Header is checked against the settings of the build before any size is derived from it
+    bool consistent = header.maxLOD == data->maxLOD &&
+                      (header.indexSize == sizeof(uint16_t) || header.indexSize == sizeof(uint32_t)) &&
+                      header.variantCount == (static_cast<uint64_t>(header.maxLOD)+1) * PatchIndices::variantsPerLOD() &&
+                      header.dimX >= data->patchSize && header.dimY >= data->patchSize &&
+                      header.patchesX == (header.dimX-1) / (data->patchSize-1) &&
+                      header.patchesY == (header.dimY-1) / (data->patchSize-1);
+
+    std::size_t samples = static_cast<std::size_t>(header.dimX) * header.dimY;
+    std::size_t patches = static_cast<std::size_t>(header.patchesX) * header.patchesY;
+    const std::size_t expectedSizes[NUM_CACHE_SECTIONS] = {
+            samples * sizeof(float),
+            samples * sizeof(glm::vec3),
+            patches * sizeof(glm::vec2),
+            patches * (header.maxLOD+1) * sizeof(float),
+            header.indexCount * header.indexSize,
+            header.variantCount * sizeof(PatchIndices::Range),
+            samples * sizeof(uint16_t)
+    };
+    for(uint32_t i = 0; i < NUM_CACHE_SECTIONS && consistent; i++){
+        const CacheSection& section = header.sections[i];
+        consistent = section.size == expectedSizes[i] && section.offset % CACHE_ALIGNMENT == 0 &&
+                     section.offset <= file.size() && section.size <= file.size() - section.offset;
+    }
+    // Index count is checked by division, the product of the sizes above could wrap
+    consistent = consistent && header.indexCount == header.sections[CACHE_INDICES].size / header.indexSize;
+
+    auto sectionData = [&](CacheSectionType type){ return file.data() + header.sections[type].offset; };
+    const auto* variants = consistent ? reinterpret_cast<const PatchIndices::Range*>(sectionData(CACHE_VARIANTS)) : nullptr;
+    for(std::size_t i = 0; i < header.variantCount && consistent; i++){
+        consistent = variants[i].start <= header.indexCount && variants[i].count <= header.indexCount - variants[i].start;
+    }
+
+    if(!consistent){
+        m_logger(Logger::WARNING) << "Terrain cache " << cacheFile << " is damaged" << '\n';
+        return false;
+    }
+
+    cancelBuild();
+
+    data->dimX = header.dimX;
+    data->dimY = header.dimY;
+    data->patchesX = header.patchesX;
+    data->patchesY = header.patchesY;
+    data->minHeight = header.minHeight;
+    data->maxHeight = header.maxHeight;
+    data->seed = header.seed;
+    data->textureFiles = textureFiles;
+
+    // Heights, normals and indices stay on the CPU for queries, edits, rebuilt buffers after a render mode switch and
+    // saving, so each is copied once into its owner. The height texture has no CPU owner and is uploaded from the mapping.
+    data->heightfield.resize(header.dimX, header.dimY);
+    std::memcpy(data->heightfield.heights(), sectionData(CACHE_HEIGHTS), header.sections[CACHE_HEIGHTS].size);
+    std::memcpy(data->heightfield.normals(), sectionData(CACHE_NORMALS), header.sections[CACHE_NORMALS].size);
+
+    const auto* bounds = reinterpret_cast<const glm::vec2*>(sectionData(CACHE_BOUNDS));
+    data->quadtree.build(std::vector<glm::vec2>(bounds, bounds + patches), data->patchSize, data->patchesX, data->patchesY,
+                         {-static_cast<float>(data->dimX)/2 * data->worldScale, -static_cast<float>(data->dimY)/2 * data->worldScale},
+                         data->worldScale);
+
+    const auto* errors = reinterpret_cast<const float*>(sectionData(CACHE_ERRORS));
+    data->patchErrors.assign(errors, errors + patches * (header.maxLOD+1));
+
+    data->patchIndices.assign(header.maxLOD, data->patchSize, variants, sectionData(CACHE_INDICES), header.indexCount, header.indexSize);
+
     clear();
+    commitBuild(std::move(data));
+
+    switch(m_renderMode){
+        case RenderMode::VERTEX_BUFFER:
+            bufferVertices();
+            break;
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION:
+            bufferPatchGrid();
+            uploadHeightTexture(reinterpret_cast<const uint16_t*>(sectionData(CACHE_TEXELS)));
+            break;
+    }
+    bufferSplatMap();
+    bufferNormalMap();
+    bufferVirtualTexture();
+
+    m_logger(Logger::INFO) << "Loaded terrain of size " << m_dimX << "x" << m_dimY << " from cache " << cacheFile << '\n';
+    return true;
+}
+
+void Terrain::saveCache(const char *cacheFile, uint64_t key) const {
+    if(m_heightfield.empty() || m_quadtree.empty())
+        return;
+
+    std::vector<uint16_t> texels(m_heightfield.size());
+    quantizeHeights(m_heightfield, m_minHeight, m_maxHeight, texels.data());
+
+    const std::vector<glm::vec2>& bounds = m_quadtree.leafBounds();
+    const std::vector<float>& errors = m_lodManager.patchErrors();
+
+    const std::pair<const void*, std::size_t> sections[NUM_CACHE_SECTIONS] = {
+            {m_heightfield.heights(), m_heightfield.size() * sizeof(float)},
+            {m_heightfield.normals(), m_heightfield.size() * sizeof(glm::vec3)},
+            {bounds.data(), bounds.size() * sizeof(glm::vec2)},
+            {errors.data(), errors.size() * sizeof(float)},
+            {m_patchIndices.data(), m_patchIndices.byteSize()},
+            {m_patchIndices.variants(), m_patchIndices.variantCount() * sizeof(PatchIndices::Range)},
+            {texels.data(), texels.size() * sizeof(uint16_t)}
+    };
+
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.seed = m_seed;
+    header.dimX = m_dimX;
+    header.dimY = m_dimY;
+    header.patchesX = m_patchesX;
+    header.patchesY = m_patchesY;
+    header.maxLOD = m_maxLOD;
+    header.indexSize = m_patchIndices.indexSize();
+    header.minHeight = m_minHeight;
+    header.maxHeight = m_maxHeight;
+    header.indexCount = m_patchIndices.indexCount();
+    header.variantCount = m_patchIndices.variantCount();
+
+    // Sections start on cache line boundaries, so mapped sections can be read as their element type
+    uint64_t offset = sizeof(CacheHeader);
+    for(uint32_t i = 0; i < NUM_CACHE_SECTIONS; i++){
+        offset = (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+        header.sections[i] = {offset, sections[i].second};
+        offset += sections[i].second;
+    }
+
+    // Written next to the target and renamed, a crash never leaves a half written cache behind
+    std::string tmpFile = std::string(cacheFile) + ".tmp";
+    std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+    if(!out){
+        m_logger(Logger::WARNING) << "Unable to write terrain cache " << cacheFile << '\n';
+        return;
+    }
 
-    m_dimX = size;
-    m_dimY = size;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+    for(uint32_t i = 0; i < NUM_CACHE_SECTIONS; i++){
+        static const char padding[CACHE_ALIGNMENT] = {0};
+        auto position = static_cast<uint64_t>(out.tellp());
+        out.write(padding, static_cast<std::streamsize>(header.sections[i].offset - position));
+        out.write(static_cast<const char*>(sections[i].first), static_cast<std::streamsize>(sections[i].second));
+    }
+    out.close();
 
-    m_logger(Logger::INFO) << "Generating midpoint terrain of size " << size << '\n';
+    std::error_code error;
+    std::filesystem::rename(tmpFile, cacheFile, error);
+    if(!out || error){
+        m_logger(Logger::WARNING) << "Unable to write terrain cache " << cacheFile << '\n';
+        std::filesystem::remove(tmpFile, error);
+        return;
+    }
 
-    generateFlatPlane();
+    m_logger(Logger::INFO) << "Saved terrain cache " << cacheFile << " of " << std::to_string(offset) << " bytes" << '\n';
+}
+
+uint64_t Terrain::randomSeed() {
+    return (static_cast<uint64_t>(m_randDevice()) << 32) | m_randDevice();
+}
+
+void Terrain::buildMidpoint(BuildData& data, float roughness) {
+    m_logger(Logger::INFO) << "Generating midpoint terrain of size " << data.dimX << " with seed " << std::to_string(data.seed) << '\n';
+
+    preparePlane(data);
+
+    // The algorithm needs a 2^n + 1 grid, bigger terrains are generated on a padded grid and cropped
+    uint32_t gridSize = std::bit_ceil(std::max(data.dimX, data.dimY) - 1) + 1;
+    bool padded = gridSize != data.dimX || gridSize != data.dimY;
+
+    std::vector<float> paddedGrid;
+    float* grid = data.heightfield.heights();
+    if(padded){
+        paddedGrid.resize(static_cast<std::size_t>(gridSize) * gridSize);
+        grid = paddedGrid.data();
+    }
 
-    uint32_t rectSize = Utils::nextPowerOf(size,2);
+    uint32_t rectSize = gridSize - 1;
     float currHeight = static_cast<float>(rectSize)/2.0f;
     float heightReduce = powf(2.0f, -roughness);
 
-    while(rectSize > 0){
-        diamondStep(rectSize, currHeight);
-        squareStep(rectSize, currHeight);
+    for(uint32_t y = 0; y < gridSize; y += rectSize){
+        for(uint32_t x = 0; x < gridSize; x += rectSize){
+            grid[y*gridSize + x] = Utils::counterRandom(data.seed, x, y, 0) * currHeight;
+        }
+    }
+
+    uint32_t level = 1;
+    while(rectSize > 1){
+        diamondStep(grid, gridSize, rectSize, currHeight, data.seed, level);
+        squareStep(grid, gridSize, rectSize, currHeight, data.seed, level);
 
         rectSize /= 2;
         currHeight *= heightReduce;
+        level++;
     }
 
-    calcMinMax();
-    normalize();
-    calcNormals();
+    if(padded){
+        ThreadPool::getInstance().parallelFor(0, data.dimY, [&](uint32_t rowBegin, uint32_t rowEnd){
+            for(uint32_t y = rowBegin; y < rowEnd; y++){
+                std::memcpy(&data.heightfield.heightAt(0, y), &grid[static_cast<std::size_t>(y)*gridSize], data.dimX * sizeof(float));
+            }
+        });
+    }
 
-    std::vector<std::vector<float>> heights;
-    heights.resize(m_patchesY);
-    for(uint32_t patchY = 0; patchY < m_patchesY; patchY++){
-        heights.at(patchY).resize(m_patchesX);
-        for(uint32_t patchX = 0; patchX < m_patchesX; patchX++){
-            heights.at(patchY).at(patchX) = hMapAt(patchX*(m_patchSize-1) + (m_patchSize-1)/2 , patchY*(m_patchSize-1) + (m_patchSize-1)/2);
+    postProcess(data);
+    calcPatchData(data);
+}
+
+void Terrain::buildNoise(BuildData &data, const FractalNoise::Settings &settings) {
+    m_logger(Logger::INFO) << "Generating noise terrain of size " << data.dimX << "x" << data.dimY << " with seed " << std::to_string(data.seed) << '\n';
+
+    preparePlane(data);
+
+    FractalNoise noise(settings);
+    noise.fillParallel(0, 0, data.dimX, data.dimY, data.heightfield.heights(), data.dimX);
+
+    postProcess(data);
+    calcPatchData(data);
+}
+
+void Terrain::calcPatchData(BuildData& data) {
+    uint32_t levels = data.maxLOD + 1;
+    uint32_t patchSize = data.patchSize;
+    data.patchErrors.assign(static_cast<std::size_t>(data.patchesX) * data.patchesY * levels, 0.0f);
+
+    ThreadPool::getInstance().parallelFor(0, data.patchesY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t patchY = rowBegin; patchY < rowEnd; patchY++){
+            for(uint32_t patchX = 0; patchX < data.patchesX; patchX++){
+                float* errors = &data.patchErrors[(static_cast<std::size_t>(patchY) * data.patchesX + patchX) * levels];
+                calcPatchErrors(data.heightfield, patchSize, data.maxLOD, patchX, patchY, errors);
+            }
         }
+    });
+
+    glm::vec2 origin(-static_cast<float>(data.dimX)/2 * data.worldScale, -static_cast<float>(data.dimY)/2 * data.worldScale);
+    data.quadtree.build(data.heightfield, data.patchSize, data.patchesX, data.patchesY, origin, data.worldScale);
+}
+
+void Terrain::calcPatchErrors(const Heightfield &heightfield, uint32_t patchSize, uint32_t maxLOD, uint32_t patchX, uint32_t patchY, float *errors) {
+    uint32_t x0 = patchX * (patchSize-1);
+    uint32_t y0 = patchY * (patchSize-1);
+    errors[0] = 0.0f;
+
+    // Error of a LOD is the largest height difference between the samples and the coarser grid interpolating them
+    for(uint32_t lod = 1; lod <= maxLOD; lod++){
+        uint32_t step = 1u << lod;
+        float invStep = 1.0f / static_cast<float>(step);
+        float error = errors[lod-1];
+
+        for(uint32_t y = 0; y < patchSize; y++){
+            uint32_t cellY = std::min(y / step * step, patchSize-1 - step);
+            float ty = static_cast<float>(y - cellY) * invStep;
+
+            for(uint32_t x = 0; x < patchSize; x++){
+                uint32_t cellX = std::min(x / step * step, patchSize-1 - step);
+                float tx = static_cast<float>(x - cellX) * invStep;
+
+                float h00 = heightfield.heightAt(x0 + cellX, y0 + cellY);
+                float h10 = heightfield.heightAt(x0 + cellX + step, y0 + cellY);
+                float h01 = heightfield.heightAt(x0 + cellX, y0 + cellY + step);
+                float h11 = heightfield.heightAt(x0 + cellX + step, y0 + cellY + step);
+                float interpolated = glm::mix(glm::mix(h00, h10, tx), glm::mix(h01, h11, tx), ty);
+
+                error = std::max(error, std::abs(heightfield.heightAt(x0 + x, y0 + y) - interpolated));
+            }
+        }
+
+        // Kept monotonic, coarser LOD is never more precise
+        errors[lod] = error;
     }
+}
 
-    m_lodManager.loadHeightsPerPatch(heights);
+void Terrain::commitBuild(std::unique_ptr<BuildData> data) {
+    m_dimX = data->dimX;
+    m_dimY = data->dimY;
+    m_patchesX = data->patchesX;
+    m_patchesY = data->patchesY;
+    m_seed = data->seed;
+    m_minHeight = data->minHeight;
+    m_maxHeight = data->maxHeight;
 
+    // Settings changed while the build ran only apply to the next build, everything committed here was built with these
+    m_maxLOD = data->maxLOD;
+    m_patchSize = data->patchSize;
+    m_worldScale = data->worldScale;
 
-    m_materials.resize(1);
+    m_heightfield = std::move(data->heightfield);
+    m_patchIndices = std::move(data->patchIndices);
+    m_quadtree = std::move(data->quadtree);
 
-    m_materials.at(0).m_diffuseColor = glm::vec3(1.0f, 1.0f, 1.0f);
-    m_materials.at(0).m_ambientColor = glm::vec3(1.0f, 1.0f, 1.0f);
+    m_lodManager.init(m_maxLOD, m_patchesX, m_patchesY, m_worldScale);
+    if(!m_quadtree.empty())
+        m_lodManager.loadPatches(m_quadtree.leafBounds(), std::move(data->patchErrors));
 
-    assert(textureFiles.size() <= MAX_TERRAIN_HEIGHT_TEXTURE);
+    m_scatter.reset(m_patchesX, m_patchesY, m_patchSize, gridOrigin(), m_worldScale);
 
-    for(uint32_t i = 0; i < textureFiles.size(); i++){
-        addBlendTexture(0.0f,Texture::createTexture(GL_TEXTURE_2D, textureFiles.at(i)));
-        m_blendingTextures.at(i).first = abs(m_minRange-m_maxRange)/(textureFiles.size()+1) * static_cast<float>(i+1);
+    if(!data->textureFiles.empty()){
+        m_materials.resize(1);
+
+        m_materials.at(0).m_diffuseColor = glm::vec3(1.0f, 1.0f, 1.0f);
+        m_materials.at(0).m_ambientColor = glm::vec3(1.0f, 1.0f, 1.0f);
+
+        setLayerTextures(data->textureFiles);
     }
+}
 
-    bufferMeshes();
+void Terrain::prepareUploadStreams(BuildData& data) {
+    switch(data.renderMode){
+        case RenderMode::VERTEX_BUFFER:
+            data.vertices.resize(static_cast<std::size_t>(data.patchesX) * data.patchesY * data.patchSize * data.patchSize);
+            fillPatchVertices(data.heightfield, data.patchSize, data.patchesX, data.patchesY, data.worldScale, data.vertices.data());
+            break;
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION:
+            data.heightTexels.resize(data.heightfield.size());
+            quantizeHeights(data.heightfield, data.minHeight, data.maxHeight, data.heightTexels.data());
+            break;
+    }
 }
 
-void Terrain::diamondStep(uint32_t rectSize, float currHeight) {
-    uint32_t halfRectSize = rectSize / 2;
+void Terrain::fillPatchVertices(const Heightfield& heightfield, uint32_t patchSize, uint32_t patchesX, uint32_t patchesY, float worldScale, GPUVertex* vertices) {
+    std::size_t patchVertices = static_cast<std::size_t>(patchSize) * patchSize;
 
-    std::mt19937 randomGen(m_randDevice());
-    std::uniform_real_distribution<float> distribution(-currHeight, currHeight);
+    // Every patch owns a block of patchSize^2 vertices, border samples are duplicated into both neighbours
+    ThreadPool::getInstance().parallelFor(0, patchesY, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t patchY = rowBegin; patchY < rowEnd; patchY++){
+            for(uint32_t patchX = 0; patchX < patchesX; patchX++){
+                GPUVertex* patch = vertices + (static_cast<std::size_t>(patchY) * patchesX + patchX) * patchVertices;
+                fillPatchRows(heightfield, patchSize, patchX, patchY, 0, patchSize, worldScale, patch);
+            }
+        }
+    });
+}
 
-    for(uint32_t x = 0; x < m_dimX; x += rectSize){
-        for(uint32_t y = 0; y < m_dimY; y += rectSize){
-            uint32_t nextX = (x + rectSize) % m_dimX;
-            uint32_t nextY = (y + rectSize) % m_dimY;
+void Terrain::fillPatchRows(const Heightfield &heightfield, uint32_t patchSize, uint32_t patchX, uint32_t patchY, uint32_t firstRow, uint32_t endRow, float worldScale, GPUVertex *vertices) {
+    float halfX = static_cast<float>(heightfield.dimX())/2;
+    float halfY = static_cast<float>(heightfield.dimY())/2;
 
-            if(nextX < x){
-                nextX = m_dimX - 1;
-            }
-            if(nextY < y){
-                nextY = m_dimY - 1;
-            }
+    for(uint32_t localY = firstRow; localY < endRow; localY++){
+        for(uint32_t localX = 0; localX < patchSize; localX++){
+            uint32_t x = patchX * (patchSize-1) + localX;
+            uint32_t y = patchY * (patchSize-1) + localY;
+
+            GPUVertex& vertex = vertices[(localY - firstRow) * patchSize + localX];
+            vertex.position = {(static_cast<float>(x) - halfX) * worldScale,
+                               heightfield.heightAt(x, y),
+                               (static_cast<float>(y) - halfY) * worldScale};
+        }
+    }
+}
 
-            float topLeft = hMapAt(x, y);
-            float topRight = hMapAt(nextX, y);
-            float bottomLeft = hMapAt(x, nextY);
-            float bottomRight = hMapAt(nextX, nextY);
+void Terrain::quantizeHeights(const Heightfield& heightfield, float minHeight, float maxHeight, uint16_t* texels) {
+    // Heights are stored normalized between the min and max height, the shader maps them back
+    float minMaxDelta = maxHeight - minHeight;
+    float quantScale = minMaxDelta > 0.0f ? static_cast<float>(std::numeric_limits<uint16_t>::max()) / minMaxDelta : 0.0f;
 
-            uint32_t midX = (x + halfRectSize) % m_dimX;
-            uint32_t midY = (y + halfRectSize) % m_dimY;
+    const float* heights = heightfield.heights();
+    ThreadPool::getInstance().parallelFor(0, heightfield.dimY(), [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(std::size_t i = heightfield.xy2i(0, rowBegin); i < heightfield.xy2i(0, rowEnd); i++){
+            float quantized = std::clamp((heights[i] - minHeight) * quantScale, 0.0f, static_cast<float>(std::numeric_limits<uint16_t>::max()));
+            texels[i] = static_cast<uint16_t>(std::lround(quantized));
+        }
+    });
+}
 
-            float randValue = distribution(randomGen);
-            float midPoint = (topLeft + topRight + bottomLeft + bottomRight) / 4.0f;
+void Terrain::quantizeHeights(const Heightfield &heightfield, float minHeight, float maxHeight, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t *texels) {
+    float minMaxDelta = maxHeight - minHeight;
+    float quantScale = minMaxDelta > 0.0f ? static_cast<float>(std::numeric_limits<uint16_t>::max()) / minMaxDelta : 0.0f;
 
-            hMapAt(midX, midY) = midPoint + randValue;
+    for(uint32_t row = 0; row < height; row++){
+        for(uint32_t column = 0; column < width; column++){
+            float quantized = std::clamp((heightfield.heightAt(x + column, y + row) - minHeight) * quantScale, 0.0f, static_cast<float>(std::numeric_limits<uint16_t>::max()));
+            texels[static_cast<std::size_t>(row) * width + column] = static_cast<uint16_t>(std::lround(quantized));
         }
     }
 }
 
-void Terrain::squareStep(uint32_t rectSize, float currHeight) {
-    uint32_t halfRectSize = rectSize / 2;
+bool Terrain::update() {
+    bool swapped = progressStagedBuild();
 
-    std::mt19937 randomGen(m_randDevice());
-    std::uniform_real_distribution<float> distribution(-currHeight, currHeight);
+    // Draw count written by the culling pass can only be consumed with ARB_indirect_parameters
+    if(flags[Flags::GPU_LOD_CULLING] && !GLAD_GL_ARB_indirect_parameters){
+        m_logger(Logger::WARNING) << "GL_ARB_indirect_parameters isn't supported, patches are selected and culled on the CPU" << '\n';
+        flags.set(Flags::GPU_LOD_CULLING, false);
+    }
 
-    for(uint32_t x = 0; x < m_dimX; x += rectSize){
-        for(uint32_t y = 0; y < m_dimY; y += rectSize){
+    // CPU cost of the GPU path doesn't grow with the amount of patches
+    if(flags[Flags::GPU_LOD_CULLING]){
+        bufferCullingData();
+    }else{
+        // Tessellated patches pick their density on the GPU
+        if(m_renderMode != RenderMode::TESSELLATION){
+            m_lodManager.update();
+        }
+        collectDrawCommands();
+    }
 
-            uint32_t nextX = (x + rectSize) % m_dimX;
-            uint32_t nextY = (y + rectSize) % m_dimY;
+    if(!m_scatter.empty()){
+        updateScatter();
+    }
+    m_virtualTexture.update();
+    return swapped;
+}
 
-            if(nextX < x){
-                nextX = m_dimX - 1;
-            }
-            if(nextY < y){
-                nextY = m_dimY - 1;
-            }
+bool Terrain::progressStagedBuild() {
+    if(!m_stagedBuild){
+        if(!m_pendingBuild.valid() || m_pendingBuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
 
-            uint32_t midX = (x + halfRectSize) % m_dimX;
-            uint32_t midY = (y + halfRectSize) % m_dimY;
+        m_stagedBuild = m_pendingBuild.get();
+        m_stagedRows = 0;
 
-            uint32_t prevMidX = (x - halfRectSize + m_dimX) % m_dimX;
-            uint32_t prevMidY = (y - halfRectSize + m_dimY) % m_dimY;
+        // Render mode changed while the build was running, upload streams are of the wrong kind
+        if(m_stagedBuild->renderMode != m_renderMode){
+            m_stagedBuild->renderMode = m_renderMode;
+            prepareUploadStreams(*m_stagedBuild);
+        }
+
+        createStagingResources();
+    }
 
-            float currTopLeft = hMapAt(x, y);
-            float currTopRight = hMapAt(nextX, y);
-            float currCenter = hMapAt(midX, midY);
-            float prevYCenter = hMapAt(midX, prevMidY);
-            float currBottomLeft = hMapAt(x, nextY);
-            float prevXCenter = hMapAt(prevMidX, midY);
+    uploadStagedRows();
 
-            float currLeftMid = (currTopLeft + currCenter + currBottomLeft + prevXCenter) / 4.0f;
-            float currTopMid = (currTopLeft + currCenter + currTopRight + prevYCenter) / 4.0f;
+    if(m_stagedRows < stagedRowCount(*m_stagedBuild))
+        return false;
 
-            hMapAt(x, midY) = currLeftMid + distribution(randomGen);
-            hMapAt(midX, y) = currTopMid + distribution(randomGen);
-        }
+    swapStaged();
+    return true;
+}
+
+void Terrain::setUploadBudget(std::size_t bytesPerFrame) {
+    m_uploadBudget = bytesPerFrame;
+}
+
+bool Terrain::isRegenerating() const {
+    return m_pendingBuild.valid() || m_stagedBuild;
+}
+
+void Terrain::createStagingResources() {
+    const BuildData& data = *m_stagedBuild;
+
+    switch(data.renderMode){
+        case RenderMode::VERTEX_BUFFER:
+            glCreateVertexArrays(1, &m_stagedVAO);
+            glCreateBuffers(ARRAY_SIZE(m_stagedBuffers), m_stagedBuffers);
+
+            glNamedBufferData(m_stagedBuffers[POS_VB], static_cast<GLsizeiptr>(data.vertices.size() * sizeof(GPUVertex)), nullptr, GL_STATIC_DRAW);
+            glNamedBufferData(m_stagedBuffers[INDEX_BUFFER], static_cast<GLsizeiptr>(data.patchIndices.byteSize()), data.patchIndices.data(), GL_STATIC_DRAW);
+
+            glBindVertexArray(m_stagedVAO);
+
+            glBindBuffer(GL_ARRAY_BUFFER, m_stagedBuffers[POS_VB]);
+            setVertexLayout();
+
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_stagedBuffers[INDEX_BUFFER]);
+
+            glBindVertexArray(0);
+            break;
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION:
+            createHeightTexture(m_stagedTexture, m_stagedTextureHandle, data.dimX, data.dimY);
+            break;
+    }
+}
+
+void Terrain::uploadStagedRows() {
+    const BuildData& data = *m_stagedBuild;
+
+    // Vertex stream is uploaded by rows of patches, height texture by rows of samples
+    std::size_t rowElements = data.renderMode == RenderMode::VERTEX_BUFFER ? static_cast<std::size_t>(data.patchesX) * data.patchSize * data.patchSize : data.dimX;
+    std::size_t rowBytes = data.renderMode == RenderMode::VERTEX_BUFFER ? rowElements * sizeof(GPUVertex) : rowElements * sizeof(uint16_t);
+    uint32_t rows = std::clamp(static_cast<uint32_t>(m_uploadBudget / rowBytes), 1u, stagedRowCount(data) - m_stagedRows);
+
+    switch(data.renderMode){
+        case RenderMode::VERTEX_BUFFER:
+            glNamedBufferSubData(m_stagedBuffers[POS_VB],
+                                 static_cast<GLintptr>(m_stagedRows * rowBytes),
+                                 static_cast<GLsizeiptr>(rows * rowBytes),
+                                 &data.vertices[m_stagedRows * rowElements]);
+            break;
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION:
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+            glTextureSubImage2D(m_stagedTexture, 0, 0, static_cast<GLint>(m_stagedRows), static_cast<GLsizei>(data.dimX), static_cast<GLsizei>(rows),
+                                GL_RED, GL_UNSIGNED_SHORT, &data.heightTexels[data.heightfield.xy2i(0, m_stagedRows)]);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            break;
     }
+
+    m_stagedRows += rows;
+}
+
+uint32_t Terrain::stagedRowCount(const BuildData& data) {
+    return data.renderMode == RenderMode::VERTEX_BUFFER ? data.patchesY : data.dimY;
 }
 
-const glm::vec3& Terrain::pMapWCoord(int32_t x, int32_t y) {
+void Terrain::swapStaged() {
+    std::unique_ptr<BuildData> data = std::move(m_stagedBuild);
+
+    clear();
+
+    switch(data->renderMode){
+        case RenderMode::VERTEX_BUFFER:
+            m_VAO = m_stagedVAO;
+            std::copy(std::begin(m_stagedBuffers), std::end(m_stagedBuffers), std::begin(m_buffers));
+            break;
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION:
+            eraseHeightTexture();
+            m_heightTexture = m_stagedTexture;
+            m_heightTextureHandle = m_stagedTextureHandle;
+            m_heightTextureDimX = data->dimX;
+            m_heightTextureDimY = data->dimY;
+            break;
+    }
+    m_stagedVAO = -1;
+    m_stagedTexture = -1;
+    m_stagedTextureHandle = 0;
+
+    commitBuild(std::move(data));
+
+    // Patch grid only changes with patch size or count and is cheap to rebuild
+    if(m_renderMode != RenderMode::VERTEX_BUFFER){
+        bufferPatchGrid();
+    }
+    bufferSplatMap();
+    bufferNormalMap();
+    bufferVirtualTexture();
+
+    m_logger(Logger::INFO) << "Swapped in regenerated terrain of size " << m_dimX << "x" << m_dimY << '\n';
+}
+
+void Terrain::cancelBuild() {
+    m_pendingBuild = {};
+
+    if(!m_stagedBuild)
+        return;
+
+    eraseStagingResources();
+    m_stagedBuild.reset();
+}
+
+void Terrain::eraseStagingResources() {
+    if(m_stagedVAO != -1){
+        glDeleteVertexArrays(1, &m_stagedVAO);
+        glDeleteBuffers(ARRAY_SIZE(m_stagedBuffers), m_stagedBuffers);
+        m_stagedVAO = -1;
+    }
+    if(m_stagedTexture != -1){
+        glMakeTextureHandleNonResidentARB(m_stagedTextureHandle);
+        glDeleteTextures(1, &m_stagedTexture);
+        m_stagedTexture = -1;
+        m_stagedTextureHandle = 0;
+    }
+}
+
+void Terrain::diamondStep(float* grid, uint32_t gridSize, uint32_t rectSize, float currHeight, uint64_t seed, uint32_t level) {
+    uint32_t halfRectSize = rectSize / 2;
+    uint32_t rows = (gridSize - 1) / rectSize;
+
+    ThreadPool::getInstance().parallelFor(0, rows, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t row = rowBegin; row < rowEnd; row++){
+            uint32_t y = row * rectSize;
+            const float* top = &grid[static_cast<std::size_t>(y) * gridSize];
+            const float* bottom = top + static_cast<std::size_t>(rectSize) * gridSize;
+            float* mid = &grid[static_cast<std::size_t>(y + halfRectSize) * gridSize];
+
+            for(uint32_t x = 0; x < gridSize - 1; x += rectSize){
+                float midPoint = (top[x] + top[x + rectSize] + bottom[x] + bottom[x + rectSize]) * 0.25f;
+                mid[x + halfRectSize] = midPoint + Utils::counterRandom(seed, x + halfRectSize, y + halfRectSize, level) * currHeight;
+            }
+        }
+    }, std::max(1u, 4096u / gridSize));
+}
+
+void Terrain::squareStep(float* grid, uint32_t gridSize, uint32_t rectSize, float currHeight, uint64_t seed, uint32_t level) {
+    uint32_t halfRectSize = rectSize / 2;
+    uint32_t rows = (gridSize - 1) / halfRectSize + 1;
+
+    ThreadPool::getInstance().parallelFor(0, rows, [&](uint32_t rowBegin, uint32_t rowEnd){
+        for(uint32_t row = rowBegin; row < rowEnd; row++){
+            uint32_t y = row * halfRectSize;
+            float* curr = &grid[static_cast<std::size_t>(y) * gridSize];
+            const float* up = y > 0 ? curr - static_cast<std::size_t>(halfRectSize) * gridSize : nullptr;
+            const float* down = y < gridSize - 1 ? curr + static_cast<std::size_t>(halfRectSize) * gridSize : nullptr;
+
+            // Square midpoints sit on rows of corners in odd columns and on rows of centers in even columns
+            for(uint32_t x = (row % 2 == 0) ? halfRectSize : 0; x < gridSize; x += rectSize){
+                float sum = 0.0f;
+                float count = 0.0f;
+
+                if(x >= halfRectSize)           { sum += curr[x - halfRectSize]; count += 1.0f; }
+                if(x + halfRectSize < gridSize) { sum += curr[x + halfRectSize]; count += 1.0f; }
+                if(up)                          { sum += up[x];                  count += 1.0f; }
+                if(down)                        { sum += down[x];                count += 1.0f; }
+
+                curr[x] = sum / count + Utils::counterRandom(seed, x, y, level) * currHeight;
+            }
+        }
+    }, std::max(1u, 4096u / gridSize));
+}
+
+glm::vec3 Terrain::pMapWCoord(int32_t x, int32_t y) {
     return pMapAt(static_cast<uint32_t>(static_cast<float>(x)/m_worldScale + static_cast<float>(m_dimX)/2), static_cast<uint32_t>(static_cast<float>(y)/m_worldScale + static_cast<float>(m_dimY)/2));
 }
 
@@ -234,122 +1034,397 @@ float Terrain::hMapWCoord(int32_t x, int32_t y){
 }
 
 float Terrain::hMapBaryWCoord(float x, float y) {
-    int32_t xF = std::floor(x);
-    int32_t yF = std::floor(y);
-    uint32_t xLoc = static_cast<uint32_t>(static_cast<float>(xF)/m_worldScale + static_cast<float>(m_dimX)/2);
-    uint32_t yLoc = static_cast<uint32_t>(static_cast<float>(yF)/m_worldScale + static_cast<float>(m_dimY)/2);
-    glm::vec3 p1;
-    glm::vec3 p2;
-    glm::vec3 p3;
-
-    float xQuad = x - static_cast<float>(xF);
-    float yQuad = y - static_cast<float>(yF);
-
-    if(xLoc%2 == 0 && yLoc%2 == 0 && xQuad > yQuad) {
-        p1 = pMapWCoord(xF, yF);
-        p2 = pMapWCoord(xF+1,yF+1);
-        p3 = pMapWCoord(xF+1, yF);
-    }else if(xLoc%2 == 0 && yLoc%2 == 0 && xQuad <= yQuad) {
-        p1 = pMapWCoord(xF, yF);
-        p2 = pMapWCoord(xF, yF+1);
-        p3 = pMapWCoord(xF+1,yF+1);
-    }else if(xLoc%2 == 1 && yLoc%2 == 0 && xQuad > -yQuad+1) {
-        p1 = pMapWCoord(xF+1, yF);
-        p2 = pMapWCoord(xF,yF+1);
-        p3 = pMapWCoord(xF+1, yF+1);
-    }else if(xLoc%2 == 1 && yLoc%2 == 0 && xQuad <= -yQuad+1) {
-        p1 = pMapWCoord(xF, yF);
-        p2 = pMapWCoord(xF,yF+1);
-        p3 = pMapWCoord(xF+1, yF);
-    }else if(xLoc%2 == 0 && yLoc%2 == 1 && xQuad > -yQuad+1) {
-        p1 = pMapWCoord(xF+1, yF);
-        p2 = pMapWCoord(xF,yF+1);
-        p3 = pMapWCoord(xF+1, yF+1);
-    }else if(xLoc%2 == 0 && yLoc%2 == 1 && xQuad <= -yQuad+1) {
-        p1 = pMapWCoord(xF, yF);
-        p2 = pMapWCoord(xF,yF+1);
-        p3 = pMapWCoord(xF+1, yF);
-    }else if(xLoc%2 == 1 && yLoc%2 == 1 && xQuad > yQuad) {
-        p1 = pMapWCoord(xF, yF);
-        p2 = pMapWCoord(xF+1,yF+1);
-        p3 = pMapWCoord(xF+1, yF);
-    }else if(xLoc%2 == 1 && yLoc%2 == 1 && xQuad <= yQuad) {
-        p1 = pMapWCoord(xF, yF);
-        p2 = pMapWCoord(xF,yF+1);
-        p3 = pMapWCoord(xF+1, yF+1);
-    }
-
-    float h1, h2, h3;
-    Utils::barycentric({x,y}, {p1.x,p1.z},{p2.x,p2.z},{p3.x,p3.z},h1,h2,h3);
-    return p1.y*h1 + p2.y*h2 + p3.y*h3;
-}
-void Terrain::generateFlatPlane() {
-    m_logger(Logger::DEBUG) << "Generating flat terrain of size " << m_dimX << "x" << m_dimY << '\n';
-
-    if((m_dimX-1) % (m_patchSize-1) != 0){
-        uint32_t nearestSize = ((m_dimX-1+m_patchSize-1)/(m_patchSize-1)*(m_patchSize-1)+1);
+    glm::vec2 position(x, y);
+    float height = 0.0f;
+    queryHeights(&position, 1, &height);
+    return height;
+}
+
+void Terrain::queryHeights(const glm::vec2 *positions, std::size_t count, float *heights, glm::vec3 *normals) const {
+    m_heightfield.sampleSurface(positions, count, gridOrigin(), m_worldScale, heights, normals);
+}
+
+void Terrain::editHeights(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const std::function<float(uint32_t, uint32_t, float)> &edit) {
+    if(m_heightfield.empty() || x >= m_dimX || y >= m_dimY)
+        return;
+
+    width = std::min(width, m_dimX - x);
+    height = std::min(height, m_dimY - y);
+    if(width == 0 || height == 0)
+        return;
+
+    float minHeight = m_minHeight;
+    float maxHeight = m_maxHeight;
+    for(uint32_t row = y; row < y + height; row++){
+        for(uint32_t column = x; column < x + width; column++){
+            float& sample = m_heightfield.heightAt(column, row);
+            sample = edit(column, row, sample);
+            minHeight = std::min(minHeight, sample);
+            maxHeight = std::max(maxHeight, sample);
+        }
+    }
+
+    // Quantized heights are relative to the range, widening it invalidates the whole height texture
+    bool rangeChanged = minHeight < m_minHeight || maxHeight > m_maxHeight;
+    m_minHeight = minHeight;
+    m_maxHeight = maxHeight;
+
+    // Central differences of the border samples read the edited heights
+    uint32_t borderX = x > 0 ? x-1 : x;
+    uint32_t borderY = y > 0 ? y-1 : y;
+    uint32_t borderWidth = std::min(x + width + 1, m_dimX) - borderX;
+    uint32_t borderHeight = std::min(y + height + 1, m_dimY) - borderY;
+    m_heightfield.calcNormals(m_worldScale, borderX, borderY, borderWidth, borderHeight);
+
+    refreshPatches(x, y, width, height);
+    uploadEditedHeights(x, y, width, height, rangeChanged);
+    uploadEditedMaps(borderX, borderY, borderWidth, borderHeight);
+
+    m_logger(Logger::DEBUG) << "Edited " << width << "x" << height << " samples at " << x << "x" << y << '\n';
+}
+
+void Terrain::raise(const glm::vec2 &center, float radius, float amount) {
+    uint32_t x, y, width, height;
+    if(!brushRect(center, radius, x, y, width, height))
+        return;
+
+    glm::vec2 origin = gridOrigin();
+    editHeights(x, y, width, height, [&](uint32_t sampleX, uint32_t sampleY, float sample){
+        glm::vec2 position(origin.x + static_cast<float>(sampleX) * m_worldScale, origin.y + static_cast<float>(sampleY) * m_worldScale);
+        return sample + amount * brushFalloff(glm::distance(position, center), radius);
+    });
+}
+
+void Terrain::flatten(const glm::vec2 &center, float radius, float targetHeight) {
+    uint32_t x, y, width, height;
+    if(!brushRect(center, radius, x, y, width, height))
+        return;
+
+    glm::vec2 origin = gridOrigin();
+    editHeights(x, y, width, height, [&](uint32_t sampleX, uint32_t sampleY, float sample){
+        glm::vec2 position(origin.x + static_cast<float>(sampleX) * m_worldScale, origin.y + static_cast<float>(sampleY) * m_worldScale);
+        // Falloff over the outer half, so the flat area blends into the surrounding terrain
+        float weight = brushFalloff(glm::distance(position, center) - radius * 0.5f, radius * 0.5f);
+        return glm::mix(sample, targetHeight, weight);
+    });
+}
+
+bool Terrain::brushRect(const glm::vec2 &center, float radius, uint32_t &x, uint32_t &y, uint32_t &width, uint32_t &height) const {
+    if(m_heightfield.empty() || radius <= 0.0f)
+        return false;
+
+    glm::vec2 origin = gridOrigin();
+    float minX = std::floor((center.x - radius - origin.x) / m_worldScale);
+    float minY = std::floor((center.y - radius - origin.y) / m_worldScale);
+    float maxX = std::ceil((center.x + radius - origin.x) / m_worldScale);
+    float maxY = std::ceil((center.y + radius - origin.y) / m_worldScale);
+
+    if(maxX < 0.0f || maxY < 0.0f || minX >= static_cast<float>(m_dimX) || minY >= static_cast<float>(m_dimY))
+        return false;
+
+    x = static_cast<uint32_t>(std::max(minX, 0.0f));
+    y = static_cast<uint32_t>(std::max(minY, 0.0f));
+    width = static_cast<uint32_t>(std::min(maxX, static_cast<float>(m_dimX-1))) - x + 1;
+    height = static_cast<uint32_t>(std::min(maxY, static_cast<float>(m_dimY-1))) - y + 1;
+    return true;
+}
+
+bool Terrain::patchesOfRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t &firstX, uint32_t &firstY, uint32_t &lastX, uint32_t &lastY) const {
+    if(m_patchesX == 0 || m_patchesY == 0 || m_patchSize < 2)
+        return false;
+
+    // Neighbouring patches share their border samples, an edited border belongs to both
+    uint32_t cells = m_patchSize-1;
+    firstX = x > 0 ? (x-1) / cells : 0;
+    firstY = y > 0 ? (y-1) / cells : 0;
+    lastX = std::min((x + width - 1) / cells, m_patchesX-1);
+    lastY = std::min((y + height - 1) / cells, m_patchesY-1);
+    return firstX <= lastX && firstY <= lastY;
+}
+
+void Terrain::refreshPatches(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if(m_quadtree.empty())
+        return;
+
+    uint32_t firstX, firstY, lastX, lastY;
+    if(!patchesOfRect(x, y, width, height, firstX, firstY, lastX, lastY))
+        return;
+
+    m_quadtree.updatePatches(m_heightfield, m_patchSize, firstX, firstY, lastX, lastY);
+
+    uint32_t levels = m_maxLOD+1;
+    uint32_t countX = lastX - firstX + 1;
+    uint32_t countY = lastY - firstY + 1;
+    std::vector<glm::vec2> bounds;
+    bounds.reserve(static_cast<std::size_t>(countX) * countY);
+    std::vector<float> errors(static_cast<std::size_t>(countX) * countY * levels);
+
+    for(uint32_t patchY = firstY; patchY <= lastY; patchY++){
+        for(uint32_t patchX = firstX; patchX <= lastX; patchX++){
+            calcPatchErrors(m_heightfield, m_patchSize, m_maxLOD, patchX, patchY, &errors[bounds.size() * levels]);
+            bounds.push_back(m_quadtree.patchBounds(patchX, patchY));
+        }
+    }
+    m_lodManager.updatePatches(firstX, firstY, lastX, lastY, bounds.data(), errors.data());
+    m_scatter.invalidate(firstX, firstY, lastX, lastY);
+
+    if(m_cullBuffers[CULL_BOUNDS_BUFFER] != 0){
+        // Rows of patches are contiguous in both buffers
+        for(uint32_t row = 0; row < countY; row++){
+            std::size_t patch = static_cast<std::size_t>(firstY + row) * m_patchesX + firstX;
+            glNamedBufferSubData(m_cullBuffers[CULL_BOUNDS_BUFFER], static_cast<GLintptr>(patch * sizeof(glm::vec2)),
+                                 static_cast<GLsizeiptr>(countX * sizeof(glm::vec2)), &bounds[static_cast<std::size_t>(row) * countX]);
+            glNamedBufferSubData(m_cullBuffers[CULL_ERRORS_BUFFER], static_cast<GLintptr>(patch * levels * sizeof(float)),
+                                 static_cast<GLsizeiptr>(countX * levels * sizeof(float)), &errors[static_cast<std::size_t>(row) * countX * levels]);
+        }
+    }
+}
+
+void Terrain::uploadEditedHeights(uint32_t x, uint32_t y, uint32_t width, uint32_t height, bool fullHeightTexture) {
+    switch(m_renderMode){
+        case RenderMode::VERTEX_BUFFER: {
+            uint32_t firstX, firstY, lastX, lastY;
+            if(m_VAO == -1 || !patchesOfRect(x, y, width, height, firstX, firstY, lastX, lastY))
+                return;
+
+            uint32_t cells = m_patchSize-1;
+            std::size_t patchVertices = static_cast<std::size_t>(m_patchSize) * m_patchSize;
+
+            // Only the rows of a patch block holding edited samples are uploaded
+            std::vector<GPUVertex> vertices;
+            for(uint32_t patchY = firstY; patchY <= lastY; patchY++){
+                uint32_t patchRow = patchY * cells;
+                uint32_t firstRow = std::max(y, patchRow) - patchRow;
+                uint32_t endRow = std::min(y + height, patchRow + m_patchSize) - patchRow;
+
+                for(uint32_t patchX = firstX; patchX <= lastX; patchX++){
+                    vertices.resize(static_cast<std::size_t>(endRow - firstRow) * m_patchSize);
+                    fillPatchRows(m_heightfield, m_patchSize, patchX, patchY, firstRow, endRow, m_worldScale, vertices.data());
+
+                    std::size_t first = (static_cast<std::size_t>(patchY) * m_patchesX + patchX) * patchVertices + static_cast<std::size_t>(firstRow) * m_patchSize;
+                    glNamedBufferSubData(m_buffers[POS_VB], static_cast<GLintptr>(first * sizeof(GPUVertex)),
+                                         static_cast<GLsizeiptr>(vertices.size() * sizeof(GPUVertex)), vertices.data());
+                }
+            }
+            break;
+        }
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION: {
+            if(m_heightTexture == -1)
+                return;
+
+            if(fullHeightTexture){
+                uploadHeightTexture();
+                return;
+            }
+
+            std::vector<uint16_t> texels(static_cast<std::size_t>(width) * height);
+            quantizeHeights(m_heightfield, m_minHeight, m_maxHeight, x, y, width, height, texels.data());
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+            glTextureSubImage2D(m_heightTexture, 0, static_cast<GLint>(x), static_cast<GLint>(y), static_cast<GLsizei>(width), static_cast<GLsizei>(height), GL_RED, GL_UNSIGNED_SHORT, texels.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            break;
+        }
+    }
+}
+
+void Terrain::uploadEditedMaps(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if(m_normalTexture != -1){
+        std::vector<uint16_t> texels(static_cast<std::size_t>(width) * height * 2);
+        NormalMap::bake(m_heightfield, x, y, width, height, texels.data());
+        glTextureSubImage2D(m_normalTexture, 0, static_cast<GLint>(x), static_cast<GLint>(y), static_cast<GLsizei>(width), static_cast<GLsizei>(height), GL_RG, GL_UNSIGNED_SHORT, texels.data());
+    }
+
+    // Weights depend on the slope, so the border of the edit changes too
+    if(m_splatTexture != -1 && m_splatSettings.layerCount > 0){
+        std::vector<uint8_t> texels(static_cast<std::size_t>(width) * height * 4);
+        SplatMap::bake(m_splatSettings, m_heightfield, x, y, width, height, texels.data());
+        glTextureSubImage2D(m_splatTexture, 0, static_cast<GLint>(x), static_cast<GLint>(y), static_cast<GLsizei>(width), static_cast<GLsizei>(height), GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+    }
+
+    // Texels of the virtual texture are composited from the same heights and slopes
+    if(!m_virtualTexture.empty()){
+        m_virtualTexture.invalidate(glm::vec2(static_cast<float>(x), static_cast<float>(y)) / m_virtualSpan,
+                                    glm::vec2(static_cast<float>(x + width), static_cast<float>(y + height)) / m_virtualSpan);
+    }
+}
+
+glm::vec2 Terrain::gridOrigin() const {
+    return {-static_cast<float>(m_dimX)/2 * m_worldScale, -static_cast<float>(m_dimY)/2 * m_worldScale};
+}
+
+bool Terrain::raycast(const glm::vec3 &origin, const glm::vec3 &direction, RayHit &hit, float maxDistance) const {
+    if(m_quadtree.empty() || glm::length(direction) == 0.0f)
+        return false;
+
+    glm::vec3 dir = glm::normalize(direction);
+    return m_quadtree.raycast(origin, dir, maxDistance, [&](uint32_t patchX, uint32_t patchY, float tEnter, float tExit){
+        return raycastPatch(origin, dir, patchX, patchY, tEnter, tExit, hit);
+    });
+}
+
+bool Terrain::raycastPatch(const glm::vec3 &origin, const glm::vec3 &direction, uint32_t patchX, uint32_t patchY, float tEnter, float tExit, RayHit &hit) const {
+    glm::vec2 gOrigin = gridOrigin();
+    float invScale = 1.0f / m_worldScale;
+
+    // Ray in grid coordinates, parametrized by the same distance as in world space
+    glm::vec2 g0((origin.x - gOrigin.x) * invScale, (origin.z - gOrigin.y) * invScale);
+    glm::vec2 gd(direction.x * invScale, direction.z * invScale);
+
+    int32_t cellX0 = static_cast<int32_t>(patchX * (m_patchSize-1));
+    int32_t cellY0 = static_cast<int32_t>(patchY * (m_patchSize-1));
+    int32_t cellX1 = cellX0 + static_cast<int32_t>(m_patchSize-1);
+    int32_t cellY1 = cellY0 + static_cast<int32_t>(m_patchSize-1);
+
+    glm::vec2 entry = g0 + gd * tEnter;
+    int32_t cellX = std::clamp(static_cast<int32_t>(std::floor(entry.x)), cellX0, cellX1-1);
+    int32_t cellY = std::clamp(static_cast<int32_t>(std::floor(entry.y)), cellY0, cellY1-1);
+
+    const float inf = std::numeric_limits<float>::infinity();
+    int32_t stepX = gd.x >= 0.0f ? 1 : -1;
+    int32_t stepY = gd.y >= 0.0f ? 1 : -1;
+    float tDeltaX = gd.x != 0.0f ? std::abs(1.0f / gd.x) : inf;
+    float tDeltaY = gd.y != 0.0f ? std::abs(1.0f / gd.y) : inf;
+    float tNextX = gd.x != 0.0f ? (static_cast<float>(cellX + (stepX > 0 ? 1 : 0)) - g0.x) / gd.x : inf;
+    float tNextY = gd.y != 0.0f ? (static_cast<float>(cellY + (stepY > 0 ? 1 : 0)) - g0.y) / gd.y : inf;
+
+    auto corner = [&](int32_t x, int32_t y){
+        return glm::vec3(gOrigin.x + static_cast<float>(x) * m_worldScale,
+                         m_heightfield.heightAt(static_cast<uint32_t>(x), static_cast<uint32_t>(y)),
+                         gOrigin.y + static_cast<float>(y) * m_worldScale);
+    };
+
+    // Moller-Trumbore, both sides of the triangle count
+    auto intersect = [&](const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float& t){
+        glm::vec3 e1 = p1 - p0;
+        glm::vec3 e2 = p2 - p0;
+        glm::vec3 pv = glm::cross(direction, e2);
+        float det = glm::dot(e1, pv);
+        if(std::abs(det) < 1e-12f)
+            return false;
+
+        float invDet = 1.0f / det;
+        glm::vec3 tv = origin - p0;
+        float u = glm::dot(tv, pv) * invDet;
+        if(u < 0.0f || u > 1.0f)
+            return false;
+
+        glm::vec3 qv = glm::cross(tv, e1);
+        float v = glm::dot(direction, qv) * invDet;
+        if(v < 0.0f || u + v > 1.0f)
+            return false;
+
+        t = glm::dot(e2, qv) * invDet;
+        return t >= 0.0f;
+    };
+
+    while(true){
+        glm::vec3 p00 = corner(cellX, cellY);
+        glm::vec3 p10 = corner(cellX+1, cellY);
+        glm::vec3 p01 = corner(cellX, cellY+1);
+        glm::vec3 p11 = corner(cellX+1, cellY+1);
+
+        // Same diagonals as the rendered mesh
+        glm::vec3 triangles[2][3];
+        if(((cellX + cellY) & 1) == 0){
+            triangles[0][0] = p00; triangles[0][1] = p11; triangles[0][2] = p10;
+            triangles[1][0] = p00; triangles[1][1] = p01; triangles[1][2] = p11;
+        }else{
+            triangles[0][0] = p00; triangles[0][1] = p10; triangles[0][2] = p01;
+            triangles[1][0] = p10; triangles[1][1] = p11; triangles[1][2] = p01;
+        }
+
+        float bestT = inf;
+        const glm::vec3* bestTriangle = nullptr;
+        for(const auto& triangle : triangles){
+            float t;
+            if(intersect(triangle[0], triangle[1], triangle[2], t) && t < bestT && t <= tExit){
+                bestT = t;
+                bestTriangle = triangle;
+            }
+        }
+
+        if(bestTriangle){
+            glm::vec3 normal = glm::normalize(glm::cross(bestTriangle[1] - bestTriangle[0], bestTriangle[2] - bestTriangle[0]));
+            hit.position = origin + direction * bestT;
+            hit.normal = normal.y < 0.0f ? -normal : normal;
+            hit.distance = bestT;
+            return true;
+        }
+
+        if(tNextX < tNextY){
+            if(tNextX > tExit)
+                return false;
+            cellX += stepX;
+            tNextX += tDeltaX;
+        }else{
+            if(tNextY > tExit)
+                return false;
+            cellY += stepY;
+            tNextY += tDeltaY;
+        }
+
+        if(cellX < cellX0 || cellX >= cellX1 || cellY < cellY0 || cellY >= cellY1)
+            return false;
+    }
+}
+
+void Terrain::preparePlane(BuildData& data) {
+    m_logger(Logger::DEBUG) << "Generating flat terrain of size " << data.dimX << "x" << data.dimY << '\n';
+
+    if((data.dimX-1) % (data.patchSize-1) != 0){
+        uint32_t nearestSize = ((data.dimX-1+data.patchSize-1)/(data.patchSize-1)*(data.patchSize-1)+1);
         m_logger(Logger::WARNING) <<
-                                  "Terrain X dimension size of " << m_dimX << " on patch size of " << m_patchSize << " may result in issues. " <<
+                                  "Terrain X dimension size of " << data.dimX << " on patch size of " << data.patchSize << " may result in issues. " <<
                                   "Recommending size is " << nearestSize << '\n';
 
-        if(flags[Flags::SET_NEAREST_SIZE]){
-            m_dimX = nearestSize;
+        if(data.setNearestSize){
+            data.dimX = nearestSize;
             m_logger(Logger::INFO) << "Flag SET_NEAREST_SIZE enabled. Setting recommended size as the new size." << '\n';
         }
     }
 
-    if((m_dimY-1) % (m_patchSize-1) != 0){
-        uint32_t nearestSize = ((m_dimY-1+m_patchSize-1)/(m_patchSize-1)*(m_patchSize-1)+1);
+    if((data.dimY-1) % (data.patchSize-1) != 0){
+        uint32_t nearestSize = ((data.dimY-1+data.patchSize-1)/(data.patchSize-1)*(data.patchSize-1)+1);
         m_logger(Logger::WARNING) <<
-                                  "Terrain Y dimension size of " << m_dimY << " on patch size of " << m_patchSize << " may result in issues. " <<
+                                  "Terrain Y dimension size of " << data.dimY << " on patch size of " << data.patchSize << " may result in issues. " <<
                                   "Recommending size is " << nearestSize << '\n';
 
-        if(flags[Flags::SET_NEAREST_SIZE]){
-            m_dimY = nearestSize;
+        if(data.setNearestSize){
+            data.dimY = nearestSize;
             m_logger(Logger::INFO) << "Flag SET_NEAREST_SIZE enabled. Setting recommended size as a new size." << '\n';
         }
 
     }
 
-    m_patchesX = (m_dimX-1) / (m_patchSize-1);
-    m_patchesY = (m_dimY-1) / (m_patchSize-1);
-
-    m_lodManager.init(m_maxLOD, m_patchesX, m_patchesY, m_worldScale);
+    data.patchesX = (data.dimX-1) / (data.patchSize-1);
+    data.patchesY = (data.dimY-1) / (data.patchSize-1);
 
-    m_vertices.resize(m_dimX * m_dimY);
-
-    // Generate vertices
-    for(int32_t y = 0; y < m_dimY; y++){
-        for(int32_t x = 0; x < m_dimX; x++){
-            Vertex vertex;
-            vertex.m_position = {(static_cast<float>(x) - static_cast<float>(m_dimX)/2) * m_worldScale,
-                                 0.0f,
-                                 (static_cast<float>(y) - static_cast<float>(m_dimY)/2) * m_worldScale};
-            vertex.m_normal = {0.0f, 0.0f, 0.0f};
-            vertex.m_texCoord = {x, y};
-            m_vertices.at(xy2i(x,y)) = vertex;
-        }
-    }
+    data.heightfield.resize(data.dimX, data.dimY);
 
-    m_logger(Logger::DEBUG) << "Generated " << m_dimX*m_dimY << " vertices" << '\n';
+    m_logger(Logger::DEBUG) << "Generated " << data.dimX*data.dimY << " height samples" << '\n';
 
-    createPatchIndices();
+    data.patchIndices.build(data.maxLOD, data.patchSize);
 }
 
 float& Terrain::hMapAt(uint32_t x, uint32_t y){
-    return m_vertices.at((y * m_dimX) + x).m_position.y;
+    return m_heightfield.heightAt(x, y);
 }
 
 float& Terrain::hMapAt(uint32_t i){
-    return m_vertices.at(i).m_position.y;
+    return m_heightfield.heightAt(i);
 }
 
-glm::vec3& Terrain::pMapAt(uint32_t x, uint32_t y){
-    return m_vertices.at((y * m_dimX) + x).m_position;
+glm::vec3 Terrain::pMapAt(uint32_t x, uint32_t y){
+    return {(static_cast<float>(x) - static_cast<float>(m_dimX)/2) * m_worldScale,
+            m_heightfield.heightAt(x, y),
+            (static_cast<float>(y) - static_cast<float>(m_dimY)/2) * m_worldScale};
 }
 
-glm::vec3& Terrain::pMapAt(uint32_t i){
-    return m_vertices.at(i).m_position;
+glm::vec3 Terrain::pMapAt(uint32_t i){
+    auto [x, y] = i2xy(i);
+    return pMapAt(x, y);
 }
 
 std::pair<float, float> Terrain::getMinMaxHeight() {
@@ -358,63 +1433,53 @@ std::pair<float, float> Terrain::getMinMaxHeight() {
 
 void Terrain::clear() {
     m_logger(Logger::DEBUG) << "Clearing terrain resources" << '\n';
-    Model::clear();
+
+    // Shared patch grid and height texture survive, regeneration of the same size only re-uploads the texture
+    Model::eraseBuffers();
+    m_vertices.clear();
+    m_materials.clear();
+    m_meshes.clear();
+    m_patchIndices.clear();
+    m_quadtree.clear();
+    m_heightfield.clear();
+    m_visiblePatches.clear();
+    m_drawCommands.clear();
+    m_scatter.clear();
+    eraseCullingBuffers();
 
     m_minHeight = std::numeric_limits<float>::infinity();
     m_maxHeight = -std::numeric_limits<float>::infinity();
 
-    m_blendingTexturesCount = 0;
-}
-
-void Terrain::addBlendTexture(float height, const std::shared_ptr<Texture>& texture) {
-    if(m_blendingTexturesCount > m_blendingTextures.size()){
-        return;
-    }
-    m_blendingTextures.at(m_blendingTexturesCount) = {height * m_worldScale, texture};
-    m_logger(Logger::DEBUG) << "Added texture [" << texture->name() << "] into blending textures at index " << m_blendingTexturesCount << '\n';
-    m_blendingTexturesCount++;
+    m_layerTextures.reset();
+    m_layerFiles.clear();
+    m_splatSettings.layerCount = 0;
 }
 
-void Terrain::bindBlendingTextures() {
-    for(uint32_t i = 0; i < m_blendingTexturesCount; i++){
-        m_blendingTextures.at(i).second->bind(COLOR_TEXTURE_UNIT + i);
-    }
-}
-
-void Terrain::calcNormals() {
-
-    assert(m_indices.size() % 3 == 0);
+void Terrain::setLayerTextures(const std::vector<std::string> &textureFiles) {
+    assert(textureFiles.size() <= MAX_TERRAIN_HEIGHT_TEXTURE);
 
-    for(uint32_t y = 0; y < m_dimY-1; y += (m_patchSize - 1)){
-        for(uint32_t x = 0; x < m_dimX-1; x += (m_patchSize - 1)){
-            uint32_t baseVertex = xy2i(x,y);
-            uint32_t numIndices = m_lodInfo.at(0).info[0][0][0][0].count;
-            for(uint32_t i = 0; i < numIndices; i += 3){
-                uint32_t index0 = baseVertex + m_indices.at(i);
-                uint32_t index1 = baseVertex + m_indices.at(i+1);
-                uint32_t index2 = baseVertex + m_indices.at(i+2);
+    SplatMap::Settings settings = SplatMap::evenHeights(static_cast<uint32_t>(textureFiles.size()), m_minRange, m_maxRange);
+    m_splatSettings.heights = settings.heights;
+    m_splatSettings.layerCount = settings.layerCount;
 
-                glm::vec3 v1 = m_vertices.at(index1).m_position - m_vertices.at(index0).m_position;
-                glm::vec3 v2 = m_vertices.at(index2).m_position - m_vertices.at(index0).m_position;
-                glm::vec3 normal = glm::normalize(glm::cross(v1, v2));
+    m_layerTextures = textureFiles.empty() ? nullptr : TextureArray::createTextureArray(textureFiles);
+    m_layerFiles = textureFiles;
+    m_logger(Logger::DEBUG) << "Terrain textured by " << m_splatSettings.layerCount << " layers" << '\n';
+}
 
-                m_vertices.at(index0).m_normal += normal;
-                m_vertices.at(index1).m_normal += normal;
-                m_vertices.at(index2).m_normal += normal;
-            }
-        }
-    }
+void Terrain::setSlopeLayer(int32_t layer, float slopeStart, float slopeEnd) {
+    m_splatSettings.slopeLayer = layer;
+    m_splatSettings.slopeStart = slopeStart;
+    m_splatSettings.slopeEnd = slopeEnd;
+}
 
-    for(auto & vert : m_vertices){
-        vert.m_normal = glm::normalize(vert.m_normal);
-    }
+void Terrain::setErosion(const Erosion::Settings &settings) {
+    m_erosionSettings = settings;
 }
 
 void Terrain::setMaxLOD(uint32_t maxLOD) {
     m_maxLOD = maxLOD;
     m_patchSize = Utils::binPow(static_cast<int32_t>(maxLOD+1)) + 1;
-
-    m_lodInfo.resize(m_maxLOD+1);
 }
 
 void Terrain::setMaxRange(float maxRange) {
@@ -425,146 +1490,360 @@ void Terrain::setMinRange(float minRange) {
     m_minRange = minRange;
 }
 
-void Terrain::createPatchIndices() {
-    for(uint32_t lod = 0; lod <= m_maxLOD; lod++){
-        for(uint8_t l = 0; l < LEFT; l++){
-            for(uint8_t r = 0; r < RIGHT; r++){
-                for(uint8_t t = 0; t < TOP; t++){
-                    for(uint8_t b = 0; b < BOTTOM; b++){
-                        m_lodInfo.at(lod).info[l][r][t][b].start = m_indices.size();
-                        createPatchIndicesLOD(lod, lod + l, lod + r, lod + t, lod + b);
-                        m_lodInfo.at(lod).info[l][r][t][b].count = m_indices.size() - m_lodInfo.at(lod).info[l][r][t][b].start;
+void Terrain::bufferMeshes() {
+    if(m_heightfield.empty())
+        return;
 
-                        m_logger(Logger::DEBUG) << "Created " << m_lodInfo.at(lod).info[l][r][t][b].count << " indices for LOD " << lod << " patch variant " << l << r << t << b << '\n';
-                    }
-                }
-            }
-        }    }
+    switch(m_renderMode){
+        case RenderMode::VERTEX_BUFFER:
+            bufferVertices();
+            break;
+        case RenderMode::HEIGHT_TEXTURE:
+        case RenderMode::TESSELLATION:
+            bufferPatchGrid();
+            uploadHeightTexture();
+            break;
+    }
+    bufferSplatMap();
+    bufferNormalMap();
+    bufferVirtualTexture();
 }
 
-void Terrain::createPatchIndicesLOD(uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom) {
-    uint32_t fanStep = Utils::binPow(lodCore+1);
-    int32_t endPos = m_patchSize - 1 - fanStep;
+void Terrain::bufferVertices() {
+    if(m_VAO != -1)
+        return;
+
+    // The vertex stream only lives for the duration of the upload
+    std::vector<GPUVertex> vertices(static_cast<std::size_t>(m_patchesX) * m_patchesY * m_patchSize * m_patchSize);
+    fillPatchVertices(m_heightfield, m_patchSize, m_patchesX, m_patchesY, m_worldScale, vertices.data());
+
+    glGenVertexArrays(1, &m_VAO);
+
+    glBindVertexArray(m_VAO);
+
+    glGenBuffers(ARRAY_SIZE(m_buffers), m_buffers);
 
-    for(uint32_t y = 0; y <= endPos; y += fanStep){
-        for(uint32_t x = 0; x <= endPos; x += fanStep){
-            uint32_t lLeft      = x == 0        ? lodLeft : lodCore;
-            uint32_t lRight     = x == endPos   ? lodRight : lodCore;
-            uint32_t lBottom    = y == 0        ? lodBottom : lodCore;
-            uint32_t lTop       = y == endPos   ? lodTop : lodCore;
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffers[POS_VB]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(vertices.size() * sizeof(GPUVertex)), vertices.data(), GL_STATIC_DRAW);
 
-            createFan(x,y, lodCore, lLeft, lRight, lTop, lBottom);
+    setVertexLayout();
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buffers[INDEX_BUFFER]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(m_patchIndices.byteSize()), m_patchIndices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+}
+
+void Terrain::setVertexLayout() {
+    glEnableVertexAttribArray(POSITION_LOCATION);
+    glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(GPUVertex), (void*) offsetof(GPUVertex, position));
+}
+
+void Terrain::bufferPatchGrid() {
+    uint32_t patchCount = m_patchesX * m_patchesY;
+
+    // Patch origins follow the shape of the patch grid, not only the amount of patches
+    if(m_gridVAO != -1 && m_gridPatchSize == m_patchSize && m_gridPatchesX == m_patchesX && m_gridPatchesY == m_patchesY)
+        return;
+
+    if(m_gridVAO != -1){
+        glDeleteVertexArrays(1, &m_gridVAO);
+        glDeleteBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
+    }
+
+    m_gridPatchSize = m_patchSize;
+    m_gridPatchesX = m_patchesX;
+    m_gridPatchesY = m_patchesY;
+
+    bool tessellated = m_renderMode == RenderMode::TESSELLATION;
+
+    // One patch worth of grid coordinates, shared by every patch and every LOD variant
+    std::vector<glm::u16vec2> gridVertices;
+    if(tessellated){
+        // Control points of the quad patch, the tessellator creates everything in between
+        uint32_t cells = m_patchSize-1;
+        gridVertices = {{0, 0}, {cells, 0}, {0, cells}, {cells, cells}};
+    }else{
+        gridVertices.resize(m_patchSize * m_patchSize);
+        for(uint32_t y = 0; y < m_patchSize; y++){
+            for(uint32_t x = 0; x < m_patchSize; x++){
+                gridVertices[y * m_patchSize + x] = {x, y};
+            }
         }
     }
+
+    std::vector<glm::uvec2> patchOrigins(patchCount);
+    for(uint32_t patchY = 0; patchY < m_patchesY; patchY++){
+        for(uint32_t patchX = 0; patchX < m_patchesX; patchX++){
+            patchOrigins[patchY * m_patchesX + patchX] = {patchX * (m_patchSize-1), patchY * (m_patchSize-1)};
+        }
+    }
+
+    glGenVertexArrays(1, &m_gridVAO);
+    glBindVertexArray(m_gridVAO);
+
+    glGenBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_gridBuffers[GRID_VB]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(gridVertices.size() * sizeof(glm::u16vec2)), gridVertices.data(), GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(GRID_POSITION_LOCATION);
+    glVertexAttribIPointer(GRID_POSITION_LOCATION, 2, GL_UNSIGNED_SHORT, sizeof(glm::u16vec2), (void*)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_gridBuffers[GRID_ORIGIN_VB]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(patchOrigins.size() * sizeof(glm::uvec2)), patchOrigins.data(), GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(PATCH_ORIGIN_LOCATION);
+    glVertexAttribIPointer(PATCH_ORIGIN_LOCATION, 2, GL_UNSIGNED_INT, sizeof(glm::uvec2), (void*)0);
+    glVertexAttribDivisor(PATCH_ORIGIN_LOCATION, 1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_gridBuffers[GRID_INDEX_BUFFER]);
+    if(tessellated){
+        // Patches are drawn by the same indirect commands as the grid, a single range of four indices
+        const uint16_t quadIndices[TERRAIN_PATCH_VERTICES] = {0, 1, 2, 3};
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quadIndices), quadIndices, GL_STATIC_DRAW);
+    }else{
+        // LOD variants are built with the row stride of one patch, the grid uses them directly
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(m_patchIndices.byteSize()), m_patchIndices.data(), GL_STATIC_DRAW);
+    }
+
+    glBindVertexArray(0);
+
+    m_logger(Logger::DEBUG) << "Buffered shared patch grid of " << (tessellated ? 2 : m_patchSize) << "x" << (tessellated ? 2 : m_patchSize) << " vertices for " << patchCount << " patches" << '\n';
 }
 
-void Terrain::createFan(uint32_t x, uint32_t y, uint32_t lodCore, uint32_t lodLeft, uint32_t lodRight, uint32_t lodTop, uint32_t lodBottom) {
-    uint32_t stepLeft   = Utils::binPow(lodLeft);
-    uint32_t stepRight  = Utils::binPow(lodRight);
-    uint32_t stepTop    = Utils::binPow(lodTop);
-    uint32_t stepBottom = Utils::binPow(lodBottom);
-    uint32_t stepCenter = Utils::binPow(lodCore);
+void Terrain::uploadHeightTexture(const uint16_t* texels) {
+    if(m_heightTexture != -1 && (m_heightTextureDimX != m_dimX || m_heightTextureDimY != m_dimY)){
+        eraseHeightTexture();
+    }
+
+    if(m_heightTexture == -1){
+        createHeightTexture(m_heightTexture, m_heightTextureHandle, m_dimX, m_dimY);
+        m_heightTextureDimX = m_dimX;
+        m_heightTextureDimY = m_dimY;
+    }
+
+    std::vector<uint16_t> quantized;
+    if(!texels){
+        quantized.resize(m_heightfield.size());
+        quantizeHeights(m_heightfield, m_minHeight, m_maxHeight, quantized.data());
+        texels = quantized.data();
+    }
 
-    uint32_t iCnt = xy2i(x+stepCenter, y+stepCenter);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTextureSubImage2D(m_heightTexture, 0, 0, 0, static_cast<GLsizei>(m_dimX), static_cast<GLsizei>(m_dimY), GL_RED, GL_UNSIGNED_SHORT, texels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-    uint32_t indexTemp1 = xy2i(x, y);
-    uint32_t indexTemp2 = xy2i(x, y+stepLeft);
+    m_logger(Logger::DEBUG) << "Uploaded height texture of size " << m_dimX << "x" << m_dimY << '\n';
+}
 
-    createTriangle(iCnt, indexTemp1, indexTemp2);
+void Terrain::createHeightTexture(GLuint& texture, GLuint64& handle, uint32_t dimX, uint32_t dimY) {
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, 1, GL_R16, static_cast<GLsizei>(dimX), static_cast<GLsizei>(dimY));
 
-    if(lodLeft == lodCore){
-        indexTemp1 = indexTemp2;
-        indexTemp2 += stepLeft * m_dimX;
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        createTriangle(iCnt, indexTemp1, indexTemp2);
+    handle = glGetTextureHandleARB(texture);
+    if(handle == 0){
+        m_logger(Logger::ERROR) << "Unable to retrieve texture handle for terrain height texture" << '\n';
+        throw textureException();
     }
+    glMakeTextureHandleResidentARB(handle);
+}
 
-    indexTemp1 = indexTemp2;
-    indexTemp2 += stepTop;
+void Terrain::eraseHeightTexture() {
+    if(m_heightTexture == -1)
+        return;
 
-    createTriangle(iCnt, indexTemp1, indexTemp2);
+    glMakeTextureHandleNonResidentARB(m_heightTextureHandle);
+    glDeleteTextures(1, &m_heightTexture);
+    m_heightTexture = -1;
+    m_heightTextureHandle = 0;
+    m_heightTextureDimX = 0;
+    m_heightTextureDimY = 0;
+}
 
-    if(lodTop == lodCore){
-        indexTemp1 = indexTemp2;
-        indexTemp2 += stepTop;
+void Terrain::eraseBuffers() {
+    Model::eraseBuffers();
 
-        createTriangle(iCnt, indexTemp1, indexTemp2);
+    if(m_gridVAO != -1){
+        glDeleteVertexArrays(1, &m_gridVAO);
+        glDeleteBuffers(ARRAY_SIZE(m_gridBuffers), m_gridBuffers);
     }
+    m_gridVAO = -1;
+    m_gridPatchSize = 0;
+    m_gridPatchesX = 0;
+    m_gridPatchesY = 0;
 
-    indexTemp1 = indexTemp2;
-    indexTemp2 -= stepRight * m_dimX;
+    if(m_drawCommandBuffer != -1){
+        glDeleteBuffers(1, &m_drawCommandBuffer);
+    }
+    m_drawCommandBuffer = -1;
 
-    createTriangle(iCnt, indexTemp1, indexTemp2);
+    if(m_scatterBuffer != -1){
+        glDeleteBuffers(1, &m_scatterBuffer);
+    }
+    m_scatterBuffer = -1;
+
+    eraseCullingBuffers();
+    eraseHeightTexture();
+    eraseSplatMap();
+    eraseNormalMap();
+    m_virtualTexture.erase();
+}
 
-    if(lodRight == lodCore){
-        indexTemp1 = indexTemp2;
-        indexTemp2 -= stepRight * m_dimX;
+void Terrain::bufferSplatMap() {
+    if(m_heightfield.empty() || m_splatSettings.layerCount == 0)
+        return;
 
-        createTriangle(iCnt, indexTemp1, indexTemp2);
+    std::vector<uint8_t> texels(m_heightfield.size() * 4);
+    SplatMap::bake(m_splatSettings, m_heightfield, texels.data());
+
+    if(m_splatTextureDimX != m_dimX || m_splatTextureDimY != m_dimY){
+        eraseSplatMap();
+        createSampleTexture(m_splatTexture, m_splatTextureHandle, GL_RGBA8, m_dimX, m_dimY, "splat map");
+        m_splatTextureDimX = m_dimX;
+        m_splatTextureDimY = m_dimY;
     }
 
-    indexTemp1 = indexTemp2;
-    indexTemp2 -= stepBottom;
+    glTextureSubImage2D(m_splatTexture, 0, 0, 0, static_cast<GLsizei>(m_dimX), static_cast<GLsizei>(m_dimY), GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+}
 
-    createTriangle(iCnt, indexTemp1, indexTemp2);
+void Terrain::eraseSplatMap() {
+    if(m_splatTexture == -1)
+        return;
 
-    if(lodBottom == lodCore){
-        indexTemp1 = indexTemp2;
-        indexTemp2 -= stepBottom;
+    glMakeTextureHandleNonResidentARB(m_splatTextureHandle);
+    glDeleteTextures(1, &m_splatTexture);
+    m_splatTexture = -1;
+    m_splatTextureHandle = 0;
+    m_splatTextureDimX = 0;
+    m_splatTextureDimY = 0;
+}
+
+void Terrain::bufferNormalMap() {
+    if(m_heightfield.empty())
+        return;
+
+    std::vector<uint16_t> texels(m_heightfield.size() * 2);
+    NormalMap::bake(m_heightfield, texels.data());
 
-        createTriangle(iCnt, indexTemp1, indexTemp2);
+    if(m_normalTextureDimX != m_dimX || m_normalTextureDimY != m_dimY){
+        eraseNormalMap();
+        createSampleTexture(m_normalTexture, m_normalTextureHandle, GL_RG16, m_dimX, m_dimY, "normal map");
+        m_normalTextureDimX = m_dimX;
+        m_normalTextureDimY = m_dimY;
     }
+
+    glTextureSubImage2D(m_normalTexture, 0, 0, 0, static_cast<GLsizei>(m_dimX), static_cast<GLsizei>(m_dimY), GL_RG, GL_UNSIGNED_SHORT, texels.data());
+}
+
+void Terrain::eraseNormalMap() {
+    if(m_normalTexture == -1)
+        return;
+
+    glMakeTextureHandleNonResidentARB(m_normalTextureHandle);
+    glDeleteTextures(1, &m_normalTexture);
+    m_normalTexture = -1;
+    m_normalTextureHandle = 0;
+    m_normalTextureDimX = 0;
+    m_normalTextureDimY = 0;
 }
 
-void Terrain::createTriangle(uint32_t i0, uint32_t i1, uint32_t i2) {
-    assert(i0 < m_vertices.size());
-    assert(i1 < m_vertices.size());
-    assert(i2 < m_vertices.size());
-    m_indices.push_back(i0);
-    m_indices.push_back(i1);
-    m_indices.push_back(i2);
-/*
-    glm::vec3 pos1 = m_vertices.at(i0).m_position;
-    glm::vec3 pos2 = m_vertices.at(i1).m_position;
-    glm::vec3 pos3 = m_vertices.at(i2).m_position;
+void Terrain::bufferVirtualTexture() {
+    if(m_virtualTexelsPerSample == 0 || m_heightfield.empty() || m_layerFiles.empty()){
+        m_virtualTexture.erase();
+        return;
+    }
 
-    glm::vec2 tex1 = m_vertices.at(i0).m_texCoord;
-    glm::vec2 tex2 = m_vertices.at(i1).m_texCoord;
-    glm::vec2 tex3 = m_vertices.at(i2).m_texCoord;
+    m_surfaceCompositor.setLayers(m_layerFiles);
 
-    float x1 = pos2.x - pos1.x;
-    float x2 = pos3.x - pos1.x;
-    float y1 = pos2.y - pos1.y;
-    float y2 = pos3.y - pos1.y;
-    float z1 = pos2.z - pos1.z;
-    float z2 = pos3.z - pos1.z;
+    // Power of two pages cover the longer side, pages past the shorter side are never requested
+    m_virtualSpan = static_cast<float>(std::max(m_dimX, m_dimY) - 1);
+    uint32_t pages = 1;
+    while(static_cast<float>(pages * VIRTUAL_PAGE_SIZE) < m_virtualSpan * static_cast<float>(m_virtualTexelsPerSample)){
+        pages *= 2;
+    }
 
-    float s1 = tex2.x - tex1.x;
-    float s2 = tex3.x - tex1.x;
-    float t1 = tex2.y - tex1.y;
-    float t2 = tex3.y - tex1.y;
+    // Pages are produced inside of update, the heightfield isn't modified meanwhile
+    m_virtualTexture.init(pages, m_virtualCacheSlots, [this, pages](const VirtualTexture::Page& page, uint8_t* texels){
+        m_surfaceCompositor.composite(m_heightfield, m_splatSettings, m_virtualSpan, pages, page, texels);
+    });
+}
 
-    float r = 1.0f / (s1 * t2 - s2 * t1);
-    glm::vec3 sdir((t2*x1-t1*x2)*r, (t2*y1-t1*y2)*r, (t2*z1-t1*z2)*r);
-    glm::vec3 tdir((s1*x2-s2*x1)*r, (s1*y2-s2*y1)*r, (s1*z2-s2*z1)*r);
+void Terrain::createSampleTexture(GLuint &texture, GLuint64 &handle, GLenum format, uint32_t dimX, uint32_t dimY, const char *name) {
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, 1, format, static_cast<GLsizei>(dimX), static_cast<GLsizei>(dimY));
 
-    m_vertices.at(i0).m_tangent += sdir;
-    m_vertices.at(i1).m_tangent += sdir;
-    m_vertices.at(i2).m_tangent += sdir;
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    m_vertices.at(i0).m_bitangent += tdir;
-    m_vertices.at(i1).m_bitangent += tdir;
-    m_vertices.at(i2).m_bitangent += tdir;
-*/
+    handle = glGetTextureHandleARB(texture);
+    if(handle == 0){
+        m_logger(Logger::ERROR) << "Unable to retrieve texture handle for terrain " << name << '\n';
+        throw textureException();
+    }
+    glMakeTextureHandleResidentARB(handle);
 }
 
-Terrain::meshIterator Terrain::meshIter() {
-    return Terrain::meshIterator(m_meshFunc);
+void Terrain::setRenderMode(RenderMode mode) {
+    if(mode == m_renderMode)
+        return;
+
+    m_renderMode = mode;
+
+    // Staged upload restarts with streams of the new kind
+    if(m_stagedBuild){
+        eraseStagingResources();
+        m_stagedBuild->renderMode = mode;
+        prepareUploadStreams(*m_stagedBuild);
+        createStagingResources();
+        m_stagedRows = 0;
+    }
+
+    if(m_VAO != -1 || m_gridVAO != -1){
+        eraseBuffers();
+        bufferMeshes();
+    }
 }
 
 void Terrain::setCamera(Camera &camera) {
     camera.sig_position.connect(m_lodManager.slt_cameraPosition);
+    m_lodManager.setFOV(camera.getPerspectiveInfo().fov);
     camera.sig_VPMatrix.connect(m_frustumCulling.slt_updateVP);
+    camera.sig_VPMatrix.connect(m_horizonCulling.slt_updateVP);
+    camera.sig_position.connect(m_horizonCulling.slt_cameraPosition);
+    camera.sig_position.connect(m_scatter.slt_cameraPosition);
+}
+
+void Terrain::setViewportHeight(float height) {
+    m_lodManager.setViewportHeight(height);
+}
+
+void Terrain::setScatterLayers(std::vector<Scatter::Layer> layers) {
+    m_scatter.setLayers(std::move(layers));
+}
+
+void Terrain::setVirtualTexture(uint32_t texelsPerSample, uint32_t cacheSlots) {
+    m_virtualTexelsPerSample = texelsPerSample;
+    m_virtualCacheSlots = cacheSlots;
+
+    if(m_VAO != -1 || m_gridVAO != -1){
+        bufferVirtualTexture();
+    }
+}
+
+void Terrain::setPixelError(float pixels) {
+    m_lodManager.setPixelError(pixels);
+}
+
+void Terrain::setTessellationEdge(float pixels) {
+    m_tessellationEdge = std::max(pixels, 1.0f);
 }
 
 void Terrain::setScale(float scale) {
@@ -587,38 +1866,120 @@ float Terrain::hMapLCoord(std::pair<uint32_t, uint32_t> coords) {
     return hMapAt(coords.first,coords.second);
 }
 
-bool Terrain::isPatchInsideFrustum(uint32_t x, uint32_t y) {
-    uint32_t x0 = x * (m_patchSize-1);
-    uint32_t x1 = x0 + m_patchSize-1;
-    uint32_t y0 = y * (m_patchSize-1);
-    uint32_t y1 = y0 + m_patchSize-1;
-
-    glm::vec3 h00 = pMapAt(x0,y0);
-    glm::vec3 h01 = pMapAt(x0,y1);
-    glm::vec3 h10 = pMapAt(x1, y0);
-    glm::vec3 h11 = pMapAt(x1,y1);
-
-    float minHeight = std::min(h00.y, std::min(h01.y, std::min(h10.y, h11.y)));
-    float maxHeight = std::max(h00.y, std::max(h01.y, std::max(h10.y, h11.y)));
-
-    glm::vec3 p00_low(static_cast<float>(h00.x), minHeight, static_cast<float>(h00.z));
-    glm::vec3 p01_low(static_cast<float>(h01.x), minHeight, static_cast<float>(h01.z));
-    glm::vec3 p10_low(static_cast<float>(h10.x), minHeight, static_cast<float>(h10.z));
-    glm::vec3 p11_low(static_cast<float>(h11.x), minHeight, static_cast<float>(h11.z));
-
-    glm::vec3 p00_high(static_cast<float>(h00.x), maxHeight, static_cast<float>(h00.z));
-    glm::vec3 p01_high(static_cast<float>(h01.x), maxHeight, static_cast<float>(h01.z));
-    glm::vec3 p10_high(static_cast<float>(h10.x), maxHeight, static_cast<float>(h10.z));
-    glm::vec3 p11_high(static_cast<float>(h11.x), maxHeight, static_cast<float>(h11.z));
-
-    return  m_frustumCulling.isPointInside(p00_low)  ||
-            m_frustumCulling.isPointInside(p01_low)  ||
-            m_frustumCulling.isPointInside(p10_low)  ||
-            m_frustumCulling.isPointInside(p11_low)  ||
-            m_frustumCulling.isPointInside(p00_high) ||
-            m_frustumCulling.isPointInside(p01_high) ||
-            m_frustumCulling.isPointInside(p10_high) ||
-            m_frustumCulling.isPointInside(p11_high);
-
-    //return m_frustum.IsBoxVisible(p00_low, p11_high);
+void Terrain::collectDrawCommands() {
+    m_drawCommands.clear();
+
+    if(m_patchesX == 0 || m_patchesY == 0)
+        return;
+
+    if(flags[Flags::CULL_PATCHES]){
+        m_quadtree.cull(m_frustumCulling, m_visiblePatches);
+    }else{
+        m_visiblePatches.resize(m_patchesX * m_patchesY);
+        for(uint32_t i = 0; i < m_visiblePatches.size(); i++){
+            m_visiblePatches[i] = i;
+        }
+    }
+
+    m_occluders.clear();
+    if(flags[Flags::HORIZON_CULLING]){
+        cullBehindHorizon();
+    }
+
+    bool instanced = m_renderMode != RenderMode::VERTEX_BUFFER;
+    bool tessellated = m_renderMode == RenderMode::TESSELLATION;
+    uint32_t patchVertices = m_patchSize * m_patchSize;
+
+    for(uint32_t patch : m_visiblePatches){
+        DrawElementsIndirectCommand& command = m_drawCommands.emplace_back();
+        command.instanceCount = 1;
+        command.baseVertex = instanced ? 0 : static_cast<int32_t>(patch * patchVertices);
+        command.baseInstance = instanced ? patch : 0;
+
+        if(tessellated){
+            command.count = TERRAIN_PATCH_VERTICES;
+            command.firstIndex = 0;
+            continue;
+        }
+
+        const LODManager::patchLOD& pLOD = m_lodManager.getPatchLOD(patch % m_patchesX, patch / m_patchesX);
+        const PatchIndices::Range& range = m_patchIndices.variant(pLOD.core, pLOD.left, pLOD.right, pLOD.top, pLOD.bottom);
+        command.count = range.count;
+        command.firstIndex = range.start;
+    }
+
+    if(m_drawCommandBuffer == -1){
+        glCreateBuffers(1, &m_drawCommandBuffer);
+    }
+
+    // Orphaned every frame, the driver hands out fresh storage instead of waiting for the previous draw
+    glNamedBufferData(m_drawCommandBuffer, static_cast<GLsizeiptr>(m_drawCommands.size() * sizeof(DrawElementsIndirectCommand)), m_drawCommands.data(), GL_STREAM_DRAW);
+}
+
+void Terrain::updateScatter() {
+    m_scatter.stream(m_heightfield, m_splatSettings);
+
+    // Occluders are known only on the CPU culling path
+    bool horizon = flags[Flags::HORIZON_CULLING] && !flags[Flags::GPU_LOD_CULLING];
+    m_scatter.collect(m_frustumCulling, horizon ? &m_horizonCulling : nullptr, m_occluders);
+
+    if(m_scatterBuffer == -1){
+        glCreateBuffers(1, &m_scatterBuffer);
+    }
+
+    // Orphaned every frame as the draw commands. Never empty, instance attributes of model VAOs always point at storage
+    const std::vector<Scatter::Instance>& instances = m_scatter.instances();
+    glNamedBufferData(m_scatterBuffer, static_cast<GLsizeiptr>(std::max<std::size_t>(instances.size(), 1) * sizeof(Scatter::Instance)),
+                      instances.empty() ? nullptr : instances.data(), GL_STREAM_DRAW);
+}
+
+void Terrain::cullBehindHorizon() {
+    glm::vec2 origin = gridOrigin();
+    float patchWorldSize = static_cast<float>(m_patchSize-1) * m_worldScale;
+
+    m_occluders.reserve(m_visiblePatches.size());
+    for(uint32_t patch : m_visiblePatches){
+        uint32_t patchX = patch % m_patchesX;
+        uint32_t patchY = patch / m_patchesX;
+        const glm::vec2& bounds = m_quadtree.patchBounds(patchX, patchY);
+
+        glm::vec3 min(origin.x + static_cast<float>(patchX) * patchWorldSize, bounds.x, origin.y + static_cast<float>(patchY) * patchWorldSize);
+        m_occluders.push_back({min, glm::vec3(min.x + patchWorldSize, bounds.y, min.z + patchWorldSize)});
+    }
+
+    // Patches are both the occluders and the tested boxes
+    m_horizonCulling.cull(m_occluders, m_occluders, m_unoccludedPatches);
+
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < m_visiblePatches.size(); i++){
+        if(m_unoccludedPatches[i])
+            m_visiblePatches[kept++] = m_visiblePatches[i];
+    }
+    m_visiblePatches.resize(kept);
+}
+
+void Terrain::bufferCullingData() {
+    // Patch data is replaced by a new terrain, which erases the buffers, or updated in place by edits
+    if(m_cullBuffers[CULL_BOUNDS_BUFFER] != 0 || m_quadtree.empty() || m_patchIndices.empty())
+        return;
+
+    const std::vector<glm::vec2>& bounds = m_quadtree.leafBounds();
+    const std::vector<float>& errors = m_lodManager.patchErrors();
+    std::size_t patchCount = static_cast<std::size_t>(m_patchesX) * m_patchesY;
+
+    glCreateBuffers(ARRAY_SIZE(m_cullBuffers), m_cullBuffers);
+    glNamedBufferStorage(m_cullBuffers[CULL_BOUNDS_BUFFER], static_cast<GLsizeiptr>(bounds.size() * sizeof(glm::vec2)), bounds.data(), GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(m_cullBuffers[CULL_ERRORS_BUFFER], static_cast<GLsizeiptr>(errors.size() * sizeof(float)), errors.data(), GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(m_cullBuffers[CULL_VARIANTS_BUFFER], static_cast<GLsizeiptr>(m_patchIndices.variantCount() * sizeof(PatchIndices::Range)), m_patchIndices.variants(), 0);
+    glNamedBufferStorage(m_cullBuffers[CULL_COMMAND_BUFFER], static_cast<GLsizeiptr>(patchCount * sizeof(DrawElementsIndirectCommand)), nullptr, 0);
+    glNamedBufferStorage(m_cullBuffers[CULL_COUNT_BUFFER], sizeof(uint32_t), nullptr, 0);
+
+    m_logger(Logger::DEBUG) << "Buffered culling data of " << std::to_string(patchCount) << " patches" << '\n';
+}
+
+void Terrain::eraseCullingBuffers() {
+    if(m_cullBuffers[CULL_BOUNDS_BUFFER] != 0){
+        glDeleteBuffers(ARRAY_SIZE(m_cullBuffers), m_cullBuffers);
+    }
+    std::fill(std::begin(m_cullBuffers), std::end(m_cullBuffers), 0);
 }
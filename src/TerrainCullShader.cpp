@@ -0,0 +1,52 @@
+#include "shader/TerrainCullShader.h"
+
+void TerrainCullShader::init() {
+    Shader::init();
+
+    addShader(GL_COMPUTE_SHADER, TERRAIN_CULL_COMP_SHADER_PATH);
+    finalize();
+
+    loc_VP = cacheUniform("u_VP");
+    loc_frustumBias = cacheUniform("u_frustumBias");
+    loc_cameraPosition = cacheUniform("u_cameraPosition");
+    loc_errorScale = cacheUniform("u_errorScale");
+    loc_patchCount = cacheUniform("u_patchCount");
+    loc_patchSize = cacheUniform("u_patchSize");
+    loc_maxLOD = cacheUniform("u_maxLOD");
+    loc_gridOrigin = cacheUniform("u_gridOrigin");
+    loc_patchWorldSize = cacheUniform("u_patchWorldSize");
+    loc_instanced = cacheUniform("u_instanced");
+    loc_tessellated = cacheUniform("u_tessellated");
+}
+
+void TerrainCullShader::setVP(const glm::mat4 &vp) const {
+    glUniformMatrix4fv(getUniformLocation(loc_VP), 1, GL_FALSE, glm::value_ptr(vp));
+}
+
+void TerrainCullShader::setFrustumBias(float bias) const {
+    glUniform1f(getUniformLocation(loc_frustumBias), bias);
+}
+
+void TerrainCullShader::setCameraPosition(const glm::vec3 &position) const {
+    glUniform3f(getUniformLocation(loc_cameraPosition), position.x, position.y, position.z);
+}
+
+void TerrainCullShader::setErrorScale(float scale) const {
+    glUniform1f(getUniformLocation(loc_errorScale), scale);
+}
+
+void TerrainCullShader::setPatchGrid(uint32_t patchesX, uint32_t patchesY, uint32_t patchSize, uint32_t maxLOD, const glm::vec2& gridOrigin, float patchWorldSize) const {
+    glUniform2ui(getUniformLocation(loc_patchCount), patchesX, patchesY);
+    glUniform1ui(getUniformLocation(loc_patchSize), patchSize);
+    glUniform1ui(getUniformLocation(loc_maxLOD), maxLOD);
+    glUniform2f(getUniformLocation(loc_gridOrigin), gridOrigin.x, gridOrigin.y);
+    glUniform1f(getUniformLocation(loc_patchWorldSize), patchWorldSize);
+}
+
+void TerrainCullShader::setInstanced(bool instanced) const {
+    glUniform1i(getUniformLocation(loc_instanced), instanced ? 1 : 0);
+}
+
+void TerrainCullShader::setTessellated(bool tessellated) const {
+    glUniform1i(getUniformLocation(loc_tessellated), tessellated ? 1 : 0);
+}
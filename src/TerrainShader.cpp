@@ -3,29 +3,52 @@
 void TerrainShader::init() {
     Shader::init();
 
-    addShader(GL_VERTEX_SHADER, TERRAIN_VERT_SHADER_PATH);
+    if(m_tessellated){
+        addShader(GL_VERTEX_SHADER, TERRAIN_TESS_VERT_SHADER_PATH);
+        addShader(GL_TESS_CONTROL_SHADER, TERRAIN_TESC_SHADER_PATH);
+        addShader(GL_TESS_EVALUATION_SHADER, TERRAIN_TESE_SHADER_PATH);
+    }else{
+        addShader(GL_VERTEX_SHADER, TERRAIN_VERT_SHADER_PATH);
+    }
     addShader(GL_FRAGMENT_SHADER, TERRAIN_FRAG_SHADER_PATH);
     finalize();
 
     loc_WVP = cacheUniform("u_WVP");
     loc_minHeight = cacheUniform("u_minHeight");
     loc_maxHeight = cacheUniform("u_maxHeight");
+    loc_vertexSource = cacheUniform("u_vertexSource");
+    loc_heightMap = cacheUniform("u_heightMap");
+    loc_heightMapSize = cacheUniform("u_heightMapSize");
+    loc_worldScale = cacheUniform("u_worldScale");
+    loc_splatArray = cacheUniform("u_splatArray");
 
-    for(uint32_t i = 0; i < ARRAY_SIZE(loc_sampler.height); i++) {
-        char name[128];
-        memset(name, 0, sizeof(name));
-        snprintf(name, sizeof(name), "u_samplers.height[%d]", i);
-        loc_sampler.height[i] = cacheUniform(name);
-    }
-
-    for(uint32_t i = 0; i < ARRAY_SIZE(loc_textureHeight); i++) {
-        char name[128];
-        memset(name, 0, sizeof(name));
-        snprintf(name, sizeof(name), "u_textureHeight[%d]", i);
-        loc_textureHeight[i] = cacheUniform(name);
+    // Streamed and clipmap sources exist only in the vertex shader, the tessellation levels only in the pipeline using them
+    if(m_tessellated){
+        loc_tessScale = cacheUniform("u_tessScale");
+        loc_maxTessLevel = cacheUniform("u_maxTessLevel");
+    }else{
+        loc_tileHeights = cacheUniform("u_tileHeights");
+        loc_tileSize = cacheUniform("u_tileSize");
+        loc_clipmapHeights = cacheUniform("u_clipmapHeights");
+        loc_clipmapTextureSize = cacheUniform("u_clipmapTextureSize");
+        loc_clipmapGridSize = cacheUniform("u_clipmapGridSize");
+        loc_clipmapLevels = cacheUniform("u_clipmapLevels");
+        loc_clipmapOrigins = cacheUniform("u_clipmapOrigins");
     }
-
-    loc_numTextureHeights = cacheUniform("u_textureHeightCount");
+    loc_layers = cacheUniform("u_layers");
+    loc_layerCount = cacheUniform("u_layerCount");
+    loc_splatMap = cacheUniform("u_splatMap");
+    loc_splatMapSize = cacheUniform("u_splatMapSize");
+    loc_normalMap = cacheUniform("u_normalMap");
+    loc_normalMapSize = cacheUniform("u_normalMapSize");
+    loc_virtualTexture = cacheUniform("u_virtualTexture");
+    loc_virtualIndirection = cacheUniform("u_virtualIndirection");
+    loc_virtualCache = cacheUniform("u_virtualCache");
+    loc_virtualPages = cacheUniform("u_virtualPages");
+    loc_virtualLevels = cacheUniform("u_virtualLevels");
+    loc_virtualCacheSlots = cacheUniform("u_virtualCacheSlots");
+    loc_virtualSpan = cacheUniform("u_virtualSpan");
+    loc_feedbackOffset = cacheUniform("u_feedbackOffset");
 
     loc_dirLight.color = cacheUniform("u_directionalLight.base.color");
     loc_dirLight.ambientIntensity = cacheUniform("u_directionalLight.base.ambientIntensity");
@@ -45,14 +68,23 @@ void TerrainShader::setMaxHeight(float maxHeight) const {
     glUniform1f(getUniformLocation(loc_maxHeight), maxHeight);
 }
 
-void TerrainShader::setBlendedTextures(const std::array<std::pair<float, std::shared_ptr<Texture>>, MAX_TERRAIN_HEIGHT_TEXTURE>& textures, uint32_t textureCount) {
-    glUniform1ui(getUniformLocation(loc_numTextureHeights), textureCount);
-    for(uint32_t i = 0; i < textureCount; i++){
-        glUniform1f(getUniformLocation(loc_textureHeight[i]), textures.at(i).first);
-        glUniform1ui64ARB(getUniformLocation(loc_sampler.height[i]), textures.at(i).second->getHandle());
+void TerrainShader::setLayerTextures(const std::shared_ptr<TextureArray>& textures, uint32_t layerCount) const {
+    glUniform1ui(getUniformLocation(loc_layerCount), textures ? layerCount : 0);
+    if(textures){
+        glUniform1ui64ARB(getUniformLocation(loc_layers), textures->getHandle());
     }
 }
 
+void TerrainShader::setSplatMap(GLuint64 handle, uint32_t dimX, uint32_t dimY) const {
+    glUniform1ui64ARB(getUniformLocation(loc_splatMap), handle);
+    glUniform2i(getUniformLocation(loc_splatMapSize), static_cast<GLint>(dimX), static_cast<GLint>(dimY));
+}
+
+void TerrainShader::setNormalMap(GLuint64 handle, uint32_t dimX, uint32_t dimY) const {
+    glUniform1ui64ARB(getUniformLocation(loc_normalMap), handle);
+    glUniform2i(getUniformLocation(loc_normalMapSize), static_cast<GLint>(dimX), static_cast<GLint>(dimY));
+}
+
 void TerrainShader::setDirectionalLight(const DirectionalLight &light) const {
     const glm::vec3 direction = light.getDirection();
     glUniform3f(getUniformLocation(loc_dirLight.color), light.color.r, light.color.g, light.color.b);
@@ -60,3 +92,55 @@ void TerrainShader::setDirectionalLight(const DirectionalLight &light) const {
     glUniform1f(getUniformLocation(loc_dirLight.diffuseIntensity), light.diffuseIntensity);
     glUniform3f(getUniformLocation(loc_dirLight.direction), direction.x, direction.y, direction.z);
 }
+
+void TerrainShader::setVertexSource(int32_t source) const {
+    glUniform1i(getUniformLocation(loc_vertexSource), source);
+}
+
+void TerrainShader::setHeightMap(GLuint64 handle, uint32_t dimX, uint32_t dimY) const {
+    glUniform1ui64ARB(getUniformLocation(loc_heightMap), handle);
+    glUniform2i(getUniformLocation(loc_heightMapSize), static_cast<GLint>(dimX), static_cast<GLint>(dimY));
+}
+
+void TerrainShader::setWorldScale(float scale) const {
+    glUniform1f(getUniformLocation(loc_worldScale), scale);
+}
+
+void TerrainShader::setTileHeights(GLuint64 handle, uint32_t tileSize) const {
+    glUniform1ui64ARB(getUniformLocation(loc_tileHeights), handle);
+    glUniform1i(getUniformLocation(loc_tileSize), static_cast<GLint>(tileSize));
+}
+
+void TerrainShader::setSplatArray(GLuint64 handle) const {
+    glUniform1ui64ARB(getUniformLocation(loc_splatArray), handle);
+}
+
+void TerrainShader::setClipmap(GLuint64 handle, uint32_t textureSize, uint32_t gridSize, const std::vector<glm::ivec2>& origins) const {
+    glUniform1ui64ARB(getUniformLocation(loc_clipmapHeights), handle);
+    glUniform1i(getUniformLocation(loc_clipmapTextureSize), static_cast<GLint>(textureSize));
+    glUniform1i(getUniformLocation(loc_clipmapGridSize), static_cast<GLint>(gridSize));
+    glUniform1i(getUniformLocation(loc_clipmapLevels), static_cast<GLint>(origins.size()));
+    glUniform2iv(getUniformLocation(loc_clipmapOrigins), static_cast<GLsizei>(origins.size()), &origins.front().x);
+}
+
+void TerrainShader::setTessellation(float scale, uint32_t maxLevel) const {
+    glUniform1f(getUniformLocation(loc_tessScale), scale);
+    glUniform1f(getUniformLocation(loc_maxTessLevel), static_cast<float>(maxLevel));
+}
+
+void TerrainShader::setVirtualTexture(const VirtualTexture* texture, float span) const {
+    bool enabled = texture && !texture->empty();
+    glUniform1i(getUniformLocation(loc_virtualTexture), enabled ? 1 : 0);
+    if(!enabled)
+        return;
+
+    glUniform1ui64ARB(getUniformLocation(loc_virtualIndirection), texture->getIndirectionHandle());
+    glUniform1ui64ARB(getUniformLocation(loc_virtualCache), texture->getCacheHandle());
+    glUniform1i(getUniformLocation(loc_virtualPages), static_cast<GLint>(texture->pages()));
+    glUniform1i(getUniformLocation(loc_virtualLevels), static_cast<GLint>(texture->levels()));
+    glUniform1i(getUniformLocation(loc_virtualCacheSlots), static_cast<GLint>(texture->cacheSlots()));
+    glUniform1f(getUniformLocation(loc_virtualSpan), span);
+
+    glm::ivec2 offset = texture->feedbackOffset();
+    glUniform2i(getUniformLocation(loc_feedbackOffset), offset.x, offset.y);
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+#include "model/texture/TextureArray.h"
+#include "extern/stb_image.h"
+
+std::unordered_map<std::string, std::shared_ptr<TextureArray>> TextureArray::m_loadedArrays;
+Logger TextureArray::m_logger = Logger("Texture Array");
+
+TextureArray::TextureArray(const std::vector<std::string> &fileNames) : m_fileNames(fileNames) {
+    if(m_fileNames.empty()){
+        m_logger(Logger::ERROR) << "Unable to create texture array without layers" << '\n';
+        throw textureException();
+    }
+
+    int32_t width = 0, height = 0;
+    for(uint32_t layer = 0; layer < m_fileNames.size(); layer++){
+        int x = 0, y = 0, bpp = 0;
+        u_char* imageData = stbi_load(m_fileNames[layer].c_str(), &x, &y, &bpp, 4);
+        if(!imageData){
+            m_logger(Logger::ERROR) << "Unable to load texture [" << m_fileNames[layer] << "]" << '\n';
+            throw textureException();
+        }
+
+        if(layer == 0){
+            width = x;
+            height = y;
+
+            auto levels = static_cast<GLsizei>(std::floor(std::log2(std::max(width, height)))) + 1;
+            glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_texObject);
+            glTextureStorage3D(m_texObject, levels, GL_RGBA8, width, height, static_cast<GLsizei>(m_fileNames.size()));
+        }
+
+        if(x == width && y == height){
+            glTextureSubImage3D(m_texObject, 0, 0, 0, static_cast<GLint>(layer), width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
+        }else{
+            m_logger(Logger::WARNING) << "Texture [" << m_fileNames[layer] << "] of size " << x << "x" << y << " is resampled to " << width << "x" << height << '\n';
+            std::vector<u_char> resampled = resample(imageData, x, y, width, height);
+            glTextureSubImage3D(m_texObject, 0, 0, 0, static_cast<GLint>(layer), width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, resampled.data());
+        }
+        stbi_image_free(imageData);
+
+        m_logger(Logger::INFO) << "Loaded texture [" << m_fileNames[layer] << "] into layer " << layer << '\n';
+    }
+
+    glTextureParameteri(m_texObject, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(m_texObject, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(m_texObject, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(m_texObject, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glGenerateTextureMipmap(m_texObject);
+
+    m_bindlessHandle = glGetTextureHandleARB(m_texObject);
+    if(m_bindlessHandle == 0){
+        m_logger(Logger::ERROR) << "Unable to retrieve texture handle for texture array" << '\n';
+        throw textureException();
+    }
+
+    glMakeTextureHandleResidentARB(m_bindlessHandle);
+}
+
+TextureArray::~TextureArray() {
+    if(m_bindlessHandle != 0)
+        glMakeTextureHandleNonResidentARB(m_bindlessHandle);
+    if(m_texObject != -1)
+        glDeleteTextures(1, &m_texObject);
+}
+
+std::shared_ptr<TextureArray> TextureArray::createTextureArray(const std::vector<std::string> &fileNames) {
+    std::string key;
+    for(const std::string& fileName : fileNames){
+        key += fileName;
+        key += '\n';
+    }
+
+    if(m_loadedArrays.contains(key)){
+        m_logger(Logger::DEBUG) << "Texture array of " << std::to_string(fileNames.size()) << " layers already loaded" << '\n';
+        return m_loadedArrays.at(key);
+    }
+
+    std::shared_ptr<TextureArray> textureArray = std::make_shared<TextureArray>(fileNames);
+    m_loadedArrays.insert({key, textureArray});
+    return textureArray;
+}
+
+std::vector<u_char> TextureArray::resample(const u_char *data, int32_t width, int32_t height, int32_t targetWidth, int32_t targetHeight) {
+    std::vector<u_char> out(static_cast<std::size_t>(targetWidth) * targetHeight * 4);
+    float scaleX = static_cast<float>(width) / static_cast<float>(targetWidth);
+    float scaleY = static_cast<float>(height) / static_cast<float>(targetHeight);
+
+    for(int32_t y = 0; y < targetHeight; y++){
+        float srcY = std::clamp((static_cast<float>(y) + 0.5f) * scaleY - 0.5f, 0.0f, static_cast<float>(height-1));
+        auto y0 = static_cast<int32_t>(srcY);
+        int32_t y1 = std::min(y0 + 1, height-1);
+        float fy = srcY - static_cast<float>(y0);
+
+        for(int32_t x = 0; x < targetWidth; x++){
+            float srcX = std::clamp((static_cast<float>(x) + 0.5f) * scaleX - 0.5f, 0.0f, static_cast<float>(width-1));
+            auto x0 = static_cast<int32_t>(srcX);
+            int32_t x1 = std::min(x0 + 1, width-1);
+            float fx = srcX - static_cast<float>(x0);
+
+            for(int32_t c = 0; c < 4; c++){
+                auto texel = [&](int32_t tx, int32_t ty){ return static_cast<float>(data[(static_cast<std::size_t>(ty) * width + tx) * 4 + c]); };
+                float bottom = texel(x0, y0) + (texel(x1, y0) - texel(x0, y0)) * fx;
+                float top = texel(x0, y1) + (texel(x1, y1) - texel(x0, y1)) * fx;
+                out[(static_cast<std::size_t>(y) * targetWidth + x) * 4 + c] = static_cast<u_char>(std::lround(bottom + (top - bottom) * fy));
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <algorithm>
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool() {
+    uint32_t count = std::max(1u, std::thread::hardware_concurrency());
+
+    m_workers.reserve(count);
+    for(uint32_t i = 0; i < count; i++){
+        m_workers.emplace_back([this](){ workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+
+    for(auto& worker : m_workers){
+        worker.join();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push(std::move(job));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    while(true){
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this](){ return m_stop || !m_jobs.empty(); });
+            if(m_stop && m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop();
+        }
+        job();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t begin, uint32_t end, const std::function<void(uint32_t, uint32_t)>& func, uint32_t grain) {
+    if(end <= begin)
+        return;
+
+    uint32_t count = end - begin;
+    grain = std::max(1u, grain);
+
+    // A few chunks per thread keep the workers balanced when chunks differ in cost
+    uint32_t chunkCount = std::min((count + grain - 1) / grain, threadCount() * 4);
+
+    if(chunkCount <= 1){
+        func(begin, end);
+        return;
+    }
+
+    struct Job {
+        std::function<void(uint32_t, uint32_t)> func;
+        uint32_t begin = 0;
+        uint32_t count = 0;
+        uint32_t chunkCount = 0;
+        std::atomic<uint32_t> nextChunk{0};
+        std::atomic<uint32_t> doneChunks{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    auto job = std::make_shared<Job>();
+    job->func = func;
+    job->begin = begin;
+    job->count = count;
+    job->chunkCount = chunkCount;
+
+    auto runChunks = [job](){
+        while(true){
+            uint32_t chunk = job->nextChunk.fetch_add(1);
+            if(chunk >= job->chunkCount)
+                return;
+
+            uint32_t chunkBegin = job->begin + static_cast<uint32_t>(static_cast<uint64_t>(job->count) * chunk / job->chunkCount);
+            uint32_t chunkEnd = job->begin + static_cast<uint32_t>(static_cast<uint64_t>(job->count) * (chunk+1) / job->chunkCount);
+            job->func(chunkBegin, chunkEnd);
+
+            if(job->doneChunks.fetch_add(1) + 1 == job->chunkCount){
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->finished.notify_all();
+            }
+        }
+    };
+
+    uint32_t helpers = std::min(threadCount(), chunkCount - 1);
+    for(uint32_t i = 0; i < helpers; i++){
+        enqueue(runChunks);
+    }
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job](){ return job->doneChunks.load() == job->chunkCount; });
+}
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <functional>
+
+#include "model/texture/VirtualTexture.h"
+#include "ThreadPool.h"
+
+Logger VirtualTexture::m_logger = Logger("Virtual Texture");
+
+namespace {
+    // Feedback is read three frames after it was written, the wait only guards against a stalled GPU
+    constexpr GLuint64 FEEDBACK_TIMEOUT = 1000000000;
+    constexpr GLbitfield FEEDBACK_ACCESS = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+}
+
+VirtualTexture::~VirtualTexture() {
+    erase();
+}
+
+void VirtualTexture::init(uint32_t pages, uint32_t cacheSlots, PageSource source) {
+    erase();
+
+    if(pages == 0 || (pages & (pages - 1)) != 0){
+        m_logger(Logger::ERROR) << "Virtual texture needs a power of two amount of pages, got " << pages << '\n';
+        throw textureException();
+    }
+
+    m_source = std::move(source);
+    m_pages = pages;
+    // Slot coordinates are stored in bytes of the indirection entries
+    m_cacheSlots = std::clamp(cacheSlots, 1u, 256u);
+    m_frame = 0;
+
+    m_levels = 1;
+    while((m_pages >> (m_levels - 1)) > 1){
+        m_levels++;
+    }
+
+    m_levelOffsets.resize(m_levels);
+    m_pageCount = 0;
+    for(uint32_t level = 0; level < m_levels; level++){
+        m_levelOffsets[level] = m_pageCount;
+        m_pageCount += (m_pages >> level) * (m_pages >> level);
+    }
+
+    m_pageSlots.assign(m_pageCount, NO_SLOT);
+    m_queued.assign(m_pageCount, 0);
+    m_stale.assign(m_pageCount, 0);
+    m_queue.clear();
+    m_refresh.clear();
+    m_indirection.assign(static_cast<std::size_t>(m_pageCount) * 4, 0);
+
+    uint32_t slotCount = m_cacheSlots * m_cacheSlots;
+    m_slots.assign(slotCount, Slot());
+    m_freeSlots.clear();
+    for(uint32_t slot = slotCount; slot-- > 0;){
+        m_freeSlots.push_back(slot);
+    }
+
+    auto cacheSize = static_cast<GLsizei>(m_cacheSlots * SLOT_SIZE);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_cacheTexture);
+    glTextureStorage2D(m_cacheTexture, 1, GL_RGBA8, cacheSize, cacheSize);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_indirectionTexture);
+    glTextureStorage2D(m_indirectionTexture, static_cast<GLsizei>(m_levels), GL_RGBA8UI, static_cast<GLsizei>(m_pages), static_cast<GLsizei>(m_pages));
+    glTextureParameteri(m_indirectionTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTextureParameteri(m_indirectionTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(m_indirectionTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(m_indirectionTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    m_cacheHandle = glGetTextureHandleARB(m_cacheTexture);
+    m_indirectionHandle = glGetTextureHandleARB(m_indirectionTexture);
+    if(m_cacheHandle == 0 || m_indirectionHandle == 0){
+        m_logger(Logger::ERROR) << "Unable to retrieve texture handles for virtual texture" << '\n';
+        throw textureException();
+    }
+    glMakeTextureHandleResidentARB(m_cacheHandle);
+    glMakeTextureHandleResidentARB(m_indirectionHandle);
+
+    // Requests are read straight from persistently mapped memory, no readback copies
+    auto feedbackSize = static_cast<GLsizeiptr>(m_pageCount * sizeof(uint32_t));
+    for(Feedback& feedback : m_feedback){
+        glCreateBuffers(1, &feedback.buffer);
+        glNamedBufferStorage(feedback.buffer, feedbackSize, nullptr, FEEDBACK_ACCESS | GL_CLIENT_STORAGE_BIT);
+        feedback.requests = static_cast<uint32_t*>(glMapNamedBufferRange(feedback.buffer, 0, feedbackSize, FEEDBACK_ACCESS));
+        std::fill(feedback.requests, feedback.requests + m_pageCount, 0u);
+    }
+
+    rebuildIndirection();
+
+    // The coarsest page covers the whole texture and stays resident, every page falls back to it
+    uint32_t root = m_pageCount - 1;
+    m_queued[root] = 1;
+    m_queue.push_back(root);
+
+    m_logger(Logger::DEBUG) << "Virtual texture of " << m_pages << "x" << m_pages << " pages in " << m_levels << " levels, cache of "
+                            << slotCount << " pages" << '\n';
+}
+
+void VirtualTexture::erase() {
+    if(m_cacheTexture == -1)
+        return;
+
+    for(Feedback& feedback : m_feedback){
+        if(feedback.fence){
+            glDeleteSync(feedback.fence);
+        }
+        glUnmapNamedBuffer(feedback.buffer);
+        glDeleteBuffers(1, &feedback.buffer);
+        feedback = Feedback();
+    }
+
+    glMakeTextureHandleNonResidentARB(m_cacheHandle);
+    glMakeTextureHandleNonResidentARB(m_indirectionHandle);
+    glDeleteTextures(1, &m_cacheTexture);
+    glDeleteTextures(1, &m_indirectionTexture);
+    m_cacheTexture = -1;
+    m_cacheHandle = 0;
+    m_indirectionTexture = -1;
+    m_indirectionHandle = 0;
+
+    m_source = nullptr;
+    m_pages = 0;
+    m_levels = 0;
+    m_pageCount = 0;
+    m_levelOffsets.clear();
+    m_pageSlots.clear();
+    m_queued.clear();
+    m_stale.clear();
+    m_queue.clear();
+    m_refresh.clear();
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_staging.clear();
+    m_indirection.clear();
+}
+
+VirtualTexture::Page VirtualTexture::pageAt(uint32_t index) const {
+    auto level = static_cast<uint32_t>(std::upper_bound(m_levelOffsets.begin(), m_levelOffsets.end(), index) - m_levelOffsets.begin()) - 1;
+    uint32_t side = m_pages >> level;
+    uint32_t local = index - m_levelOffsets[level];
+    return {level, local % side, local / side};
+}
+
+glm::ivec2 VirtualTexture::feedbackOffset() const {
+    auto step = static_cast<int32_t>(m_frame % (VIRTUAL_FEEDBACK_STRIDE * VIRTUAL_FEEDBACK_STRIDE));
+    return {step % VIRTUAL_FEEDBACK_STRIDE, step / VIRTUAL_FEEDBACK_STRIDE};
+}
+
+void VirtualTexture::update() {
+    if(empty())
+        return;
+
+    m_frame++;
+    readFeedback(m_feedback[m_frame % FEEDBACK_FRAMES]);
+
+    if(!m_queue.empty() || !m_refresh.empty()){
+        produce();
+    }
+    if(m_indirectionDirty){
+        rebuildIndirection();
+    }
+}
+
+void VirtualTexture::endFrame() {
+    if(empty())
+        return;
+
+    // Storage writes of the fragments have to reach the mapping before the fence signals
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+    Feedback& feedback = m_feedback[m_frame % FEEDBACK_FRAMES];
+    if(feedback.fence){
+        glDeleteSync(feedback.fence);
+    }
+    feedback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void VirtualTexture::readFeedback(Feedback &feedback) {
+    if(!feedback.fence)
+        return;
+
+    glClientWaitSync(feedback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, FEEDBACK_TIMEOUT);
+    glDeleteSync(feedback.fence);
+    feedback.fence = nullptr;
+
+    for(uint32_t i = 0; i < m_pageCount; i++){
+        if(feedback.requests[i]){
+            feedback.requests[i] = 0;
+            touch(i);
+        }
+    }
+}
+
+void VirtualTexture::touch(uint32_t index) {
+    Page page = pageAt(index);
+    for(uint32_t level = page.level; level < m_levels; level++){
+        uint32_t shift = level - page.level;
+        uint32_t i = pageIndex(level, page.x >> shift, page.y >> shift);
+
+        uint32_t slot = m_pageSlots[i];
+        if(slot != NO_SLOT){
+            // Pinned pages keep their maximal stamp
+            m_slots[slot].lastUsed = std::max(m_slots[slot].lastUsed, m_frame);
+        }else if(!m_queued[i]){
+            m_queued[i] = 1;
+            m_queue.push_back(i);
+        }
+    }
+}
+
+void VirtualTexture::invalidate(const glm::vec2 &min, const glm::vec2 &max) {
+    if(empty())
+        return;
+
+    // Finest levels are pushed first, so coarser pages are taken first from the back
+    for(uint32_t level = 0; level < m_levels; level++){
+        auto side = static_cast<int32_t>(m_pages >> level);
+        auto toPage = [side](float coord){ return std::clamp(static_cast<int32_t>(coord * static_cast<float>(side)), 0, side - 1); };
+
+        for(int32_t y = toPage(min.y); y <= toPage(max.y); y++){
+            for(int32_t x = toPage(min.x); x <= toPage(max.x); x++){
+                uint32_t i = pageIndex(level, x, y);
+                if(m_pageSlots[i] != NO_SLOT && !m_stale[i]){
+                    m_stale[i] = 1;
+                    m_refresh.push_back(i);
+                }
+            }
+        }
+    }
+}
+
+uint32_t VirtualTexture::acquireSlot() {
+    if(!m_freeSlots.empty()){
+        uint32_t slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        return slot;
+    }
+
+    uint32_t oldest = NO_SLOT;
+    for(uint32_t slot = 0; slot < m_slots.size(); slot++){
+        if(m_slots[slot].lastUsed < m_frame && (oldest == NO_SLOT || m_slots[slot].lastUsed < m_slots[oldest].lastUsed)){
+            oldest = slot;
+        }
+    }
+
+    if(oldest != NO_SLOT){
+        m_pageSlots[m_slots[oldest].page] = NO_SLOT;
+    }
+    return oldest;
+}
+
+void VirtualTexture::produce() {
+    std::vector<uint32_t> batch;
+    batch.reserve(m_pageBudget);
+
+    // Stale pages are produced into the slots they already have, marked used so they aren't evicted meanwhile
+    while(!m_refresh.empty() && batch.size() < m_pageBudget){
+        uint32_t page = m_refresh.back();
+        m_refresh.pop_back();
+        m_stale[page] = 0;
+
+        uint32_t slot = m_pageSlots[page];
+        if(slot != NO_SLOT){
+            m_slots[slot].lastUsed = std::max(m_slots[slot].lastUsed, m_frame);
+            batch.push_back(page);
+        }
+    }
+
+    // Coarser levels have higher indices, a page never arrives before its ancestors
+    std::sort(m_queue.begin(), m_queue.end(), std::greater<>());
+    uint32_t root = m_pageCount - 1;
+    for(uint32_t page : m_queue){
+        if(batch.size() >= m_pageBudget)
+            break;
+
+        uint32_t slot = acquireSlot();
+        if(slot == NO_SLOT)
+            break;
+
+        m_slots[slot] = {page, page == root ? UINT64_MAX : m_frame};
+        m_pageSlots[page] = slot;
+        batch.push_back(page);
+    }
+
+    // Pages left over are requested again by the feedback as long as they are needed
+    for(uint32_t page : m_queue){
+        m_queued[page] = 0;
+    }
+    m_queue.clear();
+
+    if(batch.empty())
+        return;
+
+    std::size_t slotBytes = static_cast<std::size_t>(SLOT_SIZE) * SLOT_SIZE * 4;
+    m_staging.resize(batch.size() * slotBytes);
+    ThreadPool::getInstance().parallelFor(0, static_cast<uint32_t>(batch.size()), [&](uint32_t begin, uint32_t end){
+        for(uint32_t i = begin; i < end; i++){
+            m_source(pageAt(batch[i]), &m_staging[i * slotBytes]);
+        }
+    });
+
+    for(std::size_t i = 0; i < batch.size(); i++){
+        uint32_t slot = m_pageSlots[batch[i]];
+        glTextureSubImage2D(m_cacheTexture, 0, static_cast<GLint>((slot % m_cacheSlots) * SLOT_SIZE), static_cast<GLint>((slot / m_cacheSlots) * SLOT_SIZE),
+                            SLOT_SIZE, SLOT_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &m_staging[i * slotBytes]);
+    }
+
+    m_indirectionDirty = true;
+    m_logger(Logger::DEBUG) << "Produced " << std::to_string(batch.size()) << " pages" << '\n';
+}
+
+void VirtualTexture::rebuildIndirection() {
+    // Built from the coarsest level down, pages without a slot take the entry of their parent.
+    // The whole table is only a fraction of a single cache page, so it's rebuilt instead of patched
+    for(uint32_t level = m_levels; level-- > 0;){
+        uint32_t side = m_pages >> level;
+        for(uint32_t y = 0; y < side; y++){
+            for(uint32_t x = 0; x < side; x++){
+                uint8_t* entry = &m_indirection[static_cast<std::size_t>(pageIndex(level, x, y)) * 4];
+                uint32_t slot = m_pageSlots[pageIndex(level, x, y)];
+
+                if(slot != NO_SLOT){
+                    entry[0] = static_cast<uint8_t>(slot % m_cacheSlots);
+                    entry[1] = static_cast<uint8_t>(slot / m_cacheSlots);
+                    entry[2] = static_cast<uint8_t>(level);
+                    entry[3] = 255;
+                }else if(level + 1 < m_levels){
+                    const uint8_t* parent = &m_indirection[static_cast<std::size_t>(pageIndex(level + 1, x / 2, y / 2)) * 4];
+                    std::copy(parent, parent + 4, entry);
+                }else{
+                    std::fill(entry, entry + 4, 0);
+                }
+            }
+        }
+
+        glTextureSubImage2D(m_indirectionTexture, static_cast<GLint>(level), 0, 0, static_cast<GLsizei>(side), static_cast<GLsizei>(side),
+                            GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &m_indirection[static_cast<std::size_t>(m_levelOffsets[level]) * 4]);
+    }
+    m_indirectionDirty = false;
+}
@@ -74,7 +74,7 @@ void switchPolygonMode(){
 Slot<> g_slt_switchPolygonMode{[](){ switchPolygonMode(); }};
 
 void redoTerrain(){
-    g_terrain->generateMidpoint(g_size, g_roughness, {
+    g_terrain->generateMidpointAsync(g_size, g_roughness, {
             "terrain/textures/rock.png",
             "terrain/textures/dry.png",
             "terrain/textures/grass_light.png",
@@ -179,6 +179,7 @@ void initScenes(){
     g_terrain->setMaxLOD(3);
     g_terrain->setScale(0.1);
     g_terrain->setMaxRange(20.0);
+    g_terrain->setRenderMode(Terrain::RenderMode::HEIGHT_TEXTURE);
     g_terrain->generateMidpoint(g_size, g_roughness, {
         "terrain/textures/rock.png",
         "terrain/textures/dry.png",
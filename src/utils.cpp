@@ -1,5 +1,10 @@
 
 #include <array>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "utils.h"
 
 namespace Utils{
@@ -143,6 +148,82 @@ namespace Utils{
         m_topClipPlane      = tVP[3] - tVP[1];
         m_nearClipPlane     = tVP[3] + tVP[2];
         m_farClipPlane      = tVP[3] - tVP[2];
+
+        const glm::vec4 planes[] = {m_leftClipPlane, m_rightClipPlane, m_bottomClipPlane,
+                                    m_topClipPlane, m_nearClipPlane, m_farClipPlane};
+        for(uint32_t i = 0; i < 8; i++){
+            glm::vec4 plane = i < ARRAY_SIZE(planes) ? planes[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            m_planeX[i] = plane.x;
+            m_planeY[i] = plane.y;
+            m_planeZ[i] = plane.z;
+            m_planeW[i] = plane.w;
+        }
+    }
+
+    FrustumCulling::Containment FrustumCulling::classifyBox(const glm::vec3 &min, const glm::vec3 &max, uint32_t &planeMask) const {
+        uint32_t outside = 0;
+        uint32_t straddling = 0;
+
+#if defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 bias = _mm_set1_ps(m_bias);
+        const __m128 minX = _mm_set1_ps(min.x), minY = _mm_set1_ps(min.y), minZ = _mm_set1_ps(min.z);
+        const __m128 maxX = _mm_set1_ps(max.x), maxY = _mm_set1_ps(max.y), maxZ = _mm_set1_ps(max.z);
+
+        for(uint32_t i = 0; i < 8; i += 4){
+            if(((planeMask >> i) & 0xF) == 0)
+                continue;
+
+            __m128 planeX = _mm_load_ps(m_planeX + i);
+            __m128 planeY = _mm_load_ps(m_planeY + i);
+            __m128 planeZ = _mm_load_ps(m_planeZ + i);
+            __m128 planeW = _mm_load_ps(m_planeW + i);
+
+            // Corner furthest along the plane normal decides outside, the nearest one decides inside
+            __m128 signX = _mm_cmpge_ps(planeX, zero);
+            __m128 signY = _mm_cmpge_ps(planeY, zero);
+            __m128 signZ = _mm_cmpge_ps(planeZ, zero);
+
+            __m128 farX = _mm_or_ps(_mm_and_ps(signX, maxX), _mm_andnot_ps(signX, minX));
+            __m128 farY = _mm_or_ps(_mm_and_ps(signY, maxY), _mm_andnot_ps(signY, minY));
+            __m128 farZ = _mm_or_ps(_mm_and_ps(signZ, maxZ), _mm_andnot_ps(signZ, minZ));
+            __m128 nearX = _mm_or_ps(_mm_and_ps(signX, minX), _mm_andnot_ps(signX, maxX));
+            __m128 nearY = _mm_or_ps(_mm_and_ps(signY, minY), _mm_andnot_ps(signY, maxY));
+            __m128 nearZ = _mm_or_ps(_mm_and_ps(signZ, minZ), _mm_andnot_ps(signZ, maxZ));
+
+            __m128 farDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, farX), _mm_mul_ps(planeY, farY)),
+                                        _mm_add_ps(_mm_mul_ps(planeZ, farZ), planeW));
+            __m128 nearDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX, nearX), _mm_mul_ps(planeY, nearY)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ, nearZ), planeW));
+
+            outside |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(farDist, bias))) << i;
+            straddling |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(nearDist, bias))) << i;
+        }
+#else
+        for(uint32_t i = 0; i < 8; i++){
+            if(((planeMask >> i) & 1) == 0)
+                continue;
+
+            glm::vec3 farCorner(m_planeX[i] >= 0.0f ? max.x : min.x,
+                          m_planeY[i] >= 0.0f ? max.y : min.y,
+                          m_planeZ[i] >= 0.0f ? max.z : min.z);
+            glm::vec3 nearCorner(m_planeX[i] >= 0.0f ? min.x : max.x,
+                           m_planeY[i] >= 0.0f ? min.y : max.y,
+                           m_planeZ[i] >= 0.0f ? min.z : max.z);
+
+            float farDist = m_planeX[i]*farCorner.x + m_planeY[i]*farCorner.y + m_planeZ[i]*farCorner.z + m_planeW[i];
+            float nearDist = m_planeX[i]*nearCorner.x + m_planeY[i]*nearCorner.y + m_planeZ[i]*nearCorner.z + m_planeW[i];
+
+            outside |= static_cast<uint32_t>(farDist < m_bias) << i;
+            straddling |= static_cast<uint32_t>(nearDist < m_bias) << i;
+        }
+#endif
+
+        if(outside & planeMask)
+            return Containment::OUTSIDE;
+
+        planeMask &= straddling;
+        return planeMask ? Containment::INTERSECT : Containment::INSIDE;
     }
 
     bool FrustumCulling::isPointInside(const glm::vec3 &point) const {